@@ -0,0 +1,171 @@
+#include "admin.h"
+#include "metrics.h"
+#include "conntrace.h"
+#include "logger.h"
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+int admin_is_request(const char *request) {
+    return strncmp(request, ADMIN_PREFIX, strlen(ADMIN_PREFIX)) == 0;
+}
+
+int admin_is_admin(const char *username) {
+    // A deleted admin keeps no rights on an open connection
+    return is_admin_name(username) && credstore_get(username, NULL);
+}
+
+static void list_users(const char *after, const char *count_arg, char *reply, size_t size) {
+    int max = (count_arg != NULL && *count_arg != '\0') ? atoi(count_arg) : ADMIN_PAGE_DEFAULT;
+    if (max < 1 || max > ADMIN_PAGE_MAX) {
+        snprintf(reply, size, "ADMIN_FAILED:Count must be 1-%d", ADMIN_PAGE_MAX);
+        return;
+    }
+
+    CredRecord *records = malloc(sizeof(CredRecord) * max);
+    int found = records ? credstore_list(after, records, max) : -1;
+    if (found < 0) {
+        free(records);
+        snprintf(reply, size, "ADMIN_FAILED:Could not list users");
+        return;
+    }
+
+    // Names one per line, leaving room for the header and the NEXT line
+    char body[ADMIN_REPLY_MAX];
+    size_t room = (size < sizeof(body) ? size : sizeof(body)) - 64;
+    size_t used = 0;
+    int shown = 0;
+    for (int i = 0; i < found; i++) {
+        size_t len = strlen(records[i].username);
+        if (used + len + 1 + MAX_USERNAME + 8 > room) {
+            break;
+        }
+        memcpy(body + used, records[i].username, len);
+        body[used + len] = '\n';
+        used += len + 1;
+        shown++;
+    }
+
+    // A full page or a cut-off reply may have more behind it
+    if (shown > 0 && (shown < found || found == max)) {
+        snprintf(body + used, sizeof(body) - used, "NEXT:%s", records[shown - 1].username);
+    } else {
+        snprintf(body + used, sizeof(body) - used, "END");
+    }
+    free(records);
+
+    snprintf(reply, size, "ADMIN_OK:%d of %zu users\n%s", shown, credstore_count(), body);
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+void admin_handle(const char *username, const char *request, char *reply, size_t size) {
+    // See changes made by other processes before answering
+    load_users();
+
+    if (!admin_is_admin(username)) {
+        log_warn("ADMIN", "Refused admin command from %s", username);
+        snprintf(reply, size, "ADMIN_FAILED:Not an admin");
+        return;
+    }
+
+    // strsep keeps empty fields, so "ADMIN:LIST::50" lists from the start
+    char copy[ADMIN_REPLY_MAX];
+    strncpy(copy, request + strlen(ADMIN_PREFIX), sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    copy[strcspn(copy, "\r\n")] = '\0';
+
+    char *rest = copy;
+    char *command = strsep(&rest, ":");
+    char *target = strsep(&rest, ":");
+    char *arg = strsep(&rest, ":");
+
+    if (strcmp(command, "LIST") == 0) {
+        log_info("ADMIN", "%s: LIST after '%s'", username, target ? target : "");
+        list_users(target, arg, reply, size);
+        return;
+    }
+    if (strcmp(command, "METRICS") == 0) {
+        char summary[ADMIN_REPLY_MAX];
+        metrics_summary(summary, sizeof(summary));
+        snprintf(reply, size, "ADMIN_OK:%s", summary);
+        return;
+    }
+    if (strcmp(command, "TRACE") == 0) {
+        // The breakdown fits the reply, the events go to a file. Sorting
+        // them takes a while, the event loop runs this on the auth pool
+        char breakdown[ADMIN_REPLY_MAX - 80];
+        FILE *fp = fopen(CONNTRACE_DUMP_FILE, "w");
+        if (fp == NULL) {
+            snprintf(reply, size, "ADMIN_FAILED:Could not write %s", CONNTRACE_DUMP_FILE);
+            return;
+        }
+        int events = conntrace_dump(fp, breakdown, sizeof(breakdown));
+        fclose(fp);
+        log_info("ADMIN", "%s: TRACE, %d events", username, events);
+        snprintf(reply, size, "ADMIN_OK:%s\nWrote %d events to %s", breakdown, events, CONNTRACE_DUMP_FILE);
+        return;
+    }
+
+    if (strcmp(command, "LOGLEVEL") == 0) {
+        // Without a level, report the current one
+        if (target != NULL && *target != '\0') {
+            int level = logger_parse_level(target);
+            if (level < 0) {
+                snprintf(reply, size, "ADMIN_FAILED:Unknown level (debug, info, warn, error)");
+                return;
+            }
+            logger_set_level(level);
+            log_info("ADMIN", "%s: LOGLEVEL %s", username, logger_level_name(level));
+        }
+        snprintf(reply, size, "ADMIN_OK:Log level %s", logger_level_name(logger_level()));
+        return;
+    }
+
+    if (target == NULL || *target == '\0') {
+        snprintf(reply, size, "ADMIN_FAILED:Missing username");
+        return;
+    }
+    log_info("ADMIN", "%s: %s %s", username, command, target);
+
+    if (strcmp(command, "DELETE") == 0) {
+        if (strcmp(target, username) == 0) {
+            snprintf(reply, size, "ADMIN_FAILED:Cannot delete yourself");
+            return;
+        }
+        int result = delete_user(target);
+        snprintf(reply, size, result == 1 ? "ADMIN_OK:Deleted %s" :
+                              result == -1 ? "ADMIN_FAILED:No such user %s" :
+                                             "ADMIN_FAILED:Could not delete %s", target);
+    } else if (strcmp(command, "PASSWD") == 0) {
+        if (arg == NULL) {
+            snprintf(reply, size, "ADMIN_FAILED:Missing password");
+            return;
+        }
+        int result = change_password(target, arg);
+        if (result == -3) {
+            snprintf(reply, size, "ADMIN_FAILED:Password needs at least %d characters",
+                     MIN_PASSWORD_LENGTH);
+        } else {
+            snprintf(reply, size, result == 1 ? "ADMIN_OK:Password changed for %s" :
+                                  result == -1 ? "ADMIN_FAILED:No such user %s" :
+                                                 "ADMIN_FAILED:Could not change password for %s", target);
+        }
+    } else if (strcmp(command, "REVOKE") == 0) {
+        if (!credstore_get(target, NULL)) {
+            snprintf(reply, size, "ADMIN_FAILED:No such user %s", target);
+            return;
+        }
+        int result = revoke_user_sessions(target);
+        if (result < 0) {
+            snprintf(reply, size, "ADMIN_FAILED:Could not revoke sessions of %s", target);
+        } else {
+            snprintf(reply, size, "ADMIN_OK:Revoked sessions of %s", target);
+        }
+    } else {
+        snprintf(reply, size, "ADMIN_FAILED:Unknown command");
+    }
+}
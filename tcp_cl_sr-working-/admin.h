@@ -0,0 +1,51 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "auth.h"
+
+#define ADMIN_REQUEST -2             // listen_question() code for an ADMIN: line
+#define ADMIN_PREFIX "ADMIN:"
+#define ADMIN_PAGE_DEFAULT 20
+#define ADMIN_PAGE_MAX 100
+#define ADMIN_REPLY_MAX 1000         // Fits in one read of the CLI client
+
+/*
+ * User management for authenticated admins, sent in place of a menu option:
+ *
+ *     ADMIN:LIST[:after[:count]]     users in name order, after a cursor
+ *     ADMIN:DELETE:user              delete a user, revoke their sessions
+ *     ADMIN:PASSWD:user:password     set a password, revoke sessions
+ *     ADMIN:REVOKE:user              revoke every session of a user
+ *     ADMIN:METRICS                  request counts, rates and latencies
+ *     ADMIN:TRACE                    time per connection stage, events to a file
+ *     ADMIN:LOGLEVEL[:level]         show or set the server log level
+ *
+ * Replies start with "ADMIN_OK:" or "ADMIN_FAILED:<reason>". LIST answers
+ * one name per line, then "NEXT:<cursor>" when more users follow or "END".
+ *
+ * Admins are the users named in AUTH_ADMIN_USERS (comma separated) that
+ * still exist in the credential store; with the variable unset every
+ * command is refused. Admin names cannot be registered, the accounts are
+ * created with provision. Every operation is a lookup or a log append on
+ * the indexed store.
+ */
+
+/**
+ * Returns: 1 if request is an admin command (starts with ADMIN:)
+ */
+int admin_is_request(const char *request);
+
+/**
+ * Returns: 1 if username may run admin commands
+ */
+int admin_is_admin(const char *username);
+
+/**
+ * Run an admin command for username and write the reply
+ */
+void admin_handle(const char *username, const char *request, char *reply, size_t size);
+
+#endif // ADMIN_H
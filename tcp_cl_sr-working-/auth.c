@@ -1,50 +1,91 @@
 #include "auth.h"
-
-// Global storage with thread safety
-static User users[MAX_USERS];
-static int user_count = 0;
-static Session sessions[MAX_USERS];
-static int session_count = 0;
-static pthread_mutex_t auth_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-#define CREDENTIALS_FILE "data/credentials.dat"
+#include "token.h"
+#include "credstore.h"
+#include "commitq.h"
+#include "kdf.h"
+#include "ratelimit.h"
+#include "cryptoctx.h"
+#include "sessionstore.h"
+#include "logger.h"
+#include "coarseclock.h"
+#include "timerwheel.h"
+#include <sys/mman.h>
+#include <openssl/crypto.h>
+
+// Session table shared by the server process and its forked children,
+// so a token issued in one connection can be resumed from another.
+// Slots are reused through a free list instead of compacting, so a
+// session keeps its slot, and its expiry timer, until it ends
+typedef struct {
+    pthread_mutex_t lock;
+    int count;                       // Slots ever used, entries beyond are untouched
+    int live;                        // Active sessions
+    int free_count;
+    int free_slots[MAX_SESSIONS];    // Released slots, reused first
+    Session entries[MAX_SESSIONS];
+} SessionTable;
+
+// Global storage with thread safety (users live in credstore.c)
+static SessionTable *session_table = NULL;
+static TimerWheel *session_timers = NULL; // Expiry per slot in seconds, under session_table->lock
+static int token_mode = TOKEN_MODE_STORED;
+static int token_revocation = 1; // Signed tokens are checked against the user's record
+static pid_t store_owner = 0; // Only the process that initialised auth compacts
+static KdfParams kdf_policy;  // Parameters for new hashes (see kdf.h)
+static int auth_debug = 0;    // AUTH_DEBUG=1 logs salts and hashes at login (debug level)
+static int session_persist = 0; // Stored sessions are journaled (see sessionstore.h)
 
 // ============================================================================
 // Utility Functions
 // ============================================================================
 
 void generate_salt(unsigned char *salt, size_t size) {
-    if (RAND_bytes(salt, size) != 1) {
-        fprintf(stderr, "[AUTH ERROR] Failed to generate salt\n");
+    if (!cryptoctx_random(salt, size)) {
+        log_error("AUTH", "Failed to generate salt");
         exit(1);
     }
 }
 
+static const char hex_digits[] = "0123456789abcdef";
+
+// Nibble value + 1 of each ASCII hex digit, 0 for anything else
+static const unsigned char hex_values[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
 void bytes_to_hex(const unsigned char *bytes, size_t len, char *hex) {
     for (size_t i = 0; i < len; i++) {
-        sprintf(hex + (i * 2), "%02x", bytes[i]);
+        hex[i * 2] = hex_digits[bytes[i] >> 4];
+        hex[i * 2 + 1] = hex_digits[bytes[i] & 0x0f];
     }
     hex[len * 2] = '\0';
 }
 
 void hex_to_bytes(const char *hex, unsigned char *bytes, size_t len) {
     for (size_t i = 0; i < len; i++) {
-        sscanf(hex + (i * 2), "%2hhx", &bytes[i]);
+        int hi = hex_values[(unsigned char)hex[i * 2]];
+        int lo = hi ? hex_values[(unsigned char)hex[i * 2 + 1]] : 0;
+        if (!hi || !lo) {
+            break; // Short or invalid input stops the decode, as sscanf did
+        }
+        bytes[i] = (unsigned char)(((hi - 1) << 4) | (lo - 1));
     }
 }
 
 void hash_password(const char *password, const unsigned char *salt, 
                    unsigned char *hash) {
-    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    // Reuse this thread's context instead of allocating one per call
+    EVP_MD_CTX *ctx = cryptoctx_md();
     if (ctx == NULL) {
-        fprintf(stderr, "[AUTH ERROR] Failed to create hash context\n");
+        log_error("AUTH", "Failed to create hash context");
         exit(1);
     }
 
-    if (EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
-        fprintf(stderr, "[AUTH ERROR] Failed to initialize hash\n");
-        EVP_MD_CTX_free(ctx);
+    if (EVP_DigestInit_ex(ctx, cryptoctx_sha256(), NULL) != 1) {
+        log_error("AUTH", "Failed to initialize hash");
         exit(1);
     }
 
@@ -53,30 +94,25 @@ void hash_password(const char *password, const unsigned char *salt,
     
     unsigned int hash_len;
     EVP_DigestFinal_ex(ctx, hash, &hash_len);
-    EVP_MD_CTX_free(ctx);
 }
 
-// ============================================================================
-// Validation Functions
-// ============================================================================
-
 int validate_username(const char *username) {
     if (username == NULL || strlen(username) == 0) {
-        fprintf(stderr, "[AUTH VALIDATION] Username is NULL or empty\n");
+        log_warn("AUTH", "Username is NULL or empty");
         return 0; // Empty username
     }
     
     size_t len = strlen(username);
     if (len >= MAX_USERNAME) {
-        fprintf(stderr, "[AUTH VALIDATION] Username too long: %zu chars\n", len);
+        log_warn("AUTH", "Username too long: %zu chars", len);
         return 0; // Too long
     }
     
     // Check for valid characters (alphanumeric, underscore, hyphen)
     for (size_t i = 0; i < len; i++) {
         if (!isalnum(username[i]) && username[i] != '_' && username[i] != '-') {
-            fprintf(stderr, "[AUTH VALIDATION] Invalid character in username at position %zu: '%c' (0x%02x)\n", 
-                    i, username[i], (unsigned char)username[i]);
+            log_warn("AUTH", "Invalid character in username at position %zu: '%c' (0x%02x)",
+                     i, username[i], (unsigned char)username[i]);
             return 0; // Invalid character
         }
     }
@@ -86,142 +122,199 @@ int validate_username(const char *username) {
 
 int validate_password(const char *password) {
     if (password == NULL || strlen(password) < MIN_PASSWORD_LENGTH) {
-        fprintf(stderr, "[AUTH VALIDATION] Password is NULL or too short: %zu chars (min: %d)\n", 
-                password ? strlen(password) : 0, MIN_PASSWORD_LENGTH);
+        log_warn("AUTH", "Password is NULL or too short: %zu chars (min: %d)",
+                 password ? strlen(password) : 0, MIN_PASSWORD_LENGTH);
         return 0; // Too short or null
     }
     
     if (strlen(password) >= MAX_PASSWORD) {
-        fprintf(stderr, "[AUTH VALIDATION] Password too long: %zu chars\n", strlen(password));
+        log_warn("AUTH", "Password too long: %zu chars", strlen(password));
         return 0; // Too long
     }
     
     return 1; // Valid
 }
 
+// Signed tokens stamped before this are refused from now on. Tokens carry
+// whole seconds and create_session() stamps them no earlier than the
+// previous sessions_after, so it is the second after both: every token
+// issued so far falls before it
+static uint32_t revocation_time(uint32_t previous) {
+    uint32_t now = (uint32_t)coarseclock_now();
+    return (previous > now ? previous : now) + 1;
+}
+
 // ============================================================================
 // User Management Functions
 // ============================================================================
 
-int create_user(const char *username, const char *password) {
-    pthread_mutex_lock(&auth_mutex);
-    
-    if (user_count >= MAX_USERS) {
-        fprintf(stderr, "[AUTH] Maximum users reached\n");
-        pthread_mutex_unlock(&auth_mutex);
+int prepare_user(const char *username, const char *password, CredRecord *out) {
+    memset(out, 0, sizeof(*out));
+    strncpy(out->username, username, MAX_USERNAME - 1);
+    kdf_params_to_record(&kdf_policy, out);
+
+    // Signed tokens from a deleted account or an old password stay invalid
+    out->sessions_after = revocation_time(0);
+
+    // Generate salt and hash password
+    generate_salt(out->salt, SALT_SIZE);
+    if (!kdf_derive(password, out->salt, &kdf_policy, out->hash)) {
+        log_error("AUTH", "Password hashing failed");
         return 0;
     }
+    return 1;
+}
 
-    // Check if user already exists
-    for (int i = 0; i < user_count; i++) {
-        if (strcmp(users[i].username, username) == 0) {
-            fprintf(stderr, "[AUTH] User already exists: %s\n", username);
-            pthread_mutex_unlock(&auth_mutex);
-            return 0;
-        }
+int create_user(const char *username, const char *password) {
+    if (credstore_count() >= MAX_USERS) {
+        log_warn("AUTH", "Maximum users reached");
+        return 0;
     }
 
-    User new_user;
-    strncpy(new_user.username, username, MAX_USERNAME - 1);
-    new_user.username[MAX_USERNAME - 1] = '\0';
-
-    // Generate salt
-    unsigned char salt[SALT_SIZE];
-    generate_salt(salt, SALT_SIZE);
-    bytes_to_hex(salt, SALT_SIZE, new_user.salt);
-
-    // Hash password
-    unsigned char hash[HASH_SIZE];
-    hash_password(password, salt, hash);
-    bytes_to_hex(hash, SHA256_DIGEST_LENGTH, new_user.password_hash);
+    // Hashing needs no lock, so concurrent registrations only meet in the
+    // commit queue (or the store lock when write-behind is off)
+    CredRecord new_user;
+    if (!prepare_user(username, password, &new_user)) {
+        return 0;
+    }
 
-    users[user_count++] = new_user;
-    
-    // Save to file
-    int result = save_user(&new_user);
-    pthread_mutex_unlock(&auth_mutex);
+    // The store re-checks for duplicates under its cross-process lock
+    int result = commitq_active() ? commitq_submit(&new_user) : credstore_put(&new_user, 1);
     
+    if (result == -1) {
+        log_warn("AUTH", "User already exists: %s", username);
+        return 0;
+    }
     return result;
 }
 
+int is_admin_name(const char *username) {
+    const char *admins = getenv("AUTH_ADMIN_USERS");
+    if (admins == NULL || username == NULL) {
+        return 0;
+    }
+
+    size_t len = strlen(username);
+    const char *p = admins;
+    while (*p != '\0') {
+        size_t n = strcspn(p, ",");
+        if (n == len && len > 0 && strncmp(p, username, len) == 0) {
+            return 1;
+        }
+        p += n;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return 0;
+}
+
 int register_user(const char *username, const char *password) {
     // Validate input
     if (!validate_username(username)) {
-        fprintf(stderr, "[AUTH] Invalid username format\n");
+        log_warn("AUTH", "Invalid username format");
         return -3; // Invalid format
     }
     
     if (!validate_password(password)) {
-        fprintf(stderr, "[AUTH] Invalid password (min %d characters)\n", 
-                MIN_PASSWORD_LENGTH);
+        log_warn("AUTH", "Invalid password (min %d characters)",
+                 MIN_PASSWORD_LENGTH);
         return -3; // Invalid format
     }
     
-    pthread_mutex_lock(&auth_mutex);
-    
+    // A missing admin account must not be claimable by whoever asks first
+    if (is_admin_name(username)) {
+        log_warn("AUTH", "Refused to register admin name: %s", username);
+        return -4;
+    }
+
     // Check if username already exists
-    for (int i = 0; i < user_count; i++) {
-        if (strcmp(users[i].username, username) == 0) {
-            pthread_mutex_unlock(&auth_mutex);
-            return -1; // Username already exists
-        }
+    if (credstore_get(username, NULL)) {
+        return -1; // Username already exists
     }
     
     // Check if we have space for new user
-    if (user_count >= MAX_USERS) {
-        pthread_mutex_unlock(&auth_mutex);
+    if (credstore_count() >= MAX_USERS) {
         return -2; // Too many users
     }
     
-    pthread_mutex_unlock(&auth_mutex);
-    
     // Create the new user
     if (create_user(username, password) == 1) {
-        printf("[AUTH] New user registered: %s\n", username);
+        log_info("AUTH", "New user registered: %s", username);
         return 0; // Success
     }
     
     return -3; // Failed to create user
 }
 
+// Re-hash a verified user with the current KDF policy and a fresh salt
+static void rehash_user(const CredRecord *user, const char *password) {
+    CredRecord upgraded = *user;
+    kdf_params_to_record(&kdf_policy, &upgraded);
+    generate_salt(upgraded.salt, SALT_SIZE);
+    if (!kdf_derive(password, upgraded.salt, &kdf_policy, upgraded.hash)) {
+        return;
+    }
+
+    // The hash took a while: a delete, new password or revocation made in
+    // the meantime wins and the upgrade waits for the next login
+    int result = credstore_replace(user, &upgraded);
+    if (result == 1) {
+        log_info("KDF", "Rehashed %s: %s -> %s", user->username,
+                 kdf_name(user->kdf), kdf_name(kdf_policy.kdf));
+    } else if (result == -1) {
+        log_debug("KDF", "Skipped rehash of %s, the record changed", user->username);
+    }
+}
+
 int verify_credentials(const char *username, const char *password) {
-    pthread_mutex_lock(&auth_mutex);
-    
-    printf("[DEBUG] Verifying credentials for user: %s\n", username);
-    printf("[DEBUG] User count: %d\n", user_count);
+    CredRecord user;
+    if (!credstore_get(username, &user)) {
+        if (auth_debug) {
+            log_debug("AUTH", "Unknown user: %s", username);
+        }
+        return 0; // User not found
+    }
+
+    // Hash provided password with the stored salt and parameters
+    KdfParams params;
+    kdf_params_from_record(&user, &params);
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!kdf_derive(password, user.salt, &params, hash)) {
+        log_error("AUTH", "Password hashing failed for user: %s", username);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
     
-    for (int i = 0; i < user_count; i++) {
-        printf("[DEBUG] Checking user %d: %s\n", i, users[i].username);
-        if (strcmp(users[i].username, username) == 0) {
-            printf("[DEBUG] Found user: %s\n", username);
-            printf("[DEBUG] Stored salt: %s\n", users[i].salt);
-            printf("[DEBUG] Stored hash: %s\n", users[i].password_hash);
-            
-            // Convert stored salt from hex
-            unsigned char salt[SALT_SIZE];
-            hex_to_bytes(users[i].salt, salt, SALT_SIZE);
+    // Compare hashes in constant time
+    int result = (CRYPTO_memcmp(hash, user.hash, SHA256_DIGEST_LENGTH) == 0) ? 1 : 0;
 
-            // Hash provided password
-            unsigned char hash[SHA256_DIGEST_LENGTH];
-            hash_password(password, salt, hash);
+    // Credential material stays binary, hex is only built for debugging
+    if (auth_debug) {
+        char salt_hex[SALT_SIZE * 2 + 1];
+        char stored_hex[SHA256_DIGEST_LENGTH * 2 + 1];
+        char hash_hex[SHA256_DIGEST_LENGTH * 2 + 1];
+        bytes_to_hex(user.salt, SALT_SIZE, salt_hex);
+        bytes_to_hex(user.hash, SHA256_DIGEST_LENGTH, stored_hex);
+        bytes_to_hex(hash, SHA256_DIGEST_LENGTH, hash_hex);
+        log_debug("AUTH", "User %s: salt %s, stored %s, computed %s, result %d",
+                  username, salt_hex, stored_hex, hash_hex, result);
+    }
 
-            // Convert to hex for comparison
-            char hash_hex[SHA256_DIGEST_LENGTH * 2 + 1];
-            bytes_to_hex(hash, SHA256_DIGEST_LENGTH, hash_hex);
+    // Report logins that blow the latency the KDF was calibrated for
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    if (params.kdf == kdf_policy.kdf && elapsed_ms > 2L * kdf_policy.target_ms) {
+        log_warn("KDF", "Slow %s hash: %ld ms (target %d ms)",
+                 kdf_name(params.kdf), elapsed_ms, kdf_policy.target_ms);
+    }
 
-            printf("[DEBUG] Computed hash: %s\n", hash_hex);
-            printf("[DEBUG] Hash comparison: %d\n", strcmp(hash_hex, users[i].password_hash));
-            
-            // Compare hashes
-            int result = (strcmp(hash_hex, users[i].password_hash) == 0) ? 1 : 0;
-            printf("[DEBUG] Verification result: %d\n", result);
-            pthread_mutex_unlock(&auth_mutex);
-            return result;
-        }
+    // Upgrade the stored hash while the plain password is at hand
+    if (result && kdf_needs_rehash(&user, &kdf_policy)) {
+        rehash_user(&user, password);
     }
-    
-    pthread_mutex_unlock(&auth_mutex);
-    return 0; // User not found
+    return result;
 }
 
 // ============================================================================
@@ -230,63 +323,118 @@ int verify_credentials(const char *username, const char *password) {
 
 void generate_token(char *token_hex, size_t size) {
     unsigned char token[TOKEN_SIZE];
-    if (RAND_bytes(token, TOKEN_SIZE) != 1) {
-        fprintf(stderr, "[AUTH ERROR] Failed to generate token\n");
+    if (!cryptoctx_random(token, TOKEN_SIZE)) {
+        log_error("AUTH", "Failed to generate token");
         exit(1);
     }
     bytes_to_hex(token, TOKEN_SIZE, token_hex);
 }
 
-void cleanup_expired_sessions() {
-    pthread_mutex_lock(&session_mutex);
-    
-    time_t now = time(NULL);
-    int j = 0;
-    for (int i = 0; i < session_count; i++) {
-        if (sessions[i].active && sessions[i].expiry > now) {
-            sessions[j++] = sessions[i];
-        }
+// Slot for a new session, -1 if the table is full. Caller holds the lock
+static int acquire_slot() {
+    if (session_table->free_count > 0) {
+        return session_table->free_slots[--session_table->free_count];
     }
-    session_count = j;
-    
-    pthread_mutex_unlock(&session_mutex);
+    if (session_table->count < MAX_SESSIONS) {
+        return session_table->count++;
+    }
+    return -1;
+}
+
+// End the session in slot and make the slot reusable. Caller holds the lock
+static void release_slot(int slot) {
+    session_table->entries[slot].active = 0;
+    timerwheel_cancel(session_timers, slot);
+    session_table->free_slots[session_table->free_count++] = slot;
+    session_table->live--;
+}
+
+static void session_expired(int slot, void *ctx) {
+    (void)ctx;
+    if (session_table->entries[slot].active) {
+        release_slot(slot);
+    }
+}
+
+void cleanup_expired_sessions() {
+    pthread_mutex_lock(&session_table->lock);
+    // Only the sessions due by now are touched, not the whole table
+    timerwheel_advance(session_timers, (uint64_t)coarseclock_now(), session_expired, NULL);
+    pthread_mutex_unlock(&session_table->lock);
 }
 
 int create_session(const char *username, char *token_out) {
+    // Signed tokens carry their own expiry, nothing to store. One opened in
+    // the second of a revocation is stamped at the user's sessions_after,
+    // so it is not refused along with the tokens it replaces
+    if (token_mode == TOKEN_MODE_STATELESS) {
+        time_t issued = coarseclock_now();
+        CredRecord user;
+        if (credstore_get(username, &user) && (time_t)user.sessions_after > issued) {
+            issued = (time_t)user.sessions_after;
+        }
+        return token_sign(username, issued + SESSION_TIMEOUT, token_out, SESSION_TOKEN_MAX);
+    }
+
     cleanup_expired_sessions();
     
-    pthread_mutex_lock(&session_mutex);
+    pthread_mutex_lock(&session_table->lock);
     
     // Check if session limit reached
-    if (session_count >= MAX_USERS) {
-        fprintf(stderr, "[AUTH] Maximum sessions reached\n");
-        pthread_mutex_unlock(&session_mutex);
+    int slot = acquire_slot();
+    if (slot < 0) {
+        log_warn("AUTH", "Maximum sessions reached");
+        pthread_mutex_unlock(&session_table->lock);
         return 0;
     }
 
     // Create new session
-    Session new_session;
-    strncpy(new_session.username, username, MAX_USERNAME - 1);
-    new_session.username[MAX_USERNAME - 1] = '\0';
+    Session *new_session = &session_table->entries[slot];
+    strncpy(new_session->username, username, MAX_USERNAME - 1);
+    new_session->username[MAX_USERNAME - 1] = '\0';
     
-    generate_token(new_session.token, TOKEN_SIZE * 2 + 1);
-    new_session.expiry = time(NULL) + SESSION_TIMEOUT;
-    new_session.active = 1;
+    generate_token(new_session->token, SESSION_TOKEN_MAX);
+    new_session->expiry = coarseclock_now() + SESSION_TIMEOUT;
+    new_session->active = 1;
+    session_table->live++;
+    timerwheel_schedule(session_timers, slot, (uint64_t)new_session->expiry);
 
-    sessions[session_count++] = new_session;
+    if (session_persist) {
+        sessionstore_append(SESSION_OP_CREATE, new_session->username,
+                            new_session->token, new_session->expiry);
+    }
     
-    strcpy(token_out, new_session.token);
-    pthread_mutex_unlock(&session_mutex);
+    strcpy(token_out, new_session->token);
+    pthread_mutex_unlock(&session_table->lock);
     
     return 1;
 }
 
 int verify_session(const char *username, const char *token) {
-    pthread_mutex_lock(&session_mutex);
+    if (token_mode == TOKEN_MODE_STATELESS) {
+        time_t expiry;
+        if (!token_verify(username, token, &expiry)) {
+            return 0;
+        }
+
+        // Deleted users and revoked sessions, one index lookup. Without it
+        // (AUTH_TOKEN_REVOCATION=off) the signature is all that is checked
+        if (!token_revocation) {
+            return 1;
+        }
+        CredRecord user;
+        if (!credstore_get(username, &user)) {
+            return 0;
+        }
+        return expiry - SESSION_TIMEOUT >= (time_t)user.sessions_after;
+    }
+
+    pthread_mutex_lock(&session_table->lock);
     
-    time_t now = time(NULL);
+    Session *sessions = session_table->entries;
+    time_t now = coarseclock_now();
     
-    for (int i = 0; i < session_count; i++) {
+    for (int i = 0; i < session_table->count; i++) {
         if (sessions[i].active &&
             strcmp(sessions[i].username, username) == 0 &&
             strcmp(sessions[i].token, token) == 0) {
@@ -294,107 +442,352 @@ int verify_session(const char *username, const char *token) {
             if (sessions[i].expiry > now) {
                 // Extend session
                 sessions[i].expiry = now + SESSION_TIMEOUT;
-                pthread_mutex_unlock(&session_mutex);
+                timerwheel_schedule(session_timers, i, (uint64_t)sessions[i].expiry);
+                if (session_persist) {
+                    sessionstore_append(SESSION_OP_EXTEND, sessions[i].username,
+                                        sessions[i].token, sessions[i].expiry);
+                }
+                pthread_mutex_unlock(&session_table->lock);
                 return 1;
             } else {
                 // Session expired
-                sessions[i].active = 0;
-                pthread_mutex_unlock(&session_mutex);
+                release_slot(i);
+                pthread_mutex_unlock(&session_table->lock);
                 return 0;
             }
         }
     }
     
-    pthread_mutex_unlock(&session_mutex);
+    pthread_mutex_unlock(&session_table->lock);
     return 0;
 }
 
+int resume_session(const char *username, const char *token, char *token_out) {
+    if (!verify_session(username, token)) {
+        return 0;
+    }
+
+    // Signed tokens cannot be extended in place, issue a fresh one
+    // (this also moves the client onto the current signing key)
+    if (token_mode == TOKEN_MODE_STATELESS) {
+        return create_session(username, token_out);
+    }
+
+    // The token stays valid, hand the same one back to the client
+    strncpy(token_out, token, SESSION_TOKEN_MAX - 1);
+    token_out[SESSION_TOKEN_MAX - 1] = '\0';
+    return 1;
+}
+
 int invalidate_session(const char *username, const char *token) {
-    pthread_mutex_lock(&session_mutex);
+    // Signed tokens are valid until expiry or until their key is rotated out
+    if (token_mode == TOKEN_MODE_STATELESS) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&session_table->lock);
     
-    for (int i = 0; i < session_count; i++) {
-        if (strcmp(sessions[i].username, username) == 0 &&
+    Session *sessions = session_table->entries;
+    for (int i = 0; i < session_table->count; i++) {
+        if (sessions[i].active &&
+            strcmp(sessions[i].username, username) == 0 &&
             strcmp(sessions[i].token, token) == 0) {
-            sessions[i].active = 0;
-            pthread_mutex_unlock(&session_mutex);
+            release_slot(i);
+            if (session_persist) {
+                sessionstore_append(SESSION_OP_INVALIDATE, sessions[i].username,
+                                    sessions[i].token, sessions[i].expiry);
+            }
+            pthread_mutex_unlock(&session_table->lock);
             return 1;
         }
     }
     
-    pthread_mutex_unlock(&session_mutex);
+    pthread_mutex_unlock(&session_table->lock);
     return 0;
 }
 
-// ============================================================================
-// File I/O Functions
-// ============================================================================
+int revoke_user_sessions(const char *username) {
+    // Signed tokens are checked against the user's record, see verify_session
+    // A compare-and-put, so a password set meanwhile is not undone and a
+    // user deleted meanwhile is not brought back; a lost race re-reads
+    if (token_mode == TOKEN_MODE_STATELESS) {
+        for (int attempt = 0; attempt < AUTH_REPLACE_RETRIES; attempt++) {
+            CredRecord read;
+            if (!credstore_get(username, &read)) {
+                return 0;
+            }
+            CredRecord user = read;
+            user.sessions_after = revocation_time(read.sessions_after);
+            int result = credstore_replace(&read, &user);
+            if (result != -1) {
+                return (result == 1) ? 1 : -1;
+            }
+        }
+        log_warn("AUTH", "Gave up revoking sessions of %s, the record kept changing", username);
+        return -1;
+    }
 
-int load_users() {
-    pthread_mutex_lock(&auth_mutex);
-    
-    FILE *fp = fopen(CREDENTIALS_FILE, "r");
-    if (fp == NULL) {
-        // File doesn't exist, create it
-        fp = fopen(CREDENTIALS_FILE, "w");
-        if (fp == NULL) {
-            perror("[AUTH ERROR] Could not create credentials file");
-            pthread_mutex_unlock(&auth_mutex);
-            return 0;
+    pthread_mutex_lock(&session_table->lock);
+
+    Session *sessions = session_table->entries;
+    int revoked = 0;
+    for (int i = 0; i < session_table->count; i++) {
+        if (sessions[i].active && strcmp(sessions[i].username, username) == 0) {
+            release_slot(i);
+            if (session_persist) {
+                sessionstore_append(SESSION_OP_INVALIDATE, sessions[i].username,
+                                    sessions[i].token, sessions[i].expiry);
+            }
+            revoked++;
         }
-        fclose(fp);
-        pthread_mutex_unlock(&auth_mutex);
-        return 1;
     }
 
-    user_count = 0;
-    while (fscanf(fp, "%63s %128s %32s\n", 
-                  users[user_count].username,
-                  users[user_count].password_hash,
-                  users[user_count].salt) == 3) {
-        user_count++;
-        if (user_count >= MAX_USERS) {
-            break;
+    pthread_mutex_unlock(&session_table->lock);
+    return revoked;
+}
+
+int delete_user(const char *username) {
+    int result = credstore_delete(username);
+    if (result != 1) {
+        return result;
+    }
+
+    // A deleted record cannot carry sessions_after, stateless tokens fail
+    // the user lookup in verify_session instead
+    if (token_mode == TOKEN_MODE_STORED) {
+        revoke_user_sessions(username);
+    }
+    log_info("AUTH", "User deleted: %s", username);
+    return 1;
+}
+
+int change_password(const char *username, const char *new_password) {
+    if (!validate_password(new_password)) {
+        return -3;
+    }
+    CredRecord read;
+    if (!credstore_get(username, &read)) {
+        return -1;
+    }
+
+    CredRecord user;
+    if (!prepare_user(username, new_password, &user)) {
+        return 0;
+    }
+
+    // Hashing took a while: a delete made meanwhile wins. After any other
+    // change the new password still applies. Either way the new record's
+    // sessions_after ends every session opened before it
+    int result = -1;
+    for (int attempt = 0; attempt < AUTH_REPLACE_RETRIES && result == -1; attempt++) {
+        user.sessions_after = revocation_time(read.sessions_after);
+        result = credstore_replace(&read, &user);
+        if (result == -1 && !credstore_get(username, &read)) {
+            return -1;
         }
     }
+    if (result != 1) {
+        return 0;
+    }
 
-    fclose(fp);
-    printf("[AUTH] Loaded %d users from credentials file\n", user_count);
-    pthread_mutex_unlock(&auth_mutex);
+    if (token_mode == TOKEN_MODE_STORED) {
+        revoke_user_sessions(username);
+    }
+    log_info("AUTH", "Password changed for user: %s", username);
     return 1;
 }
 
-int save_user(const User *user) {
-    FILE *fp = fopen(CREDENTIALS_FILE, "a");
-    if (fp == NULL) {
-        perror("[AUTH ERROR] Could not open credentials file for writing");
+// Live sessions for a snapshot, with the journal position they include
+static int copy_live_sessions(SessionRecord *out, int max, off_t *journal_mark) {
+    pthread_mutex_lock(&session_table->lock);
+
+    Session *sessions = session_table->entries;
+    time_t now = coarseclock_now();
+    int count = 0;
+    for (int i = 0; i < session_table->count && count < max; i++) {
+        if (sessions[i].active && sessions[i].expiry > now) {
+            memcpy(out[count].username, sessions[i].username, MAX_USERNAME);
+            memcpy(out[count].token, sessions[i].token, SESSION_TOKEN_MAX);
+            out[count].expiry = sessions[i].expiry;
+            count++;
+        }
+    }
+    *journal_mark = sessionstore_journal_mark();
+
+    pthread_mutex_unlock(&session_table->lock);
+    return count;
+}
+
+int enable_session_persistence(int snapshot_interval) {
+    // Signed tokens already outlive the process as long as the key file does
+    if (token_mode == TOKEN_MODE_STATELESS || session_persist) {
+        return 1;
+    }
+
+    SessionRecord *records = malloc(sizeof(SessionRecord) * MAX_SESSIONS);
+    if (records == NULL) {
+        return 0;
+    }
+
+    int count = sessionstore_load(records, MAX_SESSIONS, coarseclock_now());
+    if (count < 0 || !sessionstore_open()) {
+        free(records);
         return 0;
     }
 
-    fprintf(fp, "%s %s %s\n", user->username, user->password_hash, user->salt);
-    fclose(fp);
+    pthread_mutex_lock(&session_table->lock);
+    for (int i = 0; i < count; i++) {
+        int slot = acquire_slot();
+        if (slot < 0) {
+            break;
+        }
+        Session *session = &session_table->entries[slot];
+        memcpy(session->username, records[i].username, MAX_USERNAME);
+        memcpy(session->token, records[i].token, SESSION_TOKEN_MAX);
+        session->expiry = (time_t)records[i].expiry;
+        session->active = 1;
+        session_table->live++;
+        timerwheel_schedule(session_timers, slot, (uint64_t)session->expiry);
+    }
+    session_persist = 1;
+    pthread_mutex_unlock(&session_table->lock);
+
+    // Start from a fresh snapshot and an empty journal
+    off_t mark = 0;
+    count = copy_live_sessions(records, MAX_SESSIONS, &mark);
+    sessionstore_snapshot(records, count, mark);
+    free(records);
+
+    if (!sessionstore_start(snapshot_interval, copy_live_sessions)) {
+        fprintf(stderr, "[SESSION] Periodic snapshots unavailable, relying on the journal\n");
+    }
+    printf("[SESSION] Restored %d sessions, snapshot every %d s\n", count, snapshot_interval);
     return 1;
 }
 
+// ============================================================================
+// File I/O Functions
+// ============================================================================
+
+int load_users() {
+    // Maps the index on first use, then only applies new log entries
+    if (!credstore_refresh()) {
+        fprintf(stderr, "[AUTH ERROR] Could not load credential store\n");
+        return 0;
+    }
+
+    // Fold the log into the index between connections, never in a child
+    if (getpid() == store_owner && credstore_needs_compaction()) {
+        credstore_compact();
+    }
+    return 1;
+}
+
+int save_user(const User *user) {
+    CredRecord record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.username, user->username, MAX_USERNAME - 1);
+    record.kdf = CRED_KDF_SHA256;
+    hex_to_bytes(user->password_hash, record.hash, SHA256_DIGEST_LENGTH);
+    hex_to_bytes(user->salt, record.salt, SALT_SIZE);
+
+    return credstore_put(&record, 0) == 1;
+}
+
 // ============================================================================
 // Initialization and Cleanup
 // ============================================================================
 
+int load_kdf_policy(const char *path) {
+    kdf_default_params(&kdf_policy);
+    int loaded = kdf_load_policy(path, &kdf_policy);
+    if (!loaded) {
+        printf("[AUTH] No usable KDF policy file, using defaults (run --calibrate-kdf)\n");
+    }
+    printf("[AUTH] Password hashing: %s (cost %u, target %d ms)\n",
+           kdf_name(kdf_policy.kdf), kdf_policy.cost, kdf_policy.target_ms);
+    return loaded;
+}
+
+int set_token_mode(int mode, const char *key_file) {
+    if (mode == TOKEN_MODE_STATELESS && !token_keys_load(key_file)) {
+        fprintf(stderr, "[AUTH ERROR] Failed to load token signing keys\n");
+        return 0;
+    }
+
+    token_mode = mode;
+    printf("[AUTH] Session tokens: %s\n",
+           mode == TOKEN_MODE_STATELESS ? "stateless (HMAC-signed)" : "stored");
+    return 1;
+}
+
 int init_auth_system() {
     printf("[AUTH] Initializing authentication system...\n");
     
     // Initialize OpenSSL
     OpenSSL_add_all_algorithms();
     
-    // Initialize mutexes (already initialized statically)
+    // Session table lives in shared memory so forked children share it
+    session_table = mmap(NULL, sizeof(SessionTable), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (session_table == MAP_FAILED) {
+        perror("[AUTH ERROR] Could not map session table");
+        session_table = NULL;
+        return 0;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&session_table->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    session_table->count = 0;
+
+    // Expiry timers, one per slot, shared the same way
+    session_timers = mmap(NULL, timerwheel_size(MAX_SESSIONS), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (session_timers == MAP_FAILED) {
+        perror("[AUTH ERROR] Could not map session timers");
+        session_timers = NULL;
+        return 0;
+    }
+    timerwheel_init(session_timers, MAX_SESSIONS, (uint64_t)coarseclock_now());
+
+    // AUTH_TOKEN_MODE=stateless lets any process sharing the key file
+    // verify tokens without the session table
+    const char *mode = getenv("AUTH_TOKEN_MODE");
+    if (mode != NULL && strcmp(mode, "stateless") == 0) {
+        const char *key_file = getenv("AUTH_TOKEN_KEY_FILE");
+        if (!set_token_mode(TOKEN_MODE_STATELESS, key_file ? key_file : TOKEN_KEY_FILE)) {
+            return 0;
+        }
+
+        // Instances that share the key file but not the credential store
+        // can only check signatures, and cannot see revocations
+        const char *revocation = getenv("AUTH_TOKEN_REVOCATION");
+        token_revocation = !(revocation != NULL && strcmp(revocation, "off") == 0);
+        printf("[AUTH] Token revocation: %s\n", token_revocation ?
+               "checked against the credential store" : "off, tokens hold until expiry or key rotation");
+    }
     
+    // Hashing policy for new and upgraded passwords
+    load_kdf_policy(KDF_POLICY_FILE);
+
+    const char *debug = getenv("AUTH_DEBUG");
+    auth_debug = (debug != NULL && strcmp(debug, "1") == 0);
+    if (auth_debug) {
+        logger_set_level(LOG_LEVEL_DEBUG);
+    }
+
     // Load existing users
+    store_owner = getpid();
     if (!load_users()) {
         fprintf(stderr, "[AUTH ERROR] Failed to load users\n");
         return 0;
     }
 
     // If no users exist, create a default admin user
-    if (user_count == 0) {
+    if (credstore_count() == 0) {
         printf("[AUTH] No users found. Creating default admin user...\n");
         if (create_user("admin", "admin123")) {
             printf("[AUTH] Default user created: admin/admin123\n");
@@ -404,23 +797,45 @@ int init_auth_system() {
         }
     }
 
-    printf("[AUTH] Authentication system ready (%d users loaded)\n", user_count);
+    // Batch registrations through the write-behind queue from here on.
+    // Started before any fork so children share the queue
+    CommitConfig commit_config;
+    commitq_config_from_env(&commit_config);
+    if (!commitq_start(&commit_config)) {
+        fprintf(stderr, "[AUTH] Write-behind unavailable, registrations are written directly\n");
+    }
+
+    // Login rate limits, shared with forked children like the queue above
+    if (!ratelimit_init()) {
+        fprintf(stderr, "[AUTH] Rate limiting unavailable\n");
+    }
+
+    printf("[AUTH] Authentication system ready (%zu users loaded)\n", credstore_count());
     return 1;
 }
 
 void cleanup_auth_system() {
     printf("[AUTH] Cleaning up authentication system...\n");
     
-    pthread_mutex_lock(&auth_mutex);
-    user_count = 0;
-    pthread_mutex_unlock(&auth_mutex);
-    
-    pthread_mutex_lock(&session_mutex);
-    session_count = 0;
-    pthread_mutex_unlock(&session_mutex);
+    commitq_stop();
+    ratelimit_cleanup();
+    credstore_close();
+
+    // Final snapshot, before the table goes away
+    if (session_persist) {
+        sessionstore_stop();
+        session_persist = 0;
+    }
     
-    pthread_mutex_destroy(&auth_mutex);
-    pthread_mutex_destroy(&session_mutex);
+    if (session_table != NULL) {
+        pthread_mutex_destroy(&session_table->lock);
+        munmap(session_table, sizeof(SessionTable));
+        session_table = NULL;
+    }
+    if (session_timers != NULL) {
+        munmap(session_timers, timerwheel_size(MAX_SESSIONS));
+        session_timers = NULL;
+    }
     
     printf("[AUTH] Cleanup complete\n");
 }
@@ -11,6 +11,7 @@
 #include <time.h>
 #include <pthread.h>
 #include <ctype.h>
+#include "credstore.h"
 
 #define MAX_USERNAME 64
 #define MAX_PASSWORD 128
@@ -18,8 +19,15 @@
 #define SALT_SIZE 16
 #define HASH_SIZE 64
 #define TOKEN_SIZE 32
-#define MAX_USERS 100
+#define MAX_USERS 1000000 // The indexed credential store has no fixed table
+#define MAX_SESSIONS 4096
 #define SESSION_TIMEOUT 3600 // 1 hour in seconds
+#define SESSION_TOKEN_MAX 160 // Size of a token string buffer (fits signed tokens)
+#define AUTH_REPLACE_RETRIES 8 // Compare-and-put attempts against concurrent writers
+
+// Token modes, selected with the AUTH_TOKEN_MODE environment variable
+#define TOKEN_MODE_STORED 0    // Random tokens kept in the shared session table
+#define TOKEN_MODE_STATELESS 1 // HMAC-signed tokens, see token.h
 
 // User structure
 typedef struct {
@@ -31,18 +39,30 @@ typedef struct {
 // Session token structure
 typedef struct {
     char username[MAX_USERNAME];
-    char token[TOKEN_SIZE * 2 + 1]; // Hex string
+    char token[SESSION_TOKEN_MAX]; // Hex string
     time_t expiry;
     int active;
 } Session;
 
 // Function declarations
 
+/**
+ * Load the KDF policy used for new hashes (defaults if path is missing)
+ * Returns: 1 if read from path, 0 if the defaults are used
+ */
+int load_kdf_policy(const char *path);
+
 /**
  * Initialize authentication system
  */
 int init_auth_system();
 
+/**
+ * Select stored or stateless session tokens
+ * Returns: 1 on success, 0 if the signing keys could not be loaded
+ */
+int set_token_mode(int mode, const char *key_file);
+
 /**
  * Cleanup authentication system
  */
@@ -64,7 +84,8 @@ void bytes_to_hex(const unsigned char *bytes, size_t len, char *hex);
 void hex_to_bytes(const char *hex, unsigned char *bytes, size_t len);
 
 /**
- * Hash password with salt using SHA-256
+ * Hash password with salt using SHA-256 (the legacy CRED_KDF_SHA256
+ * scheme, new passwords go through kdf_derive)
  */
 void hash_password(const char *password, const unsigned char *salt, 
                    unsigned char *hash);
@@ -79,6 +100,20 @@ int validate_username(const char *username);
  */
 int validate_password(const char *password);
 
+/**
+ * Admin names come from AUTH_ADMIN_USERS (comma separated). They cannot be
+ * registered, only created with provision; unset means no admins
+ * Returns: 1 if username is on the admin list
+ */
+int is_admin_name(const char *username);
+
+/**
+ * Build a user's record: fresh salt and a hash with the current KDF policy.
+ * Does not validate or store anything, so it can run on many threads
+ * Returns: 1 on success, 0 on failure
+ */
+int prepare_user(const char *username, const char *password, CredRecord *out);
+
 /**
  * Create a new user with hashed password
  */
@@ -86,7 +121,8 @@ int create_user(const char *username, const char *password);
 
 /**
  * Register a new user
- * Returns: 0 on success, -1 if user exists, -2 if max users, -3 on error
+ * Returns: 0 on success, -1 if user exists, -2 if max users, -3 on error,
+ *          -4 if the name is reserved for an admin
  */
 int register_user(const char *username, const char *password);
 
@@ -108,11 +144,56 @@ void generate_token(char *token_hex, size_t size);
 int create_session(const char *username, char *token_out);
 
 /**
- * Verify session token
+ * Verify session token. A signed token also costs a lookup of the user's
+ * record in the credential store, which refuses tokens of deleted users
+ * and ones issued before the user's sessions_after, so every instance
+ * verifying them needs the store as well as the key file. With
+ * AUTH_TOKEN_REVOCATION=off only the signature and expiry are checked:
+ * no store needed, but DELETE, PASSWD and REVOKE take effect only when
+ * the token expires or its key is rotated out
  * Returns: 1 if valid, 0 if invalid or expired
  */
 int verify_session(const char *username, const char *token);
 
+/**
+ * Resume an existing session from a token issued by create_session
+ * Copies the token to hand back to the client into token_out
+ * Returns: 1 if resumed, 0 if invalid or expired
+ */
+int resume_session(const char *username, const char *token, char *token_out);
+
+/**
+ * End every session of a user. Stored tokens are invalidated in the
+ * session table, signed tokens issued until now stop verifying
+ * Returns: number of stored sessions revoked (1 for signed tokens),
+ *          0 if the user is unknown in stateless mode, -1 on error or
+ *          when the record kept changing under concurrent writers
+ */
+int revoke_user_sessions(const char *username);
+
+/**
+ * Delete a user and revoke their sessions
+ * Returns: 1 on success, -1 if the user does not exist, 0 on error
+ */
+int delete_user(const char *username);
+
+/**
+ * Set a new password (hashed with the current KDF policy) and revoke every
+ * session opened with the old one. A user deleted while the password is
+ * hashed stays deleted
+ * Returns: 1 on success, -1 if the user does not exist (or no longer),
+ *          -3 if the password is too weak, 0 on error
+ */
+int change_password(const char *username, const char *new_password);
+
+/**
+ * Restore stored sessions saved by a previous run, then journal every
+ * change and snapshot the table every snapshot_interval seconds.
+ * Must be called before fork(). Nothing to do for stateless tokens
+ * Returns: 1 on success, 0 on failure
+ */
+int enable_session_persistence(int snapshot_interval);
+
 /**
  * Invalidate a session
  * Returns: 1 on success, 0 on failure
@@ -120,12 +201,12 @@ int verify_session(const char *username, const char *token);
 int invalidate_session(const char *username, const char *token);
 
 /**
- * Load users from file
+ * Load users from the credential store (applies only new changes)
  */
 int load_users();
 
 /**
- * Save user to file
+ * Save user to the credential store
  */
 int save_user(const User *user);
 
@@ -0,0 +1,244 @@
+#include "authpool.h"
+#include "conntrace.h"
+#include "logger.h"
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <openssl/crypto.h>
+
+// Pool state (one pool per process)
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[AUTHPOOL_MAX_THREADS];
+static int worker_count = 0;
+static int running = 0;
+
+static AuthJob *queue_head = NULL;   // Waiting for a worker
+static AuthJob *queue_tail = NULL;
+static AuthJob *done_head = NULL;    // Finished, waiting for authpool_collect()
+static AuthJob *done_tail = NULL;
+static int pending = 0;              // Queued + running
+static int max_pending = AUTHPOOL_DEFAULT_PENDING;
+
+static int done_fd = -1;
+
+// ============================================================================
+// Workers
+// ============================================================================
+
+// Same checks and replies as the handshake in handle_client()
+static void run_job(AuthJob *job) {
+    char token[SESSION_TOKEN_MAX];
+    job->success = 0;
+
+    // admin_handle() loads users itself and checks the caller's rights
+    if (job->type == AUTH_JOB_ADMIN) {
+        job->loaded_us = conntrace_now_us();
+        admin_handle(job->username, job->request, job->reply, sizeof(job->reply));
+        job->hashed_us = conntrace_now_us();
+        job->success = (strncmp(job->reply, "ADMIN_OK", strlen("ADMIN_OK")) == 0);
+        return;
+    }
+
+    // Pick up users added by other processes
+    load_users();
+    job->loaded_us = conntrace_now_us();
+
+    if (job->type == AUTH_JOB_REGISTER) {
+        int reg_result = register_user(job->username, job->password);
+        job->hashed_us = conntrace_now_us();
+        if (reg_result != 0) {
+            const char *reason = "Registration failed";
+            if (reg_result == -1) {
+                reason = "Username already exists";
+            } else if (reg_result == -2) {
+                reason = "Too many users";
+            } else if (reg_result == -3) {
+                reason = "Invalid username or password format";
+            } else if (reg_result == -4) {
+                reason = "Username reserved";
+            }
+            log_warn("AUTH", "Registration failed for user: %s (code: %d)", job->username, reg_result);
+            snprintf(job->reply, sizeof(job->reply), "AUTH_FAILED:%s", reason);
+            return;
+        }
+        log_info("AUTH", "User registered successfully: %s", job->username);
+    } else {
+        int verified = verify_credentials(job->username, job->password);
+        job->hashed_us = conntrace_now_us();
+        if (!verified) {
+            log_warn("AUTH", "Authentication failed for user: %s", job->username);
+            snprintf(job->reply, sizeof(job->reply), "AUTH_FAILED:Invalid credentials");
+            return;
+        }
+        log_info("AUTH", "User authenticated: %s", job->username);
+    }
+
+    if (!create_session(job->username, token)) {
+        log_warn("AUTH", "Failed to create session for user: %s", job->username);
+        snprintf(job->reply, sizeof(job->reply), "AUTH_FAILED:Session creation failed");
+        return;
+    }
+
+    snprintf(job->reply, sizeof(job->reply), "AUTH_OK:%s", token);
+    job->success = 1;
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&pool_mutex);
+    while (1) {
+        while (running && queue_head == NULL) {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        }
+        if (queue_head == NULL) {
+            break;
+        }
+
+        AuthJob *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+
+        job->started_us = conntrace_now_us();
+        run_job(job);
+        OPENSSL_cleanse(job->password, sizeof(job->password));
+        OPENSSL_cleanse(job->request, sizeof(job->request)); // ADMIN:PASSWD
+        job->next = NULL;
+
+        pthread_mutex_lock(&pool_mutex);
+        if (done_tail != NULL) {
+            done_tail->next = job;
+        } else {
+            done_head = job;
+        }
+        done_tail = job;
+        pending--;
+
+        uint64_t one = 1;
+        if (write(done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            log_error("AUTHPOOL", "Could not signal completion: %s", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int authpool_start(int threads, int limit) {
+    if (running) {
+        return 1;
+    }
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (threads > AUTHPOOL_MAX_THREADS) {
+        threads = AUTHPOOL_MAX_THREADS;
+    }
+    max_pending = (limit > 0) ? limit : AUTHPOOL_DEFAULT_PENDING;
+
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_fd < 0) {
+        perror("[AUTHPOOL ERROR] Could not create eventfd");
+        return 0;
+    }
+
+    running = 1;
+    for (worker_count = 0; worker_count < threads; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) {
+            perror("[AUTHPOOL ERROR] Could not start worker");
+            break;
+        }
+    }
+    if (worker_count == 0) {
+        running = 0;
+        close(done_fd);
+        done_fd = -1;
+        return 0;
+    }
+
+    printf("[AUTHPOOL] %d hashing threads, at most %d pending logins\n", worker_count, max_pending);
+    return 1;
+}
+
+int authpool_submit(AuthJob *job) {
+    pthread_mutex_lock(&pool_mutex);
+    if (!running || pending >= max_pending) {
+        pthread_mutex_unlock(&pool_mutex);
+        return 0;
+    }
+
+    job->next = NULL;
+    job->queued_us = conntrace_now_us();
+    if (queue_tail != NULL) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    pending++;
+
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    return 1;
+}
+
+int authpool_fd() {
+    return done_fd;
+}
+
+AuthJob *authpool_collect() {
+    uint64_t count;
+    if (read(done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        log_error("AUTHPOOL", "Could not read completions: %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    AuthJob *jobs = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+    return jobs;
+}
+
+int authpool_pending() {
+    pthread_mutex_lock(&pool_mutex);
+    int count = pending;
+    pthread_mutex_unlock(&pool_mutex);
+    return count;
+}
+
+void authpool_stop() {
+    pthread_mutex_lock(&pool_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&pool_mutex);
+        return;
+    }
+    running = 0;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    worker_count = 0;
+
+    // Finished jobs nobody collected
+    AuthJob *job = authpool_collect();
+    while (job != NULL) {
+        AuthJob *next = job->next;
+        free(job);
+        job = next;
+    }
+
+    close(done_fd);
+    done_fd = -1;
+}
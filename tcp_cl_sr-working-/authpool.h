@@ -0,0 +1,85 @@
+#ifndef AUTHPOOL_H
+#define AUTHPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "auth.h"
+#include "admin.h"
+
+#define AUTHPOOL_MAX_THREADS 64
+#define AUTHPOOL_DEFAULT_PENDING 256  // Jobs queued or running before new ones are refused
+#define AUTHPOOL_REQUEST_SIZE 256     // An ADMIN: line, as read by the event loop
+#define AUTHPOOL_REPLY_SIZE ADMIN_REPLY_MAX
+
+#define AUTH_JOB_LOGIN 1
+#define AUTH_JOB_REGISTER 2
+#define AUTH_JOB_ADMIN 3
+
+/*
+ * Password hashing off the connection thread.
+ *
+ * Callers submit AUTH / REGISTER requests, a fixed set of worker threads
+ * runs verify_credentials() or register_user() plus create_session(), and
+ * finished jobs are handed back through a file descriptor that becomes
+ * readable (an eventfd), so an event loop can poll it with its sockets.
+ * ADMIN: commands go the same way, PASSWD hashes and the others read or
+ * rewrite the credential store.
+ */
+
+typedef struct AuthJob {
+    int type;                           // AUTH_JOB_*
+    char username[MAX_USERNAME];        // Who logs in, or the admin
+    char password[MAX_PASSWORD];
+    char request[AUTHPOOL_REQUEST_SIZE]; // AUTH_JOB_ADMIN: the ADMIN: line
+    void *owner;                        // Caller data, e.g. the connection
+    long long queued_us;                // Stage times on the monotonic clock
+    long long started_us;
+    long long loaded_us;                // load_users() done
+    long long hashed_us;                // Password checked or user created
+
+    // Filled by the worker
+    int success;                        // 1 if authenticated and a session exists
+    char reply[AUTHPOOL_REPLY_SIZE];    // "AUTH_OK:<token>" or "AUTH_FAILED:<reason>",
+                                        // admin_handle()'s reply for admin jobs
+
+    struct AuthJob *next;
+} AuthJob;
+
+/**
+ * Start the pool. threads <= 0 uses one per online CPU, max_pending <= 0
+ * uses AUTHPOOL_DEFAULT_PENDING
+ * Returns: 1 on success, 0 on failure
+ */
+int authpool_start(int threads, int max_pending);
+
+/**
+ * Queue a job (allocated with malloc). Refused when max_pending jobs are
+ * already queued or running, so a login flood cannot grow the backlog
+ * Returns: 1 if queued, 0 if refused (caller keeps ownership)
+ */
+int authpool_submit(AuthJob *job);
+
+/**
+ * Descriptor that is readable while finished jobs are waiting
+ */
+int authpool_fd();
+
+/**
+ * Take every finished job, oldest first. The caller owns (and frees) them
+ * Returns: linked list through next, NULL if none
+ */
+AuthJob *authpool_collect();
+
+/**
+ * Number of jobs queued or running
+ */
+int authpool_pending();
+
+/**
+ * Stop the workers after the queued jobs finish
+ */
+void authpool_stop();
+
+#endif // AUTHPOOL_H
@@ -0,0 +1,157 @@
+#include "capture.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int capture_fd = -1;
+static long long capture_start_us = 0;
+static uint32_t next_conn = 1;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// FNV-1a, a stable pseudonym for a username
+static uint32_t user_id(const char *username) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static void append(uint32_t conn, uint8_t type, uint8_t detail, uint32_t value,
+                   const char *payload, size_t len) {
+    if (capture_fd < 0 || conn == 0) {
+        return;
+    }
+    if (len > CAPTURE_PAYLOAD_MAX) {
+        len = CAPTURE_PAYLOAD_MAX;
+    }
+
+    // Header and payload in one write so appends from processes never mix
+    char data[sizeof(CaptureRecord) + CAPTURE_PAYLOAD_MAX];
+    CaptureRecord *record = (CaptureRecord *)data;
+    memset(record, 0, sizeof(CaptureRecord));
+    record->at_us = (uint64_t)(monotonic_us() - capture_start_us);
+    record->conn = conn;
+    record->value = value;
+    record->type = type;
+    record->detail = detail;
+    record->length = (uint16_t)len;
+    if (len > 0) {
+        memcpy(data + sizeof(CaptureRecord), payload, len);
+    }
+
+    ssize_t written;
+    do {
+        written = write(capture_fd, data, sizeof(CaptureRecord) + len);
+    } while (written < 0 && errno == EINTR);
+}
+
+// ============================================================================
+// Capture
+// ============================================================================
+
+int capture_open(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror("[CAPTURE ERROR] Could not open trace");
+        return 0;
+    }
+
+    CaptureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.started_at = time(NULL);
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        perror("[CAPTURE ERROR] Could not write trace header");
+        close(fd);
+        return 0;
+    }
+
+    capture_fd = fd;
+    capture_start_us = monotonic_us();
+    printf("[CAPTURE] Recording client traffic to %s\n", path);
+    return 1;
+}
+
+void capture_stop() {
+    if (capture_fd >= 0) {
+        close(capture_fd);
+        capture_fd = -1;
+    }
+}
+
+uint32_t capture_connect() {
+    if (capture_fd < 0) {
+        return 0;
+    }
+    uint32_t conn = next_conn++;
+    append(conn, CAPTURE_CONNECT, 0, 0, NULL, 0);
+    return conn;
+}
+
+void capture_login(uint32_t conn, const char *command, const char *username) {
+    uint8_t kind = 0;
+    if (strcmp(command, "AUTH") == 0) {
+        kind = CAPTURE_LOGIN_AUTH;
+    } else if (strcmp(command, "REGISTER") == 0) {
+        kind = CAPTURE_LOGIN_REGISTER;
+    } else if (strcmp(command, "RESUME") == 0) {
+        kind = CAPTURE_LOGIN_RESUME;
+    }
+    append(conn, CAPTURE_LOGIN, kind, user_id(username), NULL, 0);
+}
+
+void capture_request(uint32_t conn, const char *data, size_t len) {
+    // "ADMIN:PASSWD:user:secret" keeps "ADMIN:PASSWD" only
+    if (len > 6 && strncmp(data, "ADMIN:", 6) == 0) {
+        size_t keep = 6;
+        while (keep < len && data[keep] != ':' && data[keep] != '\n') {
+            keep++;
+        }
+        len = keep;
+    }
+    append(conn, CAPTURE_REQUEST, 0, 0, data, len);
+}
+
+void capture_response(uint32_t conn, size_t bytes) {
+    append(conn, CAPTURE_RESPONSE, 0, (uint32_t)bytes, NULL, 0);
+}
+
+void capture_close(uint32_t conn) {
+    append(conn, CAPTURE_CLOSE, 0, 0, NULL, 0);
+}
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+int capture_read_header(FILE *fp, CaptureFileHeader *header) {
+    return fread(header, sizeof(*header), 1, fp) == 1 &&
+           header->magic == CAPTURE_MAGIC && header->version == CAPTURE_VERSION;
+}
+
+int capture_read_record(FILE *fp, CaptureRecord *record, char *payload) {
+    if (fread(record, sizeof(*record), 1, fp) != 1) {
+        return feof(fp) ? 0 : -1;
+    }
+    if (record->type < CAPTURE_CONNECT || record->type > CAPTURE_CLOSE ||
+        record->length > CAPTURE_PAYLOAD_MAX) {
+        return -1;
+    }
+    if (record->length > 0 && fread(payload, record->length, 1, fp) != 1) {
+        return -1;
+    }
+    return 1;
+}
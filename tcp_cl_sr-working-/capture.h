@@ -0,0 +1,105 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC 0x50435254u    // "TRCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_PAYLOAD_MAX 256      // A request is at most one MAX_BUFFER read
+
+// Record types
+#define CAPTURE_CONNECT 1            // Connection accepted
+#define CAPTURE_LOGIN 2              // Handshake: detail = CAPTURE_LOGIN_*, value = user id
+#define CAPTURE_REQUEST 3            // One read() after login, payload = the bytes read
+#define CAPTURE_RESPONSE 4           // Answer to the last request, value = bytes sent
+#define CAPTURE_CLOSE 5              // Connection closed by either side
+
+#define CAPTURE_LOGIN_AUTH 1
+#define CAPTURE_LOGIN_REGISTER 2
+#define CAPTURE_LOGIN_RESUME 3
+
+/*
+ * Traffic capture: what clients send, per connection, with timing.
+ *
+ * The trace is a CaptureFileHeader followed by CaptureRecords, each with
+ * `length` payload bytes. Records of different connections interleave in
+ * time order and are told apart by `conn`. `at_us` counts from the start
+ * of the capture on the monotonic clock.
+ *
+ * Credentials never reach the trace: a login keeps its kind and a 32-bit
+ * hash of the username (enough to tell users apart when replaying), never
+ * the password or token. Admin requests keep only their command name.
+ *
+ * Every record is appended with a single write() to a file opened with
+ * O_APPEND before fork(), so worker processes share the trace without a
+ * lock.
+ */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t started_at;              // Wall clock, seconds
+} CaptureFileHeader;
+
+typedef struct {
+    uint64_t at_us;
+    uint32_t conn;
+    uint32_t value;
+    uint8_t type;                    // CAPTURE_*
+    uint8_t detail;
+    uint16_t length;                 // Payload bytes that follow
+    uint32_t reserved;
+} CaptureRecord;
+
+/**
+ * Start capturing to path (truncated). Call before fork()
+ * Returns: 1 on success, 0 on failure
+ */
+int capture_open(const char *path);
+
+/**
+ * Stop capturing and close the trace
+ */
+void capture_stop();
+
+/**
+ * Record a new connection
+ * Returns: its connection id, 0 when capture is off
+ */
+uint32_t capture_connect();
+
+/**
+ * Record a handshake (AUTH, REGISTER or RESUME) without its secret
+ */
+void capture_login(uint32_t conn, const char *command, const char *username);
+
+/**
+ * Record the bytes of one request read from the client
+ */
+void capture_request(uint32_t conn, const char *data, size_t len);
+
+/**
+ * Record how many bytes answered the last request
+ */
+void capture_response(uint32_t conn, size_t bytes);
+
+/**
+ * Record the end of a connection
+ */
+void capture_close(uint32_t conn);
+
+/**
+ * Read and check the header of a trace
+ * Returns: 1 if fp holds a trace this version understands, 0 otherwise
+ */
+int capture_read_header(FILE *fp, CaptureFileHeader *header);
+
+/**
+ * Read the next record and its payload (at most CAPTURE_PAYLOAD_MAX bytes)
+ * Returns: 1 on success, 0 at the end of the trace, -1 if it is damaged
+ */
+int capture_read_record(FILE *fp, CaptureRecord *record, char *payload);
+
+#endif // CAPTURE_H
@@ -1,25 +1,484 @@
 #include "clientdef.h"
+#include <termios.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+
+static ClientLoop *loop = NULL;
+static ClientConn *conn = NULL;
+
+static char session_user[CLIENT_USER_MAX];
+static char session_token[SESSION_TOKEN_MAX];
+
+// ============================================================================
+// Connection
+// ============================================================================
+
+int connect_server(const char *host, int port) {
+    ClientAddr addr;
+    if (!client_resolve(host, port, &addr)) {
+        fprintf(stderr,"ERROR, no such host\n");
+        return 0;
+    }
+
+    loop = client_loop_new(1);
+    conn = (loop != NULL) ? client_conn_new(loop, NULL) : NULL;
+    if (conn == NULL) {
+        perror("ERROR opening socket");
+        return 0;
+    }
+
+    if (!client_connect(conn, &addr, NULL) || client_wait(conn) != CLIENT_OK) {
+        fprintf(stderr, "ERROR connecting: %s\n", conn->error);
+        return 0;
+    }
+    return 1;
+}
+
+void close_connection(){
+    client_loop_free(loop);
+    loop = NULL;
+    conn = NULL;
+}
+
+// Send a request and print its short answer
+// Returns: 1 to go on, 0 if the connection is gone
+static int ask(const char *request) {
+    if (!client_request(conn, request, strlen(request), CLIENT_FRAME_SHORT, 0, NULL, NULL)) {
+        fprintf(stderr, "ERROR writing to socket: %s\n", conn->error);
+        return 0;
+    }
+    if (client_wait(conn) != CLIENT_OK) {
+        printf("Server closed connection (%s)\n", conn->error);
+        return 0;
+    }
+    printf("%s\n", conn->reply);
+    return 1;
+}
+
+static void print_part(ClientConn *c, const char *data, size_t len) {
+    (void)c;
+    fwrite(data, 1, len, stdout);
+}
+
+// Option 3: print the file as it arrives, whatever its size
+static int ask_file(const char *name) {
+    if (!client_request_file(conn, name, 0, print_part, NULL)) {
+        fprintf(stderr, "ERROR writing to socket: %s\n", conn->error);
+        return 0;
+    }
+    int status = client_wait(conn);
+    printf("\n");
+    if (status == CLIENT_ERROR) {
+        printf("Server closed connection (%s)\n", conn->error);
+        return 0;
+    }
+    // A missing file was printed as the server's error message
+    return 1;
+}
+
+// ============================================================================
+// Authentication
+// ============================================================================
+
+// Function to disable echo for password input
+void disable_echo() {
+    struct termios term;
+    tcgetattr(STDIN_FILENO, &term);
+    term.c_lflag &= ~ECHO;
+    tcsetattr(STDIN_FILENO, TCSANOW, &term);
+}
+
+// Function to enable echo
+void enable_echo() {
+    struct termios term;
+    tcgetattr(STDIN_FILENO, &term);
+    term.c_lflag |= ECHO;
+    tcsetattr(STDIN_FILENO, TCSANOW, &term);
+}
+
+// Load the session token cached by a previous login
+int load_cached_session() {
+    FILE *fp = fopen(SESSION_CACHE_FILE, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    int found = (fscanf(fp, "%63s %179s", session_user, session_token) == 2);
+    fclose(fp);
+    return found;
+}
+
+// Cache the session token so the next connection can skip the password
+void save_cached_session(const char *username, const char *token) {
+    strncpy(session_user, username, sizeof(session_user) - 1);
+    session_user[sizeof(session_user) - 1] = '\0';
+    strncpy(session_token, token, sizeof(session_token) - 1);
+    session_token[sizeof(session_token) - 1] = '\0';
+
+    mode_t old_mask = umask(077);
+    FILE *fp = fopen(SESSION_CACHE_FILE, "w");
+    umask(old_mask);
+    if (fp == NULL) {
+        return;
+    }
+    fprintf(fp, "%s %s\n", session_user, session_token);
+    fclose(fp);
+}
+
+void clear_cached_session() {
+    session_user[0] = '\0';
+    session_token[0] = '\0';
+    unlink(SESSION_CACHE_FILE);
+}
+
+// Try to resume the cached session, returns 1 if the server accepted it
+int resume_cached_session() {
+    char auth_message[MAX_BUFFER];
+
+    if (!load_cached_session()) {
+        return 0;
+    }
+
+    client_auth_message(auth_message, sizeof(auth_message), "RESUME", session_user, session_token);
+    if (!client_handshake(conn, auth_message, NULL)) {
+        fprintf(stderr, "ERROR: Failed to send session token: %s\n", conn->error);
+        return 0;
+    }
+
+    int status = client_wait(conn);
+    if (status == CLIENT_OK) {
+        save_cached_session(session_user, conn->token);
+        printf("[AUTH] Session resumed for %s\n", session_user);
+        return 1;
+    }
+    if (status == CLIENT_ERROR) {
+        return 0;
+    }
+
+    // The server keeps the connection open for a normal login
+    printf("[AUTH] Cached session expired, please log in again\n");
+    clear_cached_session();
+    return 0;
+}
+
+// Function to handle authentication
+int authenticate() {
+    char username[64];
+    char password[128];
+    char choice[10];
+    char auth_message[MAX_BUFFER];
+
+    if (resume_cached_session()) {
+        return 1;
+    }
+    if (conn->state != CLIENT_IDLE) {
+        fprintf(stderr, "ERROR: Connection lost: %s\n", conn->error);
+        return 0;
+    }
+
+    printf("\n========================================\n");
+    printf("         AUTHENTICATION\n");
+    printf("========================================\n");
+    printf("1. Register new account\n");
+    printf("2. Login with existing account\n");
+    printf("========================================\n");
+    printf("Enter your choice (1-2): ");
+
+    if (fgets(choice, sizeof(choice), stdin) == NULL) {
+        fprintf(stderr, "ERROR: Failed to read choice\n");
+        return 0;
+    }
+    choice[strcspn(choice, "\n")] = 0;
+
+    int is_register = (strcmp(choice, "1") == 0);
+
+    // Get username
+    printf("Username: ");
+    if (fgets(username, sizeof(username), stdin) == NULL) {
+        fprintf(stderr, "ERROR: Failed to read username\n");
+        return 0;
+    }
+    username[strcspn(username, "\n")] = 0; // Remove newline
+
+    // Get password (without echo)
+    printf("Password: ");
+    disable_echo();
+    if (fgets(password, sizeof(password), stdin) == NULL) {
+        enable_echo();
+        fprintf(stderr, "\nERROR: Failed to read password\n");
+        return 0;
+    }
+    enable_echo();
+    printf("\n");
+    password[strcspn(password, "\n")] = 0; // Remove newline
+
+    // Send authentication/registration request
+    client_auth_message(auth_message, sizeof(auth_message), is_register ? "REGISTER" : "AUTH",
+                        username, password);
+    if (!client_handshake(conn, auth_message, NULL)) {
+        fprintf(stderr, "ERROR: Failed to send credentials: %s\n", conn->error);
+        return 0;
+    }
+
+    // Wait for authentication result
+    int status = client_wait(conn);
+    if (status == CLIENT_OK) {
+        if (is_register) {
+            printf("[AUTH] Registration successful! You are now logged in.\n");
+        } else {
+            printf("[AUTH] Authentication successful!\n");
+        }
+
+        if (conn->token[0] != '\0') {
+            save_cached_session(username, conn->token);
+            printf("[AUTH] Session token received\n");
+        }
+        return 1;
+    } else if (status == CLIENT_REJECTED) {
+        fprintf(stderr, "[AUTH] Failed: %s\n", conn->error);
+        return 0;
+    } else {
+        fprintf(stderr, "ERROR: Failed to receive authentication result: %s\n", conn->error);
+        return 0;
+    }
+}
+
+// ============================================================================
+// Menu
+// ============================================================================
+
+// Read the choice typed at the menu prompt
+// Returns: 1, 0 at the end of input
+static int send_question(char *line, size_t size) {
+    if (fgets(line, size, stdin) == NULL) {
+        return 0;
+    }
+    return 1;
+}
+
+// Carry out the choice in line
+// Returns: 1 to show the menu again, 0 when done
+static int reseve_answer(const char *line) {
+    char filepath[MAX_BUFFER];
+
+    switch (line[0])
+    {
+        case '3' :
+            // Option 3: Ask for file path
+            printf("Enter file path in data directory: ");
+            if (fgets(filepath, sizeof(filepath), stdin) == NULL) {
+                return 0;
+            }
+
+            // Remove newline if present
+            filepath[strcspn(filepath, "\n")] = 0;
+
+            // Option 3 and the path go out together, then the content
+            return ask_file(filepath);
+        case '5' :
+            client_close(conn, 1);
+            return 0 ;
+        default:
+            // Options 1, 2 and 4, ADMIN:... commands, and anything else,
+            // which the server answers with an error
+            return ask(line);
+    }
+}
+
+void run_normal_client() {
+    int run = 1;
+    char line[MAX_BUFFER];
+
+    // Authenticate first
+    if (!authenticate()) {
+        fprintf(stderr, "ERROR: Authentication failed. Disconnecting.\n");
+        return;
+    }
+
+    printf("\n[INFO] Connected to server in NORMAL mode.\n");
+
+    while (run)
+    {
+        printf("\n========================================\n") ;
+        printf("         SERVER MENU\n") ;
+        printf("========================================\n") ;
+        printf("1. Show date and time\n") ;
+        printf("2. List directory files\n") ;
+        printf("3. Display file content (specify path)\n") ;
+        printf("4. Show session elapsed time\n") ;
+        printf("5. Exit\n") ;
+        printf("Admins: ADMIN:LIST[:after[:count]] ADMIN:DELETE:user\n") ;
+        printf("        ADMIN:PASSWD:user:password ADMIN:REVOKE:user\n") ;
+        printf("========================================\n") ;
+        printf("Enter your choice: ") ;
+
+        if (!send_question(line, sizeof(line))) {
+            client_close(conn, 1);
+            break;
+        }
+
+        run = reseve_answer(line) ;
+    }
+}
+
+void run_mono_client() {
+    char line[MAX_BUFFER];
+
+    // Authenticate first
+    if (!authenticate()) {
+        fprintf(stderr, "ERROR: Authentication failed. Disconnecting.\n");
+        return;
+    }
+
+    printf("\n[INFO] Connected to server in MONO mode.\n");
+    printf("[INFO] Single session - make one request and disconnect.\n\n");
+
+    printf("========================================\n") ;
+    printf("         SERVER MENU (MONO)\n") ;
+    printf("========================================\n") ;
+    printf("1. Show date and time\n") ;
+    printf("2. List directory files\n") ;
+    printf("3. Display file content (specify path)\n") ;
+    printf("4. Show session elapsed time\n") ;
+    printf("5. Exit\n") ;
+    printf("========================================\n") ;
+    printf("Enter your choice: ") ;
+
+    if (send_question(line, sizeof(line))) {
+        reseve_answer(line) ;
+    }
+}
+
+// ============================================================================
+// Ping mode
+// ============================================================================
+
+static volatile sig_atomic_t ping_stop = 0;
+
+static void ping_interrupted(int sig) {
+    (void)sig;
+    ping_stop = 1;
+}
+
+// Send one PING and time it
+// Returns: 1 with the times in ns, 0 if the connection failed
+int ping_once(int64_t *rtt, int64_t *server_ns, int64_t *offset) {
+    char message[MAX_BUFFER];
+    ProbeStamp sent, answered, received, replied;
+    long long echoed;
+
+    probe_stamp(&sent);
+    snprintf(message, sizeof(message), "%s%lld", PROBE_PREFIX, (long long)sent.real_ns);
+    if (!client_request(conn, message, strlen(message), CLIENT_FRAME_SHORT, 0, NULL, NULL)) {
+        fprintf(stderr, "ERROR writing to socket: %s\n", conn->error);
+        return 0;
+    }
+    int status = client_wait(conn);
+    probe_stamp(&answered);
+    if (status != CLIENT_OK) {
+        printf("Server closed connection\n");
+        return 0;
+    }
+
+    long long recv_mono, recv_real, send_mono, send_real;
+    if (sscanf(conn->reply, PROBE_REPLY_PREFIX "%lld:%lld:%lld:%lld:%lld",
+               &echoed, &recv_mono, &recv_real, &send_mono, &send_real) != 5 ||
+        echoed != sent.real_ns) {
+        fprintf(stderr, "[PING] Unexpected reply: %s\n", conn->reply);
+        return 0;
+    }
+    received.mono_ns = recv_mono;
+    received.real_ns = recv_real;
+    replied.mono_ns = send_mono;
+    replied.real_ns = send_real;
+
+    *rtt = answered.mono_ns - sent.mono_ns;
+    *server_ns = replied.mono_ns - received.mono_ns;
+    // NTP estimate: how far the server's realtime clock is ahead of ours
+    *offset = ((received.real_ns - sent.real_ns) + (replied.real_ns - answered.real_ns)) / 2;
+    return 1;
+}
+
+// Probe the server every interval_ms until count probes (0 = until Ctrl-C)
+void run_ping_client(int interval_ms, int count) {
+    if (!authenticate()) {
+        fprintf(stderr, "ERROR: Authentication failed. Disconnecting.\n");
+        return;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ping_interrupted;
+    sigaction(SIGINT, &sa, NULL);
+
+    printf("\n[PING] Probing every %d ms, Ctrl-C to stop\n", interval_ms);
+    printf("%6s %10s %10s %10s %11s\n", "seq", "rtt ms", "server ms", "network ms", "offset ms");
+
+    int sent = 0, answered = 0;
+    int64_t rtt_min = INT64_MAX, rtt_max = 0, rtt_sum = 0, server_sum = 0, best_offset = 0;
+    while (!ping_stop && (count == 0 || sent < count)) {
+        int64_t rtt, server_ns, offset;
+        sent++;
+        if (!ping_once(&rtt, &server_ns, &offset)) {
+            break;
+        }
+        answered++;
+        printf("%6d %10.3f %10.3f %10.3f %+11.3f\n", sent, rtt / 1e6, server_ns / 1e6,
+               (rtt - server_ns) / 1e6, offset / 1e6);
+        fflush(stdout);
+
+        // The fastest round trip has the least queueing in it
+        if (rtt < rtt_min) {
+            rtt_min = rtt;
+            best_offset = offset;
+        }
+        if (rtt > rtt_max) {
+            rtt_max = rtt;
+        }
+        rtt_sum += rtt;
+        server_sum += server_ns;
+
+        if (!ping_stop && (count == 0 || sent < count)) {
+            usleep(interval_ms * 1000);
+        }
+    }
+
+    printf("\n[PING] %d probes, %d answered\n", sent, answered);
+    if (answered > 0) {
+        printf("[PING] rtt min/avg/max %.3f/%.3f/%.3f ms, server avg %.3f ms, offset %+.3f ms\n",
+               rtt_min / 1e6, rtt_sum / 1e6 / answered, rtt_max / 1e6,
+               server_sum / 1e6 / answered, best_offset / 1e6);
+    }
+
+    client_close(conn, 1);
+}
+
+// ============================================================================
+// Main
+// ============================================================================
 
 int main(int argc, char *argv[])
 {
-    int run = 1;
-    
     if (argc < 3) {
        fprintf(stderr,"usage %s hostname port\n", argv[0]);
+       fprintf(stderr,"      %s hostname port ping [interval_ms] [count]\n", argv[0]);
        exit(0);
     }
-    portno = atoi(argv[2]);
-
-    // 1. Create a socket
-    new_socket(argv[1]) ;
 
-    socket_init(portno) ;
-
-    // 2. Connect to the server
-    connect_server() ;
+    // 1. Connect to the server
+    if (!connect_server(argv[1], atoi(argv[2]))) {
+        exit(1);
+    }
 
-    // 3. Communicate with normal client mode
-    run_normal_client();
+    // 2. Communicate with normal client mode, or measure latency
+    if (argc > 3 && strcmp(argv[3], "ping") == 0) {
+        int interval_ms = (argc > 4) ? atoi(argv[4]) : PING_INTERVAL_MS;
+        int count = (argc > 5) ? atoi(argv[5]) : 0;
+        run_ping_client(interval_ms > 0 ? interval_ms : PING_INTERVAL_MS, count);
+    } else {
+        run_normal_client();
+    }
 
     close_connection() ;
     return 0;
@@ -0,0 +1,760 @@
+#include "clientlib.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+
+#define CLIENT_MAX_EVENTS 256
+
+// Each connection has two timers in the wheel
+#define TIMER_DEADLINE 0       // 2 * id: deadline of the operation in flight
+#define TIMER_CALLER 1         // 2 * id + 1: client_timer()
+
+#define OP_NONE 0
+#define OP_CONNECT 1
+#define OP_HANDSHAKE 2
+#define OP_REQUEST 3
+#define OP_FILE 4
+
+typedef struct {
+    int fd;
+    ClientWatchFn fn;
+    void *ctx;
+} ClientWatch;
+
+struct ClientLoop {
+    int epoll_fd;
+    int capacity;
+    ClientConn *conns;
+    int *free_slots;
+    int free_count;
+    TimerWheel *timers;                 // Ticks are ms since start_us
+    long long start_us;
+    ClientWatch watches[CLIENT_MAX_WATCHES];
+    int watch_count;
+    char buffer[CLIENT_CHUNK];          // Every recv() lands here
+};
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+long long client_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// First tick at or after at_us
+static uint64_t tick_at(const ClientLoop *loop, long long at_us) {
+    long long since = at_us - loop->start_us;
+    return since <= 0 ? 0 : (uint64_t)((since + 999) / 1000);
+}
+
+static void set_deadline(ClientConn *c, int ms) {
+    if (ms <= 0) {
+        timerwheel_cancel(c->loop->timers, 2 * c->id + TIMER_DEADLINE);
+        return;
+    }
+    timerwheel_schedule(c->loop->timers, 2 * c->id + TIMER_DEADLINE,
+                        tick_at(c->loop, client_now_us() + ms * 1000LL));
+}
+
+static void set_events(ClientConn *c, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)c->generation << 32) | (uint32_t)c->id;
+    epoll_ctl(c->loop->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void close_socket(ClientConn *c) {
+    if (c->fd >= 0) {
+        epoll_ctl(c->loop->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->state = CLIENT_CLOSED;
+    c->logged_in = 0;
+}
+
+static void clear_op(ClientConn *c) {
+    timerwheel_cancel(c->loop->timers, 2 * c->id + TIMER_DEADLINE);
+    if (c->paused && c->fd >= 0) {
+        set_events(c, EPOLLIN);
+    }
+    c->op = OP_NONE;
+    c->on_done = NULL;
+    c->on_data = NULL;
+    c->cancelled = 0;
+    c->paused = 0;
+    c->pending_len = 0;
+}
+
+static void start_op(ClientConn *c, int op, int frame, size_t expected,
+                     ClientDataFn on_data, ClientDoneFn on_done) {
+    c->op = op;
+    c->frame = frame;
+    c->expected = expected;
+    c->on_data = on_data;
+    c->on_done = on_done;
+    c->cancelled = 0;
+    c->paused = 0;
+    c->head_len = 0;
+    c->drained = 0;
+    c->received = 0;
+    c->reply_len = 0;
+    c->error[0] = '\0';
+    c->status = CLIENT_OK;
+    c->state = CLIENT_BUSY;
+}
+
+// End the operation in flight and hand its outcome to on_done
+static void finish(ClientConn *c, int status) {
+    ClientDoneFn done = c->on_done;
+    int short_answer = (c->frame == CLIENT_FRAME_SHORT && c->reply_len > 0);
+    clear_op(c);
+    c->status = status;
+    if (c->fd >= 0) {
+        c->state = CLIENT_IDLE;
+    }
+    if (done != NULL) {
+        done(c, status, short_answer ? c->reply : NULL, short_answer ? c->reply_len : c->received);
+    }
+}
+
+// Close the connection and end the operation with CLIENT_ERROR
+static void fail(ClientConn *c, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(c->error, sizeof(c->error), format, args);
+    va_end(args);
+    close_socket(c);
+    finish(c, CLIENT_ERROR);
+}
+
+static int ready(ClientConn *c) {
+    if (c->state == CLIENT_IDLE) {
+        return 1;
+    }
+    snprintf(c->error, sizeof(c->error), "%s",
+             c->state == CLIENT_CLOSED ? "Not connected" : "Request already in flight");
+    return 0;
+}
+
+// Requests are small and go out on an idle socket, so one send() normally
+// takes all of it. Closes the connection on failure
+static int send_all(ClientConn *c, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            snprintf(c->error, sizeof(c->error), "Connection lost: %s",
+                     errno == EAGAIN ? "server not reading" : strerror(errno));
+            close_socket(c);
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// The file name goes out on its own, the server reads it with a separate read()
+static void send_name(ClientConn *c) {
+    size_t len = c->pending_len;
+    c->pending_len = 0;
+    if (!send_all(c, c->pending, len)) {
+        finish(c, CLIENT_ERROR);
+        return;
+    }
+    c->sent_us = client_now_us();
+    set_deadline(c, c->reply_timeout_ms);
+}
+
+// A streamed answer is over: all expected bytes, silence, or the server closed
+static void end_stream(ClientConn *c) {
+    if (c->cancelled) {
+        finish(c, CLIENT_CANCELLED);
+        return;
+    }
+    size_t missing = strlen(CLIENT_MISSING_FILE);
+    if (c->op == OP_FILE && c->received == missing && c->head_len == missing &&
+        memcmp(c->head, CLIENT_MISSING_FILE, missing) == 0) {
+        snprintf(c->error, sizeof(c->error), "File does not exist");
+        finish(c, CLIENT_REJECTED);
+        return;
+    }
+    finish(c, CLIENT_OK);
+}
+
+static void handshake_reply(ClientConn *c) {
+    if (strncmp(c->reply, "AUTH_OK", 7) == 0) {
+        const char *token = strchr(c->reply, ':');
+        snprintf(c->token, sizeof(c->token), "%s", token != NULL ? token + 1 : "");
+        c->logged_in = 1;
+        finish(c, CLIENT_OK);
+        return;
+    }
+    if (strncmp(c->reply, "AUTH_FAILED", 11) == 0) {
+        const char *reason = strchr(c->reply, ':');
+        snprintf(c->error, sizeof(c->error), "%s", reason != NULL ? reason + 1 : c->reply);
+        // The server keeps the connection open after a failed RESUME only,
+        // for a login with the password
+        if (!c->resuming) {
+            close_socket(c);
+        }
+        finish(c, CLIENT_REJECTED);
+        return;
+    }
+    fail(c, "Unexpected server response: %.60s", c->reply);
+}
+
+static void conn_connected(ClientConn *c) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    if (err != 0) {
+        fail(c, "Cannot connect: %s", strerror(err));
+        return;
+    }
+    set_events(c, EPOLLIN);
+    finish(c, CLIENT_OK);
+}
+
+static void conn_readable(ClientConn *c) {
+    ClientLoop *loop = c->loop;
+    ssize_t n = recv(c->fd, loop->buffer, sizeof(loop->buffer), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        int lost = (n < 0) ? errno : 0;
+        int streaming = (c->state == CLIENT_BUSY && c->frame != CLIENT_FRAME_SHORT &&
+                         c->pending_len == 0 && c->received + c->drained > 0);
+        close_socket(c);
+        if (streaming) {
+            end_stream(c);
+        } else if (c->op != OP_NONE && lost != 0) {
+            fail(c, "Connection lost: %s", strerror(lost));
+        } else if (c->op != OP_NONE) {
+            fail(c, "Server closed the connection");
+        }
+        return;
+    }
+    c->last_byte_us = client_now_us();
+
+    // Nothing asked (or the file name not sent yet): stray bytes are dropped
+    if (c->state != CLIENT_BUSY || c->pending_len > 0) {
+        return;
+    }
+
+    if (c->frame == CLIENT_FRAME_SHORT) {
+        if (c->reply == NULL && (c->reply = malloc(CLIENT_REPLY_MAX + 1)) == NULL) {
+            fail(c, "Out of memory");
+            return;
+        }
+        size_t keep = (size_t)n < CLIENT_REPLY_MAX ? (size_t)n : CLIENT_REPLY_MAX;
+        memcpy(c->reply, loop->buffer, keep);
+        c->reply[keep] = '\0';
+        c->reply_len = keep;
+        c->received = keep;
+        if (c->op == OP_HANDSHAKE) {
+            handshake_reply(c);
+        } else {
+            finish(c, CLIENT_OK);
+        }
+        return;
+    }
+
+    if (c->cancelled) {
+        c->drained += n;
+    } else {
+        if (c->head_len < sizeof(c->head) - 1) {
+            size_t take = sizeof(c->head) - 1 - c->head_len;
+            take = (size_t)n < take ? (size_t)n : take;
+            memcpy(c->head + c->head_len, loop->buffer, take);
+            c->head_len += take;
+        }
+        c->received += n;
+        if (c->on_data != NULL) {
+            int op = c->op;
+            c->on_data(c, loop->buffer, n);
+            // Closed, freed or finished from the callback
+            if (c->state != CLIENT_BUSY || c->op != op) {
+                return;
+            }
+        }
+    }
+
+    if (c->frame == CLIENT_FRAME_SIZED && c->received + c->drained >= c->expected) {
+        end_stream(c);
+        return;
+    }
+    if (!c->paused) {
+        set_deadline(c, c->quiet_ms);
+    }
+}
+
+static void deadline_passed(ClientConn *c) {
+    if (c->op == OP_CONNECT) {
+        fail(c, "Connection timed out");
+        return;
+    }
+    if (c->state != CLIENT_BUSY) {
+        return;
+    }
+    if (c->op == OP_FILE && c->pending_len > 0) {
+        send_name(c);
+        return;
+    }
+    if (c->received + c->drained == 0) {
+        fail(c, "No answer from server");
+        return;
+    }
+    end_stream(c);
+}
+
+static void timer_fired(int timer, void *ctx) {
+    ClientLoop *loop = (ClientLoop *)ctx;
+    ClientConn *c = &loop->conns[timer / 2];
+    if (timer % 2 == TIMER_DEADLINE) {
+        deadline_passed(c);
+        return;
+    }
+    ClientTimerFn fn = c->on_timer;
+    c->on_timer = NULL;
+    if (fn != NULL) {
+        fn(c);
+    }
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int client_resolve(const char *host, int port, ClientAddr *out) {
+    struct addrinfo hints;
+    struct addrinfo *found = NULL;
+    char service[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &found) != 0 || found == NULL) {
+        return 0;
+    }
+    // localhost may list ::1 first, the server listens on IPv4
+    const struct addrinfo *pick = found;
+    for (const struct addrinfo *ai = found; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            pick = ai;
+            break;
+        }
+    }
+    memset(out, 0, sizeof(*out));
+    memcpy(&out->addr, pick->ai_addr, pick->ai_addrlen);
+    out->len = pick->ai_addrlen;
+    freeaddrinfo(found);
+    return 1;
+}
+
+void client_set_port(ClientAddr *addr, int port) {
+    if (addr->addr.ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)&addr->addr)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in *)&addr->addr)->sin_port = htons(port);
+    }
+}
+
+void client_auth_message(char *out, size_t size, const char *command,
+                         const char *user, const char *secret) {
+    snprintf(out, size, "%s:%s:%s", command, user, secret);
+}
+
+ClientLoop *client_loop_new(int capacity) {
+    ClientLoop *loop = calloc(1, sizeof(ClientLoop));
+    if (loop == NULL) {
+        return NULL;
+    }
+    loop->capacity = capacity;
+    loop->conns = calloc(capacity, sizeof(ClientConn));
+    loop->free_slots = calloc(capacity, sizeof(int));
+    loop->timers = calloc(1, timerwheel_size(2 * capacity));
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->conns == NULL || loop->free_slots == NULL || loop->timers == NULL ||
+        loop->epoll_fd < 0) {
+        client_loop_free(loop);
+        return NULL;
+    }
+
+    loop->start_us = client_now_us();
+    timerwheel_init(loop->timers, 2 * capacity, 0);
+    for (int i = capacity - 1; i >= 0; i--) {
+        loop->conns[i].loop = loop;
+        loop->conns[i].id = i;
+        loop->conns[i].fd = -1;
+        loop->free_slots[loop->free_count++] = i;
+    }
+    return loop;
+}
+
+void client_loop_free(ClientLoop *loop) {
+    if (loop == NULL) {
+        return;
+    }
+    if (loop->conns != NULL) {
+        for (int i = 0; i < loop->capacity; i++) {
+            if (loop->conns[i].fd >= 0) {
+                close(loop->conns[i].fd);
+            }
+            free(loop->conns[i].reply);
+        }
+    }
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    free(loop->conns);
+    free(loop->free_slots);
+    free(loop->timers);
+    free(loop);
+}
+
+int client_watch(ClientLoop *loop, int fd, ClientWatchFn fn, void *ctx) {
+    if (loop->watch_count == CLIENT_MAX_WATCHES) {
+        return 0;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)(loop->capacity + loop->watch_count);
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        return 0;
+    }
+    ClientWatch *watch = &loop->watches[loop->watch_count++];
+    watch->fd = fd;
+    watch->fn = fn;
+    watch->ctx = ctx;
+    return 1;
+}
+
+int client_poll(ClientLoop *loop, long long until_us) {
+    // Sleep until the earlier of until_us and the wheel's next work
+    long long now = client_now_us();
+    long long wake_at = until_us;
+    int64_t ticks = timerwheel_next(loop->timers);
+    if (ticks >= 0) {
+        long long due = loop->start_us + (long long)(loop->timers->now + ticks) * 1000LL;
+        if (due < wake_at) {
+            wake_at = due;
+        }
+    }
+    int timeout = wake_at <= now ? 0 : (int)((wake_at - now + 999) / 1000);
+
+    struct epoll_event events[CLIENT_MAX_EVENTS];
+    int count = epoll_wait(loop->epoll_fd, events, CLIENT_MAX_EVENTS, timeout);
+    if (count < 0 && errno != EINTR) {
+        perror("[CLIENT ERROR] epoll_wait failed");
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint32_t id = (uint32_t)events[i].data.u64;
+        unsigned generation = (unsigned)(events[i].data.u64 >> 32);
+        if (id >= (uint32_t)loop->capacity) {
+            ClientWatch *watch = &loop->watches[id - loop->capacity];
+            watch->fn(watch->ctx);
+            continue;
+        }
+
+        // Skip events of a socket an earlier callback already replaced
+        ClientConn *c = &loop->conns[id];
+        if (c->fd < 0 || c->generation != generation) {
+            continue;
+        }
+        if (c->state == CLIENT_CONNECTING) {
+            conn_connected(c);
+        } else if (!c->paused || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+            conn_readable(c);
+        }
+    }
+
+    uint64_t tick = (uint64_t)((client_now_us() - loop->start_us) / 1000);
+    timerwheel_advance(loop->timers, tick, timer_fired, loop);
+    return 1;
+}
+
+ClientConn *client_conn_new(ClientLoop *loop, void *owner) {
+    if (loop->free_count == 0) {
+        return NULL;
+    }
+    ClientConn *c = &loop->conns[loop->free_slots[--loop->free_count]];
+    char *reply = c->reply;
+    unsigned generation = c->generation;
+    int id = c->id;
+
+    memset(c, 0, sizeof(ClientConn));
+    c->loop = loop;
+    c->id = id;
+    c->in_use = 1;
+    c->generation = generation;
+    c->reply = reply;
+    c->fd = -1;
+    c->owner = owner;
+    c->connect_timeout_ms = CLIENT_CONNECT_TIMEOUT_MS;
+    c->reply_timeout_ms = CLIENT_REPLY_TIMEOUT_MS;
+    c->quiet_ms = CLIENT_QUIET_MS;
+    c->name_gap_ms = CLIENT_NAME_GAP_MS;
+    return c;
+}
+
+void client_conn_free(ClientConn *c) {
+    if (c == NULL || !c->in_use) {
+        return;
+    }
+    client_close(c, 0);
+    client_timer_cancel(c);
+    c->in_use = 0;
+    c->pool_next = NULL;
+    c->loop->free_slots[c->loop->free_count++] = c->id;
+}
+
+int client_connect(ClientConn *c, const ClientAddr *addr, ClientDoneFn on_done) {
+    if (c->state != CLIENT_CLOSED) {
+        snprintf(c->error, sizeof(c->error), "Already connected");
+        return 0;
+    }
+    int fd = socket(addr->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        snprintf(c->error, sizeof(c->error), "Cannot open socket: %s", strerror(errno));
+        return 0;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (const struct sockaddr *)&addr->addr, addr->len) < 0 && errno != EINPROGRESS) {
+        snprintf(c->error, sizeof(c->error), "Cannot connect: %s", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    c->generation++;
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u64 = ((uint64_t)c->generation << 32) | (uint32_t)c->id;
+    if (epoll_ctl(c->loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        snprintf(c->error, sizeof(c->error), "Cannot watch socket: %s", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    c->fd = fd;
+    c->logged_in = 0;
+    c->user[0] = '\0';
+    c->token[0] = '\0';
+    start_op(c, OP_CONNECT, CLIENT_FRAME_SHORT, 0, NULL, on_done);
+    c->state = CLIENT_CONNECTING;
+    set_deadline(c, c->connect_timeout_ms);
+    return 1;
+}
+
+int client_handshake(ClientConn *c, const char *message, ClientDoneFn on_done) {
+    if (!ready(c)) {
+        return 0;
+    }
+
+    // The token will belong to the user in "command:user:secret"
+    const char *user = strchr(message, ':');
+    size_t user_len = 0;
+    if (user != NULL) {
+        user++;
+        user_len = strcspn(user, ":");
+        user_len = user_len < sizeof(c->user) - 1 ? user_len : sizeof(c->user) - 1;
+        memcpy(c->user, user, user_len);
+    }
+    c->user[user_len] = '\0';
+    c->logged_in = 0;
+
+    if (!send_all(c, message, strlen(message))) {
+        return 0;
+    }
+    start_op(c, OP_HANDSHAKE, CLIENT_FRAME_SHORT, 0, NULL, on_done);
+    c->resuming = (strncmp(message, "RESUME:", 7) == 0);
+    c->sent_us = client_now_us();
+    set_deadline(c, c->reply_timeout_ms);
+    return 1;
+}
+
+int client_request(ClientConn *c, const char *data, size_t len, int frame, size_t expected,
+                   ClientDataFn on_data, ClientDoneFn on_done) {
+    if (!ready(c) || !send_all(c, data, len)) {
+        return 0;
+    }
+    start_op(c, OP_REQUEST, frame, expected, on_data, on_done);
+    c->sent_us = client_now_us();
+    set_deadline(c, c->reply_timeout_ms);
+    return 1;
+}
+
+int client_request_file(ClientConn *c, const char *name, size_t expected,
+                        ClientDataFn on_data, ClientDoneFn on_done) {
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len >= sizeof(c->pending)) {
+        snprintf(c->error, sizeof(c->error), "Invalid file name");
+        return 0;
+    }
+    if (!ready(c) || !send_all(c, "3", 1)) {
+        return 0;
+    }
+    if (c->name_gap_ms <= 0 && !send_all(c, name, name_len)) {
+        return 0;
+    }
+
+    start_op(c, OP_FILE, expected > 0 ? CLIENT_FRAME_SIZED : CLIENT_FRAME_QUIET, expected,
+             on_data, on_done);
+    c->sent_us = client_now_us();
+    if (c->name_gap_ms > 0) {
+        memcpy(c->pending, name, name_len);
+        c->pending_len = name_len;
+        set_deadline(c, c->name_gap_ms);
+    } else {
+        set_deadline(c, c->reply_timeout_ms);
+    }
+    return 1;
+}
+
+int client_send(ClientConn *c, const char *data, size_t len) {
+    return ready(c) && send_all(c, data, len);
+}
+
+void client_cancel(ClientConn *c) {
+    if (c->state != CLIENT_BUSY || c->frame == CLIENT_FRAME_SHORT || c->cancelled) {
+        return;
+    }
+    c->cancelled = 1;
+    if (c->paused) {
+        client_pause(c, 0);
+    }
+}
+
+void client_pause(ClientConn *c, int paused) {
+    if (c->state != CLIENT_BUSY || c->frame == CLIENT_FRAME_SHORT || c->paused == !!paused) {
+        return;
+    }
+    c->paused = !!paused;
+    if (c->paused) {
+        set_events(c, 0);
+        timerwheel_cancel(c->loop->timers, 2 * c->id + TIMER_DEADLINE);
+        return;
+    }
+    set_events(c, EPOLLIN);
+    if (c->pending_len > 0) {
+        set_deadline(c, c->name_gap_ms);
+    } else {
+        set_deadline(c, c->received + c->drained > 0 ? c->quiet_ms : c->reply_timeout_ms);
+    }
+}
+
+void client_close(ClientConn *c, int goodbye) {
+    if (goodbye && c->state == CLIENT_IDLE) {
+        send(c->fd, "5", 1, MSG_NOSIGNAL);
+    }
+    clear_op(c);
+    close_socket(c);
+}
+
+void client_timer(ClientConn *c, long long at_us, ClientTimerFn fn) {
+    c->on_timer = fn;
+    timerwheel_schedule(c->loop->timers, 2 * c->id + TIMER_CALLER, tick_at(c->loop, at_us));
+}
+
+void client_timer_cancel(ClientConn *c) {
+    c->on_timer = NULL;
+    timerwheel_cancel(c->loop->timers, 2 * c->id + TIMER_CALLER);
+}
+
+int client_wait(ClientConn *c) {
+    while (c->state == CLIENT_CONNECTING || c->state == CLIENT_BUSY) {
+        if (!client_poll(c->loop, client_now_us() + 1000000LL)) {
+            snprintf(c->error, sizeof(c->error), "Waiting for the server failed");
+            client_close(c, 0);
+            c->status = CLIENT_ERROR;
+        }
+    }
+    return c->status;
+}
+
+// ============================================================================
+// Connection Pool
+// ============================================================================
+
+static ClientConn **pool_bucket(ClientPool *pool, const char *user) {
+    uint32_t hash = 2166136261u;   // FNV-1a
+    for (const char *p = user; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return &pool->buckets[hash % CLIENT_POOL_BUCKETS];
+}
+
+void client_pool_init(ClientPool *pool, int max_idle) {
+    memset(pool, 0, sizeof(ClientPool));
+    pool->max_idle = max_idle;
+}
+
+ClientConn *client_pool_take(ClientPool *pool, const char *user) {
+    ClientConn **link = pool_bucket(pool, user);
+    while (*link != NULL) {
+        ClientConn *c = *link;
+        // Closed by the server while pooled, an idle timeout for example
+        if (c->state != CLIENT_IDLE || !c->logged_in) {
+            *link = c->pool_next;
+            pool->idle--;
+            client_conn_free(c);
+            continue;
+        }
+        if (strcmp(c->user, user) == 0) {
+            *link = c->pool_next;
+            c->pool_next = NULL;
+            pool->idle--;
+            pool->hits++;
+            return c;
+        }
+        link = &c->pool_next;
+    }
+    pool->misses++;
+    return NULL;
+}
+
+void client_pool_give(ClientPool *pool, ClientConn *c) {
+    if (c->state != CLIENT_IDLE || !c->logged_in || pool->idle >= pool->max_idle) {
+        client_close(c, 1);
+        client_conn_free(c);
+        return;
+    }
+    client_timer_cancel(c);
+    c->owner = NULL;
+    ClientConn **bucket = pool_bucket(pool, c->user);
+    c->pool_next = *bucket;
+    *bucket = c;
+    pool->idle++;
+}
+
+void client_pool_drain(ClientPool *pool) {
+    for (int i = 0; i < CLIENT_POOL_BUCKETS; i++) {
+        ClientConn *c = pool->buckets[i];
+        while (c != NULL) {
+            ClientConn *next = c->pool_next;
+            client_close(c, 1);
+            client_conn_free(c);
+            c = next;
+        }
+        pool->buckets[i] = NULL;
+    }
+    pool->idle = 0;
+}
@@ -0,0 +1,296 @@
+#ifndef CLIENTLIB_H
+#define CLIENTLIB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "timerwheel.h"
+
+#define CLIENT_MESSAGE_MAX 256           // Handshake or request sent, as MAX_BUFFER on the server
+#define CLIENT_TOKEN_MAX 180             // Session token in AUTH_OK
+#define CLIENT_USER_MAX 64
+#define CLIENT_REPLY_MAX (64 * 1024)     // Largest short answer kept
+#define CLIENT_CHUNK (64 * 1024)         // Bytes read at once, the most an on_data call gets
+#define CLIENT_CONNECT_TIMEOUT_MS 5000
+#define CLIENT_REPLY_TIMEOUT_MS 10000    // Waiting for the first byte of an answer
+#define CLIENT_QUIET_MS 150              // Silence that ends an answer without a length
+#define CLIENT_NAME_GAP_MS 10            // Between "3" and the file name, read separately by the server
+#define CLIENT_MAX_WATCHES 4
+#define CLIENT_POOL_BUCKETS 256
+#define CLIENT_MISSING_FILE "ERROR: File does not exist"  // Option 3 answer for a missing file
+
+// How an answer ends. The protocol has no length prefix or end marker,
+// the request decides
+#define CLIENT_FRAME_SHORT 0   // One write() on the server, ends with the first read
+#define CLIENT_FRAME_QUIET 1   // Ends when the server has been quiet for quiet_ms or closes
+#define CLIENT_FRAME_SIZED 2   // Ends after expected bytes, or quiet_ms after a shorter one
+
+// Results passed to ClientDoneFn
+#define CLIENT_OK 0
+#define CLIENT_ERROR -1        // Failed, lost or timed out, the connection is closed
+#define CLIENT_REJECTED -2     // AUTH_FAILED (see reply), or the file does not exist
+#define CLIENT_CANCELLED -3    // Answer dropped with client_cancel()
+
+// Connection states
+#define CLIENT_CLOSED 0
+#define CLIENT_CONNECTING 1
+#define CLIENT_IDLE 2          // Connected, nothing in flight
+#define CLIENT_BUSY 3          // Request in flight
+
+/*
+ * Client side of the protocol, shared by the CLI, the GUI and the load
+ * generator.
+ *
+ * A ClientLoop owns an epoll descriptor and up to capacity connections.
+ * Connecting, logging in and requests are non-blocking: each call starts
+ * the operation and returns, and the operation's ClientDoneFn runs from
+ * client_poll() once it finishes. A connection has one operation in
+ * flight at a time, as the server answers in order. Deadlines and
+ * caller timers share one timer wheel (timerwheel.h) with 1 ms ticks.
+ *
+ * The framing of the unframed protocol lives here: how a short answer, a
+ * file and a file of known size end, the pause before a file name, and
+ * which AUTH_FAILED answers keep the connection open.
+ *
+ * Blocking callers run the same path through client_wait(), which polls
+ * until the connection's operation is done.
+ *
+ * Not thread safe, a loop belongs to one thread.
+ */
+
+typedef struct ClientLoop ClientLoop;
+typedef struct ClientConn ClientConn;
+
+/**
+ * The operation in flight on conn finished with status (CLIENT_*).
+ * reply is the short answer, NUL-terminated, or NULL for streamed ones.
+ * The connection may be given a new operation, closed or freed here
+ */
+typedef void (*ClientDoneFn)(ClientConn *conn, int status, const char *reply, size_t len);
+
+/**
+ * Part of a streamed answer, the data is only valid during the call
+ */
+typedef void (*ClientDataFn)(ClientConn *conn, const char *data, size_t len);
+
+typedef void (*ClientTimerFn)(ClientConn *conn);
+typedef void (*ClientWatchFn)(void *ctx);
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t len;
+} ClientAddr;
+
+struct ClientConn {
+    ClientLoop *loop;
+    int id;                             // Slot in the loop
+    int in_use;
+    unsigned generation;                // Socket count, tells a stale epoll event apart
+    int fd;
+    int state;                          // CLIENT_CLOSED / CONNECTING / IDLE / BUSY
+    void *owner;                        // Caller data
+
+    // Limits, set by client_conn_new(), 0 = none
+    int connect_timeout_ms;
+    int reply_timeout_ms;               // Until the first byte of an answer
+    int quiet_ms;                       // Silence that ends CLIENT_FRAME_QUIET / short SIZED answers
+    int name_gap_ms;                    // Between "3" and the file name
+
+    // Operation in flight
+    int op;
+    int frame;                          // CLIENT_FRAME_*
+    size_t expected;                    // CLIENT_FRAME_SIZED
+    ClientDoneFn on_done;
+    ClientDataFn on_data;
+    ClientTimerFn on_timer;
+    int resuming;                       // Handshake is a RESUME
+    int cancelled;
+    int paused;
+    char pending[CLIENT_MESSAGE_MAX];   // File name, sent after name_gap_ms
+    size_t pending_len;
+    char head[sizeof(CLIENT_MISSING_FILE)];  // First bytes of a file
+    size_t head_len;
+    size_t drained;                     // Bytes dropped after a cancel
+
+    // Outcome of the last operation
+    int status;
+    char *reply;                        // Short answer, NUL-terminated
+    size_t reply_len;
+    size_t received;                    // Answer bytes passed on (streamed) or kept (short)
+    long long sent_us;                  // When the request, or its last part, went out
+    long long last_byte_us;
+    char error[128];                    // Why, when status is CLIENT_ERROR
+
+    // Session, set by a successful handshake
+    int logged_in;
+    char user[CLIENT_USER_MAX];
+    char token[CLIENT_TOKEN_MAX];
+
+    struct ClientConn *pool_next;
+};
+
+/*
+ * Logged-in connections kept for reuse, by user. A taken connection
+ * skips the connect and the handshake; connections the server closed
+ * while pooled are dropped when met.
+ */
+typedef struct {
+    ClientConn *buckets[CLIENT_POOL_BUCKETS];
+    int idle;
+    int max_idle;
+    uint64_t hits;
+    uint64_t misses;
+} ClientPool;
+
+/**
+ * Monotonic clock in microseconds
+ */
+long long client_now_us();
+
+/**
+ * Look up host (name or address, IPv4 preferred, then IPv6) and port
+ * Returns: 1 on success, 0 if the host is unknown
+ */
+int client_resolve(const char *host, int port, ClientAddr *out);
+
+/**
+ * Change the port of a resolved address
+ */
+void client_set_port(ClientAddr *addr, int port);
+
+/**
+ * Build "command:user:secret" for client_handshake()
+ */
+void client_auth_message(char *out, size_t size, const char *command,
+                         const char *user, const char *secret);
+
+/**
+ * Create a loop for up to capacity connections
+ * Returns: the loop, NULL on failure
+ */
+ClientLoop *client_loop_new(int capacity);
+
+/**
+ * Close every connection and free the loop
+ */
+void client_loop_free(ClientLoop *loop);
+
+/**
+ * Call fn whenever fd is readable, fn must clear what made it readable
+ * Returns: 1 on success, 0 if there is no room
+ */
+int client_watch(ClientLoop *loop, int fd, ClientWatchFn fn, void *ctx);
+
+/**
+ * Wait for events until until_us at the latest, then run due callbacks
+ * Returns: 1, 0 if waiting failed
+ */
+int client_poll(ClientLoop *loop, long long until_us);
+
+/**
+ * Take a closed connection from the loop
+ * Returns: the connection, NULL if all are in use
+ */
+ClientConn *client_conn_new(ClientLoop *loop, void *owner);
+
+/**
+ * Close conn without calling on_done, and give it back to the loop
+ */
+void client_conn_free(ClientConn *conn);
+
+/**
+ * Start connecting. on_done gets CLIENT_OK once connected
+ * Returns: 1 if started, 0 if it failed at once (on_done is not called)
+ */
+int client_connect(ClientConn *conn, const ClientAddr *addr, ClientDoneFn on_done);
+
+/**
+ * Send an AUTH / REGISTER / RESUME message. CLIENT_OK stores the token
+ * in conn->token, CLIENT_REJECTED passes the AUTH_FAILED answer and
+ * closes the connection, except after a failed RESUME
+ * Returns: 1 if sent, 0 if it failed at once (on_done is not called)
+ */
+int client_handshake(ClientConn *conn, const char *message, ClientDoneFn on_done);
+
+/**
+ * Send a request whose answer ends as frame says. With on_data the
+ * answer is streamed to it, without it a CLIENT_FRAME_SHORT answer is
+ * kept in conn->reply and longer ones are only counted
+ * Returns: 1 if sent, 0 if it failed at once (on_done is not called)
+ */
+int client_request(ClientConn *conn, const char *data, size_t len, int frame, size_t expected,
+                   ClientDataFn on_data, ClientDoneFn on_done);
+
+/**
+ * Option 3: "3", then name after name_gap_ms. The file ends after
+ * expected bytes, or when the server goes quiet if expected is 0.
+ * A missing file completes with CLIENT_REJECTED
+ * Returns: 1 if sent, 0 if it failed at once (on_done is not called)
+ */
+int client_request_file(ClientConn *conn, const char *name, size_t expected,
+                        ClientDataFn on_data, ClientDoneFn on_done);
+
+/**
+ * Send data that has no answer, on an idle connection
+ * Returns: 1 if sent, 0 on failure (the connection is closed)
+ */
+int client_send(ClientConn *conn, const char *data, size_t len);
+
+/**
+ * Drop the rest of the streamed answer in flight. It is still read, so
+ * the connection stays usable, and on_done gets CLIENT_CANCELLED
+ */
+void client_cancel(ClientConn *conn);
+
+/**
+ * Stop (paused = 1) or resume reading a streamed answer, so a slow
+ * consumer holds the server back instead of buffering the answer
+ */
+void client_pause(ClientConn *conn, int paused);
+
+/**
+ * Close conn, leaving with option 5 first when goodbye is set and it is
+ * idle. An operation in flight ends without calling on_done
+ */
+void client_close(ClientConn *conn, int goodbye);
+
+/**
+ * Call fn at at_us, replacing the timer conn had. Separate from the
+ * deadlines of its operations
+ */
+void client_timer(ClientConn *conn, long long at_us, ClientTimerFn fn);
+
+void client_timer_cancel(ClientConn *conn);
+
+/**
+ * Poll until conn has nothing in flight
+ * Returns: the status of its last operation
+ */
+int client_wait(ClientConn *conn);
+
+/**
+ * Empty pool keeping up to max_idle connections
+ */
+void client_pool_init(ClientPool *pool, int max_idle);
+
+/**
+ * Take an idle connection logged in as user
+ * Returns: the connection, NULL if there is none
+ */
+ClientConn *client_pool_take(ClientPool *pool, const char *user);
+
+/**
+ * Keep a logged-in idle connection for reuse. Others, or any when the
+ * pool is full, are closed (option 5) and freed
+ */
+void client_pool_give(ClientPool *pool, ClientConn *conn);
+
+/**
+ * Close (option 5) and free every pooled connection
+ */
+void client_pool_drain(ClientPool *pool);
+
+#endif // CLIENTLIB_H
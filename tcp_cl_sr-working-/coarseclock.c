@@ -0,0 +1,119 @@
+#include "coarseclock.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+typedef struct {
+    uint64_t seq;                    // Odd while the ticker is writing
+    int64_t now;
+    char text[COARSECLOCK_TEXT_MAX];
+} ClockShared;
+
+static ClockShared *shared = NULL;
+static pthread_t ticker_thread;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static void format_local(time_t when, char *out, size_t size) {
+    struct tm tm;
+    localtime_r(&when, &tm);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void publish(time_t now) {
+    char text[COARSECLOCK_TEXT_MAX];
+    format_local(now, text, sizeof(text));
+
+    __atomic_store_n(&shared->seq, shared->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&shared->now, (int64_t)now, __ATOMIC_RELAXED);
+    memcpy(shared->text, text, sizeof(text));
+    __atomic_store_n(&shared->seq, shared->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void *ticker_main(void *arg) {
+    (void)arg;
+    while (1) {
+        // Sleep to just past the next second, then publish it
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        struct timespec wait = { 0, 1000000000L - ts.tv_nsec + COARSECLOCK_SLACK_MS * 1000000L };
+        if (wait.tv_nsec >= 1000000000L) {
+            wait.tv_sec = 1;
+            wait.tv_nsec -= 1000000000L;
+        }
+        nanosleep(&wait, NULL);
+
+        // time() follows the kernel tick and can still be in the old second
+        clock_gettime(CLOCK_REALTIME, &ts);
+        // Picks up TZ or /etc/localtime changes, as localtime() did per request
+        tzset();
+        publish(ts.tv_sec);
+    }
+    return NULL;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int coarseclock_start() {
+    if (shared != NULL) {
+        return 1;
+    }
+    void *map = mmap(NULL, sizeof(ClockShared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("[CLOCK ERROR] Could not map clock page");
+        return 0;
+    }
+    shared = map;
+    tzset();
+    publish(time(NULL));
+
+    if (pthread_create(&ticker_thread, NULL, ticker_main, NULL) != 0) {
+        perror("[CLOCK ERROR] Could not start clock ticker");
+        shared = NULL;
+        munmap(map, sizeof(ClockShared));
+        return 0;
+    }
+    pthread_detach(ticker_thread);
+    return 1;
+}
+
+time_t coarseclock_now() {
+    if (shared == NULL) {
+        return time(NULL);
+    }
+    return (time_t)__atomic_load_n(&shared->now, __ATOMIC_RELAXED);
+}
+
+void coarseclock_datetime(char *out, size_t size) {
+    if (shared == NULL) {
+        format_local(time(NULL), out, size);
+        return;
+    }
+
+    char text[COARSECLOCK_TEXT_MAX];
+    uint64_t before, after;
+    do {
+        before = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        memcpy(text, shared->text, sizeof(text));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    if (size == 0) {
+        return;
+    }
+    size_t len = strnlen(text, sizeof(text) - 1);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(out, text, len);
+    out[len] = '\0';
+}
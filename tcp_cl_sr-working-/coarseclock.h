@@ -0,0 +1,41 @@
+#ifndef COARSECLOCK_H
+#define COARSECLOCK_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define COARSECLOCK_TEXT_MAX 32          // "%Y-%m-%d %H:%M:%S" in local time
+#define COARSECLOCK_SLACK_MS 1           // Wake this long after each second boundary
+
+/*
+ * Coarse wall clock for the request paths: the current second and its
+ * preformatted local date and time, as option 1 answers it.
+ *
+ * A ticker thread in the server process refreshes both right after every
+ * second boundary (running localtime() and strftime() once, off the
+ * request path) into a page shared with forked children. Readers copy
+ * them under a sequence counter, no locks and no system calls. Values
+ * lag the system clock by at most COARSECLOCK_SLACK_MS plus scheduling
+ * delay, well inside the one second resolution they have.
+ *
+ * Until coarseclock_start() runs (and in the tools), the functions read
+ * the system clock directly.
+ */
+
+/**
+ * Map the shared page and start the ticker. Call before fork()
+ * Returns: 1 on success, 0 on failure (callers fall back to time())
+ */
+int coarseclock_start();
+
+/**
+ * Returns: the current time in seconds, like time(NULL)
+ */
+time_t coarseclock_now();
+
+/**
+ * Write the current local date and time as "YYYY-MM-DD HH:MM:SS"
+ */
+void coarseclock_datetime(char *out, size_t size);
+
+#endif // COARSECLOCK_H
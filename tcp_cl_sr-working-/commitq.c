@@ -0,0 +1,238 @@
+#include "commitq.h"
+#include "logger.h"
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// Ring of pending registrations, shared with forked children
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t pending;     // Signalled when entries are queued
+    pthread_cond_t space;       // Signalled when the writer takes a batch
+    pthread_cond_t committed;   // Signalled when a batch is on disk
+    CommitConfig config;
+    int running;
+    int head;                   // Ring index of the oldest pending entry
+    int count;
+    uint64_t next_seq;          // Sequence number of the next submitted entry
+    uint64_t committed_seq;     // Every entry below this has been written
+    CredRecord ring[COMMITQ_CAPACITY];
+} CommitQueue;
+
+static CommitQueue *queue = NULL;
+static pthread_t writer_thread;
+static pid_t writer_pid = 0;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static int env_int(const char *name, int fallback, int min, int max) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    int n = atoi(value);
+    if (n < min || n > max) {
+        log_warn("COMMIT", "Ignoring %s=%s (expected %d-%d)", name, value, min, max);
+        return fallback;
+    }
+    return n;
+}
+
+// Absolute CLOCK_MONOTONIC time ms milliseconds from now
+static struct timespec deadline_after(long ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+void commitq_config_from_env(CommitConfig *config) {
+    config->max_delay_ms = env_int("AUTH_COMMIT_DELAY_MS", COMMITQ_DEFAULT_DELAY_MS, 0, 10000);
+    config->max_batch = env_int("AUTH_COMMIT_BATCH", COMMITQ_DEFAULT_BATCH, 1, COMMITQ_CAPACITY);
+
+    const char *mode = getenv("AUTH_COMMIT_MODE");
+    config->durable = !(mode != NULL && strcmp(mode, "async") == 0);
+}
+
+// ============================================================================
+// Writer Thread
+// ============================================================================
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    CredRecord *batch = malloc(sizeof(CredRecord) * queue->config.max_batch);
+    if (batch == NULL) {
+        log_error("COMMIT", "Out of memory, writer stopped");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->running || queue->count > 0) {
+        while (queue->running && queue->count == 0) {
+            pthread_cond_wait(&queue->pending, &queue->lock);
+        }
+        if (queue->count == 0) {
+            break;
+        }
+
+        // Give the batch max_delay_ms to fill before writing it
+        struct timespec deadline = deadline_after(queue->config.max_delay_ms);
+        while (queue->running && queue->count < queue->config.max_batch) {
+            if (pthread_cond_timedwait(&queue->pending, &queue->lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        int n = queue->count < queue->config.max_batch ? queue->count : queue->config.max_batch;
+        for (int i = 0; i < n; i++) {
+            batch[i] = queue->ring[(queue->head + i) % COMMITQ_CAPACITY];
+        }
+        queue->head = (queue->head + n) % COMMITQ_CAPACITY;
+        queue->count -= n;
+        uint64_t batch_end = queue->committed_seq + n;
+        pthread_cond_broadcast(&queue->space);
+        pthread_mutex_unlock(&queue->lock);
+
+        // One write + fdatasync for the whole batch, duplicates dropped
+        int written = credstore_put_batch(batch, n, 1, 1);
+        if (written < 0) {
+            log_error("COMMIT", "Failed to write %d registrations", n);
+        } else if (written < n) {
+            log_warn("COMMIT", "Dropped %d duplicate registrations", n - written);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        queue->committed_seq = batch_end;
+        pthread_cond_broadcast(&queue->committed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    free(batch);
+    return NULL;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int commitq_start(const CommitConfig *config) {
+    if (queue != NULL) {
+        return 1;
+    }
+
+    queue = mmap(NULL, sizeof(CommitQueue), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (queue == MAP_FAILED) {
+        log_error("COMMIT", "Could not map commit queue: %s", strerror(errno));
+        queue = NULL;
+        return 0;
+    }
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&queue->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->pending, &cattr);
+    pthread_cond_init(&queue->space, &cattr);
+    pthread_cond_init(&queue->committed, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    queue->config = *config;
+    queue->running = 1;
+
+    int err = pthread_create(&writer_thread, NULL, writer_main, NULL);
+    if (err != 0) {
+        log_error("COMMIT", "Could not start writer thread: %s", strerror(err));
+        munmap(queue, sizeof(CommitQueue));
+        queue = NULL;
+        return 0;
+    }
+    writer_pid = getpid();
+
+    printf("[COMMIT] Write-behind enabled (%s, batch %d, delay %d ms)\n",
+           config->durable ? "sync" : "async", config->max_batch, config->max_delay_ms);
+    return 1;
+}
+
+int commitq_active() {
+    return queue != NULL;
+}
+
+int commitq_submit(const CredRecord *record) {
+    if (queue == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->running && queue->count == COMMITQ_CAPACITY) {
+        pthread_cond_wait(&queue->space, &queue->lock);
+    }
+    if (!queue->running) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+
+    queue->ring[(queue->head + queue->count) % COMMITQ_CAPACITY] = *record;
+    queue->count++;
+    uint64_t seq = queue->next_seq++;
+    pthread_cond_signal(&queue->pending);
+
+    if (!queue->config.durable) {
+        pthread_mutex_unlock(&queue->lock);
+        return 1;
+    }
+
+    // Bounded wait so a dead writer process cannot hang the connection
+    struct timespec deadline = deadline_after(COMMITQ_WAIT_TIMEOUT * 1000L);
+    int timed_out = 0;
+    while (queue->committed_seq <= seq && !timed_out) {
+        timed_out = (pthread_cond_timedwait(&queue->committed, &queue->lock, &deadline) == ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    if (timed_out) {
+        log_error("COMMIT", "Timed out waiting for writer");
+        return 0;
+    }
+
+    // The batch may have dropped this entry as a duplicate, so check that
+    // the stored record is ours
+    CredRecord stored;
+    credstore_refresh();
+    if (!credstore_get(record->username, &stored)) {
+        return 0;
+    }
+    return memcmp(stored.salt, record->salt, CREDSTORE_SALT) == 0 ? 1 : -1;
+}
+
+void commitq_stop() {
+    if (queue == NULL) {
+        return;
+    }
+
+    // Only the process that owns the writer flushes and tears down
+    if (getpid() == writer_pid) {
+        pthread_mutex_lock(&queue->lock);
+        queue->running = 0;
+        pthread_cond_broadcast(&queue->pending);
+        pthread_cond_broadcast(&queue->space);
+        pthread_mutex_unlock(&queue->lock);
+        pthread_join(writer_thread, NULL);
+        printf("[COMMIT] Write-behind queue flushed\n");
+    }
+
+    munmap(queue, sizeof(CommitQueue));
+    queue = NULL;
+}
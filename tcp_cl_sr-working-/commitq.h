@@ -0,0 +1,64 @@
+#ifndef COMMITQ_H
+#define COMMITQ_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "credstore.h"
+
+#define COMMITQ_CAPACITY 4096        // Registrations waiting to be written
+#define COMMITQ_DEFAULT_DELAY_MS 5   // Batching window after the first pending entry
+#define COMMITQ_DEFAULT_BATCH 256    // Entries per write + fsync
+#define COMMITQ_WAIT_TIMEOUT 10      // Seconds a durable submit waits for the writer
+
+/*
+ * Write-behind queue for new registrations.
+ *
+ * The queue lives in shared memory, so forked children submit to it and a
+ * single writer thread in the process that started it commits batches with
+ * one write + fdatasync each.
+ *
+ * Durability modes (AUTH_COMMIT_MODE):
+ *   sync   submit returns once the batch holding the entry is on disk
+ *   async  submit returns once the entry is queued. At most the queue
+ *          capacity, buffered for up to max_delay_ms, can be lost on a crash
+ */
+
+typedef struct {
+    int max_delay_ms;   // How long the writer waits for a batch to fill
+    int max_batch;      // Largest batch written at once
+    int durable;        // 1 = ack after fsync, 0 = ack after queueing
+} CommitConfig;
+
+/**
+ * Fill config from AUTH_COMMIT_DELAY_MS, AUTH_COMMIT_BATCH and
+ * AUTH_COMMIT_MODE, using the defaults above for unset values
+ */
+void commitq_config_from_env(CommitConfig *config);
+
+/**
+ * Create the shared queue and start the writer thread. Must be called
+ * before fork() so children share the queue
+ * Returns: 1 on success, 0 on failure
+ */
+int commitq_start(const CommitConfig *config);
+
+/**
+ * Returns: 1 if a queue has been started (in this process or a parent)
+ */
+int commitq_active();
+
+/**
+ * Queue a new user for writing. In sync mode, waits until it is on disk
+ * Returns: 1 on success, 0 on failure, -1 if the user already existed
+ */
+int commitq_submit(const CredRecord *record);
+
+/**
+ * Write everything still queued and stop the writer thread
+ */
+void commitq_stop();
+
+#endif // COMMITQ_H
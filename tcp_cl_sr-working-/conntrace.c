@@ -0,0 +1,352 @@
+#define _GNU_SOURCE                  // sched_getcpu()
+#include "conntrace.h"
+#include "metrics.h"
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+typedef struct {
+    uint64_t seq;            // Claim + 1 once written, 0 while empty or being rewritten
+    uint64_t at_us;          // Start, monotonic
+    uint32_t conn;
+    uint32_t duration_us;
+    uint32_t value;
+    uint8_t stage;           // TRACE_*
+    uint8_t command;         // METRIC_*, 0xff when none
+    uint16_t reserved;
+} TraceSlot;
+
+typedef struct {
+    uint64_t head;           // Slots claimed so far
+    TraceSlot slots[CONNTRACE_RING_EVENTS];
+} __attribute__((aligned(64))) Ring;
+
+typedef struct {
+    long long started_us;
+    uint32_t next_conn;
+    uint32_t sample;         // Trace one connection in sample
+    Ring rings[CONNTRACE_RINGS];
+} TraceShared;
+
+static const char *stage_names[TRACE_STAGES] = {
+    "-", "accept", "auth", "auth_queue", "load_users", "hash", "request", "close"
+};
+
+static TraceShared *shared = NULL;
+
+// Writer of SERVER_TRACE_FILE
+static FILE *trace_file = NULL;
+static pthread_t flush_thread;
+static uint64_t flushed[CONNTRACE_RINGS];   // Next claim to write, per ring
+
+#define NO_COMMAND 0xff
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+long long conntrace_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void record(uint32_t conn, int stage, int command, long long at_us, long long duration_us,
+                   uint32_t value) {
+    if (shared == NULL || conn == 0) {
+        return;
+    }
+    int cpu = sched_getcpu();
+    Ring *ring = &shared->rings[(cpu < 0 ? 0 : cpu) % CONNTRACE_RINGS];
+    uint64_t claim = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    TraceSlot *slot = &ring->slots[claim % CONNTRACE_RING_EVENTS];
+
+    // Readers see seq 0 (skip) until every field is in place
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->at_us = (uint64_t)at_us;
+    slot->conn = conn;
+    slot->duration_us = (duration_us > 0) ? (uint32_t)duration_us : 0;
+    slot->value = value;
+    slot->stage = (uint8_t)stage;
+    slot->command = (command >= 0) ? (uint8_t)command : NO_COMMAND;
+    __atomic_store_n(&slot->seq, claim + 1, __ATOMIC_RELEASE);
+}
+
+// Copy the event of claim out of its slot
+// Returns: 1 if copied, 0 if not written yet, -1 if already overwritten
+static int read_slot(const Ring *ring, uint64_t claim, TraceSlot *out) {
+    const TraceSlot *slot = &ring->slots[claim % CONNTRACE_RING_EVENTS];
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != claim + 1) {
+        return (seq > claim + 1) ? -1 : 0;
+    }
+    memcpy(out, slot, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) ? 1 : -1;
+}
+
+static int by_time(const void *a, const void *b) {
+    const TraceSlot *x = a, *y = b;
+    return (x->at_us > y->at_us) - (x->at_us < y->at_us);
+}
+
+// Copy every readable event out of the rings, in no particular order
+// Returns: number of events in *events (caller frees), -1 on failure
+static int collect(TraceSlot **events) {
+    *events = malloc(sizeof(TraceSlot) * CONNTRACE_RINGS * CONNTRACE_RING_EVENTS);
+    if (*events == NULL) {
+        return -1;
+    }
+    int count = 0;
+    for (int r = 0; r < CONNTRACE_RINGS; r++) {
+        const Ring *ring = &shared->rings[r];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t claim = (head > CONNTRACE_RING_EVENTS) ? head - CONNTRACE_RING_EVENTS : 0;
+        for (; claim < head; claim++) {
+            if (read_slot(ring, claim, &(*events)[count]) == 1) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static void print_event(FILE *fp, const TraceSlot *e) {
+    fprintf(fp, "%.3f %u %s %s %u %u\n",
+            ((long long)e->at_us - shared->started_us) / 1000.0, e->conn,
+            stage_names[e->stage < TRACE_STAGES ? e->stage : 0],
+            e->command == NO_COMMAND ? "-" : metrics_command_name(e->command),
+            e->duration_us, e->value);
+}
+
+static size_t appendf(char *out, size_t size, size_t used, const char *fmt, ...) {
+    if (used >= size) {
+        return used;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + used, size - used, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return used;
+    }
+    return (used + n < size) ? used + n : size - 1;
+}
+
+// ============================================================================
+// Recording
+// ============================================================================
+
+int conntrace_init() {
+    if (shared != NULL) {
+        return 1;
+    }
+    const char *sample_env = getenv("SERVER_TRACE_SAMPLE");
+    int sample = (sample_env != NULL && *sample_env != '\0') ? atoi(sample_env) : 1;
+    if (sample <= 0) {
+        return 1;
+    }
+
+    void *map = mmap(NULL, sizeof(TraceShared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("[TRACE ERROR] Could not map trace rings");
+        return 0;
+    }
+    shared = map;
+    shared->started_us = conntrace_now_us();
+    shared->sample = (uint32_t)sample;
+    return 1;
+}
+
+uint32_t conntrace_connect() {
+    if (shared == NULL) {
+        return 0;
+    }
+    uint32_t conn = __atomic_add_fetch(&shared->next_conn, 1, __ATOMIC_RELAXED);
+    if (conn == 0 || conn % shared->sample != 0) {
+        return 0;
+    }
+    record(conn, TRACE_ACCEPT, -1, conntrace_now_us(), 0, 0);
+    return conn;
+}
+
+void conntrace_span(uint32_t conn, int stage, int command, long long started_us, uint32_t value) {
+    if (conn != 0) {
+        record(conn, stage, command, started_us, conntrace_now_us() - started_us, value);
+    }
+}
+
+void conntrace_span_at(uint32_t conn, int stage, int command, long long started_us,
+                       long long ended_us, uint32_t value) {
+    record(conn, stage, command, started_us, ended_us - started_us, value);
+}
+
+void conntrace_close(uint32_t conn) {
+    if (conn != 0) {
+        record(conn, TRACE_CLOSE, -1, conntrace_now_us(), 0, 0);
+    }
+}
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+// Group spans by stage and command, shortest first within a group
+static int by_group(const void *a, const void *b) {
+    const TraceSlot *x = a, *y = b;
+    int gx = x->stage * 256 + x->command, gy = y->stage * 256 + y->command;
+    if (gx != gy) {
+        return gx - gy;
+    }
+    return (x->duration_us > y->duration_us) - (x->duration_us < y->duration_us);
+}
+
+// The breakdown of collected events, which it reorders by group
+static void breakdown_of(TraceSlot *events, int count, char *out, size_t size) {
+    if (count < 0) {
+        snprintf(out, size, "Tracing is off");
+        return;
+    }
+    qsort(events, count, sizeof(TraceSlot), by_group);
+
+    size_t used = appendf(out, size, 0, "stage       command   count   p50 ms   p99 ms   max ms\n");
+    int start = 0;
+    while (start < count) {
+        int end = start;
+        while (end < count && events[end].stage == events[start].stage &&
+               events[end].command == events[start].command) {
+            end++;
+        }
+        const TraceSlot *e = &events[start];
+        int n = end - start;
+        if (e->stage != TRACE_ACCEPT && e->stage != TRACE_CLOSE) {
+            used = appendf(out, size, used, "%-11s %-8s %6d %8.2f %8.2f %8.2f\n",
+                           stage_names[e->stage < TRACE_STAGES ? e->stage : 0],
+                           e->command == NO_COMMAND ? "-" : metrics_command_name(e->command), n,
+                           events[start + n / 2].duration_us / 1000.0,
+                           events[start + (int)(n * 0.99)].duration_us / 1000.0,
+                           events[end - 1].duration_us / 1000.0);
+        }
+        start = end;
+    }
+    if (used > 0 && out[used - 1] == '\n') {
+        out[used - 1] = '\0';
+    }
+}
+
+void conntrace_breakdown(char *out, size_t size) {
+    TraceSlot *events = NULL;
+    int count = (shared != NULL) ? collect(&events) : -1;
+    breakdown_of(events, count, out, size);
+    free(events);
+}
+
+int conntrace_dump(FILE *fp, char *breakdown, size_t size) {
+    char own[2048];
+    if (breakdown == NULL) {
+        breakdown = own;
+        size = sizeof(own);
+    }
+
+    // One copy of the rings serves the breakdown and the event list
+    TraceSlot *events = NULL;
+    int count = (shared != NULL) ? collect(&events) : -1;
+    breakdown_of(events, count, breakdown, size);
+    fprintf(fp, "# ");
+    for (const char *p = breakdown; *p; p++) {
+        fputc(*p, fp);
+        if (*p == '\n') {
+            fprintf(fp, "# ");
+        }
+    }
+    fprintf(fp, "\n# ms conn stage command duration_us value\n");
+
+    if (count > 0) {
+        qsort(events, count, sizeof(TraceSlot), by_time);
+    }
+    for (int i = 0; i < count; i++) {
+        print_event(fp, &events[i]);
+    }
+    free(events);
+    return count > 0 ? count : 0;
+}
+
+// Append what was recorded since the last pass to trace_file
+static void flush_new_events(TraceSlot *batch) {
+    int count = 0;
+    uint64_t dropped = 0;
+    for (int r = 0; r < CONNTRACE_RINGS; r++) {
+        const Ring *ring = &shared->rings[r];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head - flushed[r] > CONNTRACE_RING_EVENTS) {
+            dropped += head - CONNTRACE_RING_EVENTS - flushed[r];
+            flushed[r] = head - CONNTRACE_RING_EVENTS;
+        }
+        // Stop at a slot still being written, it is picked up next time
+        while (flushed[r] < head) {
+            int got = read_slot(ring, flushed[r], &batch[count]);
+            if (got == 0) {
+                break;
+            }
+            if (got == 1) {
+                count++;
+            } else {
+                dropped++;
+            }
+            flushed[r]++;
+        }
+    }
+
+    qsort(batch, count, sizeof(TraceSlot), by_time);
+    for (int i = 0; i < count; i++) {
+        print_event(trace_file, &batch[i]);
+    }
+    if (dropped > 0) {
+        fprintf(trace_file, "# dropped %llu events\n", (unsigned long long)dropped);
+    }
+    fflush(trace_file);
+}
+
+static void *flush_main(void *arg) {
+    (void)arg;
+    TraceSlot *batch = malloc(sizeof(TraceSlot) * CONNTRACE_RINGS * CONNTRACE_RING_EVENTS);
+    if (batch == NULL) {
+        return NULL;
+    }
+    while (1) {
+        usleep(CONNTRACE_FLUSH_MS * 1000);
+        flush_new_events(batch);
+    }
+    return NULL;
+}
+
+int conntrace_start_file(const char *path) {
+    if (shared == NULL) {
+        fprintf(stderr, "[TRACE] Tracing is off, not writing %s\n", path);
+        return 0;
+    }
+    trace_file = fopen(path, "a");
+    if (trace_file == NULL) {
+        perror("[TRACE ERROR] Could not open trace file");
+        return 0;
+    }
+    fprintf(trace_file, "# ms conn stage command duration_us value\n");
+
+    if (pthread_create(&flush_thread, NULL, flush_main, NULL) != 0) {
+        perror("[TRACE ERROR] Could not start trace writer");
+        fclose(trace_file);
+        trace_file = NULL;
+        return 0;
+    }
+    pthread_detach(flush_thread);
+    printf("[TRACE] Writing connection stages to %s\n", path);
+    return 1;
+}
@@ -0,0 +1,98 @@
+#ifndef CONNTRACE_H
+#define CONNTRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CONNTRACE_RINGS 16               // Rings, picked by CPU
+#define CONNTRACE_RING_EVENTS 4096       // Events kept per ring, 2 MB in total
+#define CONNTRACE_FLUSH_MS 1000          // How often SERVER_TRACE_FILE is appended to
+#define CONNTRACE_DUMP_FILE "conntrace.txt"  // Written by ADMIN:TRACE
+
+// Stages of a connection
+#define TRACE_ACCEPT 1                   // accept() returned
+#define TRACE_AUTH 2                     // First handshake byte read to reply written, value = 1 if accepted
+#define TRACE_AUTH_QUEUE 3               // Event loop: waiting for a hashing thread
+#define TRACE_LOAD_USERS 4               // load_users() during the handshake
+#define TRACE_HASH 5                     // verify_credentials() or register_user()
+#define TRACE_REQUEST 6                  // Request read to answer written, value = bytes sent
+#define TRACE_CLOSE 7
+#define TRACE_STAGES 8
+
+/*
+ * Connection stage tracing: where the time of each connection went.
+ *
+ * Every stage is an event with a start time on the monotonic clock and a
+ * duration (0 for accept and close), tagged with a connection id and, for
+ * handshakes and requests, the METRIC_* command. A handshake's auth span
+ * contains its auth_queue, load_users and hash spans, so hashing can be
+ * told apart from the rest.
+ *
+ * Events go into rings in shared memory mapped before fork(), one per
+ * CPU shard so concurrent writers rarely share a cache line. A writer
+ * claims a slot with an atomic add and publishes it with a sequence
+ * number, so nothing locks and a reader skips slots being rewritten. The
+ * rings keep the latest events (a flight recorder); older ones are
+ * overwritten.
+ *
+ * SERVER_TRACE_SAMPLE=N traces one connection in N (default 1, 0 turns
+ * tracing off). Traces are read with ADMIN:TRACE (written to
+ * CONNTRACE_DUMP_FILE), from /trace on the metrics endpoint, or streamed
+ * to SERVER_TRACE_FILE by a background thread.
+ */
+
+/**
+ * Map the rings and read SERVER_TRACE_SAMPLE. Call before fork()
+ * Returns: 1 on success (or tracing off), 0 on failure
+ */
+int conntrace_init();
+
+/**
+ * Append new events to path every CONNTRACE_FLUSH_MS from a background thread
+ * Returns: 1 on success, 0 on failure
+ */
+int conntrace_start_file(const char *path);
+
+/**
+ * Returns: microseconds on the monotonic clock, for stage start times
+ */
+long long conntrace_now_us();
+
+/**
+ * Record an accepted connection
+ * Returns: its trace id, 0 when it is not traced
+ */
+uint32_t conntrace_connect();
+
+/**
+ * Record a stage of conn from started_us until now
+ */
+void conntrace_span(uint32_t conn, int stage, int command, long long started_us, uint32_t value);
+
+/**
+ * Record a stage of conn that started and ended at the given times
+ */
+void conntrace_span_at(uint32_t conn, int stage, int command, long long started_us,
+                       long long ended_us, uint32_t value);
+
+/**
+ * Record the end of a connection
+ */
+void conntrace_close(uint32_t conn);
+
+/**
+ * Write p50 / p99 / max per stage (requests per command) over the events
+ * still in the rings
+ */
+void conntrace_breakdown(char *out, size_t size);
+
+/**
+ * Write the breakdown as comments, then every event in the rings, oldest
+ * first. The rings are copied once for both, and the breakdown is also
+ * left in breakdown when it is not NULL
+ * Returns: number of events written
+ */
+int conntrace_dump(FILE *fp, char *breakdown, size_t size);
+
+#endif // CONNTRACE_H
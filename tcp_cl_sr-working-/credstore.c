@@ -0,0 +1,1005 @@
+#include "credstore.h"
+#include "logger.h"
+#include <errno.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#define SLOT_EMPTY 0
+#define SLOT_PUT 1
+#define SLOT_DELETED 2
+
+#define REPLAY_BATCH 256 // Log entries read per pread()
+
+// Changes applied from the log since the last compaction, keyed by username
+typedef struct {
+    CredRecord record;
+    uint8_t state;
+} OverlaySlot;
+
+// Store state (per process, the index mapping is shared across fork)
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int store_open = 0;
+
+static int lock_fd = -1;
+static pid_t lock_pid = 0;
+
+static int log_fd = -1;
+static dev_t log_dev = 0;
+static ino_t log_ino = 0;
+static uint64_t log_generation = 0;
+static off_t log_applied = 0;      // Offset of the first entry not yet applied
+static int log_entries = 0;        // Entries applied since the last compaction
+
+static void *index_map = NULL;
+static size_t index_map_size = 0;
+static const CredRecord *index_records = NULL;
+static size_t index_count = 0;
+static uint64_t index_generation = 0;
+
+static OverlaySlot *overlay = NULL;
+static size_t overlay_capacity = 0;
+static size_t overlay_used = 0;
+
+static size_t live_count = 0;
+
+// ============================================================================
+// Checksums and Hashing
+// ============================================================================
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+// Standard CRC-32 (IEEE 802.3)
+static uint32_t crc32_buf(const void *data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+
+    const unsigned char *p = data;
+    uint32_t c = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        c = crc_table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+static uint32_t entry_crc(const CredLogEntry *entry) {
+    return crc32_buf(&entry->op, offsetof(CredLogEntry, crc) - offsetof(CredLogEntry, op));
+}
+
+static uint32_t index_header_crc(const CredIndexHeader *header) {
+    return crc32_buf(header, offsetof(CredIndexHeader, header_crc));
+}
+
+// FNV-1a over the username
+static uint64_t name_hash(const char *username) {
+    uint64_t h = 1469598103934665603ull;
+    for (int i = 0; i < CREDSTORE_USERNAME && username[i] != '\0'; i++) {
+        h ^= (unsigned char)username[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static int name_cmp(const char *a, const char *b) {
+    return strncmp(a, b, CREDSTORE_USERNAME);
+}
+
+// ============================================================================
+// In-Memory Lookup
+// ============================================================================
+
+static OverlaySlot *overlay_find(const char *username) {
+    if (overlay_capacity == 0) {
+        return NULL;
+    }
+
+    size_t mask = overlay_capacity - 1;
+    for (size_t i = name_hash(username) & mask; ; i = (i + 1) & mask) {
+        if (overlay[i].state == SLOT_EMPTY) {
+            return NULL;
+        }
+        if (name_cmp(overlay[i].record.username, username) == 0) {
+            return &overlay[i];
+        }
+    }
+}
+
+static int overlay_grow() {
+    size_t new_capacity = overlay_capacity ? overlay_capacity * 2 : 64;
+    OverlaySlot *slots = calloc(new_capacity, sizeof(OverlaySlot));
+    if (slots == NULL) {
+        return 0;
+    }
+
+    size_t mask = new_capacity - 1;
+    for (size_t j = 0; j < overlay_capacity; j++) {
+        if (overlay[j].state == SLOT_EMPTY) {
+            continue;
+        }
+        size_t i = name_hash(overlay[j].record.username) & mask;
+        while (slots[i].state != SLOT_EMPTY) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = overlay[j];
+    }
+
+    free(overlay);
+    overlay = slots;
+    overlay_capacity = new_capacity;
+    return 1;
+}
+
+// Find the slot for username, claiming an empty one if needed
+static OverlaySlot *overlay_slot(const char *username) {
+    OverlaySlot *slot = overlay_find(username);
+    if (slot != NULL) {
+        return slot;
+    }
+
+    // Keep the load factor under 3/4
+    if ((overlay_used + 1) * 4 > overlay_capacity * 3 && !overlay_grow()) {
+        return NULL;
+    }
+
+    size_t mask = overlay_capacity - 1;
+    size_t i = name_hash(username) & mask;
+    while (overlay[i].state != SLOT_EMPTY) {
+        i = (i + 1) & mask;
+    }
+    overlay_used++;
+    return &overlay[i];
+}
+
+static const CredRecord *index_find(const char *username) {
+    size_t lo = 0, hi = index_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = name_cmp(index_records[mid].username, username);
+        if (cmp == 0) {
+            return &index_records[mid];
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Current record for username: overlay first, then the index
+static const CredRecord *lookup(const char *username) {
+    OverlaySlot *slot = overlay_find(username);
+    if (slot != NULL) {
+        return (slot->state == SLOT_PUT) ? &slot->record : NULL;
+    }
+    return index_find(username);
+}
+
+static int apply_entry(const CredLogEntry *entry) {
+    int existed = (lookup(entry->record.username) != NULL);
+    OverlaySlot *slot = overlay_slot(entry->record.username);
+    if (slot == NULL) {
+        log_error("STORE", "Out of memory applying log entry");
+        return 0;
+    }
+
+    slot->record = entry->record;
+    if (entry->op == CRED_OP_PUT) {
+        slot->state = SLOT_PUT;
+        if (!existed) {
+            live_count++;
+        }
+    } else {
+        slot->state = SLOT_DELETED;
+        if (existed) {
+            live_count--;
+        }
+    }
+    log_entries++;
+    return 1;
+}
+
+// ============================================================================
+// File Handling
+// ============================================================================
+
+// Take the cross-process store lock (reopened after fork, since flock
+// locks are shared by every copy of the descriptor)
+static int lock_store(int operation) {
+    if (lock_fd < 0 || lock_pid != getpid()) {
+        if (lock_fd >= 0) {
+            close(lock_fd);
+        }
+        lock_fd = open(CREDSTORE_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lock_fd < 0) {
+            log_error("STORE", "Could not open lock file: %s", strerror(errno));
+            return 0;
+        }
+        lock_pid = getpid();
+    }
+
+    while (flock(lock_fd, operation) != 0) {
+        if (errno != EINTR) {
+            log_error("STORE", "Could not lock store: %s", strerror(errno));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void unlock_store() {
+    flock(lock_fd, LOCK_UN);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static void sync_data_dir() {
+    int dir_fd = open("data", O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+// Write a file next to path and rename it into place
+static int replace_file(const char *path, const void *head, size_t head_len,
+                        const void *body, size_t body_len) {
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_error("STORE", "Could not create temporary file: %s", strerror(errno));
+        return 0;
+    }
+
+    int ok = write_all(fd, head, head_len) &&
+             (body_len == 0 || write_all(fd, body, body_len)) &&
+             fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        log_error("STORE", "Could not write store file: %s", strerror(errno));
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static int write_empty_log(uint64_t generation) {
+    CredLogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CRED_LOG_MAGIC;
+    header.version = CRED_VERSION;
+    header.generation = generation;
+    return replace_file(CREDSTORE_LOG_FILE, &header, sizeof(header), NULL, 0);
+}
+
+static void close_files() {
+    if (index_map != NULL) {
+        munmap(index_map, index_map_size);
+    }
+    index_map = NULL;
+    index_map_size = 0;
+    index_records = NULL;
+    index_count = 0;
+    index_generation = 0;
+
+    if (log_fd >= 0) {
+        close(log_fd);
+    }
+    log_fd = -1;
+    log_applied = 0;
+    log_entries = 0;
+
+    free(overlay);
+    overlay = NULL;
+    overlay_capacity = 0;
+    overlay_used = 0;
+    live_count = 0;
+}
+
+static int map_index() {
+    int fd = open(CREDSTORE_INDEX_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 1; // No index yet, everything is in the log
+        }
+        log_error("STORE", "Could not open index: %s", strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CredIndexHeader)) {
+        log_error("STORE", "Index file is truncated");
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("STORE", "Could not map index: %s", strerror(errno));
+        return 0;
+    }
+
+    const CredIndexHeader *header = map;
+    const CredRecord *records = (const CredRecord *)((const char *)map + sizeof(CredIndexHeader));
+    size_t expected = sizeof(CredIndexHeader) + header->count * sizeof(CredRecord);
+    if (header->magic != CRED_INDEX_MAGIC || header->version != CRED_VERSION ||
+        header->header_crc != index_header_crc(header) ||
+        expected != (size_t)st.st_size ||
+        header->records_crc != crc32_buf(records, header->count * sizeof(CredRecord))) {
+        log_error("STORE", "Index file is corrupt");
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    index_map = map;
+    index_map_size = st.st_size;
+    index_records = records;
+    index_count = header->count;
+    index_generation = header->generation;
+    return 1;
+}
+
+// Apply every complete, valid entry past log_applied
+static int replay_log() {
+    struct stat st;
+    if (fstat(log_fd, &st) != 0) {
+        return 0;
+    }
+
+    CredLogEntry batch[REPLAY_BATCH];
+    while (log_applied + (off_t)sizeof(CredLogEntry) <= st.st_size) {
+        ssize_t n = pread(log_fd, batch, sizeof(batch), log_applied);
+        if (n < (ssize_t)sizeof(CredLogEntry)) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        int complete = n / sizeof(CredLogEntry);
+        for (int i = 0; i < complete; i++) {
+            const CredLogEntry *entry = &batch[i];
+            int valid = entry->magic == CRED_ENTRY_MAGIC &&
+                        (entry->op == CRED_OP_PUT || entry->op == CRED_OP_DELETE) &&
+                        entry->crc == entry_crc(entry);
+            if (!valid) {
+                // A bad last entry may still be being written, retry later
+                if (log_applied + (off_t)sizeof(CredLogEntry) >= st.st_size) {
+                    return 1;
+                }
+                log_error("STORE", "Skipping corrupt log entry at offset %lld",
+                          (long long)log_applied);
+            } else if (!apply_entry(entry)) {
+                return 0;
+            }
+            log_applied += sizeof(CredLogEntry);
+        }
+    }
+    return 1;
+}
+
+// Map the index and replay the log, caller holds the exclusive lock
+static int open_files_locked() {
+    close_files();
+
+    if (!map_index()) {
+        return 0;
+    }
+
+    log_fd = open(CREDSTORE_LOG_FILE, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (log_fd < 0 && errno == ENOENT) {
+        if (!write_empty_log(index_generation ? index_generation : 1)) {
+            return 0;
+        }
+        log_fd = open(CREDSTORE_LOG_FILE, O_RDWR | O_APPEND | O_CLOEXEC);
+    }
+    if (log_fd < 0) {
+        log_error("STORE", "Could not open log: %s", strerror(errno));
+        return 0;
+    }
+
+    CredLogHeader header;
+    if (pread(log_fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != CRED_LOG_MAGIC || header.version != CRED_VERSION) {
+        log_error("STORE", "Log file has a bad header");
+        return 0;
+    }
+
+    if (header.generation < index_generation) {
+        // Compaction stopped after installing the index: the old log is
+        // already folded in, start the matching empty one
+        close(log_fd);
+        log_fd = -1;
+        if (!write_empty_log(index_generation)) {
+            return 0;
+        }
+        return open_files_locked();
+    }
+    if (header.generation > index_generation && index_map != NULL) {
+        log_error("STORE", "Log is newer than index, replaying both");
+    }
+
+    struct stat st;
+    fstat(log_fd, &st);
+    log_dev = st.st_dev;
+    log_ino = st.st_ino;
+    log_generation = header.generation;
+    log_applied = sizeof(CredLogHeader);
+    live_count = index_count;
+
+    return replay_log();
+}
+
+// Bring this process up to date with the files on disk
+static int sync_files(int locked) {
+    struct stat st;
+    if (stat(CREDSTORE_LOG_FILE, &st) == 0 && st.st_dev == log_dev && st.st_ino == log_ino) {
+        // Same log: only apply what was appended (one stat when unchanged)
+        return (st.st_size > log_applied) ? replay_log() : 1;
+    }
+
+    // Log was replaced by a compaction, remap everything
+    if (!locked && !lock_store(LOCK_EX)) {
+        return 0;
+    }
+    int ok = open_files_locked();
+    if (!locked) {
+        unlock_store();
+    }
+    return ok;
+}
+
+// Append entries, caller holds the exclusive lock and is in sync
+static int write_entries_locked(const CredLogEntry *entries, int count, int sync) {
+    struct stat st;
+    if (fstat(log_fd, &st) != 0) {
+        return 0;
+    }
+
+    // Drop a torn entry left by a crash so later entries stay aligned
+    off_t body = st.st_size - sizeof(CredLogHeader);
+    if (body % sizeof(CredLogEntry) != 0) {
+        log_warn("STORE", "Truncating torn log entry");
+        if (ftruncate(log_fd, st.st_size - body % sizeof(CredLogEntry)) != 0) {
+            return 0;
+        }
+    }
+
+    if (!write_all(log_fd, entries, count * sizeof(CredLogEntry))) {
+        log_error("STORE", "Could not append to log: %s", strerror(errno));
+        return 0;
+    }
+    if (sync && fdatasync(log_fd) != 0) {
+        log_error("STORE", "Could not sync log: %s", strerror(errno));
+        return 0;
+    }
+
+    return replay_log();
+}
+
+static int record_cmp(const void *a, const void *b) {
+    return name_cmp(((const CredRecord *)a)->username, ((const CredRecord *)b)->username);
+}
+
+static int slot_cmp(const void *a, const void *b) {
+    return record_cmp(&((const OverlaySlot *)a)->record, &((const OverlaySlot *)b)->record);
+}
+
+// Records of one array by name, then by position so the first one sorts first
+static int record_ptr_cmp(const void *a, const void *b) {
+    const CredRecord *ra = *(const CredRecord *const *)a;
+    const CredRecord *rb = *(const CredRecord *const *)b;
+    int cmp = record_cmp(ra, rb);
+    return cmp != 0 ? cmp : (ra > rb) - (ra < rb);
+}
+
+// Clear skip[i] for the first record of each name and set it for the
+// repeats, in O(n log n) and without the store lock
+static int mark_batch_duplicates(const CredRecord *records, int count, unsigned char *skip) {
+    const CredRecord **sorted = malloc((count ? count : 1) * sizeof(CredRecord *));
+    if (sorted == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        sorted[i] = &records[i];
+    }
+    qsort(sorted, count, sizeof(CredRecord *), record_ptr_cmp);
+
+    memset(skip, 0, count);
+    for (int i = 1; i < count; i++) {
+        if (record_cmp(sorted[i - 1], sorted[i]) == 0) {
+            skip[sorted[i] - records] = 1;
+        }
+    }
+    free(sorted);
+    return 1;
+}
+
+// Merge index and overlay into a new index and start a new log generation
+static int compact_locked() {
+    OverlaySlot *changes = malloc((overlay_used ? overlay_used : 1) * sizeof(OverlaySlot));
+    CredRecord *merged = malloc((index_count + overlay_used + 1) * sizeof(CredRecord));
+    if (changes == NULL || merged == NULL) {
+        free(changes);
+        free(merged);
+        return 0;
+    }
+
+    size_t change_count = 0;
+    for (size_t i = 0; i < overlay_capacity; i++) {
+        if (overlay[i].state != SLOT_EMPTY) {
+            changes[change_count++] = overlay[i];
+        }
+    }
+    qsort(changes, change_count, sizeof(OverlaySlot), slot_cmp);
+
+    // Both inputs are sorted, overlay entries win on equal names
+    size_t i = 0, j = 0, count = 0;
+    while (i < index_count || j < change_count) {
+        int cmp;
+        if (i == index_count) {
+            cmp = 1;
+        } else if (j == change_count) {
+            cmp = -1;
+        } else {
+            cmp = name_cmp(index_records[i].username, changes[j].record.username);
+        }
+
+        if (cmp < 0) {
+            merged[count++] = index_records[i++];
+        } else {
+            if (changes[j].state == SLOT_PUT) {
+                merged[count++] = changes[j].record;
+            }
+            if (cmp == 0) {
+                i++;
+            }
+            j++;
+        }
+    }
+
+    uint64_t generation = (log_generation > index_generation ? log_generation : index_generation) + 1;
+
+    CredIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CRED_INDEX_MAGIC;
+    header.version = CRED_VERSION;
+    header.generation = generation;
+    header.count = count;
+    header.records_crc = crc32_buf(merged, count * sizeof(CredRecord));
+    header.header_crc = index_header_crc(&header);
+
+    // Index first: a crash before the log is replaced leaves an older log
+    // generation, which open_files_locked() recognises as already merged
+    int ok = replace_file(CREDSTORE_INDEX_FILE, &header, sizeof(header),
+                          merged, count * sizeof(CredRecord)) &&
+             write_empty_log(generation);
+    free(changes);
+    free(merged);
+    sync_data_dir();
+
+    if (!ok) {
+        return 0;
+    }
+    log_info("STORE", "Compacted %zu users into index (generation %llu)",
+             count, (unsigned long long)generation);
+    return open_files_locked();
+}
+
+// ============================================================================
+// Legacy Text Import
+// ============================================================================
+
+static int decode_hex(const char *hex, unsigned char *out, size_t len) {
+    if (strlen(hex) != len * 2) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char pair[3] = { hex[i * 2], hex[i * 2 + 1], '\0' };
+        if (!isxdigit((unsigned char)pair[0]) || !isxdigit((unsigned char)pair[1])) {
+            return 0;
+        }
+        out[i] = (unsigned char)strtoul(pair, NULL, 16);
+    }
+    return 1;
+}
+
+static int import_text_locked(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        log_error("STORE", "Could not open text credentials: %s", strerror(errno));
+        return -1;
+    }
+
+    CredLogEntry batch[REPLAY_BATCH];
+    int pending = 0;
+    int imported = 0;
+    char username[CREDSTORE_USERNAME];
+    char hash_hex[CREDSTORE_HASH * 2 + 2];
+    char salt_hex[CREDSTORE_SALT * 2 + 2];
+
+    while (fscanf(fp, "%63s %65s %33s\n", username, hash_hex, salt_hex) == 3) {
+        CredRecord record;
+        memset(&record, 0, sizeof(record));
+        strncpy(record.username, username, CREDSTORE_USERNAME - 1);
+        record.kdf = CRED_KDF_SHA256;
+        if (!decode_hex(hash_hex, record.hash, CREDSTORE_HASH) ||
+            !decode_hex(salt_hex, record.salt, CREDSTORE_SALT)) {
+            log_warn("STORE", "Skipping malformed entry for %s", username);
+            continue;
+        }
+
+        credstore_make_entry(&batch[pending++], CRED_OP_PUT, &record);
+        imported++;
+        if (pending == REPLAY_BATCH) {
+            if (!write_entries_locked(batch, pending, 0)) {
+                fclose(fp);
+                return -1;
+            }
+            pending = 0;
+        }
+    }
+    fclose(fp);
+
+    if (pending > 0 && !write_entries_locked(batch, pending, 0)) {
+        return -1;
+    }
+    if (fdatasync(log_fd) != 0 || !compact_locked()) {
+        return -1;
+    }
+    return imported;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+// Keep store_mutex consistent across fork() when a thread (such as the
+// commit writer) may be inside the store at the time
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void before_fork() {
+    pthread_mutex_lock(&store_mutex);
+}
+
+static void after_fork() {
+    pthread_mutex_unlock(&store_mutex);
+}
+
+static void register_atfork() {
+    pthread_atfork(before_fork, after_fork, after_fork);
+}
+
+void credstore_make_entry(CredLogEntry *entry, int op, const CredRecord *record) {
+    memset(entry, 0, sizeof(*entry));
+    entry->magic = CRED_ENTRY_MAGIC;
+    entry->op = op;
+    entry->record = *record;
+    entry->crc = entry_crc(entry);
+}
+
+int credstore_open() {
+    pthread_once(&atfork_once, register_atfork);
+
+    pthread_mutex_lock(&store_mutex);
+    if (store_open) {
+        pthread_mutex_unlock(&store_mutex);
+        return 1;
+    }
+
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    int fresh = access(CREDSTORE_LOG_FILE, F_OK) != 0 && access(CREDSTORE_INDEX_FILE, F_OK) != 0;
+    int ok = open_files_locked();
+
+    // First start on a tree that still has the text file: convert it
+    if (ok && fresh && access(CREDSTORE_TEXT_FILE, F_OK) == 0) {
+        int imported = import_text_locked(CREDSTORE_TEXT_FILE);
+        if (imported < 0) {
+            ok = 0;
+        } else {
+            printf("[STORE] Imported %d users from %s\n", imported, CREDSTORE_TEXT_FILE);
+        }
+    }
+    unlock_store();
+
+    store_open = ok;
+    if (ok) {
+        printf("[STORE] Opened credential store: %zu users (%zu indexed, %d in log)\n",
+               live_count, index_count, log_entries);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+void credstore_close() {
+    pthread_mutex_lock(&store_mutex);
+    close_files();
+    if (lock_fd >= 0 && lock_pid == getpid()) {
+        close(lock_fd);
+    }
+    lock_fd = -1;
+    store_open = 0;
+    pthread_mutex_unlock(&store_mutex);
+}
+
+int credstore_refresh() {
+    if (!store_open) {
+        return credstore_open();
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    int ok = sync_files(0);
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+int credstore_get(const char *username, CredRecord *out) {
+    pthread_mutex_lock(&store_mutex);
+    const CredRecord *record = lookup(username);
+    if (record != NULL && out != NULL) {
+        *out = *record;
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return record != NULL;
+}
+
+// First index position whose username sorts after the given one
+static size_t index_upper_bound(const char *username) {
+    size_t lo = 0, hi = index_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (name_cmp(index_records[mid].username, username) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int credstore_list(const char *after, CredRecord *out, int max) {
+    if (after == NULL) {
+        after = "";
+    }
+
+    pthread_mutex_lock(&store_mutex);
+
+    // Changes since the last compaction past the cursor, sorted. There are
+    // at most about CREDSTORE_COMPACT_THRESHOLD of them
+    OverlaySlot *changes = malloc((overlay_used ? overlay_used : 1) * sizeof(OverlaySlot));
+    if (changes == NULL) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    size_t m = 0;
+    for (size_t k = 0; k < overlay_capacity; k++) {
+        if (overlay[k].state != SLOT_EMPTY && name_cmp(overlay[k].record.username, after) > 0) {
+            changes[m++] = overlay[k];
+        }
+    }
+    qsort(changes, m, sizeof(OverlaySlot), slot_cmp);
+
+    // Merge with the index from the cursor on, the overlay wins on ties
+    size_t i = index_upper_bound(after);
+    size_t j = 0;
+    int count = 0;
+    while (count < max && (i < index_count || j < m)) {
+        int cmp = (i >= index_count) ? 1 :
+                  (j >= m) ? -1 : name_cmp(index_records[i].username, changes[j].record.username);
+        if (cmp < 0) {
+            out[count++] = index_records[i++];
+            continue;
+        }
+        if (cmp == 0) {
+            i++;
+        }
+        if (changes[j].state == SLOT_PUT) {
+            out[count++] = changes[j].record;
+        }
+        j++;
+    }
+
+    free(changes);
+    pthread_mutex_unlock(&store_mutex);
+    return count;
+}
+
+int credstore_put(const CredRecord *record, int must_be_new) {
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    int result = sync_files(1);
+    if (result && must_be_new && lookup(record->username) != NULL) {
+        result = -1;
+    } else if (result) {
+        CredLogEntry entry;
+        credstore_make_entry(&entry, CRED_OP_PUT, record);
+        result = write_entries_locked(&entry, 1, 0);
+    }
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+int credstore_replace(const CredRecord *expected, const CredRecord *record) {
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    // Another writer may have deleted the user, set a password or revoked
+    // sessions since expected was read
+    int result = sync_files(1);
+    const CredRecord *current = result ? lookup(expected->username) : NULL;
+    if (result && (current == NULL ||
+                   memcmp(current->salt, expected->salt, CREDSTORE_SALT) != 0 ||
+                   memcmp(current->hash, expected->hash, CREDSTORE_HASH) != 0 ||
+                   current->sessions_after != expected->sessions_after)) {
+        result = -1;
+    } else if (result) {
+        CredLogEntry entry;
+        credstore_make_entry(&entry, CRED_OP_PUT, record);
+        result = write_entries_locked(&entry, 1, 0);
+    }
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+int credstore_delete(const char *username) {
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    int result = sync_files(1);
+    const CredRecord *existing = result ? lookup(username) : NULL;
+    if (result && existing == NULL) {
+        result = -1;
+    } else if (result) {
+        CredLogEntry entry;
+        credstore_make_entry(&entry, CRED_OP_DELETE, existing);
+        result = write_entries_locked(&entry, 1, 0);
+    }
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+int credstore_put_batch(const CredRecord *records, int count, int must_be_new, int sync) {
+    CredLogEntry *entries = malloc((count ? count : 1) * sizeof(CredLogEntry));
+    unsigned char *skip = malloc(count ? count : 1);
+    if (entries == NULL || skip == NULL ||
+        (must_be_new && !mark_batch_duplicates(records, count, skip))) {
+        free(entries);
+        free(skip);
+        return -1;
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        free(entries);
+        free(skip);
+        return -1;
+    }
+
+    // Repeats within the batch are already marked, only the store is searched
+    int written = sync_files(1) ? 0 : -1;
+    for (int i = 0; written >= 0 && i < count; i++) {
+        if (must_be_new && (skip[i] || lookup(records[i].username) != NULL)) {
+            continue;
+        }
+        credstore_make_entry(&entries[written++], CRED_OP_PUT, &records[i]);
+    }
+
+    if (written > 0 && !write_entries_locked(entries, written, sync)) {
+        written = -1;
+    }
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    free(entries);
+    free(skip);
+    return written;
+}
+
+int credstore_append(const CredLogEntry *entries, int count, int sync) {
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    int result = sync_files(1) && write_entries_locked(entries, count, sync);
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+size_t credstore_count() {
+    pthread_mutex_lock(&store_mutex);
+    size_t count = live_count;
+    pthread_mutex_unlock(&store_mutex);
+    return count;
+}
+
+int credstore_needs_compaction() {
+    pthread_mutex_lock(&store_mutex);
+    int needed = log_entries >= CREDSTORE_COMPACT_THRESHOLD;
+    pthread_mutex_unlock(&store_mutex);
+    return needed;
+}
+
+int credstore_compact() {
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    int result = sync_files(1) && compact_locked();
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+int credstore_import_text(const char *path) {
+    pthread_mutex_lock(&store_mutex);
+    if (!lock_store(LOCK_EX)) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+
+    int result = sync_files(1) ? import_text_locked(path) : -1;
+
+    unlock_store();
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+uint32_t credstore_crc32(const void *data, size_t len) {
+    return crc32_buf(data, len);
+}
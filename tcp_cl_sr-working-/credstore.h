@@ -0,0 +1,190 @@
+#ifndef CREDSTORE_H
+#define CREDSTORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <openssl/sha.h>
+
+#define CREDSTORE_LOG_FILE   "data/credentials.log"
+#define CREDSTORE_INDEX_FILE "data/credentials.idx"
+#define CREDSTORE_LOCK_FILE  "data/credentials.lock"
+#define CREDSTORE_TEXT_FILE  "data/credentials.dat" // Legacy text format, imported once
+
+#define CREDSTORE_USERNAME 64
+#define CREDSTORE_HASH SHA256_DIGEST_LENGTH
+#define CREDSTORE_SALT 16
+#define CREDSTORE_COMPACT_THRESHOLD 1024 // Log entries before compaction
+
+#define CRED_LOG_MAGIC   0x474c4443u // "CDLG"
+#define CRED_ENTRY_MAGIC 0x45524443u // "CDRE"
+#define CRED_INDEX_MAGIC 0x58494443u // "CDIX"
+#define CRED_VERSION 1
+
+#define CRED_OP_PUT 1
+#define CRED_OP_DELETE 2
+
+#define CRED_KDF_SHA256 0 // Single salted SHA-256 (original scheme)
+#define CRED_KDF_PBKDF2 1 // PBKDF2-HMAC-SHA256, see kdf.h
+#define CRED_KDF_SCRYPT 2 // scrypt, see kdf.h
+
+/*
+ * On-disk layout (native byte order, fixed-size records):
+ *
+ * credentials.log   CredLogHeader, then CredLogEntry... appended with a
+ *                   CRC each. Holds changes made since the last compaction.
+ * credentials.idx   CredIndexHeader, then CredRecord[count] sorted by
+ *                   username. Mapped read-only and binary searched.
+ *
+ * Compaction folds the log into a new index and starts an empty log with
+ * the next generation number. The index is renamed into place first, so a
+ * log whose generation is older than the index is already included.
+ */
+
+// One user's credentials in binary form
+typedef struct {
+    char username[CREDSTORE_USERNAME];   // NUL padded, sort key
+    unsigned char hash[CREDSTORE_HASH];
+    unsigned char salt[CREDSTORE_SALT];
+    uint8_t kdf;                         // CRED_KDF_*
+    uint8_t reserved[3];
+    uint32_t kdf_cost;                   // KDF parameters, 0 for SHA-256
+    uint32_t kdf_param;
+    uint32_t sessions_after;             // Tokens issued before this time are revoked
+} CredRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+} CredLogHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t op;                          // CRED_OP_*
+    uint8_t reserved[3];
+    CredRecord record;
+    uint32_t crc;                        // CRC-32 of op, reserved and record
+    uint32_t reserved2;
+} CredLogEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;                 // Log generation paired with this index
+    uint64_t count;
+    uint32_t records_crc;
+    uint32_t header_crc;                 // CRC-32 of the fields above
+    uint8_t reserved[32];
+} CredIndexHeader;
+
+/**
+ * Open the store: map the index and replay the log. Imports the legacy
+ * text file when no binary store exists yet
+ * Returns: 1 on success, 0 on failure
+ */
+int credstore_open();
+
+/**
+ * Unmap the index and release all store state
+ */
+void credstore_close();
+
+/**
+ * Apply log entries appended by other processes since the last call.
+ * Cheap (one fstat) when nothing changed
+ * Returns: 1 on success, 0 on failure
+ */
+int credstore_refresh();
+
+/**
+ * Look up a user
+ * Returns: 1 if found (copied to out), 0 otherwise
+ */
+int credstore_get(const char *username, CredRecord *out);
+
+/**
+ * Add or replace a user. With must_be_new set, fails if the user exists
+ * (checked under the store lock, so it holds across processes)
+ * Returns: 1 on success, 0 on I/O error, -1 if the user already exists
+ */
+int credstore_put(const CredRecord *record, int must_be_new);
+
+/**
+ * Replace a user only if its stored salt, hash and sessions_after still
+ * match expected (compared under the store lock), for writes computed from
+ * a record read earlier
+ * Returns: 1 on success, 0 on I/O error, -1 if the user changed or is gone
+ */
+int credstore_replace(const CredRecord *expected, const CredRecord *record);
+
+/**
+ * Delete a user
+ * Returns: 1 on success, 0 on I/O error, -1 if the user does not exist
+ */
+int credstore_delete(const char *username);
+
+/**
+ * List users in username order, starting after the given name ("" or NULL
+ * for the first page). O(log n) to find the page, plus the changes since
+ * the last compaction
+ * Returns: number of records written to out (at most max), -1 on failure
+ */
+int credstore_list(const char *after, CredRecord *out, int max);
+
+/**
+ * Add several users with one write (and one fsync if sync is set). With
+ * must_be_new set, users that already exist are skipped and a name given
+ * twice in the batch is written once, from its first record
+ * Returns: number of users written, -1 on failure
+ */
+int credstore_put_batch(const CredRecord *records, int count, int must_be_new, int sync);
+
+/**
+ * Append a batch of prepared entries with a single write, fsync'ed if sync
+ * is set. Entries must already carry their CRC (see credstore_make_entry)
+ * Returns: 1 on success, 0 on failure
+ */
+int credstore_append(const CredLogEntry *entries, int count, int sync);
+
+/**
+ * Fill a log entry for op/record, including its CRC
+ */
+void credstore_make_entry(CredLogEntry *entry, int op, const CredRecord *record);
+
+/**
+ * Number of live users
+ */
+size_t credstore_count();
+
+/**
+ * Returns: 1 if the log has grown past CREDSTORE_COMPACT_THRESHOLD
+ */
+int credstore_needs_compaction();
+
+/**
+ * Fold the log into a new sorted index and start a new log generation
+ * Returns: 1 on success, 0 on failure
+ */
+int credstore_compact();
+
+/**
+ * Import "username hash salt" lines from the legacy text format
+ * Returns: number of users imported, -1 on failure
+ */
+int credstore_import_text(const char *path);
+
+/**
+ * CRC-32 (IEEE) of len bytes, as used for the store's records
+ */
+uint32_t credstore_crc32(const void *data, size_t len);
+
+#endif // CREDSTORE_H
@@ -0,0 +1,102 @@
+#include "cryptoctx.h"
+#include <openssl/crypto.h>
+
+typedef struct {
+    EVP_MD_CTX *md_ctx;
+    unsigned int fork_generation;   // Value of fork_generation when filled
+    size_t rand_pos;                // Next unused byte, CRYPTOCTX_RAND_POOL = empty
+    unsigned char rand_buf[CRYPTOCTX_RAND_POOL];
+} ThreadCrypto;
+
+static pthread_key_t thread_key;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static EVP_MD *sha256_md = NULL;
+
+// Bumped in every child so inherited random pools are thrown away
+static volatile unsigned int fork_generation = 0;
+
+// ============================================================================
+// Per-Thread State
+// ============================================================================
+
+static void free_thread_crypto(void *ptr) {
+    ThreadCrypto *tc = ptr;
+    EVP_MD_CTX_free(tc->md_ctx);
+    OPENSSL_cleanse(tc, sizeof(*tc));
+    free(tc);
+}
+
+static void after_fork_child() {
+    fork_generation++;
+}
+
+static void init_process() {
+    pthread_key_create(&thread_key, free_thread_crypto);
+    pthread_atfork(NULL, NULL, after_fork_child);
+
+    // Explicit fetch, so digests skip the by-name lookup on every init
+    sha256_md = EVP_MD_fetch(NULL, "SHA256", NULL);
+}
+
+static ThreadCrypto *thread_crypto() {
+    pthread_once(&init_once, init_process);
+
+    ThreadCrypto *tc = pthread_getspecific(thread_key);
+    if (tc == NULL) {
+        tc = calloc(1, sizeof(ThreadCrypto));
+        if (tc == NULL) {
+            return NULL;
+        }
+        tc->rand_pos = CRYPTOCTX_RAND_POOL;
+        tc->fork_generation = fork_generation;
+        pthread_setspecific(thread_key, tc);
+    }
+    return tc;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+const EVP_MD *cryptoctx_sha256() {
+    pthread_once(&init_once, init_process);
+    return sha256_md ? sha256_md : EVP_sha256();
+}
+
+EVP_MD_CTX *cryptoctx_md() {
+    ThreadCrypto *tc = thread_crypto();
+    if (tc == NULL) {
+        return NULL;
+    }
+    if (tc->md_ctx == NULL) {
+        tc->md_ctx = EVP_MD_CTX_new();
+    }
+    return tc->md_ctx;
+}
+
+int cryptoctx_random(unsigned char *out, size_t len) {
+    ThreadCrypto *tc = thread_crypto();
+    if (tc == NULL || len > CRYPTOCTX_RAND_DIRECT) {
+        return RAND_bytes(out, len) == 1;
+    }
+
+    // Never reuse bytes buffered before a fork
+    if (tc->fork_generation != fork_generation) {
+        OPENSSL_cleanse(tc->rand_buf, sizeof(tc->rand_buf));
+        tc->rand_pos = CRYPTOCTX_RAND_POOL;
+        tc->fork_generation = fork_generation;
+    }
+
+    if (CRYPTOCTX_RAND_POOL - tc->rand_pos < len) {
+        if (RAND_bytes(tc->rand_buf, CRYPTOCTX_RAND_POOL) != 1) {
+            tc->rand_pos = CRYPTOCTX_RAND_POOL;
+            return 0;
+        }
+        tc->rand_pos = 0;
+    }
+
+    memcpy(out, tc->rand_buf + tc->rand_pos, len);
+    OPENSSL_cleanse(tc->rand_buf + tc->rand_pos, len);
+    tc->rand_pos += len;
+    return 1;
+}
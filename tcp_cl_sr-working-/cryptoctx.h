@@ -0,0 +1,40 @@
+#ifndef CRYPTOCTX_H
+#define CRYPTOCTX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define CRYPTOCTX_RAND_POOL 4096      // Random bytes buffered per thread
+#define CRYPTOCTX_RAND_DIRECT 256     // Larger requests bypass the pool
+
+/*
+ * Per-thread OpenSSL state for the authentication hot path: a digest
+ * context reused across calls, the SHA-256 implementation fetched once,
+ * and a pool of random bytes refilled with one RAND_bytes() call.
+ *
+ * The pool is discarded in a child after fork(), so parent and child never
+ * hand out the same bytes, and used bytes are wiped as they are consumed.
+ */
+
+/**
+ * SHA-256, fetched from the provider once per process
+ */
+const EVP_MD *cryptoctx_sha256();
+
+/**
+ * This thread's digest context, ready for EVP_DigestInit_ex()
+ * Returns: NULL on allocation failure
+ */
+EVP_MD_CTX *cryptoctx_md();
+
+/**
+ * Fill out with len random bytes from this thread's pool
+ * Returns: 1 on success, 0 if the generator failed
+ */
+int cryptoctx_random(unsigned char *out, size_t len);
+
+#endif // CRYPTOCTX_H
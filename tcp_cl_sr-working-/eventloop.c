@@ -0,0 +1,727 @@
+#include "eventloop.h"
+#include "authpool.h"
+#include "service.h"
+#include "ratelimit.h"
+#include "admin.h"
+#include "capture.h"
+#include "metrics.h"
+#include "conntrace.h"
+#include "logger.h"
+#include "probe.h"
+#include "coarseclock.h"
+#include "timerwheel.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+static int epoll_fd = -1;
+
+// Connection timeouts, timer = descriptor, ticks of EVENTLOOP_TIMER_TICK_MS
+static TimerWheel *timers = NULL;
+static Conn **timer_conns = NULL;   // Connection owning each descriptor's timer
+static Deadlines timeouts;
+static uint64_t loop_now;           // Tick the current batch of events arrived at
+
+// Markers for the non-connection descriptors in epoll_event.data.ptr
+static int listener_tag;
+static int completion_tag;
+
+// ============================================================================
+// Connection Helpers
+// ============================================================================
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+static uint64_t loop_tick() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / EVENTLOOP_TIMER_TICK_MS;
+}
+
+// Tick seconds from now, 0 (no timeout) for 0 seconds
+static uint64_t expires_in(int seconds) {
+    return seconds ? loop_now + (uint64_t)seconds * 1000 / EVENTLOOP_TIMER_TICK_MS : 0;
+}
+
+// Arm timeout kind to fire at tick expires, 0 = disarm
+static void conn_timer(Conn *c, int kind, uint64_t expires) {
+    c->timeout = expires ? kind : TIMEOUT_NONE;
+    if (c->fd >= timers->capacity) {
+        return;
+    }
+    if (expires) {
+        timer_conns[c->fd] = c;
+        timerwheel_schedule(timers, c->fd, expires);
+    } else {
+        timer_conns[c->fd] = NULL;
+        timerwheel_cancel(timers, c->fd);
+    }
+}
+
+// Returns: 1 while output is queued or still to be read from a file
+static int conn_pending(const Conn *c) {
+    return c->out_sent < c->out_len || c->file != NULL;
+}
+
+// Pick the timeout for what the connection waits on now. activity is set
+// when the client sent or took data, which restarts idle and write timeouts
+static void conn_rearm(Conn *c, int activity) {
+    if (conn_pending(c)) {
+        if (activity || c->timeout != TIMEOUT_WRITE) {
+            conn_timer(c, TIMEOUT_WRITE, expires_in(timeouts.write_sec));
+        }
+        return;
+    }
+
+    switch (c->state) {
+        case CONN_AUTH:
+            if (c->timeout != TIMEOUT_AUTH) {
+                conn_timer(c, TIMEOUT_AUTH, c->auth_expires);
+            }
+            break;
+        case CONN_MENU:
+        case CONN_FILENAME:
+            if (activity || c->timeout != TIMEOUT_IDLE) {
+                conn_timer(c, TIMEOUT_IDLE, expires_in(timeouts.idle_sec));
+            }
+            break;
+        default:
+            // Hashing: the auth pool owns the connection until it answers
+            conn_timer(c, TIMEOUT_NONE, 0);
+            break;
+    }
+}
+
+static void conn_close(Conn *c) {
+    conn_timer(c, TIMEOUT_NONE, 0);
+    if (c->file != NULL) {
+        // The client left or stopped reading in the middle of a file
+        fclose(c->file);
+        metrics_request(METRIC_FILE, c->request_started, c->request_in, 0, 1);
+    }
+    capture_close(c->capture_id);
+    metrics_close();
+    conntrace_close(c->trace_id);
+    log_info("SERVER", "Client disconnected: %s (socket %d)",
+             c->username[0] ? c->username : "(not authenticated)", c->fd);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->out);
+    free(c);
+}
+
+// Register the events matching the connection state
+// Returns: 1 if the connection is still open, 0 if it was closed
+static int conn_update(Conn *c) {
+    if (c->state == CONN_CLOSING && c->out_sent == c->out_len) {
+        conn_close(c);
+        return 0;
+    }
+
+    struct epoll_event ev;
+    ev.events = (c->state == CONN_CLOSING || c->state == CONN_SENDING) ? 0 : EPOLLIN;
+    c->want_write = conn_pending(c);
+    if (c->want_write) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    return 1;
+}
+
+// Make room for len more bytes of output
+// Returns: 1 on success, 0 when out of memory
+static int conn_reserve(Conn *c, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : EVENTLOOP_BUFFER;
+        while (cap < c->out_len + len) {
+            cap *= 2;
+        }
+        char *grown = realloc(c->out, cap);
+        if (grown == NULL) {
+            return 0;
+        }
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    return 1;
+}
+
+// Trace a request once its answer has left the output buffer
+static void trace_answer(Conn *c, int command, long long started, size_t bytes) {
+    if (c->trace_id == 0) {
+        return;
+    }
+    if (c->trace_pending) {
+        // The previous answer is still going out, count it up to now
+        conntrace_span(c->trace_id, TRACE_REQUEST, c->trace_command, c->trace_started, c->trace_bytes);
+    }
+    c->trace_pending = (c->out_len > 0);
+    if (!c->trace_pending) {
+        conntrace_span(c->trace_id, TRACE_REQUEST, command, started, bytes);
+        return;
+    }
+    c->trace_command = command;
+    c->trace_started = started;
+    c->trace_bytes = bytes;
+}
+
+// Count an option 3 answer once its last byte is queued
+static void file_answered(Conn *c) {
+    size_t bytes = c->bytes_out - c->file_before;
+    capture_response(c->capture_id, bytes);
+    metrics_request(METRIC_FILE, c->request_started, c->request_in, bytes, 0);
+    trace_answer(c, METRIC_FILE, c->request_started, bytes);
+}
+
+// Queue the next chunk of the file being sent, or finish it at the end
+// Returns: 1 if a chunk was queued, 0 if the file is done, -1 if the
+//          connection was closed
+static int file_refill(Conn *c) {
+    if (!conn_reserve(c, EVENTLOOP_FILE_CHUNK)) {
+        log_error("SERVER", "No memory to send a file to socket %d", c->fd);
+        conn_close(c);
+        return -1;
+    }
+    size_t bytes_read = fread(c->out + c->out_len, 1, EVENTLOOP_FILE_CHUNK, c->file);
+    if (bytes_read > 0) {
+        c->out_len += bytes_read;
+        c->bytes_out += bytes_read;
+        return 1;
+    }
+
+    fclose(c->file);
+    c->file = NULL;
+    c->state = CONN_MENU;
+    file_answered(c);
+    return 0;
+}
+
+// Send as much pending output as the socket takes, then at most one more
+// chunk of a file being sent
+// Returns: 1 if the connection is still open, 0 if it was closed
+static int conn_flush(Conn *c) {
+    int state = c->state;
+    int progress = 0, refilled = 0;
+    while (1) {
+        while (c->out_sent < c->out_len) {
+            ssize_t sent = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                log_error("SOCKET", "Write failed: %s", strerror(errno));
+                conn_close(c);
+                return 0;
+            }
+            c->out_sent += sent;
+            progress = 1;
+        }
+        if (c->out_sent < c->out_len) {
+            break;
+        }
+        c->out_sent = c->out_len = 0;
+        if (c->file == NULL || refilled) {
+            break;
+        }
+        refilled = 1;
+        if (file_refill(c) < 0) {
+            return 0;
+        }
+    }
+
+    if (c->out_len == 0 && c->trace_pending) {
+        c->trace_pending = 0;
+        conntrace_span(c->trace_id, TRACE_REQUEST, c->trace_command, c->trace_started, c->trace_bytes);
+    }
+
+    if ((conn_pending(c) != c->want_write || c->state != state || c->state == CONN_CLOSING) &&
+        !conn_update(c)) {
+        return 0;
+    }
+    conn_rearm(c, progress || c->out_len == 0);
+    return 1;
+}
+
+static int conn_send(Conn *c, const char *data, size_t len) {
+    if (!conn_reserve(c, len)) {
+        conn_close(c);
+        return 0;
+    }
+
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    c->bytes_out += len;
+    return conn_flush(c);
+}
+
+static int conn_send_str(Conn *c, const char *msg) {
+    return conn_send(c, msg, strlen(msg));
+}
+
+// Reply and close, as handle_client() does on a failed handshake
+static int conn_fail(Conn *c, const char *msg) {
+    c->state = CONN_CLOSING;
+    return conn_send_str(c, msg);
+}
+
+// Answer a handshake and count it, closing the connection after a failure
+// that ends it
+static int auth_reply(Conn *c, const char *msg, int closing) {
+    metrics_login(c->auth_kind, c->request_started, c->request_in, msg);
+    conntrace_span(c->trace_id, TRACE_AUTH, c->auth_kind, c->request_started,
+                   strncmp(msg, "AUTH_OK", 7) == 0);
+    return closing ? conn_fail(c, msg) : conn_send_str(c, msg);
+}
+
+// ============================================================================
+// Protocol
+// ============================================================================
+
+static int handle_handshake(Conn *c, char *request) {
+    char *saveptr = NULL;
+    char *command = strtok_r(request, ":", &saveptr);
+    char *username = strtok_r(NULL, ":", &saveptr);
+    char *password = strtok_r(NULL, ":", &saveptr);
+    c->auth_kind = metrics_login_command(command);
+
+    if (!command || !username || !password) {
+        log_warn("AUTH", "Invalid authentication format");
+        return auth_reply(c, "AUTH_FAILED:Invalid format", 1);
+    }
+
+    strncpy(c->username, username, MAX_USERNAME - 1);
+    c->username[MAX_USERNAME - 1] = '\0';
+    capture_login(c->capture_id, command, c->username);
+
+    // Resuming only checks a token, cheap enough to do inline
+    if (strcmp(command, "RESUME") == 0) {
+        char token[SESSION_TOKEN_MAX];
+        if (resume_session(c->username, password, token)) {
+            log_info("AUTH", "Session resumed for user: %s", c->username);
+            char success_msg[EVENTLOOP_BUFFER];
+            snprintf(success_msg, sizeof(success_msg), "AUTH_OK:%s", token);
+            c->state = CONN_MENU;
+            return auth_reply(c, success_msg, 0);
+        }
+
+        log_warn("AUTH", "Session resume failed for user: %s", c->username);
+        if (c->resume_failed) {
+            return auth_reply(c, "AUTH_FAILED:Session expired", 1);
+        }
+        c->resume_failed = 1;
+        return auth_reply(c, "AUTH_FAILED:Session expired", 0);
+    }
+
+    int type;
+    if (strcmp(command, "REGISTER") == 0) {
+        type = AUTH_JOB_REGISTER;
+    } else if (strcmp(command, "AUTH") == 0) {
+        type = AUTH_JOB_LOGIN;
+    } else {
+        log_warn("AUTH", "Unknown command: %s", command);
+        return auth_reply(c, "AUTH_FAILED:Unknown command", 1);
+    }
+
+    // Rejected before the job reaches a hashing thread
+    int limited = ratelimit_check_login(&c->addr, c->username);
+    if (limited != RATE_OK) {
+        log_warn("AUTH", "Rate limited (%s): %s",
+                 limited == RATE_LIMITED_IP ? "address" : "user", c->username);
+        return auth_reply(c, "AUTH_FAILED:Too many attempts", 1);
+    }
+
+    AuthJob *job = calloc(1, sizeof(AuthJob));
+    if (job == NULL) {
+        return auth_reply(c, "AUTH_FAILED:Server busy", 1);
+    }
+    job->type = type;
+    strncpy(job->username, c->username, MAX_USERNAME - 1);
+    strncpy(job->password, password, MAX_PASSWORD - 1);
+    job->owner = c;
+
+    if (!authpool_submit(job)) {
+        log_warn("AUTH", "Auth pool full, refusing login for: %s", c->username);
+        free(job);
+        return auth_reply(c, "AUTH_FAILED:Server busy", 1);
+    }
+
+    // Park the socket until the pool answers, any input waits in the kernel
+    c->state = CONN_HASHING;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    return 1;
+}
+
+static int send_file(Conn *c, const char *filepath) {
+    char full_path[512];
+    snprintf(full_path, sizeof(full_path), "./data/%s", filepath);
+    c->file_before = c->bytes_out;
+
+    FILE *file_ptr = fopen(full_path, "r");
+    if (file_ptr == NULL) {
+        long long started = c->request_started;
+        size_t bytes_in = c->request_in;
+        if (!conn_send_str(c, "ERROR: File does not exist")) {
+            metrics_request(METRIC_FILE, started, bytes_in, 0, 1);
+            return 0;
+        }
+        file_answered(c);
+        return 1;
+    }
+
+    // conn_flush() reads it in as the socket drains and counts the answer
+    // once the end is queued
+    c->file = file_ptr;
+    c->state = CONN_SENDING;
+    return conn_flush(c);
+}
+
+static int handle_menu(Conn *c, const char *request, const ProbeStamp *received) {
+    char reply[EVENTLOOP_BUFFER];
+
+    if (probe_is_request(request)) {
+        probe_reply(request, received, reply, sizeof(reply));
+        return conn_send_str(c, reply);
+    }
+
+    // PASSWD hashes and the rest touch the credential store, so admin
+    // commands run on the auth pool like logins
+    if (admin_is_request(request)) {
+        AuthJob *job = calloc(1, sizeof(AuthJob));
+        if (job == NULL) {
+            return conn_send_str(c, "ADMIN_FAILED:Server busy");
+        }
+        job->type = AUTH_JOB_ADMIN;
+        strncpy(job->username, c->username, MAX_USERNAME - 1);
+        strncpy(job->request, request, AUTHPOOL_REQUEST_SIZE - 1);
+        job->owner = c;
+
+        if (!authpool_submit(job)) {
+            log_warn("ADMIN", "Auth pool full, refusing admin command from: %s", c->username);
+            free(job);
+            return conn_send_str(c, "ADMIN_FAILED:Server busy");
+        }
+        c->state = CONN_HASHING;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        return 1;
+    }
+
+    switch (atoi(request)) {
+        case 1:
+            date_time(reply, sizeof(reply));
+            return conn_send_str(c, reply);
+        case 2:
+            directory_files(reply, sizeof(reply));
+            return conn_send_str(c, reply);
+        case 3:
+            c->state = CONN_FILENAME;
+            return 1;
+        case 4:
+            session_time(reply, sizeof(reply), c->start_time);
+            return conn_send_str(c, reply);
+        case 5:
+            conn_close(c);
+            return 0;
+        default:
+            return conn_send_str(c, "Invalid option. Please try again.");
+    }
+}
+
+// Read one request, like a single read() in handle_client()
+static void conn_readable(Conn *c) {
+    // Input is not watched while a file goes out, this is a hang-up or an
+    // error on the socket
+    if (c->state == CONN_SENDING) {
+        conn_close(c);
+        return;
+    }
+
+    char request[EVENTLOOP_BUFFER];
+    ssize_t len = recv(c->fd, request, sizeof(request) - 1, 0);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            log_error("SOCKET", "Read failed: %s", strerror(errno));
+            conn_close(c);
+        }
+        return;
+    }
+    if (len == 0) {
+        conn_close(c);
+        return;
+    }
+    request[len] = '\0';
+
+    int open = 1;
+    switch (c->state) {
+        case CONN_AUTH:
+            c->request_started = metrics_now_us();
+            c->request_in = len;
+            open = handle_handshake(c, request);
+            break;
+        case CONN_MENU: {
+            ProbeStamp received;
+            int probe = probe_is_request(request);
+            if (probe) {
+                probe_stamp(&received);
+            }
+            capture_request(c->capture_id, request, len);
+            long long started = metrics_now_us();
+            int option = atoi(request);
+            int command = admin_is_request(request) ? METRIC_ADMIN
+                          : probe ? METRIC_PING : metrics_menu_command(option);
+            size_t before = c->bytes_out;
+            // Option 3 answers after the file name, admin commands once the
+            // pool is done, 5 closes
+            open = handle_menu(c, request, &received);
+            if (open) {
+                if (c->state == CONN_MENU) {
+                    capture_response(c->capture_id, c->bytes_out - before);
+                    metrics_request(command, started, len, c->bytes_out - before, 0);
+                    trace_answer(c, command, started, c->bytes_out - before);
+                } else {
+                    c->request_started = started;
+                    c->request_in = len;
+                }
+            } else if (option != 5) {
+                metrics_request(command, started, len, 0, 1);
+            }
+            break;
+        }
+        case CONN_FILENAME: {
+            capture_request(c->capture_id, request, len);
+            c->request_started = metrics_now_us();
+            c->request_in += len;
+            request[strcspn(request, "\n")] = '\0';
+            c->state = CONN_MENU;
+            open = send_file(c, request);
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (open) {
+        conn_rearm(c, 1);
+    }
+}
+
+// An admin command's answer from the pool, counted like any other menu reply
+static void admin_answered(Conn *c, const AuthJob *job) {
+    long long started = c->request_started;
+    size_t bytes_in = c->request_in;
+    size_t before = c->bytes_out;
+    c->state = CONN_MENU;
+    if (!conn_send_str(c, job->reply)) {
+        metrics_request(METRIC_ADMIN, started, bytes_in, 0, 1);
+        return;
+    }
+    capture_response(c->capture_id, c->bytes_out - before);
+    metrics_request(METRIC_ADMIN, started, bytes_in, c->bytes_out - before, 0);
+    trace_answer(c, METRIC_ADMIN, started, c->bytes_out - before);
+}
+
+// Deliver finished logins and admin commands back to their connections
+static void handle_completions() {
+    AuthJob *job = authpool_collect();
+    while (job != NULL) {
+        AuthJob *next = job->next;
+        Conn *c = job->owner;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+        c->want_write = 0;
+
+        if (job->type == AUTH_JOB_ADMIN) {
+            admin_answered(c, job);
+            free(job);
+            job = next;
+            continue;
+        }
+
+        conntrace_span_at(c->trace_id, TRACE_AUTH_QUEUE, c->auth_kind, job->queued_us, job->started_us, 0);
+        conntrace_span_at(c->trace_id, TRACE_LOAD_USERS, c->auth_kind, job->started_us, job->loaded_us, 0);
+        conntrace_span_at(c->trace_id, TRACE_HASH, c->auth_kind, job->loaded_us, job->hashed_us, 0);
+
+        if (job->success) {
+            log_info("AUTH", "Session created for user: %s", c->username);
+            c->start_time = coarseclock_now();
+            c->state = CONN_MENU;
+            auth_reply(c, job->reply, 0);
+        } else {
+            auth_reply(c, job->reply, 1);
+        }
+
+        free(job);
+        job = next;
+    }
+}
+
+static void accept_clients(int listen_fd) {
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept(listen_fd, (struct sockaddr *)&addr, &addr_len);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_error("SOCKET", "Accept failed: %s", strerror(errno));
+                metrics_accept(0);
+            }
+            return;
+        }
+
+        Conn *c = calloc(1, sizeof(Conn));
+        if (c == NULL || !set_nonblocking(fd)) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->fd = fd;
+        c->addr = addr;
+        c->state = CONN_AUTH;
+        c->capture_id = capture_connect();
+        c->trace_id = conntrace_connect();
+        c->start_time = coarseclock_now();
+        c->auth_expires = expires_in(timeouts.auth_sec);
+        conn_rearm(c, 1);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            log_error("SOCKET", "Could not watch client socket: %s", strerror(errno));
+            conn_timer(c, TIMEOUT_NONE, 0);
+            close(fd);
+            free(c);
+            continue;
+        }
+        metrics_accept(1);
+        log_debug("AUTH", "Client connected. Starting authentication...");
+    }
+}
+
+// ============================================================================
+// Main Loop
+// ============================================================================
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return (value != NULL && *value != '\0') ? atoi(value) : fallback;
+}
+
+static void conn_expired(int fd, void *ctx) {
+    (void)ctx;
+    Conn *c = timer_conns[fd];
+    if (c == NULL) {
+        return;
+    }
+    static const char *what[] = { "", "No credentials within %d s", "Idle for %d s",
+                                  "Not reading its answer for %d s" };
+    int seconds = c->timeout == TIMEOUT_AUTH ? timeouts.auth_sec
+                  : c->timeout == TIMEOUT_IDLE ? timeouts.idle_sec : timeouts.write_sec;
+    char reason[64];
+    snprintf(reason, sizeof(reason), what[c->timeout], seconds);
+    log_warn("SERVER", "%s, disconnecting: %s (socket %d)", reason,
+             c->username[0] ? c->username : "(not authenticated)", c->fd);
+    conn_close(c);
+}
+
+// One timer per descriptor the process can open, up to EVENTLOOP_MAX_TIMERS
+static int start_timers() {
+    struct rlimit limit;
+    int capacity = EVENTLOOP_MAX_TIMERS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)capacity) {
+        capacity = (int)limit.rlim_cur;
+    }
+
+    // calloc()ed zeroes are an empty wheel, pages are touched as fds are used
+    timers = calloc(1, timerwheel_size(capacity));
+    timer_conns = calloc(capacity, sizeof(Conn *));
+    if (timers == NULL || timer_conns == NULL) {
+        return 0;
+    }
+    deadlines_load(&timeouts);
+    loop_now = loop_tick();
+    timerwheel_init(timers, capacity, loop_now);
+    return 1;
+}
+
+// Milliseconds epoll_wait() may sleep before the next timeout is due
+static int next_timeout_ms() {
+    int64_t ticks = timerwheel_next(timers);
+    if (ticks < 0) {
+        return -1;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    int64_t due_ms = (int64_t)(timers->now + ticks) * EVENTLOOP_TIMER_TICK_MS;
+    return due_ms > now_ms ? (int)(due_ms - now_ms) : 0;
+}
+
+void run_event_loop(int listen_fd) {
+    if (!authpool_start(env_int("AUTH_POOL_THREADS", 0),
+                        env_int("AUTH_POOL_PENDING", AUTHPOOL_DEFAULT_PENDING))) {
+        fprintf(stderr, "ERROR: Could not start auth worker pool\n");
+        exit(1);
+    }
+    if (!start_timers()) {
+        fprintf(stderr, "ERROR: Could not allocate connection timers\n");
+        exit(1);
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0 || !set_nonblocking(listen_fd)) {
+        perror("ERROR setting up epoll");
+        exit(1);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listener_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &completion_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, authpool_fd(), &ev);
+
+    struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+    while (1) {
+        // Close what timed out, between batches so no event refers to it
+        timerwheel_advance(timers, loop_tick(), conn_expired, NULL);
+
+        int ready = epoll_wait(epoll_fd, events, EVENTLOOP_MAX_EVENTS, next_timeout_ms());
+        loop_now = loop_tick();
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ERROR in epoll_wait");
+            exit(1);
+        }
+
+        for (int i = 0; i < ready; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &listener_tag) {
+                accept_clients(listen_fd);
+            } else if (ptr == &completion_tag) {
+                handle_completions();
+            } else {
+                Conn *c = ptr;
+                if (events[i].events & EPOLLOUT) {
+                    if (!conn_flush(c)) {
+                        continue;
+                    }
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    conn_readable(c);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include "auth.h"
+
+#define EVENTLOOP_MAX_EVENTS 64
+#define EVENTLOOP_BUFFER 256              // Request size, same as MAX_BUFFER in serverdef.h
+#define EVENTLOOP_FILE_CHUNK (64 * 1024)  // File bytes queued per wakeup for option 3
+#define EVENTLOOP_TIMER_TICK_MS 100       // Resolution of connection timeouts
+#define EVENTLOOP_MAX_TIMERS 65536        // Descriptors above this have no timeouts
+
+// Where a connection is in the protocol
+#define CONN_AUTH 0       // Waiting for AUTH / REGISTER / RESUME
+#define CONN_HASHING 1    // Credentials are with the auth pool
+#define CONN_MENU 2       // Waiting for a menu option
+#define CONN_FILENAME 3   // Option 3 chosen, waiting for the file name
+#define CONN_CLOSING 4    // Close once the output is sent
+#define CONN_SENDING 5    // Streaming a file for option 3, requests wait
+
+// Which timeout a connection is waiting on
+#define TIMEOUT_NONE 0
+#define TIMEOUT_AUTH 1    // Handshake not done, counted from accept()
+#define TIMEOUT_IDLE 2    // No request since the last one
+#define TIMEOUT_WRITE 3   // Output pending and the client not taking it
+
+typedef struct {
+    int fd;
+    struct sockaddr_in addr;      // Client address, for rate limiting
+    int state;                    // CONN_*
+    int resume_failed;
+    time_t start_time;
+    char username[MAX_USERNAME];
+
+    // Output not yet accepted by the socket
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    int want_write;               // EPOLLOUT currently registered
+    int timeout;                  // TIMEOUT_*, armed in the loop's timer wheel
+    uint64_t auth_expires;        // Tick the handshake must be done by
+    size_t bytes_out;             // Total queued, to size captured responses
+    uint32_t capture_id;          // 0 when not capturing
+    int auth_kind;                // METRIC_AUTH / METRIC_REGISTER / METRIC_RESUME
+    long long request_started;    // us, when the handshake or option 3's file name was read
+    size_t request_in;            // Bytes of the handshake, or of option 3
+
+    // File being sent for option 3, read a chunk at a time as the socket drains
+    FILE *file;
+    size_t file_before;           // bytes_out when its answer started
+
+    // Stage trace, a request counts until its answer leaves the buffer
+    uint32_t trace_id;            // 0 when not traced
+    int trace_pending;            // An answer is still being sent
+    int trace_command;
+    long long trace_started;
+    size_t trace_bytes;
+} Conn;
+
+/*
+ * Single-threaded epoll server. Every socket is non-blocking, menu requests
+ * are answered inline and password hashing goes to the auth pool
+ * (authpool.c), so a burst of logins does not hold up other connections.
+ *
+ * Pool size and admission limit come from AUTH_POOL_THREADS and
+ * AUTH_POOL_PENDING. Logins beyond the limit get "AUTH_FAILED:Server busy".
+ *
+ * Files are read a chunk (EVENTLOOP_FILE_CHUNK) at a time as the socket
+ * takes them, so a connection holds at most one chunk whatever the file
+ * size, and one chunk per wakeup keeps a fast reader from holding up the
+ * others. Requests sent meanwhile wait until the file is out.
+ *
+ * Each connection has at most one timeout pending in a timer wheel keyed
+ * by descriptor (see timerwheel.h), and epoll_wait() sleeps until the
+ * nearest one, so idle, silent and stalled clients cost nothing until
+ * they are closed.
+ */
+
+/**
+ * Serve connections from listen_fd forever
+ */
+void run_event_loop(int listen_fd);
+
+#endif // EVENTLOOP_H
@@ -4,129 +4,297 @@
 static AppWidgets *app_widgets = NULL;
 
 // ============================================================================
-// Network Functions
+// Network Requests
 // ============================================================================
 
-int connect_to_server(const char *hostname, int port) {
-    int sockfd;
-    struct sockaddr_in serv_addr;
-    struct hostent *server;
-    
-    // Create socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        return -1;
+// Grey out the buttons that talk to the server while a request is out
+static void set_busy(AppWidgets *widgets, int busy) {
+    gboolean idle = !busy;
+    widgets->busy = busy;
+    gtk_widget_set_sensitive(widgets->connect_button, idle);
+    gtk_widget_set_sensitive(widgets->login_button, idle);
+    gtk_widget_set_sensitive(widgets->register_button, idle);
+    gtk_widget_set_sensitive(widgets->datetime_button, idle);
+    gtk_widget_set_sensitive(widgets->listfiles_button, idle);
+    gtk_widget_set_sensitive(widgets->readfile_button, idle);
+    gtk_widget_set_sensitive(widgets->savefile_button, idle);
+    gtk_widget_set_sensitive(widgets->sessiontime_button, idle);
+}
+
+// Hand a request to the I/O thread (guinet.c), the answer arrives in on_net_ready()
+static int submit_job(AppWidgets *widgets, int type, const char *message) {
+    NetJob *job = guinet_job(type, widgets);
+    if (job == NULL) {
+        return 0;
     }
-    
-    // Get server by hostname
-    server = gethostbyname(hostname);
-    if (server == NULL) {
-        close(sockfd);
-        return -1;
+    if (message != NULL) {
+        g_strlcpy(job->message, message, sizeof(job->message));
     }
-    
-    // Initialize socket address structure
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, 
-         (char *)&serv_addr.sin_addr.s_addr,
-         server->h_length);
-    serv_addr.sin_port = htons(port);
-    
-    // Connect to server
-    if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-        close(sockfd);
-        return -1;
+    if (!guinet_submit(job)) {
+        guinet_free(job);
+        return 0;
     }
-    
-    return sockfd;
+    set_busy(widgets, 1);
+    return 1;
 }
 
-int authenticate_user(int sockfd, const char *username, const char *password, int is_register) {
-    char auth_message[MAX_BUFFER];
-    char auth_response[MAX_BUFFER];
-    int n;
-    
-    // Build authentication message
-    if (is_register) {
-        snprintf(auth_message, MAX_BUFFER, "REGISTER:%s:%s", username, password);
-    } else {
-        snprintf(auth_message, MAX_BUFFER, "AUTH:%s:%s", username, password);
+// Ask for a file, shown as it arrives or written to save_path when given
+static int submit_file(AppWidgets *widgets, const char *filename, const char *save_path) {
+    NetJob *job = guinet_job(NET_JOB_FILE, widgets);
+    if (job == NULL) {
+        return 0;
     }
-    
-    // Send authentication request
-    n = write(sockfd, auth_message, strlen(auth_message));
-    if (n < 0) {
-        return -1;
+    g_strlcpy(job->message, filename, sizeof(job->message));
+    if (save_path != NULL) {
+        g_strlcpy(job->save_path, save_path, sizeof(job->save_path));
     }
-    
-    // Receive authentication result
-    bzero(auth_response, MAX_BUFFER);
-    n = read(sockfd, auth_response, MAX_BUFFER - 1);
-    if (n <= 0) {
-        return -1;
+    if (!guinet_submit(job)) {
+        guinet_free(job);
+        return 0;
     }
-    auth_response[n] = '\0';
-    
-    // Check if authentication succeeded
-    if (strncmp(auth_response, "AUTH_OK", 7) == 0) {
-        return 0; // Success
-    } else {
-        return -2; // Failed authentication
+    set_busy(widgets, 1);
+
+    widgets->streaming = 1;
+    widgets->view_bytes = 0;
+    widgets->carry_len = 0;
+    gtk_text_buffer_set_text(widgets->result_buffer, save_path != NULL ? "Saving..." : "", -1);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar), "Waiting for the server...");
+    gtk_widget_set_sensitive(widgets->cancel_button, TRUE);
+    gtk_widget_show(widgets->progress_bar);
+    gtk_widget_show(widgets->cancel_button);
+    return 1;
+}
+
+static int submit_auth(AppWidgets *widgets, const char *command,
+                       const char *username, const char *secret) {
+    char auth_message[GUINET_MESSAGE_MAX];
+    snprintf(auth_message, sizeof(auth_message), "%s:%s:%s", command, username, secret);
+    return submit_job(widgets, NET_JOB_AUTH, auth_message);
+}
+
+static void connect_done(AppWidgets *widgets, NetJob *job) {
+    if (job->status != NET_OK) {
+        char status[256];
+        snprintf(status, sizeof(status), "Error: %s", job->error);
+        gtk_label_set_text(GTK_LABEL(widgets->status_label), status);
+        return;
     }
+
+    // A cached token is only meaningful for the server that issued it
+    int same_server = (strcmp(widgets->hostname, job->host) == 0 && widgets->port == job->port);
+
+    // Save connection info
+    widgets->connected = 1;
+    g_strlcpy(widgets->hostname, job->host, sizeof(widgets->hostname));
+    widgets->port = job->port;
+
+    // Reuse the cached session instead of sending the password again
+    if (same_server && widgets->session_token[0] != '\0' &&
+        submit_auth(widgets, "RESUME", widgets->session_user, widgets->session_token)) {
+        gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connected! Resuming session...");
+        return;
+    }
+
+    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connected! Please authenticate.");
+    
+    // Switch to authentication page
+    gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "auth");
 }
 
-int send_request(int sockfd, const char *request) {
-    int n = write(sockfd, request, strlen(request));
-    return (n < 0) ? -1 : 0;
+static void resume_done(AppWidgets *widgets, NetJob *job) {
+    if (job->status == NET_OK) {
+        g_strlcpy(widgets->session_token, job->reply + strlen("AUTH_OK:"), sizeof(widgets->session_token));
+        gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connected! Session resumed.");
+        gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "menu");
+        return;
+    }
+
+    // The server keeps the connection open so we can log in normally
+    widgets->session_user[0] = '\0';
+    widgets->session_token[0] = '\0';
+    if (job->status == NET_ERROR) {
+        widgets->connected = 0;
+        gtk_label_set_text(GTK_LABEL(widgets->status_label), "Error: Connection lost during resume");
+        return;
+    }
+    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connected! Please authenticate.");
+    gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "auth");
 }
 
-int receive_response(int sockfd, char *response, size_t max_size) {
-    int total_read = 0;
-    int n;
-    fd_set readfds;
-    struct timeval tv;
-    
-    bzero(response, max_size);
-    
-    // Read response (may come in multiple chunks for large files)
-    while (total_read < max_size - 1) {
-        // Set up select with timeout
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        tv.tv_sec = 2;  // 2 second timeout
-        tv.tv_usec = 0;
+static void auth_done(AppWidgets *widgets, NetJob *job) {
+    int is_register = (strncmp(job->message, "REGISTER:", 9) == 0);
+
+    if (job->status == NET_OK) {
+        // Username between the command and the password
+        const char *username = strchr(job->message, ':') + 1;
+        size_t username_len = strcspn(username, ":");
+        if (username_len >= sizeof(widgets->session_user)) {
+            username_len = sizeof(widgets->session_user) - 1;
+        }
+        memcpy(widgets->session_user, username, username_len);
+        widgets->session_user[username_len] = '\0';
+        g_strlcpy(widgets->session_token, job->reply + strlen("AUTH_OK:"), sizeof(widgets->session_token));
+
+        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label),
+                           is_register ? "Registration successful!" : "Login successful!");
         
-        int ready = select(sockfd + 1, &readfds, NULL, NULL, &tv);
+        // Switch to main menu
+        gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "menu");
         
-        if (ready < 0) {
-            return -1;  // Error
-        } else if (ready == 0) {
-            // Timeout - no more data
+        // Clear password field
+        gtk_entry_set_text(GTK_ENTRY(widgets->auth_password_entry), "");
+    } else if (job->status == NET_REJECTED) {
+        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label),
+                           is_register ? "Error: Username already exists or invalid"
+                                       : "Error: Invalid username or password");
+    } else {
+        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label),
+                           is_register ? "Error: Registration failed" : "Error: Authentication failed");
+    }
+}
+
+static void request_done(AppWidgets *widgets, NetJob *job) {
+    if (job->status != NET_OK) {
+        char error[256];
+        snprintf(error, sizeof(error), "Error: %s", job->error);
+        gtk_text_buffer_set_text(widgets->result_buffer, error, -1);
+        return;
+    }
+    
+    // Display result
+    gtk_text_buffer_set_text(widgets->result_buffer, job->reply, (gint)job->reply_len);
+}
+
+static void append_note(AppWidgets *widgets, const char *note) {
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(widgets->result_buffer, &end);
+    gtk_text_buffer_insert(widgets->result_buffer, &end, note, -1);
+}
+
+// Append part of a file to the result view, up to GUI_VIEW_MAX bytes.
+// Parts end anywhere, so the start of a split character waits for the
+// next one, and bytes that are not UTF-8 show as U+FFFD since the text
+// buffer only takes valid text
+static void append_text(AppWidgets *widgets, const char *data, size_t len) {
+    if (widgets->view_bytes >= GUI_VIEW_MAX) {
+        return;
+    }
+    if (len > GUI_VIEW_MAX - widgets->view_bytes) {
+        len = GUI_VIEW_MAX - widgets->view_bytes;
+    }
+    widgets->view_bytes += len;
+
+    size_t left = widgets->carry_len + len;
+    char *text = g_malloc(left);
+    memcpy(text, widgets->utf8_carry, widgets->carry_len);
+    memcpy(text + widgets->carry_len, data, len);
+    widgets->carry_len = 0;
+
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(widgets->result_buffer, &end);
+    const gchar *p = text;
+    while (left > 0) {
+        const gchar *valid_end;
+        g_utf8_validate(p, (gssize)left, &valid_end);
+        gtk_text_buffer_insert(widgets->result_buffer, &end, p, (gint)(valid_end - p));
+        left -= valid_end - p;
+        p = valid_end;
+        if (left == 0) {
             break;
         }
-        
-        // Data is available, read it
-        n = read(sockfd, response + total_read, max_size - total_read - 1);
-        
-        if (n < 0) {
-            return -1;  // Error
-        } else if (n == 0) {
-            // Connection closed
+        if (left < sizeof(widgets->utf8_carry) &&
+            g_utf8_get_char_validated(p, (gssize)left) == (gunichar)-2) {
+            memcpy(widgets->utf8_carry, p, left);
+            widgets->carry_len = left;
             break;
         }
-        
-        total_read += n;
+        gtk_text_buffer_insert(widgets->result_buffer, &end, "\xEF\xBF\xBD", -1);
+        p++;
+        left--;
     }
-    
-    response[total_read] = '\0';
-    return total_read;
+    g_free(text);
 }
 
-void disconnect_from_server(int sockfd) {
-    if (sockfd >= 0) {
-        close(sockfd);
+static void progress_done(AppWidgets *widgets, NetJob *job) {
+    if (job->reply != NULL) {
+        append_text(widgets, job->reply, job->reply_len);
     }
+
+    // No size comes ahead of a file, so the bar pulses with a byte count
+    char text[64];
+    snprintf(text, sizeof(text), "%zu KB received", job->received / 1024);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar), text);
+    gtk_progress_bar_pulse(GTK_PROGRESS_BAR(widgets->progress_bar));
+}
+
+static void file_done(AppWidgets *widgets, NetJob *job) {
+    int saving = (job->save_path[0] != '\0');
+    char note[768];
+
+    widgets->streaming = 0;
+    gtk_widget_hide(widgets->progress_bar);
+    gtk_widget_hide(widgets->cancel_button);
+
+    if (job->status == NET_CANCELLED) {
+        if (!widgets->connected) {
+            return;
+        }
+        if (saving) {
+            snprintf(note, sizeof(note), "Cancelled after %zu bytes, nothing saved", job->received);
+            gtk_text_buffer_set_text(widgets->result_buffer, note, -1);
+        } else {
+            snprintf(note, sizeof(note), "\n\n[Cancelled after %zu bytes]", job->received);
+            append_note(widgets, note);
+        }
+    } else if (job->status != NET_OK) {
+        request_done(widgets, job);
+    } else if (saving) {
+        snprintf(note, sizeof(note), "Saved %zu bytes to %s", job->received, job->save_path);
+        gtk_text_buffer_set_text(widgets->result_buffer, note, -1);
+    } else if (job->received > widgets->view_bytes) {
+        snprintf(note, sizeof(note), "\n\n[Showing the first %d KB of %zu bytes, use Save File to Disk for all of it]",
+                 GUI_VIEW_MAX / 1024, job->received);
+        append_note(widgets, note);
+    }
+}
+
+gboolean on_net_ready(gint fd, GIOCondition condition, gpointer data) {
+    AppWidgets *widgets = (AppWidgets *)data;
+    (void)fd;
+    (void)condition;
+
+    NetJob *job = guinet_collect();
+    while (job != NULL) {
+        NetJob *next = job->next;
+        switch (job->type) {
+            case NET_JOB_CONNECT:
+                connect_done(widgets, job);
+                break;
+            case NET_JOB_AUTH:
+                if (strncmp(job->message, "RESUME:", 7) == 0) {
+                    resume_done(widgets, job);
+                } else {
+                    auth_done(widgets, job);
+                }
+                break;
+            case NET_JOB_REQUEST:
+                request_done(widgets, job);
+                break;
+            case NET_JOB_PROGRESS:
+                progress_done(widgets, job);
+                break;
+            case NET_JOB_FILE:
+                file_done(widgets, job);
+                break;
+            default:
+                break;
+        }
+        guinet_free(job);
+        job = next;
+    }
+
+    set_busy(widgets, guinet_pending() > 0);
+    return G_SOURCE_CONTINUE;
 }
 
 // ============================================================================
@@ -155,25 +323,20 @@ void on_connect_clicked(GtkWidget *widget, gpointer data) {
         return;
     }
     
-    // Attempt connection
-    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connecting...");
-    
-    int sockfd = connect_to_server(hostname, port);
-    if (sockfd < 0) {
-        gtk_label_set_text(GTK_LABEL(widgets->status_label), "Error: Failed to connect to server");
+    // Attempt connection, connect_done() picks it up
+    NetJob *job = guinet_job(NET_JOB_CONNECT, widgets);
+    if (job == NULL) {
         return;
     }
-    
-    // Save connection info
-    widgets->sockfd = sockfd;
-    widgets->connected = 1;
-    strncpy(widgets->hostname, hostname, sizeof(widgets->hostname) - 1);
-    widgets->port = port;
-    
-    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connected! Please authenticate.");
-    
-    // Switch to authentication page
-    gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "auth");
+    g_strlcpy(job->host, hostname, sizeof(job->host));
+    job->port = port;
+    if (!guinet_submit(job)) {
+        guinet_free(job);
+        gtk_label_set_text(GTK_LABEL(widgets->status_label), "Error: Network thread not running");
+        return;
+    }
+    set_busy(widgets, 1);
+    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Connecting...");
 }
 
 // ============================================================================
@@ -196,21 +359,9 @@ void on_login_clicked(GtkWidget *widget, gpointer data) {
         return;
     }
     
-    // Attempt authentication
-    gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Authenticating...");
-    
-    int result = authenticate_user(widgets->sockfd, username, password, 0);
-    
-    if (result == 0) {
-        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Login successful!");
-        
-        // Switch to main menu
-        gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "menu");
-        
-        // Clear password field
-        gtk_entry_set_text(GTK_ENTRY(widgets->auth_password_entry), "");
-    } else if (result == -2) {
-        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Error: Invalid username or password");
+    // Attempt authentication, auth_done() picks it up
+    if (submit_auth(widgets, "AUTH", username, password)) {
+        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Authenticating...");
     } else {
         gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Error: Authentication failed");
     }
@@ -232,21 +383,9 @@ void on_register_clicked(GtkWidget *widget, gpointer data) {
         return;
     }
     
-    // Attempt registration
-    gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Registering...");
-    
-    int result = authenticate_user(widgets->sockfd, username, password, 1);
-    
-    if (result == 0) {
-        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Registration successful!");
-        
-        // Switch to main menu
-        gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "menu");
-        
-        // Clear password field
-        gtk_entry_set_text(GTK_ENTRY(widgets->auth_password_entry), "");
-    } else if (result == -2) {
-        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Error: Username already exists or invalid");
+    // Attempt registration, auth_done() picks it up
+    if (submit_auth(widgets, "REGISTER", username, password)) {
+        gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Registering...");
     } else {
         gtk_label_set_text(GTK_LABEL(widgets->auth_status_label), "Error: Registration failed");
     }
@@ -256,50 +395,24 @@ void on_register_clicked(GtkWidget *widget, gpointer data) {
 // GTK Callbacks - Main Menu Page
 // ============================================================================
 
-void on_datetime_clicked(GtkWidget *widget, gpointer data) {
-    AppWidgets *widgets = (AppWidgets *)data;
-    char response[4096];
-    
-    // Send request
-    if (send_request(widgets->sockfd, "1") < 0) {
+// Send a menu option, request_done() shows the answer
+static void request_option(AppWidgets *widgets, const char *option) {
+    if (!submit_job(widgets, NET_JOB_REQUEST, option)) {
         gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to send request", -1);
-        return;
     }
-    
-    // Receive response
-    if (receive_response(widgets->sockfd, response, sizeof(response)) < 0) {
-        gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to receive response", -1);
-        return;
-    }
-    
-    // Display result
-    gtk_text_buffer_set_text(widgets->result_buffer, response, -1);
+}
+
+void on_datetime_clicked(GtkWidget *widget, gpointer data) {
+    request_option((AppWidgets *)data, "1");
 }
 
 void on_listfiles_clicked(GtkWidget *widget, gpointer data) {
-    AppWidgets *widgets = (AppWidgets *)data;
-    char response[4096];
-    
-    // Send request
-    if (send_request(widgets->sockfd, "2") < 0) {
-        gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to send request", -1);
-        return;
-    }
-    
-    // Receive response
-    if (receive_response(widgets->sockfd, response, sizeof(response)) < 0) {
-        gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to receive response", -1);
-        return;
-    }
-    
-    // Display result
-    gtk_text_buffer_set_text(widgets->result_buffer, response, -1);
+    request_option((AppWidgets *)data, "2");
 }
 
-void on_readfile_clicked(GtkWidget *widget, gpointer data) {
-    AppWidgets *widgets = (AppWidgets *)data;
-    char response[8192];
-    
+// Ask for a file name in the data directory
+// Returns: the name, free with g_free(), NULL if cancelled or empty
+static gchar *ask_filename(AppWidgets *widgets) {
     // Create dialog to ask for filename
     GtkWidget *dialog = gtk_dialog_new_with_buttons(
         "Enter Filename",
@@ -318,82 +431,98 @@ void on_readfile_clicked(GtkWidget *widget, gpointer data) {
     gtk_widget_show_all(dialog);
     
     gint result = gtk_dialog_run(GTK_DIALOG(dialog));
+    gchar *filename = NULL;
     
     if (result == GTK_RESPONSE_OK) {
-        const char *filename = gtk_entry_get_text(GTK_ENTRY(entry));
+        const char *text = gtk_entry_get_text(GTK_ENTRY(entry));
         
-        if (strlen(filename) == 0) {
+        if (strlen(text) == 0) {
             gtk_text_buffer_set_text(widgets->result_buffer, "Error: Please enter a filename", -1);
-            gtk_widget_destroy(dialog);
-            return;
-        }
-        
-        // Send request option 3
-        if (send_request(widgets->sockfd, "3") < 0) {
-            gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to send request", -1);
-            gtk_widget_destroy(dialog);
-            return;
-        }
-        
-        // Small delay to ensure server is ready for filename
-        usleep(10000);  // 10ms delay
-        
-        // Send filename (without newline, just the filename)
-        if (write(widgets->sockfd, filename, strlen(filename)) < 0) {
-            gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to send filename", -1);
-            gtk_widget_destroy(dialog);
-            return;
-        }
-        
-        // Receive response (file content)
-        int bytes_received = receive_response(widgets->sockfd, response, sizeof(response));
-        if (bytes_received < 0) {
-            gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to receive response", -1);
-            gtk_widget_destroy(dialog);
-            return;
-        } else if (bytes_received == 0) {
-            gtk_text_buffer_set_text(widgets->result_buffer, "Error: No response from server", -1);
-            gtk_widget_destroy(dialog);
-            return;
+        } else {
+            filename = g_strdup(text);
         }
-        
-        // Display result
-        gtk_text_buffer_set_text(widgets->result_buffer, response, -1);
     }
     
     gtk_widget_destroy(dialog);
+    return filename;
 }
 
-void on_sessiontime_clicked(GtkWidget *widget, gpointer data) {
+void on_readfile_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
-    char response[4096];
+    gchar *filename = ask_filename(widgets);
+    if (filename == NULL) {
+        return;
+    }
     
-    // Send request
-    if (send_request(widgets->sockfd, "4") < 0) {
+    // Option 3 and the file name go out on the I/O thread, the content
+    // comes back in parts to progress_done()
+    if (!submit_file(widgets, filename, NULL)) {
         gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to send request", -1);
+    }
+    g_free(filename);
+}
+
+void on_savefile_clicked(GtkWidget *widget, gpointer data) {
+    AppWidgets *widgets = (AppWidgets *)data;
+    gchar *filename = ask_filename(widgets);
+    if (filename == NULL) {
         return;
     }
     
-    // Receive response
-    if (receive_response(widgets->sockfd, response, sizeof(response)) < 0) {
-        gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to receive response", -1);
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
+        "Save File As",
+        GTK_WINDOW(widgets->window),
+        GTK_FILE_CHOOSER_ACTION_SAVE,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Save", GTK_RESPONSE_ACCEPT,
+        NULL
+    );
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), filename);
+    
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        gchar *save_path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        
+        // The I/O thread writes the parts straight to save_path
+        if (save_path == NULL || !submit_file(widgets, filename, save_path)) {
+            gtk_text_buffer_set_text(widgets->result_buffer, "Error: Failed to send request", -1);
+        }
+        g_free(save_path);
+    }
+    
+    gtk_widget_destroy(dialog);
+    g_free(filename);
+}
+
+void on_cancel_clicked(GtkWidget *widget, gpointer data) {
+    AppWidgets *widgets = (AppWidgets *)data;
+    if (!widgets->streaming) {
         return;
     }
     
-    // Display result
-    gtk_text_buffer_set_text(widgets->result_buffer, response, -1);
+    // The file job completes with NET_CANCELLED once the rest is drained
+    guinet_cancel();
+    gtk_widget_set_sensitive(widgets->cancel_button, FALSE);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar), "Cancelling...");
+}
+
+void on_sessiontime_clicked(GtkWidget *widget, gpointer data) {
+    request_option((AppWidgets *)data, "4");
 }
 
 void on_disconnect_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
     
-    // Send exit request
-    send_request(widgets->sockfd, "5");
-    
-    // Disconnect
-    disconnect_from_server(widgets->sockfd);
+    // Send exit request and disconnect, after anything still queued and
+    // without waiting for the rest of a file
+    if (widgets->streaming) {
+        guinet_cancel();
+    }
+    NetJob *job = guinet_job(NET_JOB_DISCONNECT, widgets);
+    if (job != NULL && !guinet_submit(job)) {
+        guinet_free(job);
+    }
     widgets->connected = 0;
-    widgets->sockfd = -1;
     
     // Clear result buffer
     gtk_text_buffer_set_text(widgets->result_buffer, "Disconnected from server.", -1);
@@ -409,11 +538,13 @@ void on_disconnect_clicked(GtkWidget *widget, gpointer data) {
 void on_window_destroy(GtkWidget *widget, gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
     
-    // Cleanup
-    if (widgets->connected) {
-        send_request(widgets->sockfd, "5");
-        disconnect_from_server(widgets->sockfd);
+    // Cleanup, the I/O thread sends option 5 if still connected
+    if (widgets->net_watch != 0) {
+        g_source_remove(widgets->net_watch);
+        widgets->net_watch = 0;
     }
+    guinet_stop();
+    widgets->connected = 0;
     
     gtk_main_quit();
 }
@@ -538,6 +669,10 @@ void create_main_menu_page(AppWidgets *widgets) {
     g_signal_connect(widgets->readfile_button, "clicked", G_CALLBACK(on_readfile_clicked), widgets);
     gtk_box_pack_start(GTK_BOX(page), widgets->readfile_button, FALSE, FALSE, 5);
     
+    widgets->savefile_button = gtk_button_new_with_label("Save File to Disk...");
+    g_signal_connect(widgets->savefile_button, "clicked", G_CALLBACK(on_savefile_clicked), widgets);
+    gtk_box_pack_start(GTK_BOX(page), widgets->savefile_button, FALSE, FALSE, 5);
+    
     widgets->sessiontime_button = gtk_button_new_with_label("Show Session Time");
     g_signal_connect(widgets->sessiontime_button, "clicked", G_CALLBACK(on_sessiontime_clicked), widgets);
     gtk_box_pack_start(GTK_BOX(page), widgets->sessiontime_button, FALSE, FALSE, 5);
@@ -559,6 +694,19 @@ void create_main_menu_page(AppWidgets *widgets) {
     gtk_container_add(GTK_CONTAINER(scroll), widgets->result_textview);
     gtk_box_pack_start(GTK_BOX(page), scroll, TRUE, TRUE, 5);
     
+    // File progress, shown only while a file arrives
+    GtkWidget *progress_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    widgets->progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(widgets->progress_bar), TRUE);
+    gtk_widget_set_no_show_all(widgets->progress_bar, TRUE);
+    gtk_box_pack_start(GTK_BOX(progress_box), widgets->progress_bar, TRUE, TRUE, 0);
+    
+    widgets->cancel_button = gtk_button_new_with_label("Cancel");
+    g_signal_connect(widgets->cancel_button, "clicked", G_CALLBACK(on_cancel_clicked), widgets);
+    gtk_widget_set_no_show_all(widgets->cancel_button, TRUE);
+    gtk_box_pack_start(GTK_BOX(progress_box), widgets->cancel_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(page), progress_box, FALSE, FALSE, 5);
+    
     gtk_stack_add_named(GTK_STACK(widgets->stack), page, "menu");
 }
 
@@ -569,10 +717,23 @@ void create_main_menu_page(AppWidgets *widgets) {
 int main(int argc, char *argv[]) {
     gtk_init(&argc, &argv);
     
+    // Network requests run on their own thread (see guinet.h)
+    if (!guinet_start()) {
+        fprintf(stderr, "ERROR: Could not start the network thread\n");
+        return 1;
+    }
+    
     // Allocate widgets structure
     app_widgets = g_malloc(sizeof(AppWidgets));
-    app_widgets->sockfd = -1;
     app_widgets->connected = 0;
+    app_widgets->busy = 0;
+    app_widgets->streaming = 0;
+    app_widgets->view_bytes = 0;
+    app_widgets->carry_len = 0;
+    app_widgets->hostname[0] = '\0';
+    app_widgets->port = 0;
+    app_widgets->session_user[0] = '\0';
+    app_widgets->session_token[0] = '\0';
     
     // Create main window
     app_widgets->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -593,6 +754,9 @@ int main(int argc, char *argv[]) {
     // Show connection page first
     gtk_stack_set_visible_child_name(GTK_STACK(app_widgets->stack), "connection");
     
+    // Finished requests wake the main loop through the I/O thread's eventfd
+    app_widgets->net_watch = g_unix_fd_add(guinet_fd(), G_IO_IN, on_net_ready, app_widgets);
+    
     // Show window
     gtk_widget_show_all(app_widgets->window);
     
@@ -2,18 +2,16 @@
 #define GUI_CLIENT_H
 
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/select.h>
-#include <sys/time.h>
-#include <netinet/in.h>
-#include <netdb.h>
+#include "guinet.h"
 
 #define MAX_BUFFER 256
+#define GUI_VIEW_MAX (512 * 1024)   // File bytes shown in the result view, the rest only counted
 
 // Global GTK widgets
 typedef struct {
@@ -39,19 +37,33 @@ typedef struct {
     GtkWidget *datetime_button;
     GtkWidget *listfiles_button;
     GtkWidget *readfile_button;
+    GtkWidget *savefile_button;
     GtkWidget *sessiontime_button;
     GtkWidget *disconnect_button;
     GtkWidget *result_textview;
     GtkTextBuffer *result_buffer;
+    GtkWidget *progress_bar;
+    GtkWidget *cancel_button;
+    
+    // File being received, in NET_JOB_PROGRESS parts
+    int streaming;
+    size_t view_bytes;            // Shown so far, up to GUI_VIEW_MAX
+    char utf8_carry[4];           // Character split across parts
+    size_t carry_len;
     
     // File path dialog
     GtkWidget *filepath_entry;
     
-    // Socket information
-    int sockfd;
+    // Connection state, the socket itself belongs to the I/O thread (guinet.c)
+    guint net_watch;              // Main loop source for guinet_fd()
+    int busy;                     // Requests queued or running, buttons greyed out
     int connected;
     char hostname[256];
     int port;
+    
+    // Cached session for RESUME on reconnect
+    char session_user[64];
+    char session_token[MAX_BUFFER];
 } AppWidgets;
 
 // Function declarations
@@ -64,15 +76,13 @@ void on_register_clicked(GtkWidget *widget, gpointer data);
 void on_datetime_clicked(GtkWidget *widget, gpointer data);
 void on_listfiles_clicked(GtkWidget *widget, gpointer data);
 void on_readfile_clicked(GtkWidget *widget, gpointer data);
+void on_savefile_clicked(GtkWidget *widget, gpointer data);
+void on_cancel_clicked(GtkWidget *widget, gpointer data);
 void on_sessiontime_clicked(GtkWidget *widget, gpointer data);
 void on_disconnect_clicked(GtkWidget *widget, gpointer data);
 void on_window_destroy(GtkWidget *widget, gpointer data);
 
-// Network functions
-int connect_to_server(const char *hostname, int port);
-int authenticate_user(int sockfd, const char *username, const char *password, int is_register);
-int send_request(int sockfd, const char *request);
-int receive_response(int sockfd, char *response, size_t max_size);
-void disconnect_from_server(int sockfd);
+// Network completions, finished requests from the I/O thread
+gboolean on_net_ready(gint fd, GIOCondition condition, gpointer data);
 
 #endif // GUI_CLIENT_H
@@ -0,0 +1,511 @@
+#include "guinet.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Queue state, one I/O thread per process
+static pthread_mutex_t net_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t io_thread;
+static int running = 0;
+
+static NetJob *queue_head = NULL;   // Waiting for the I/O thread
+static NetJob *queue_tail = NULL;
+static NetJob *done_head = NULL;    // Finished, waiting for guinet_collect()
+static NetJob *done_tail = NULL;
+static int pending = 0;             // Queued + running
+static size_t stream_queued = 0;    // File bytes in progress jobs not yet collected
+static int cancel_requested = 0;    // guinet_cancel() was called
+
+static int done_fd = -1;
+static int wake_fd = -1;            // New job, cancel, room in the window or stop
+
+// Owned by the I/O thread
+static ClientLoop *loop = NULL;
+static ClientConn *conn = NULL;
+static NetJob *current = NULL;      // Job in flight
+static int save_fd = -1;            // NET_JOB_FILE with save_path
+static ClientAddr last_addr;        // Reconnected to after the server drops a failed login
+static int have_addr = 0;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static void wake_io() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("[NET ERROR] Could not wake I/O thread");
+    }
+}
+
+// Hand a job back to guinet_collect(). Caller holds net_mutex
+static void push_done(NetJob *job) {
+    job->next = NULL;
+    if (done_tail != NULL) {
+        done_tail->next = job;
+    } else {
+        done_head = job;
+    }
+    done_tail = job;
+
+    uint64_t one = 1;
+    if (write(done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("[NET ERROR] Could not signal completion");
+    }
+}
+
+// The job in flight is over, hand it back
+static void complete(int status) {
+    NetJob *job = current;
+    current = NULL;
+    if (job->status == NET_OK) {
+        job->status = status;
+    }
+    if (job->status == NET_ERROR && job->error[0] == '\0') {
+        snprintf(job->error, sizeof(job->error), "%s", conn->error);
+    }
+    job->elapsed_us = client_now_us() - job->queued_us;
+
+    pthread_mutex_lock(&net_mutex);
+    push_done(job);
+    pending--;
+    pthread_mutex_unlock(&net_mutex);
+}
+
+static void fail(const char *message) {
+    snprintf(current->error, sizeof(current->error), "%s", message);
+    complete(NET_ERROR);
+}
+
+// Keep a short answer (or the AUTH_FAILED one) in the job
+static void keep_reply(const char *reply, size_t len) {
+    if (reply == NULL) {
+        return;
+    }
+    current->reply = malloc(len + 1);
+    if (current->reply != NULL) {
+        memcpy(current->reply, reply, len);
+        current->reply[len] = '\0';
+        current->reply_len = len;
+    }
+}
+
+// ============================================================================
+// Jobs
+// ============================================================================
+
+static void start_next();
+
+static void connected(ClientConn *c, int status, const char *reply, size_t len) {
+    (void)reply;
+    (void)len;
+    if (status != CLIENT_OK) {
+        snprintf(current->error, sizeof(current->error), "Failed to connect to %.40s:%d (%.50s)",
+                 current->host, current->port, c->error);
+    }
+    complete(status);
+    start_next();
+}
+
+static void answered(ClientConn *c, int status, const char *reply, size_t len) {
+    (void)c;
+    keep_reply(reply, len);
+    complete(status);
+    start_next();
+}
+
+static void send_auth() {
+    if (!client_handshake(conn, current->message, answered)) {
+        fail(conn->error);
+    }
+}
+
+static void reconnected(ClientConn *c, int status, const char *reply, size_t len) {
+    (void)reply;
+    (void)len;
+    if (status != CLIENT_OK) {
+        fail(c->error);
+    } else {
+        send_auth();
+    }
+    start_next();
+}
+
+// The file failed on this side: the rest is read and dropped, so the
+// connection stays usable, and the job completes with NET_ERROR
+static void abandon_file(ClientConn *c, const char *message) {
+    current->status = NET_ERROR;
+    snprintf(current->error, sizeof(current->error), "%s", message);
+    client_cancel(c);
+}
+
+// Pass on one part of a file: written to save_fd, or copied into a
+// progress job. Reading pauses while the caller is GUINET_STREAM_WINDOW behind
+static void file_part(ClientConn *c, const char *data, size_t len) {
+    NetJob *progress = malloc(sizeof(NetJob));
+    if (progress == NULL) {
+        abandon_file(c, "Out of memory");
+        return;
+    }
+    current->received = c->received;
+    *progress = *current;
+    progress->type = NET_JOB_PROGRESS;
+    progress->reply = NULL;
+    progress->reply_len = 0;
+
+    if (save_fd >= 0) {
+        size_t written = 0;
+        while (written < len) {
+            ssize_t n = write(save_fd, data + written, len - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                char message[128];
+                snprintf(message, sizeof(message), "Cannot write file: %s", strerror(errno));
+                free(progress);
+                abandon_file(c, message);
+                return;
+            }
+            written += n;
+        }
+    } else {
+        progress->reply = malloc(len + 1);
+        if (progress->reply == NULL) {
+            free(progress);
+            abandon_file(c, "Out of memory");
+            return;
+        }
+        memcpy(progress->reply, data, len);
+        progress->reply[len] = '\0';
+        progress->reply_len = len;
+    }
+
+    pthread_mutex_lock(&net_mutex);
+    push_done(progress);
+    stream_queued += progress->reply_len;
+    int full = stream_queued > GUINET_STREAM_WINDOW;
+    pthread_mutex_unlock(&net_mutex);
+    if (full && !__atomic_load_n(&cancel_requested, __ATOMIC_ACQUIRE)) {
+        client_pause(c, 1);
+    }
+}
+
+static void file_done(ClientConn *c, int status, const char *reply, size_t len) {
+    (void)reply;
+    (void)len;
+    current->received = c->received;
+    if (status == CLIENT_CANCELLED && current->status == NET_ERROR) {
+        status = NET_ERROR;    // Cancelled by abandon_file()
+    }
+    if (save_fd >= 0) {
+        close(save_fd);
+        save_fd = -1;
+        // No partial or error files left behind
+        if (status != NET_OK || current->status != NET_OK) {
+            unlink(current->save_path);
+        }
+    }
+    __atomic_store_n(&cancel_requested, 0, __ATOMIC_RELEASE);
+    complete(status);
+    start_next();
+}
+
+// Start job, which completes from a callback, or here if it cannot start
+static void run_job(NetJob *job) {
+    job->status = NET_OK;
+    current = job;
+
+    switch (job->type) {
+        case NET_JOB_CONNECT: {
+            ClientAddr addr;
+            if (!client_resolve(job->host, job->port, &addr)) {
+                snprintf(job->error, sizeof(job->error), "Unknown host %.100s", job->host);
+                complete(NET_ERROR);
+                return;
+            }
+            last_addr = addr;
+            have_addr = 1;
+            client_close(conn, 0);
+            if (!client_connect(conn, &addr, connected)) {
+                fail(conn->error);
+            }
+            break;
+        }
+        case NET_JOB_DISCONNECT:
+            client_close(conn, 1);
+            complete(NET_OK);
+            break;
+        case NET_JOB_AUTH:
+            // The server closes the connection after a failed login, log in
+            // again on a new one
+            if (conn->state == CLIENT_CLOSED && have_addr) {
+                if (!client_connect(conn, &last_addr, reconnected)) {
+                    fail(conn->error);
+                }
+                break;
+            }
+            send_auth();
+            break;
+        case NET_JOB_REQUEST:
+            if (!client_request(conn, job->message, strlen(job->message), CLIENT_FRAME_SHORT, 0,
+                                NULL, answered)) {
+                fail(conn->error);
+            }
+            break;
+        case NET_JOB_FILE:
+            if (job->save_path[0] != '\0') {
+                save_fd = open(job->save_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (save_fd < 0) {
+                    // Nothing asked yet, the connection stays as it is
+                    snprintf(job->error, sizeof(job->error), "Cannot write file: %s", strerror(errno));
+                    complete(NET_ERROR);
+                    return;
+                }
+            }
+            if (!client_request_file(conn, job->message, 0, file_part, file_done)) {
+                if (save_fd >= 0) {
+                    close(save_fd);
+                    save_fd = -1;
+                    unlink(job->save_path);
+                }
+                fail(conn->error);
+            }
+            break;
+        default:
+            snprintf(job->error, sizeof(job->error), "Unknown job type %d", job->type);
+            complete(NET_ERROR);
+            break;
+    }
+}
+
+// Run queued jobs until one is in flight
+static void start_next() {
+    while (current == NULL) {
+        pthread_mutex_lock(&net_mutex);
+        NetJob *job = running ? queue_head : NULL;
+        if (job != NULL) {
+            queue_head = job->next;
+            if (queue_head == NULL) {
+                queue_tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&net_mutex);
+        if (job == NULL) {
+            return;
+        }
+        run_job(job);
+    }
+}
+
+// wake_fd is readable: a job was queued, a file cancelled or collected
+static void on_wake(void *ctx) {
+    (void)ctx;
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("[NET ERROR] Could not read wake-ups");
+    }
+
+    // A cancel only applies to the file in flight, file_done() clears it
+    int streaming = (current != NULL && current->type == NET_JOB_FILE);
+    if (__atomic_load_n(&cancel_requested, __ATOMIC_ACQUIRE)) {
+        if (streaming) {
+            client_cancel(conn);
+        } else {
+            __atomic_store_n(&cancel_requested, 0, __ATOMIC_RELEASE);
+        }
+    }
+    if (streaming && conn->paused) {
+        pthread_mutex_lock(&net_mutex);
+        int room = stream_queued <= GUINET_STREAM_WINDOW;
+        pthread_mutex_unlock(&net_mutex);
+        if (room) {
+            client_pause(conn, 0);
+        }
+    }
+    start_next();
+}
+
+static void *io_main(void *arg) {
+    (void)arg;
+    start_next();
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        if (!client_poll(loop, client_now_us() + 1000000LL)) {
+            break;
+        }
+    }
+
+    // The job in flight goes with the others, leave the server politely
+    if (current != NULL) {
+        if (save_fd >= 0) {
+            close(save_fd);
+            save_fd = -1;
+            unlink(current->save_path);
+        }
+        snprintf(current->error, sizeof(current->error), "Cancelled");
+        complete(NET_ERROR);
+    }
+    client_close(conn, 1);
+    return NULL;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int guinet_start() {
+    if (running) {
+        return 1;
+    }
+
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_fd < 0 || wake_fd < 0) {
+        perror("[NET ERROR] Could not create eventfd");
+        guinet_stop();
+        return 0;
+    }
+
+    loop = client_loop_new(1);
+    conn = (loop != NULL) ? client_conn_new(loop, NULL) : NULL;
+    if (conn == NULL || !client_watch(loop, wake_fd, on_wake, NULL)) {
+        fprintf(stderr, "[NET ERROR] Could not create client loop\n");
+        guinet_stop();
+        return 0;
+    }
+    conn->quiet_ms = GUINET_QUIET_MS;
+    have_addr = 0;
+
+    running = 1;
+    if (pthread_create(&io_thread, NULL, io_main, NULL) != 0) {
+        perror("[NET ERROR] Could not start I/O thread");
+        running = 0;
+        guinet_stop();
+        return 0;
+    }
+    return 1;
+}
+
+NetJob *guinet_job(int type, void *owner) {
+    NetJob *job = calloc(1, sizeof(NetJob));
+    if (job != NULL) {
+        job->type = type;
+        job->owner = owner;
+    }
+    return job;
+}
+
+int guinet_submit(NetJob *job) {
+    pthread_mutex_lock(&net_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&net_mutex);
+        return 0;
+    }
+
+    job->next = NULL;
+    job->queued_us = client_now_us();
+    if (queue_tail != NULL) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    pending++;
+    pthread_mutex_unlock(&net_mutex);
+
+    wake_io();
+    return 1;
+}
+
+int guinet_fd() {
+    return done_fd;
+}
+
+NetJob *guinet_collect() {
+    uint64_t count;
+    if (read(done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("[NET ERROR] Could not read completions");
+    }
+
+    pthread_mutex_lock(&net_mutex);
+    NetJob *jobs = done_head;
+    done_head = done_tail = NULL;
+
+    // File parts taken off the I/O thread's hands, it may read on
+    int collected = 0;
+    for (NetJob *job = jobs; job != NULL; job = job->next) {
+        if (job->type == NET_JOB_PROGRESS) {
+            stream_queued -= job->reply_len;
+            collected = 1;
+        }
+    }
+    int wake = collected && running;
+    pthread_mutex_unlock(&net_mutex);
+
+    if (wake) {
+        wake_io();
+    }
+    return jobs;
+}
+
+void guinet_free(NetJob *job) {
+    if (job != NULL) {
+        free(job->reply);
+        free(job);
+    }
+}
+
+int guinet_pending() {
+    pthread_mutex_lock(&net_mutex);
+    int count = pending;
+    pthread_mutex_unlock(&net_mutex);
+    return count;
+}
+
+void guinet_cancel() {
+    __atomic_store_n(&cancel_requested, 1, __ATOMIC_RELEASE);
+    if (wake_fd >= 0) {
+        wake_io();
+    }
+}
+
+void guinet_stop() {
+    pthread_mutex_lock(&net_mutex);
+    int was_running = running;
+    running = 0;
+    pthread_mutex_unlock(&net_mutex);
+
+    if (was_running) {
+        // Cut short a wait for the server, the thread exits after that
+        wake_io();
+        pthread_join(io_thread, NULL);
+    }
+
+    // Jobs that never ran and answers nobody collected
+    NetJob *lists[2] = { queue_head, done_head };
+    for (int i = 0; i < 2; i++) {
+        NetJob *job = lists[i];
+        while (job != NULL) {
+            NetJob *next = job->next;
+            guinet_free(job);
+            job = next;
+        }
+    }
+    queue_head = queue_tail = done_head = done_tail = NULL;
+    pending = 0;
+    stream_queued = 0;
+
+    client_loop_free(loop);
+    loop = NULL;
+    conn = NULL;
+    if (done_fd >= 0) {
+        close(done_fd);
+        done_fd = -1;
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+}
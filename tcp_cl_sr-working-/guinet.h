@@ -0,0 +1,120 @@
+#ifndef GUINET_H
+#define GUINET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "clientlib.h"
+
+#define GUINET_MESSAGE_MAX CLIENT_MESSAGE_MAX  // Handshake or request sent
+#define GUINET_CHUNK CLIENT_CHUNK              // File bytes per progress job, at most
+#define GUINET_STREAM_WINDOW (256 * 1024) // File bytes handed over but not collected before reading pauses
+#define GUINET_QUIET_MS CLIENT_QUIET_MS        // Silence that ends a file, which has no end marker
+
+#define NET_JOB_CONNECT 1      // Connect to host:port
+#define NET_JOB_AUTH 2         // Send an AUTH / REGISTER / RESUME message
+#define NET_JOB_REQUEST 3      // Send a menu option or command
+#define NET_JOB_FILE 4         // Option 3, then the file name in message
+#define NET_JOB_DISCONNECT 5   // Send option 5 and close
+#define NET_JOB_PROGRESS 6     // Part of a NET_JOB_FILE answer, made by the I/O thread
+
+#define NET_OK CLIENT_OK
+#define NET_ERROR CLIENT_ERROR           // Connection failed or lost, the socket is closed
+#define NET_REJECTED CLIENT_REJECTED     // Server answered AUTH_FAILED, or the file does not exist
+#define NET_CANCELLED CLIENT_CANCELLED   // File cancelled with guinet_cancel()
+
+/*
+ * Network layer of the GUI client, off the GTK main thread.
+ *
+ * One I/O thread runs a ClientLoop (clientlib.h) with one connection and
+ * runs jobs in the order they were submitted, as the protocol is one
+ * request and one answer at a time. Finished jobs are handed back through
+ * a descriptor that becomes readable (an eventfd, as in authpool.h), which
+ * the GTK main loop watches, so a click never waits on the network.
+ *
+ * How answers end is clientlib's: files have no length or end marker,
+ * they complete when the server has been quiet for GUINET_QUIET_MS or
+ * closes the connection.
+ *
+ * Files are streamed: while one arrives, NET_JOB_PROGRESS jobs carry each
+ * new part (up to GUINET_CHUNK bytes) and the byte count so far, then the
+ * NET_JOB_FILE job completes without a reply. Reading pauses while more
+ * than GUINET_STREAM_WINDOW bytes wait to be collected, so memory stays
+ * bounded however large the file. With save_path set the parts go
+ * straight to that file instead and progress jobs only carry the count.
+ */
+
+typedef struct NetJob {
+    int type;                           // NET_JOB_*
+    char host[256];                     // NET_JOB_CONNECT
+    int port;
+    char message[GUINET_MESSAGE_MAX];   // What to send, the file name for NET_JOB_FILE
+    char save_path[512];                // NET_JOB_FILE: write the file here, empty = stream it back
+    void *owner;                        // Caller data
+
+    // Filled by the I/O thread
+    int status;                         // NET_OK / NET_ERROR / NET_REJECTED / NET_CANCELLED
+    char *reply;                        // Answer, NUL-terminated, NULL if none
+    size_t reply_len;
+    size_t received;                    // File bytes so far (NET_JOB_PROGRESS), in all (NET_JOB_FILE)
+    char error[128];                    // Why, when status is NET_ERROR
+    long long queued_us;                // Monotonic clock, when submitted
+    long long elapsed_us;               // From submission to completion
+
+    struct NetJob *next;
+} NetJob;
+
+/**
+ * Start the I/O thread
+ * Returns: 1 on success, 0 on failure
+ */
+int guinet_start();
+
+/**
+ * Allocate a zeroed job of type for owner
+ * Returns: the job, NULL when out of memory
+ */
+NetJob *guinet_job(int type, void *owner);
+
+/**
+ * Queue a job for the I/O thread, which takes ownership until it is
+ * collected
+ * Returns: 1 if queued, 0 if the thread is not running
+ */
+int guinet_submit(NetJob *job);
+
+/**
+ * Descriptor that is readable while finished jobs are waiting
+ */
+int guinet_fd();
+
+/**
+ * Take every finished job, oldest first. Free each with guinet_free()
+ * Returns: linked list through next, NULL if none
+ */
+NetJob *guinet_collect();
+
+/**
+ * Free a collected job and its reply
+ */
+void guinet_free(NetJob *job);
+
+/**
+ * Returns: number of jobs queued or running
+ */
+int guinet_pending();
+
+/**
+ * Cancel the file being received. The rest the server sends is read and
+ * dropped so the connection stays usable, then the NET_JOB_FILE job
+ * completes with NET_CANCELLED
+ */
+void guinet_cancel();
+
+/**
+ * Drop queued jobs, leave the server (option 5) and stop the thread
+ */
+void guinet_stop();
+
+#endif // GUINET_H
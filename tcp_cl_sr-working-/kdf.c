@@ -0,0 +1,271 @@
+#include "kdf.h"
+#include "auth.h"
+#include <time.h>
+
+// ============================================================================
+// Parameters
+// ============================================================================
+
+const char *kdf_name(uint8_t kdf) {
+    switch (kdf) {
+        case CRED_KDF_PBKDF2: return "pbkdf2";
+        case CRED_KDF_SCRYPT: return "scrypt";
+        default: return "sha256";
+    }
+}
+
+static int kdf_from_name(const char *name, uint8_t *kdf) {
+    if (strcmp(name, "pbkdf2") == 0) {
+        *kdf = CRED_KDF_PBKDF2;
+    } else if (strcmp(name, "scrypt") == 0) {
+        *kdf = CRED_KDF_SCRYPT;
+    } else if (strcmp(name, "sha256") == 0) {
+        *kdf = CRED_KDF_SHA256;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+void kdf_default_params(KdfParams *params) {
+    params->kdf = CRED_KDF_SCRYPT;
+    params->cost = KDF_SCRYPT_DEFAULT_LOG_N;
+    params->param = (KDF_SCRYPT_R << 8) | KDF_SCRYPT_P;
+    params->target_ms = KDF_DEFAULT_TARGET_MS;
+}
+
+// A hand-edited or corrupt policy could make every login hash for minutes
+// or allocate gigabytes. sha256 has no cost (microbench uses it to time the
+// code around the KDF)
+// Returns: NULL if params are usable for new hashes, else what is wrong
+static const char *policy_problem(const KdfParams *params) {
+    if (params->kdf == CRED_KDF_SCRYPT) {
+        uint32_t r = params->param >> 8;
+        uint32_t p = params->param & 0xff;
+        if (params->cost < KDF_SCRYPT_MIN_LOG_N || params->cost > KDF_SCRYPT_MAX_LOG_N) {
+            return "scrypt log2(N) out of range";
+        }
+        if (r < 1 || r > KDF_SCRYPT_MAX_R || p < 1 || p > KDF_SCRYPT_MAX_P) {
+            return "scrypt r or p out of range";
+        }
+        return NULL;
+    }
+    if (params->kdf == CRED_KDF_PBKDF2 &&
+        (params->cost < KDF_PBKDF2_MIN_ITER || params->cost > KDF_PBKDF2_MAX_ITER)) {
+        return "pbkdf2 iterations out of range";
+    }
+    return NULL;
+}
+
+int kdf_load_policy(const char *path, KdfParams *params) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    char name[16];
+    unsigned int cost, param;
+    int target_ms;
+    KdfParams loaded;
+    int ok = (fscanf(fp, "%15s %u %u %d", name, &cost, &param, &target_ms) == 4 &&
+              kdf_from_name(name, &loaded.kdf));
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "[KDF ERROR] Invalid policy file %s, using defaults\n", path);
+        kdf_default_params(params);
+        return 0;
+    }
+
+    loaded.cost = cost;
+    loaded.param = param;
+    loaded.target_ms = target_ms;
+    const char *problem = policy_problem(&loaded);
+    if (problem != NULL) {
+        fprintf(stderr, "[KDF ERROR] Policy file %s: %s (%s cost %u param %u), using defaults\n",
+                path, problem, name, cost, param);
+        kdf_default_params(params);
+        return 0;
+    }
+    *params = loaded;
+    return 1;
+}
+
+int kdf_save_policy(const char *path, const KdfParams *params) {
+    char tmp_path[300];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        perror("[KDF ERROR] Could not write policy file");
+        return 0;
+    }
+    fprintf(fp, "%s %u %u %d\n", kdf_name(params->kdf), params->cost,
+            params->param, params->target_ms);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        perror("[KDF ERROR] Could not flush policy file");
+        fclose(fp);
+        unlink(tmp_path);
+        return 0;
+    }
+    fclose(fp);
+
+    if (rename(tmp_path, path) != 0) {
+        perror("[KDF ERROR] Could not replace policy file");
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+void kdf_params_from_record(const CredRecord *record, KdfParams *params) {
+    params->kdf = record->kdf;
+    params->cost = record->kdf_cost;
+    params->param = record->kdf_param;
+    params->target_ms = 0;
+}
+
+void kdf_params_to_record(const KdfParams *params, CredRecord *record) {
+    record->kdf = params->kdf;
+    record->kdf_cost = params->cost;
+    record->kdf_param = params->param;
+}
+
+int kdf_needs_rehash(const CredRecord *record, const KdfParams *params) {
+    return record->kdf != params->kdf || record->kdf_cost != params->cost ||
+           record->kdf_param != params->param;
+}
+
+// ============================================================================
+// Derivation
+// ============================================================================
+
+int kdf_derive(const char *password, const unsigned char *salt,
+               const KdfParams *params, unsigned char *out) {
+    size_t password_len = strlen(password);
+
+    switch (params->kdf) {
+        case CRED_KDF_SHA256:
+            hash_password(password, salt, out);
+            return 1;
+
+        case CRED_KDF_PBKDF2:
+            return PKCS5_PBKDF2_HMAC(password, password_len, salt, CREDSTORE_SALT,
+                                     params->cost, EVP_sha256(),
+                                     CREDSTORE_HASH, out) == 1;
+
+        case CRED_KDF_SCRYPT: {
+            if (params->cost < KDF_SCRYPT_MIN_LOG_N || params->cost > KDF_SCRYPT_MAX_LOG_N) {
+                return 0;
+            }
+            uint64_t n = (uint64_t)1 << params->cost;
+            uint64_t r = params->param >> 8;
+            uint64_t p = params->param & 0xff;
+            // scrypt needs 128 * r * N * p bytes, allow that plus slack
+            uint64_t maxmem = 128 * r * (n + 2) * (p ? p : 1) + (1 << 20);
+            return EVP_PBE_scrypt(password, password_len, salt, CREDSTORE_SALT,
+                                  n, r, p, maxmem, out, CREDSTORE_HASH) == 1;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+// ============================================================================
+// Calibration
+// ============================================================================
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+double kdf_measure_ms(const KdfParams *params) {
+    unsigned char salt[CREDSTORE_SALT] = {0};
+    unsigned char out[CREDSTORE_HASH];
+    double samples[KDF_SAMPLES];
+
+    for (int i = 0; i < KDF_SAMPLES; i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!kdf_derive("calibration-password", salt, params, out)) {
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[i] = elapsed_ms(&start, &end);
+    }
+
+    // Median, so a single scheduling hiccup does not skew the choice
+    for (int i = 1; i < KDF_SAMPLES; i++) {
+        for (int j = i; j > 0 && samples[j] < samples[j - 1]; j--) {
+            double t = samples[j];
+            samples[j] = samples[j - 1];
+            samples[j - 1] = t;
+        }
+    }
+    return samples[KDF_SAMPLES / 2];
+}
+
+static int calibrate_scrypt(int target_ms, KdfParams *out) {
+    KdfParams candidate;
+    candidate.kdf = CRED_KDF_SCRYPT;
+    candidate.param = (KDF_SCRYPT_R << 8) | KDF_SCRYPT_P;
+    candidate.target_ms = target_ms;
+
+    int found = 0;
+    for (uint32_t log_n = KDF_SCRYPT_MIN_LOG_N; log_n <= KDF_SCRYPT_MAX_LOG_N; log_n++) {
+        candidate.cost = log_n;
+        double ms = kdf_measure_ms(&candidate);
+        printf("[KDF] scrypt N=2^%u r=%d p=%d: %.1f ms (%llu MB)\n", log_n,
+               KDF_SCRYPT_R, KDF_SCRYPT_P, ms,
+               (unsigned long long)((128ull * KDF_SCRYPT_R << log_n) >> 20));
+        if (ms < 0 || ms > target_ms) {
+            break;
+        }
+        *out = candidate;
+        found = 1;
+    }
+    return found;
+}
+
+static int calibrate_pbkdf2(int target_ms, KdfParams *out) {
+    KdfParams candidate;
+    candidate.kdf = CRED_KDF_PBKDF2;
+    candidate.param = 0;
+    candidate.target_ms = target_ms;
+
+    // Cost is linear in the iteration count: measure once, scale, then
+    // step down until the measured time fits
+    candidate.cost = KDF_PBKDF2_MIN_ITER;
+    double ms = kdf_measure_ms(&candidate);
+    printf("[KDF] pbkdf2 %u iterations: %.1f ms\n", candidate.cost, ms);
+    if (ms < 0 || ms > target_ms) {
+        return 0;
+    }
+
+    double scaled = candidate.cost * (target_ms / (ms > 0.01 ? ms : 0.01));
+    candidate.cost = (scaled > 100000000.0) ? 100000000u : (uint32_t)scaled;
+    while (candidate.cost > KDF_PBKDF2_MIN_ITER) {
+        ms = kdf_measure_ms(&candidate);
+        printf("[KDF] pbkdf2 %u iterations: %.1f ms\n", candidate.cost, ms);
+        if (ms >= 0 && ms <= target_ms) {
+            break;
+        }
+        candidate.cost = (uint32_t)(candidate.cost * 0.9);
+    }
+    if (candidate.cost < KDF_PBKDF2_MIN_ITER) {
+        candidate.cost = KDF_PBKDF2_MIN_ITER;
+    }
+
+    *out = candidate;
+    return 1;
+}
+
+int kdf_calibrate(uint8_t kdf, int target_ms, KdfParams *out) {
+    printf("[KDF] Calibrating %s for %d ms per login...\n", kdf_name(kdf), target_ms);
+
+    switch (kdf) {
+        case CRED_KDF_SCRYPT: return calibrate_scrypt(target_ms, out);
+        case CRED_KDF_PBKDF2: return calibrate_pbkdf2(target_ms, out);
+        default: return 0;
+    }
+}
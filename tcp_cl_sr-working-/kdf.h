@@ -0,0 +1,92 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include "credstore.h"
+
+#define KDF_POLICY_FILE "data/kdf_policy.dat"
+#define KDF_DEFAULT_TARGET_MS 100   // Per-login hashing budget
+#define KDF_SAMPLES 3               // Timed runs per candidate during calibration
+
+// scrypt: cost is log2(N), param packs r and p as (r << 8) | p
+#define KDF_SCRYPT_DEFAULT_LOG_N 15
+#define KDF_SCRYPT_MIN_LOG_N 10
+#define KDF_SCRYPT_MAX_LOG_N 22
+#define KDF_SCRYPT_R 8
+#define KDF_SCRYPT_P 1
+#define KDF_SCRYPT_MAX_R 32         // Largest r and p a policy file may ask for
+#define KDF_SCRYPT_MAX_P 16
+
+// PBKDF2-HMAC-SHA256: cost is the iteration count
+#define KDF_PBKDF2_DEFAULT_ITER 600000
+#define KDF_PBKDF2_MIN_ITER 10000
+#define KDF_PBKDF2_MAX_ITER 100000000
+
+// Which KDF new hashes use and with what cost
+typedef struct {
+    uint8_t kdf;           // CRED_KDF_*
+    uint32_t cost;
+    uint32_t param;
+    int target_ms;         // Latency the parameters were calibrated for
+} KdfParams;
+
+/**
+ * Default policy used when no policy file exists (scrypt, N = 2^15)
+ */
+void kdf_default_params(KdfParams *params);
+
+/**
+ * Read the policy written by kdf_save_policy(). A cost or param outside
+ * the KDF_* bounds is refused with an error
+ * Returns: 1 if loaded, 0 if missing (params left untouched) or invalid
+ *          (params set to kdf_default_params())
+ */
+int kdf_load_policy(const char *path, KdfParams *params);
+
+/**
+ * Write the policy atomically
+ * Returns: 1 on success, 0 on failure
+ */
+int kdf_save_policy(const char *path, const KdfParams *params);
+
+/**
+ * Derive a CREDSTORE_HASH byte hash of password with salt and params.
+ * CRED_KDF_SHA256 is the original single salted SHA-256
+ * Returns: 1 on success, 0 on failure
+ */
+int kdf_derive(const char *password, const unsigned char *salt,
+               const KdfParams *params, unsigned char *out);
+
+/**
+ * Parameters stored with a user's record, and back
+ */
+void kdf_params_from_record(const CredRecord *record, KdfParams *params);
+void kdf_params_to_record(const KdfParams *params, CredRecord *record);
+
+/**
+ * Returns: 1 if the record was hashed with other parameters than params
+ */
+int kdf_needs_rehash(const CredRecord *record, const KdfParams *params);
+
+/**
+ * Median time of one derivation with params, in milliseconds
+ */
+double kdf_measure_ms(const KdfParams *params);
+
+/**
+ * Find the most expensive parameters for kdf whose hash time stays within
+ * target_ms on this host, printing each measurement
+ * Returns: 1 on success, 0 if even the minimum cost is over target
+ */
+int kdf_calibrate(uint8_t kdf, int target_ms, KdfParams *out);
+
+/**
+ * Short name ("scrypt", "pbkdf2", "sha256")
+ */
+const char *kdf_name(uint8_t kdf);
+
+#endif // KDF_H
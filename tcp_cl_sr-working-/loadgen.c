@@ -0,0 +1,1491 @@
+#include "clientdef.h"
+#include "capture.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Load generator: many connections on one ClientLoop (clientlib.h), each
+// authenticating like authenticate() in client.c, then sending menu options 1-4.
+//
+// Closed loop (default): every connection waits for an answer (plus a think
+// time) before its next request, so a slow server slows the load down.
+//
+// Open loop (-R): client sessions arrive at a fixed rate whatever the server
+// does. Each one connects, logs in (RESUME after a first login), sends one
+// request and quits; with -k it takes a logged-in connection from a
+// ClientPool instead and gives it back. Latency is measured from the time
+// the session was due, so time spent queued in the client, the accept
+// backlog or behind another client in run_fifo_server() is counted rather
+// than omitted.
+//
+// Replay (-T): re-issues a trace recorded with SERVER_CAPTURE_FILE, each
+// captured connection on its own socket at its original time (divided by
+// -x), so the concurrency and the mix of requests are the real ones.
+//
+// With -S the server is started once per mode listed in -M and the
+// results are printed side by side.
+
+#define LOADGEN_RETRY_MS 200        // Back-off before reconnecting after an error
+#define LOADGEN_PROBE_QUIET_MS 300  // Silence that ends the option 3 probe
+#define LOADGEN_LOGIN_TIMEOUT_MS 10000
+#define LOADGEN_DRAIN_US 5000000LL  // Wait for late answers after the run
+#define LOADGEN_SERVER_START_MS 10000
+#define LOADGEN_MAX_MODES 8
+#define LOADGEN_REPLAY_STALL_MS 5000  // Give up on a replayed answer
+#define LOADGEN_REPLAY_QUIET_MS 100   // Silence that ends a short answer
+
+// Latency histogram in microseconds: exact below 128, then 64 buckets per
+// power of two (under 1.6% error) up to about 2^37 us
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_BUCKETS (HIST_SUB + 31 * HIST_HALF)
+
+// Commands measured, index 1-4 are the menu options
+#define CMD_AUTH 0
+#define CMD_OTHER 5       // Replayed requests that are not an option 1-4
+#define CMD_COUNT 6
+
+// Connection states
+#define LC_CONNECTING 0
+#define LC_AUTH 1         // Handshake sent, waiting for AUTH_OK
+#define LC_THINK 2        // Idle until its timer
+#define LC_WAIT 3         // Request sent, waiting for the answer
+#define LC_RETRY 5        // Reconnect when its timer fires
+#define LC_DONE 6
+#define LC_REPLAY 7       // Next trace event is due when its timer fires
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t errors;
+    uint64_t late;             // Unanswered when the run ended, recorded as a lower bound
+    uint64_t max;
+} Histogram;
+
+// One captured event, see capture.h
+typedef struct {
+    long long at_us;
+    uint8_t type;
+    uint8_t detail;
+    uint16_t length;
+    uint32_t value;            // Replay user index for logins
+    char *payload;
+} TraceEvent;
+
+typedef struct {
+    TraceEvent *events;
+    int count;
+    int cap;
+} TraceConn;
+
+typedef struct {
+    ClientConn *conn;          // Open loop: NULL between sessions
+    int id;
+    int user;
+    int state;
+    int command;               // CMD_* in flight
+    int registering;           // Handshake is a REGISTER
+    int raced;                 // Lost a REGISTER race, handshake is an AUTH
+    int resuming;              // Handshake is a RESUME
+    int ready_once;            // Counted as established
+    int requests;              // Since the last (re)connect
+    long long sent_at;         // us, replay: when the last event went out
+    long long intended;        // us, when an open-loop session was due
+    TraceConn *trace;          // Replay: events of this connection
+    int next_event;
+    int logged_in;
+    int awaiting_name;         // Replay: option 3 sent, file name is next
+} LoadConn;
+
+typedef struct {
+    int connections;
+    int duration;              // Seconds
+    int warmup;                // Seconds not recorded
+    int weights[CMD_COUNT];    // Menu option mix
+    int think_ms;              // Mean think time, uniform in [0, 2 * think_ms]
+    int gap_ms;                // Pause between "3" and the file name
+    int users;
+    const char *user_prefix;
+    const char *password;
+    const char *file;
+    int max_connecting;        // Handshakes in flight while ramping up
+    int pooled;                // Open loop: reuse logged-in connections
+    int reconnect_after;       // Requests before reconnecting with RESUME, 0 = never
+    double rate;               // Open-loop sessions per second, 0 = closed loop
+    const char *server_path;   // Start this server once per mode
+    int modes[LOADGEN_MAX_MODES];
+    int mode_count;
+    const char *server_log;
+    const char *trace_file;    // Replay this capture
+    double speed;              // Replay speed-up, 1 = as captured
+    int csv;
+    const char *hist_file;
+} LoadConfig;
+
+typedef struct {
+    int mode;
+    int port;
+    int ran;
+    double seconds;
+    Histogram hist[CMD_COUNT];
+} ModeResult;
+
+static const char *command_names[CMD_COUNT] = {"auth", "date", "list", "file", "elapsed", "other"};
+static const char *mode_names[] = {"server", "multi-process", "fifo", "mono", "event-loop"};
+
+static LoadConfig config;
+static Histogram hist[CMD_COUNT];
+static LoadConn *conns = NULL;
+static ClientLoop *loop = NULL;
+static ClientAddr server_addr;
+static ClientPool pool;        // -k: logged-in connections between sessions
+static int connecting = 0;
+static int established = 0;
+static char (*user_tokens)[SESSION_TOKEN_MAX] = NULL;
+static size_t file_size = 0;   // Bytes the server sends for option 3
+static long long record_from;  // us, end of warm-up
+static long long end_at;       // us
+
+// Open loop: session k is due at run_start + k / rate
+static long long run_start;
+static long long next_arrival;
+static long long total_arrivals;
+static int *free_slots = NULL;
+static int free_count = 0;
+
+// Replay
+static TraceConn *traces = NULL;
+static long long trace_length_us = 0;
+static int replay_done = 0;
+
+// ============================================================================
+// Time and Histograms
+// ============================================================================
+
+static long long now_us() {
+    return client_now_us();
+}
+
+static int hist_index(uint64_t v) {
+    if (v < HIST_SUB) {
+        return (int)v;
+    }
+    int shift = (63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+    if (shift > 31) {
+        return HIST_BUCKETS - 1;
+    }
+    return shift * HIST_HALF + (int)(v >> shift);
+}
+
+// Highest value that falls in bucket index
+static uint64_t hist_value(int index) {
+    if (index < HIST_SUB) {
+        return index;
+    }
+    int shift = index / HIST_HALF - 1;
+    uint64_t mantissa = index - shift * HIST_HALF;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static void hist_record_at(Histogram *h, long long start, long long now) {
+    if (start < record_from) {
+        return;
+    }
+    uint64_t v = (now > start) ? (uint64_t)(now - start) : 0;
+    h->counts[hist_index(v)]++;
+    h->total++;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+// An answer still missing at the end counts with the time waited so far
+static void hist_record(Histogram *h, long long start) {
+    hist_record_at(h, start, now_us());
+}
+
+static void hist_record_late(Histogram *h, long long start) {
+    if (start < record_from) {
+        return;
+    }
+    hist_record(h, start);
+    h->late++;
+}
+
+static uint64_t hist_percentile(const Histogram *h, double percentile) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * h->total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = hist_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+// ============================================================================
+// Connections
+// ============================================================================
+
+static int open_loop() {
+    return config.rate > 0;
+}
+
+static int replaying() {
+    return config.trace_file != NULL;
+}
+
+static int conn_open(const LoadConn *c) {
+    return c->conn != NULL && c->conn->state != CLIENT_CLOSED;
+}
+
+// Answers may take long under load: late ones are counted when the run
+// ends rather than timed out, except in a replay
+static void conn_setup(ClientConn *conn) {
+    conn->connect_timeout_ms = 0;
+    conn->reply_timeout_ms = replaying() ? LOADGEN_REPLAY_STALL_MS : 0;
+    conn->quiet_ms = replaying() ? LOADGEN_REPLAY_QUIET_MS : 0;
+    conn->name_gap_ms = config.gap_ms;
+}
+
+static void conn_drop(LoadConn *c) {
+    if (c->conn != NULL) {
+        client_timer_cancel(c->conn);
+        client_close(c->conn, 0);
+    }
+}
+
+static void timer_expired(ClientConn *conn);
+static void replay_advance(LoadConn *c);
+
+static void timer_set(LoadConn *c, int state, long long wake_at) {
+    c->state = state;
+    client_timer(c->conn, wake_at, timer_expired);
+}
+
+// Replay: the captured connection is over
+static void replay_end(LoadConn *c) {
+    conn_drop(c);
+    if (c->state != LC_DONE) {
+        c->state = LC_DONE;
+        replay_done++;
+    }
+}
+
+// Open loop: the session is over, its slot takes the next arrival. With
+// goodbye the connection leaves with option 5, or goes back to the pool
+static void session_end(LoadConn *c, int goodbye) {
+    if (c->conn != NULL) {
+        if (config.pooled && goodbye) {
+            client_pool_give(&pool, c->conn);
+        } else {
+            client_close(c->conn, goodbye);
+            client_conn_free(c->conn);
+        }
+        c->conn = NULL;
+    }
+    c->state = LC_DONE;
+    free_slots[free_count++] = c->id;
+}
+
+static void conn_fail(LoadConn *c, int command) {
+    hist[command].errors++;
+    if (open_loop()) {
+        session_end(c, 0);
+        return;
+    }
+    if (replaying()) {
+        replay_end(c);
+        return;
+    }
+    conn_drop(c);
+    if (!c->ready_once) {
+        connecting--;
+    }
+    c->resuming = 0;
+    timer_set(c, LC_RETRY, now_us() + LOADGEN_RETRY_MS * 1000LL);
+}
+
+static void connected(ClientConn *conn, int status, const char *reply, size_t len);
+
+static void conn_start(LoadConn *c) {
+    c->state = LC_CONNECTING;
+    c->requests = 0;
+    if (!c->ready_once) {
+        connecting++;
+    }
+    if (!client_connect(c->conn, &server_addr, connected)) {
+        conn_fail(c, CMD_AUTH);
+    }
+}
+
+static void auth_done(ClientConn *conn, int status, const char *reply, size_t len);
+
+// Same messages authenticate() and resume_cached_session() send
+static void send_handshake(LoadConn *c) {
+    char message[MAX_BUFFER];
+    char username[64];
+    snprintf(username, sizeof(username), "%s%d", config.user_prefix, c->user);
+
+    if (c->resuming && user_tokens[c->user][0] != '\0') {
+        client_auth_message(message, sizeof(message), "RESUME", username, user_tokens[c->user]);
+    } else {
+        c->resuming = 0;
+        client_auth_message(message, sizeof(message), c->registering ? "REGISTER" : "AUTH",
+                            username, config.password);
+    }
+
+    c->state = LC_AUTH;
+    if (!client_handshake(c->conn, message, auth_done)) {
+        conn_fail(c, CMD_AUTH);
+    }
+}
+
+static int pick_command() {
+    int total = 0;
+    for (int i = 1; i < CMD_COUNT; i++) {
+        total += config.weights[i];
+    }
+    int r = rand() % total;
+    for (int i = 1; i < CMD_COUNT; i++) {
+        if (r < config.weights[i]) {
+            return i;
+        }
+        r -= config.weights[i];
+    }
+    return 1;
+}
+
+static void next_request(LoadConn *c);
+
+// Timers have 1 ms ticks, without a think time the next request goes out now
+static void think(LoadConn *c) {
+    if (config.think_ms <= 0) {
+        next_request(c);
+        return;
+    }
+    long long pause = rand() % (2 * config.think_ms * 1000 + 1);
+    timer_set(c, LC_THINK, now_us() + pause);
+}
+
+static void request_done(ClientConn *conn, int status, const char *reply, size_t len);
+
+// Options 1, 2 and 4 answer with one short write, option 3 with the file
+// (size measured by the probe)
+static void send_request(LoadConn *c) {
+    c->requests++;
+    c->state = LC_WAIT;
+    int sent;
+    if (c->command == 3) {
+        sent = client_request_file(c->conn, config.file, file_size, NULL, request_done);
+    } else {
+        char option[4];
+        snprintf(option, sizeof(option), "%d", c->command);
+        sent = client_request(c->conn, option, strlen(option), CLIENT_FRAME_SHORT, 0, NULL,
+                              request_done);
+    }
+    if (!sent) {
+        conn_fail(c, c->command);
+    }
+}
+
+static void next_request(LoadConn *c) {
+    if (now_us() >= end_at) {
+        client_close(c->conn, 1);
+        c->state = LC_DONE;
+        return;
+    }
+
+    // Exercise the RESUME path every reconnect_after requests
+    if (config.reconnect_after > 0 && c->requests >= config.reconnect_after) {
+        client_close(c->conn, 1);
+        c->resuming = 1;
+        conn_start(c);
+        return;
+    }
+
+    c->command = pick_command();
+    send_request(c);
+}
+
+// Open loop: begin session k in a free slot
+static void arrival_start(long long k) {
+    LoadConn *c = &conns[free_slots[--free_count]];
+    c->intended = run_start + (long long)(k * 1e6 / config.rate);
+    c->command = pick_command();
+    c->user = (int)(k % config.users);
+    c->registering = 0;
+    c->raced = 0;
+    c->resuming = 1;
+
+    if (config.pooled) {
+        char username[64];
+        snprintf(username, sizeof(username), "%s%d", config.user_prefix, c->user);
+        c->conn = client_pool_take(&pool, username);
+        if (c->conn != NULL) {
+            c->conn->owner = c;
+            send_request(c);
+            return;
+        }
+    }
+    c->conn = client_conn_new(loop, c);
+    if (c->conn == NULL) {
+        conn_fail(c, CMD_AUTH);
+        return;
+    }
+    conn_setup(c->conn);
+    conn_start(c);
+}
+
+static void connected(ClientConn *conn, int status, const char *reply, size_t len) {
+    LoadConn *c = conn->owner;
+    (void)reply;
+    (void)len;
+    if (status != CLIENT_OK) {
+        conn_fail(c, CMD_AUTH);
+        return;
+    }
+    // A replayed login goes out when the capture says, a retry now
+    if (replaying() && !c->registering && !c->raced) {
+        replay_advance(c);
+    } else {
+        send_handshake(c);
+    }
+}
+
+static void auth_done(ClientConn *conn, int status, const char *reply, size_t len) {
+    LoadConn *c = conn->owner;
+    (void)len;
+    if (status == CLIENT_OK) {
+        hist_record(&hist[CMD_AUTH], open_loop() ? c->intended : conn->sent_us);
+        strncpy(user_tokens[c->user], conn->token, SESSION_TOKEN_MAX - 1);
+        if (!c->ready_once) {
+            c->ready_once = 1;
+            connecting--;
+            established++;
+        }
+        c->resuming = 0;
+        c->raced = 0;
+        c->logged_in = 1;
+        if (open_loop()) {
+            send_request(c);
+        } else if (replaying()) {
+            replay_advance(c);
+        } else {
+            think(c);
+        }
+        return;
+    }
+    if (status != CLIENT_REJECTED) {
+        conn_fail(c, CMD_AUTH);
+        return;
+    }
+
+    // The connection stays open after a failed RESUME
+    if (c->resuming) {
+        c->resuming = 0;
+        user_tokens[c->user][0] = '\0';
+        send_handshake(c);
+        return;
+    }
+
+    // Unknown user: register it on a new connection, as a user would
+    if (!c->registering && !c->raced && strstr(reply, "Invalid credentials") != NULL) {
+        c->registering = 1;
+        if (!c->ready_once) {
+            connecting--;
+        }
+        conn_start(c);
+        return;
+    }
+
+    // Another connection registered the user first (a replay has one per
+    // captured login): log in as it instead
+    if (c->registering && strstr(reply, "already exists") != NULL) {
+        c->registering = 0;
+        c->raced = 1;
+        if (!c->ready_once) {
+            connecting--;
+        }
+        conn_start(c);
+        return;
+    }
+
+    if (config.csv == 0 && hist[CMD_AUTH].errors < 5) {
+        fprintf(stderr, "[LOAD] Handshake failed for connection %d: %s\n", c->id, reply);
+    }
+    c->registering = 0;
+    c->raced = 0;
+    conn_fail(c, CMD_AUTH);
+}
+
+// A missing file (CLIENT_REJECTED) is an answer like any other
+static void request_done(ClientConn *conn, int status, const char *reply, size_t len) {
+    LoadConn *c = conn->owner;
+    (void)reply;
+    (void)len;
+    if (status == CLIENT_ERROR) {
+        conn_fail(c, c->command);
+        return;
+    }
+
+    if (replaying()) {
+        // Answers like option 4's change size between runs: a shorter one
+        // ended once the server had been quiet for a moment
+        if (conn->received >= conn->expected) {
+            hist_record(&hist[c->command], conn->sent_us);
+        } else {
+            hist_record_at(&hist[c->command], conn->sent_us, conn->last_byte_us);
+        }
+        replay_advance(c);
+    } else if (open_loop()) {
+        hist_record(&hist[c->command], c->intended);
+        session_end(c, 1);
+    } else {
+        hist_record(&hist[c->command], conn->sent_us);
+        think(c);
+    }
+}
+
+static void timer_expired(ClientConn *conn) {
+    LoadConn *c = conn->owner;
+    switch (c->state) {
+        case LC_THINK:
+            next_request(c);
+            break;
+        case LC_RETRY:
+            if (now_us() < end_at) {
+                conn_start(c);
+            } else {
+                c->state = LC_DONE;
+            }
+            break;
+        case LC_REPLAY:
+            replay_advance(c);
+            break;
+        default:
+            break;
+    }
+}
+
+// ============================================================================
+// Replay
+// ============================================================================
+
+// Send one captured request
+// Returns: 1 if the connection now waits for the answer or has ended
+static int replay_request(LoadConn *c, const TraceEvent *e) {
+    // Admin requests were captured without their arguments
+    if (!c->logged_in || (e->length >= 6 && strncmp(e->payload, "ADMIN:", 6) == 0)) {
+        return 0;
+    }
+
+    int choice = 0;
+    if (!c->awaiting_name) {
+        char option[8];
+        size_t n = e->length < sizeof(option) - 1 ? e->length : sizeof(option) - 1;
+        memcpy(option, e->payload, n);
+        option[n] = '\0';
+        choice = atoi(option);
+        c->command = (choice >= 1 && choice <= 4) ? choice : CMD_OTHER;
+    }
+    if (choice == 5) {
+        client_close(c->conn, 1);
+        replay_end(c);
+        return 1;
+    }
+
+    // Wait for as many bytes as the server sent when the trace was taken.
+    // Option 3 itself has no answer, its file name is the next event
+    const TraceEvent *answer = e + 1;
+    int answered = (choice != 3 && c->next_event < c->trace->count &&
+                    answer->type == CAPTURE_RESPONSE && answer->value > 0);
+    c->awaiting_name = (choice == 3);
+    if (!answered) {
+        if (!client_send(c->conn, e->payload, e->length)) {
+            conn_fail(c, c->command);
+            return 1;
+        }
+        c->sent_at = now_us();
+        return 0;
+    }
+
+    c->next_event++;
+    c->state = LC_WAIT;
+    if (!client_request(c->conn, e->payload, e->length, CLIENT_FRAME_SIZED, answer->value,
+                        NULL, request_done)) {
+        conn_fail(c, c->command);
+    }
+    return 1;
+}
+
+// Issue the events of c that are due, until one is in the future or has
+// to wait for the server
+static void replay_advance(LoadConn *c) {
+    while (c->next_event < c->trace->count) {
+        const TraceEvent *e = &c->trace->events[c->next_event];
+        long long due = run_start + (long long)(e->at_us / config.speed);
+        // Keep "3" and the file name apart, or the server reads them as one
+        if (c->awaiting_name && due < c->sent_at + config.gap_ms * 1000LL) {
+            due = c->sent_at + config.gap_ms * 1000LL;
+        }
+        if (due > now_us()) {
+            timer_set(c, LC_REPLAY, due);
+            return;
+        }
+        c->next_event++;
+
+        if (e->type == CAPTURE_CONNECT) {
+            conn_start(c);
+            return;
+        }
+        if (e->type == CAPTURE_LOGIN && !c->logged_in && conn_open(c)) {
+            // A login after a successful one was a retry of a failed RESUME
+            c->user = (int)e->value;
+            c->resuming = (e->detail == CAPTURE_LOGIN_RESUME);
+            c->registering = 0;
+            c->raced = 0;
+            send_handshake(c);
+            return;
+        }
+        if (e->type == CAPTURE_REQUEST && conn_open(c) && replay_request(c, e)) {
+            return;
+        }
+        if (e->type == CAPTURE_CLOSE) {
+            break;
+        }
+    }
+    replay_end(c);
+}
+
+// Group the records of a trace by connection, users become <prefix><n>
+// Returns: number of connections, -1 on error
+static int load_trace(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    CaptureFileHeader header;
+    if (fp == NULL || !capture_read_header(fp, &header)) {
+        fprintf(stderr, "ERROR: %s is not a capture trace\n", path);
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return -1;
+    }
+
+    int count = 0;                // Connections, ids are 1..count
+    int user_count = 0;
+    int user_cap = 0;
+    uint32_t *user_ids = NULL;
+    CaptureRecord record;
+    char payload[CAPTURE_PAYLOAD_MAX];
+    int status;
+    while ((status = capture_read_record(fp, &record, payload)) == 1) {
+        if (record.conn == 0) {
+            continue;
+        }
+        if ((int)record.conn > count) {
+            TraceConn *grown = realloc(traces, sizeof(TraceConn) * record.conn);
+            if (grown == NULL) {
+                break;
+            }
+            memset(grown + count, 0, sizeof(TraceConn) * (record.conn - count));
+            traces = grown;
+            count = record.conn;
+        }
+
+        TraceConn *t = &traces[record.conn - 1];
+        if (t->count == t->cap) {
+            int cap = t->cap ? t->cap * 2 : 16;
+            TraceEvent *grown = realloc(t->events, sizeof(TraceEvent) * cap);
+            if (grown == NULL) {
+                break;
+            }
+            t->events = grown;
+            t->cap = cap;
+        }
+
+        TraceEvent *e = &t->events[t->count++];
+        e->at_us = (long long)record.at_us;
+        e->type = record.type;
+        e->detail = record.detail;
+        e->length = record.length;
+        e->value = record.value;
+        e->payload = NULL;
+        if (record.length > 0) {
+            e->payload = malloc(record.length);
+            if (e->payload != NULL) {
+                memcpy(e->payload, payload, record.length);
+            } else {
+                e->length = 0;
+            }
+        }
+
+        // Number users in order of appearance
+        if (record.type == CAPTURE_LOGIN) {
+            int u = 0;
+            while (u < user_count && user_ids[u] != record.value) {
+                u++;
+            }
+            if (u == user_count) {
+                if (user_count == user_cap) {
+                    user_cap = user_cap ? user_cap * 2 : 64;
+                    uint32_t *grown = realloc(user_ids, sizeof(uint32_t) * user_cap);
+                    if (grown == NULL) {
+                        break;
+                    }
+                    user_ids = grown;
+                }
+                user_ids[user_count++] = record.value;
+            }
+            e->value = (uint32_t)u;
+        }
+        if (e->at_us > trace_length_us) {
+            trace_length_us = e->at_us;
+        }
+    }
+    fclose(fp);
+    free(user_ids);
+
+    if (status < 0) {
+        fprintf(stderr, "[LOAD] Trace damaged, replaying the part before it\n");
+    }
+    config.users = user_count > 0 ? user_count : 1;
+    return count;
+}
+
+// ============================================================================
+// Blocking Logins and the Option 3 Probe
+// ============================================================================
+
+// Log user in, registering it when it does not exist
+// Returns: the logged-in connection with the token in user_tokens, NULL on failure
+static ClientConn *login_blocking(int user) {
+    char username[64];
+    snprintf(username, sizeof(username), "%s%d", config.user_prefix, user);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        ClientConn *conn = client_conn_new(loop, NULL);
+        if (conn == NULL) {
+            return NULL;
+        }
+        conn->reply_timeout_ms = LOADGEN_LOGIN_TIMEOUT_MS;
+        if (!client_connect(conn, &server_addr, NULL) || client_wait(conn) != CLIENT_OK) {
+            fprintf(stderr, "ERROR connecting: %s\n", conn->error);
+            client_conn_free(conn);
+            return NULL;
+        }
+
+        char message[MAX_BUFFER];
+        client_auth_message(message, sizeof(message), attempt ? "REGISTER" : "AUTH",
+                            username, config.password);
+        int status = client_handshake(conn, message, NULL) ? client_wait(conn) : CLIENT_ERROR;
+        if (status == CLIENT_OK) {
+            strncpy(user_tokens[user], conn->token, SESSION_TOKEN_MAX - 1);
+            return conn;
+        }
+        int unknown = (status == CLIENT_REJECTED && strstr(conn->error, "Invalid credentials") != NULL);
+        client_conn_free(conn);
+        if (!unknown) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Ask for the file once to learn how many bytes an option 3 answer has
+static int probe_file_size() {
+    ClientConn *conn = login_blocking(0);
+    if (conn == NULL) {
+        fprintf(stderr, "ERROR: Could not log in as %s0 to probe option 3\n", config.user_prefix);
+        return 0;
+    }
+
+    conn->name_gap_ms = config.gap_ms;
+    conn->quiet_ms = LOADGEN_PROBE_QUIET_MS;
+    file_size = 0;
+    if (client_request_file(conn, config.file, 0, NULL, NULL) &&
+        client_wait(conn) != CLIENT_ERROR) {
+        file_size = conn->received;
+    }
+    client_close(conn, 1);
+    client_conn_free(conn);
+    return file_size > 0;
+}
+
+// Open loop: log every user in before the clock starts so sessions RESUME
+// and the run measures the server rather than the password hash. With -k
+// the connections wait in the pool for each user's first session
+static void prime_users() {
+    int failed = 0;
+    for (int user = 0; user < config.users; user++) {
+        ClientConn *conn = login_blocking(user);
+        if (conn == NULL) {
+            failed++;
+            continue;
+        }
+        if (config.pooled) {
+            conn_setup(conn);
+            client_pool_give(&pool, conn);
+        } else {
+            client_close(conn, 1);
+            client_conn_free(conn);
+        }
+    }
+    if (failed > 0) {
+        fprintf(stderr, "[LOAD] %d of %d users could not log in ahead of the run\n",
+                failed, config.users);
+    }
+}
+
+// ============================================================================
+// Runs
+// ============================================================================
+
+static int run_closed_loop() {
+    int started = 0;
+    while (1) {
+        // Ramp up without flooding the server's accept backlog
+        while (started < config.connections && connecting < config.max_connecting &&
+               now_us() < end_at) {
+            conn_start(&conns[started]);
+            started++;
+        }
+
+        long long now = now_us();
+        if (!client_poll(loop, now < end_at ? end_at : now + 1000000LL)) {
+            return 0;
+        }
+
+        // Stop once the time is up and no answer is still outstanding
+        now = now_us();
+        if (now >= end_at) {
+            int done = 1;
+            for (int i = 0; i < started; i++) {
+                if (conns[i].state == LC_WAIT) {
+                    done = 0;
+                } else if (conns[i].state != LC_DONE) {
+                    if (conns[i].state == LC_THINK) {
+                        client_close(conns[i].conn, 1);
+                    }
+                    conn_drop(&conns[i]);
+                    conns[i].state = LC_DONE;
+                }
+            }
+            if (done) {
+                return 1;
+            }
+            if (now > end_at + LOADGEN_DRAIN_US) {
+                break;
+            }
+        }
+    }
+
+    // Give up on answers more than LOADGEN_DRAIN_US late
+    for (int i = 0; i < started; i++) {
+        if (conns[i].state == LC_WAIT) {
+            hist_record_late(&hist[conns[i].command], conns[i].conn->sent_us);
+            conn_drop(&conns[i]);
+            conns[i].state = LC_DONE;
+        }
+    }
+    return 1;
+}
+
+static int run_open_loop() {
+    while (1) {
+        // Start every session that is due, as long as a connection is free;
+        // the others wait here and their latency keeps counting
+        long long now = now_us();
+        while (free_count > 0 && next_arrival < total_arrivals &&
+               run_start + (long long)(next_arrival * 1e6 / config.rate) <= now) {
+            arrival_start(next_arrival++);
+        }
+
+        if (next_arrival == total_arrivals && free_count == config.connections) {
+            return 1;
+        }
+        if (now > end_at + LOADGEN_DRAIN_US) {
+            break;
+        }
+
+        long long wake_at = now + 1000000LL;
+        if (free_count > 0 && next_arrival < total_arrivals) {
+            wake_at = run_start + (long long)(next_arrival * 1e6 / config.rate);
+        }
+        if (!client_poll(loop, wake_at)) {
+            return 0;
+        }
+    }
+
+    // Sessions still running or never started count with the time waited
+    for (int i = 0; i < config.connections; i++) {
+        if (conns[i].state != LC_DONE) {
+            hist_record_late(&hist[conns[i].command], conns[i].intended);
+            session_end(&conns[i], 0);
+        }
+    }
+    for (; next_arrival < total_arrivals; next_arrival++) {
+        hist_record_late(&hist[pick_command()],
+                         run_start + (long long)(next_arrival * 1e6 / config.rate));
+    }
+    return 1;
+}
+
+static int run_replay() {
+    while (replay_done < config.connections) {
+        long long now = now_us();
+        if (now > end_at + LOADGEN_DRAIN_US) {
+            break;
+        }
+        if (!client_poll(loop, now + 1000000LL)) {
+            return 0;
+        }
+    }
+
+    // Whatever is still waiting for an answer counts with the time waited
+    for (int i = 0; i < config.connections; i++) {
+        if (conns[i].state == LC_WAIT) {
+            hist_record_late(&hist[conns[i].command], conns[i].conn->sent_us);
+        }
+        replay_end(&conns[i]);
+    }
+    return 1;
+}
+
+// One measured run against serv_addr, results are left in hist
+static int run_load() {
+    memset(hist, 0, sizeof(hist));
+    memset(user_tokens, 0, sizeof(*user_tokens) * config.users);
+    client_pool_init(&pool, config.users);
+    connecting = 0;
+    established = 0;
+
+    if (!replaying() && config.weights[3] > 0 && !probe_file_size()) {
+        return 0;
+    }
+    if (open_loop()) {
+        if (!config.csv) {
+            printf("[LOAD] Logging in %d users...\n", config.users);
+            fflush(stdout);
+        }
+        prime_users();
+    }
+
+    free_count = 0;
+    for (int i = config.connections - 1; i >= 0; i--) {
+        client_conn_free(conns[i].conn);   // Left by the previous mode's run
+        memset(&conns[i], 0, sizeof(LoadConn));
+        conns[i].id = i;
+        conns[i].user = i % config.users;
+        conns[i].state = LC_DONE;
+        if (open_loop()) {
+            // Sessions come and go, there is no ramp-up to pace
+            conns[i].ready_once = 1;
+            free_slots[free_count++] = i;
+        } else {
+            conns[i].conn = client_conn_new(loop, &conns[i]);
+            conn_setup(conns[i].conn);
+        }
+        if (replaying()) {
+            conns[i].ready_once = 1;
+            conns[i].trace = &traces[i];
+            conns[i].state = LC_REPLAY;
+        }
+    }
+
+    run_start = now_us();
+    record_from = run_start + config.warmup * 1000000LL;
+    end_at = record_from + config.duration * 1000000LL;
+    next_arrival = 0;
+    total_arrivals = (long long)(config.rate * (config.warmup + config.duration));
+
+    int ran;
+    if (replaying()) {
+        replay_done = 0;
+        end_at = run_start + (long long)(trace_length_us / config.speed) + 1;
+        for (int i = 0; i < config.connections; i++) {
+            replay_advance(&conns[i]);
+        }
+        ran = run_replay();
+    } else {
+        ran = open_loop() ? run_open_loop() : run_closed_loop();
+    }
+
+    if (config.pooled && !config.csv) {
+        printf("[LOAD] Pool: %llu sessions reused a connection, %llu connected\n",
+               (unsigned long long)pool.hits, (unsigned long long)pool.misses);
+    }
+    client_pool_drain(&pool);
+    return ran;
+}
+
+// ============================================================================
+// Server Modes
+// ============================================================================
+
+static const char *mode_name(int mode) {
+    if (mode >= 1 && mode < (int)(sizeof(mode_names) / sizeof(mode_names[0]))) {
+        return mode_names[mode];
+    }
+    return "other";
+}
+
+// Start the server and answer its mode prompt, in its own process group so
+// the children of multi-process mode are stopped with it
+static pid_t spawn_server(int mode, int port) {
+    int prompt[2];
+    if (pipe(prompt) < 0) {
+        perror("ERROR creating pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ERROR on fork");
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(prompt[0], STDIN_FILENO);
+        close(prompt[0]);
+        close(prompt[1]);
+        const char *log = config.server_log ? config.server_log : "/dev/null";
+        int out = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (out >= 0) {
+            dup2(out, STDOUT_FILENO);
+            dup2(out, STDERR_FILENO);
+            close(out);
+        }
+        char port_arg[16];
+        snprintf(port_arg, sizeof(port_arg), "%d", port);
+        execl(config.server_path, config.server_path, port_arg, (char *)NULL);
+        _exit(127);
+    }
+
+    setpgid(pid, pid);
+    close(prompt[0]);
+    char answer[16];
+    int len = snprintf(answer, sizeof(answer), "%d\n", mode);
+    if (write(prompt[1], answer, len) != len) {
+        perror("ERROR answering the server prompt");
+    }
+    close(prompt[1]);
+    return pid;
+}
+
+// Returns: 1 once the server accepts connections, 0 if it exited or timed out
+static int wait_for_server(pid_t pid) {
+    for (int waited = 0; waited < LOADGEN_SERVER_START_MS; waited += 50) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return 0;
+        }
+        int fd = socket(server_addr.addr.ss_family, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&server_addr.addr, server_addr.len) == 0) {
+            close(fd);
+            return 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        usleep(50000);
+    }
+    return 0;
+}
+
+static void stop_server(pid_t pid) {
+    kill(-pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    while (waitpid(-pid, NULL, WNOHANG) > 0) {
+    }
+}
+
+// ============================================================================
+// Report
+// ============================================================================
+
+static void print_header(int with_mode) {
+    if (config.csv) {
+        printf("%scommand,count,errors,late,ops_per_sec,p50_us,p90_us,p99_us,p999_us,max_us\n",
+               with_mode ? "mode," : "");
+    } else {
+        printf("\n%s%-8s %10s %8s %6s %10s %9s %9s %9s %9s %9s\n", with_mode ? "mode           " : "",
+               "command", "count", "errors", "late", "ops/s", "p50 ms", "p90 ms", "p99 ms",
+               "p99.9 ms", "max ms");
+    }
+}
+
+// One row per command, prefixed with mode when comparing server modes
+// Returns: menu requests answered
+static uint64_t print_rows(const char *mode, const Histogram *hists, double seconds) {
+    uint64_t total = 0;
+    for (int i = 0; i < CMD_COUNT; i++) {
+        const Histogram *h = &hists[i];
+        if (h->total == 0 && h->errors == 0) {
+            continue;
+        }
+        total += (i == CMD_AUTH) ? 0 : h->total - h->late;
+        double rate = (h->total - h->late) / seconds;
+        if (config.csv) {
+            if (mode != NULL) {
+                printf("%s,", mode);
+            }
+            printf("%s,%llu,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu\n", command_names[i],
+                   (unsigned long long)h->total, (unsigned long long)h->errors,
+                   (unsigned long long)h->late, rate,
+                   (unsigned long long)hist_percentile(h, 50),
+                   (unsigned long long)hist_percentile(h, 90),
+                   (unsigned long long)hist_percentile(h, 99),
+                   (unsigned long long)hist_percentile(h, 99.9),
+                   (unsigned long long)h->max);
+        } else {
+            if (mode != NULL) {
+                printf("%-14s ", mode);
+            }
+            printf("%-8s %10llu %8llu %6llu %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n", command_names[i],
+                   (unsigned long long)h->total, (unsigned long long)h->errors,
+                   (unsigned long long)h->late, rate,
+                   hist_percentile(h, 50) / 1000.0, hist_percentile(h, 90) / 1000.0,
+                   hist_percentile(h, 99) / 1000.0, hist_percentile(h, 99.9) / 1000.0,
+                   h->max / 1000.0);
+        }
+    }
+    return total;
+}
+
+static void print_summary(const char *mode, uint64_t total, double seconds) {
+    if (config.csv) {
+        return;
+    }
+    printf("%s%s%sMenu requests: %llu answered in %.1f s (%.1f/s)", mode ? "[" : "",
+           mode ? mode : "", mode ? "] " : "", (unsigned long long)total, seconds, total / seconds);
+    if (open_loop()) {
+        printf(", %.1f/s offered\n", config.rate);
+    } else if (replaying()) {
+        printf(", %d connections replayed at %gx\n", config.connections, config.speed);
+    } else {
+        printf(", %d of %d connections established\n", established, config.connections);
+    }
+}
+
+// Percentile distribution per command, one block each, HdrHistogram style
+static void write_histograms(FILE *fp, const char *mode, const Histogram *hists) {
+    for (int i = 0; i < CMD_COUNT; i++) {
+        const Histogram *h = &hists[i];
+        if (h->total == 0) {
+            continue;
+        }
+        fprintf(fp, "# %s%s%s\n%12s %14s %10s %14s\n", mode ? mode : "", mode ? " " : "",
+                command_names[i], "Value(ms)", "Percentile", "TotalCount", "1/(1-Percentile)");
+        uint64_t seen = 0;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            if (h->counts[b] == 0) {
+                continue;
+            }
+            seen += h->counts[b];
+            double fraction = (double)seen / h->total;
+            fprintf(fp, "%12.3f %14.12f %10llu %14.2f\n", hist_value(b) / 1000.0, fraction,
+                    (unsigned long long)seen, fraction < 1.0 ? 1.0 / (1.0 - fraction) : 0.0);
+        }
+        fprintf(fp, "#[Mean max = %.3f, Total count = %llu]\n\n", h->max / 1000.0,
+                (unsigned long long)h->total);
+    }
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s <hostname> <port> [options]\n"
+            "  -c N     connections, or sessions at once with -R (default 100)\n"
+            "  -d SEC   duration (default 10)\n"
+            "  -w SEC   warm-up not recorded (default 0)\n"
+            "  -m MIX   option weights, e.g. 1:40,2:30,3:0,4:30 (default)\n"
+            "  -t MS    mean think time between requests (default 0)\n"
+            "  -g MS    pause between option 3 and the file name (default 5)\n"
+            "  -f FILE  file for option 3 (default my_data.txt)\n"
+            "  -u N     distinct users (default: one per connection)\n"
+            "  -U NAME  username prefix (default load)\n"
+            "  -p PASS  password (default loadpass)\n"
+            "  -P N     handshakes in flight while ramping up (default 64)\n"
+            "  -r N     reconnect with RESUME every N requests (default never)\n"
+            "  -R RATE  open loop: RATE sessions per second of one request each\n"
+            "  -k       with -R, sessions reuse their user's logged-in connection\n"
+            "  -S PATH  start server PATH once per mode, on port, port+1, ...\n"
+            "  -M LIST  server modes for -S (default 1,2,3,4)\n"
+            "  -L FILE  append server output to FILE (default /dev/null)\n"
+            "  -T FILE  replay a trace captured with SERVER_CAPTURE_FILE\n"
+            "  -x N     replay N times faster than captured (default 1)\n"
+            "  -H FILE  write percentile distributions to FILE\n"
+            "  -C       CSV output\n"
+            "Unknown users are registered. Raise AUTH_RATE_IP/AUTH_BURST_IP on the\n"
+            "server, every connection comes from the same address (-S does).\n"
+            "-k keeps a connection per user open: modes 2 and 3 serve one at a time.\n", prog);
+    exit(1);
+}
+
+static void parse_mix(const char *mix) {
+    memset(config.weights, 0, sizeof(config.weights));
+    char copy[128];
+    strncpy(copy, mix, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        int option, weight;
+        if (sscanf(item, "%d:%d", &option, &weight) != 2 || option < 1 || option > 4 || weight < 0) {
+            fprintf(stderr, "ERROR: Bad mix entry '%s'\n", item);
+            exit(1);
+        }
+        config.weights[option] = weight;
+    }
+}
+
+static void parse_modes(const char *list) {
+    config.mode_count = 0;
+    char copy[128];
+    strncpy(copy, list, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if (config.mode_count == LOADGEN_MAX_MODES || atoi(item) < 1) {
+            fprintf(stderr, "ERROR: Bad mode list '%s'\n", list);
+            exit(1);
+        }
+        config.modes[config.mode_count++] = atoi(item);
+    }
+}
+
+static void print_banner() {
+    if (config.csv) {
+        return;
+    }
+    if (replaying()) {
+        printf("[LOAD] Replaying %d connections of %s (%.1f s at %gx)\n", config.connections,
+               config.trace_file, trace_length_us / 1e6, config.speed);
+    } else if (open_loop()) {
+        printf("[LOAD] Open loop, %.1f sessions/s for %d s (warm-up %d s), at most %d at once, "
+               "mix 1:%d 2:%d 3:%d 4:%d%s\n", config.rate, config.duration, config.warmup,
+               config.connections, config.weights[1], config.weights[2], config.weights[3],
+               config.weights[4], config.pooled ? ", pooled connections" : "");
+    } else {
+        printf("[LOAD] %d connections for %d s (warm-up %d s), mix 1:%d 2:%d 3:%d 4:%d, think %d ms\n",
+               config.connections, config.duration, config.warmup, config.weights[1],
+               config.weights[2], config.weights[3], config.weights[4], config.think_ms);
+    }
+    fflush(stdout);
+}
+
+// Run once per server mode, then print every mode side by side
+static int compare_modes(int base_port) {
+    // Every connection comes from this host, don't let the limiter skew the run
+    setenv("AUTH_RATE_IP", "100000", 0);
+    setenv("AUTH_BURST_IP", "100000", 0);
+    setenv("AUTH_RATE_USER", "1000", 0);
+    setenv("AUTH_BURST_USER", "1000", 0);
+
+    ModeResult *results = calloc(config.mode_count, sizeof(ModeResult));
+    if (results == NULL) {
+        perror("ERROR allocating results");
+        return 0;
+    }
+
+    for (int m = 0; m < config.mode_count; m++) {
+        ModeResult *r = &results[m];
+        r->mode = config.modes[m];
+        // The server does not set SO_REUSEADDR, each mode gets a fresh port
+        r->port = base_port + m;
+        client_set_port(&server_addr, r->port);
+
+        if (!config.csv) {
+            printf("[LOAD] Mode %d (%s) on port %d\n", r->mode, mode_name(r->mode), r->port);
+            fflush(stdout);
+        }
+        pid_t pid = spawn_server(r->mode, r->port);
+        if (pid < 0) {
+            continue;
+        }
+        if (!wait_for_server(pid)) {
+            fprintf(stderr, "[LOAD] Server mode %d did not start on port %d\n", r->mode, r->port);
+            stop_server(pid);
+            continue;
+        }
+
+        r->ran = run_load();
+        r->seconds = (end_at - record_from) / 1e6;
+        memcpy(r->hist, hist, sizeof(hist));
+        stop_server(pid);
+    }
+
+    print_header(1);
+    for (int m = 0; m < config.mode_count; m++) {
+        if (results[m].ran) {
+            print_rows(mode_name(results[m].mode), results[m].hist, results[m].seconds);
+        }
+    }
+    if (!config.csv) {
+        printf("\n");
+        for (int m = 0; m < config.mode_count; m++) {
+            if (!results[m].ran) {
+                printf("[%s] Not measured\n", mode_name(results[m].mode));
+                continue;
+            }
+            uint64_t total = 0;
+            for (int i = 1; i < CMD_COUNT; i++) {
+                total += results[m].hist[i].total - results[m].hist[i].late;
+            }
+            print_summary(mode_name(results[m].mode), total, results[m].seconds);
+        }
+    }
+
+    if (config.hist_file != NULL) {
+        FILE *fp = fopen(config.hist_file, "w");
+        if (fp == NULL) {
+            perror("ERROR writing histogram file");
+        } else {
+            for (int m = 0; m < config.mode_count; m++) {
+                if (results[m].ran) {
+                    write_histograms(fp, mode_name(results[m].mode), results[m].hist);
+                }
+            }
+            fclose(fp);
+        }
+    }
+    free(results);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+
+    config.connections = 100;
+    config.duration = 10;
+    config.gap_ms = 5;
+    config.user_prefix = "load";
+    config.password = "loadpass";
+    config.file = "my_data.txt";
+    config.max_connecting = 64;
+    config.speed = 1.0;
+    parse_mix("1:40,2:30,3:0,4:30");
+    parse_modes("1,2,3,4");
+
+    int opt;
+    optind = 3;
+    while ((opt = getopt(argc, argv, "c:d:w:m:t:g:f:u:U:p:P:r:R:kS:M:L:T:x:H:C")) != -1) {
+        switch (opt) {
+            case 'c': config.connections = atoi(optarg); break;
+            case 'd': config.duration = atoi(optarg); break;
+            case 'w': config.warmup = atoi(optarg); break;
+            case 'm': parse_mix(optarg); break;
+            case 't': config.think_ms = atoi(optarg); break;
+            case 'g': config.gap_ms = atoi(optarg); break;
+            case 'f': config.file = optarg; break;
+            case 'u': config.users = atoi(optarg); break;
+            case 'U': config.user_prefix = optarg; break;
+            case 'p': config.password = optarg; break;
+            case 'P': config.max_connecting = atoi(optarg); break;
+            case 'r': config.reconnect_after = atoi(optarg); break;
+            case 'R': config.rate = atof(optarg); break;
+            case 'k': config.pooled = 1; break;
+            case 'S': config.server_path = optarg; break;
+            case 'M': parse_modes(optarg); break;
+            case 'L': config.server_log = optarg; break;
+            case 'T': config.trace_file = optarg; break;
+            case 'x': config.speed = atof(optarg); break;
+            case 'H': config.hist_file = optarg; break;
+            case 'C': config.csv = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    // A replay has one connection per captured one and its own users
+    if (config.trace_file != NULL) {
+        config.connections = load_trace(config.trace_file);
+        config.warmup = 0;
+        config.rate = 0;
+        if (config.speed <= 0) {
+            usage(argv[0]);
+        }
+        if (config.connections <= 0) {
+            fprintf(stderr, "ERROR: Nothing to replay in %s\n", config.trace_file);
+            return 1;
+        }
+    }
+    if (config.users <= 0) {
+        config.users = config.connections;
+    }
+    int weight_sum = config.weights[1] + config.weights[2] + config.weights[3] + config.weights[4];
+    if (config.connections < 1 || config.duration < 1 || config.max_connecting < 1 ||
+        weight_sum == 0 || config.rate < 0) {
+        usage(argv[0]);
+    }
+
+    // Resolve the server the same way the CLI client does
+    int port = atoi(argv[2]);
+    if (!client_resolve(argv[1], port, &server_addr)) {
+        fprintf(stderr, "ERROR, no such host\n");
+        return 1;
+    }
+    config.pooled = config.pooled && open_loop();
+
+    // One descriptor per connection, pooled ones included, plus the probe
+    int capacity = config.connections + (config.pooled ? config.users : 0) + 1;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)capacity + 64) {
+        limit.rlim_cur = (rlim_t)capacity + 64;
+        if (limit.rlim_cur > limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+        }
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    conns = calloc(config.connections, sizeof(LoadConn));
+    free_slots = calloc(config.connections, sizeof(int));
+    user_tokens = calloc(config.users, sizeof(*user_tokens));
+    loop = client_loop_new(capacity);
+    if (conns == NULL || free_slots == NULL || user_tokens == NULL || loop == NULL) {
+        perror("ERROR setting up");
+        return 1;
+    }
+    srand((unsigned)getpid());
+    print_banner();
+
+    if (config.server_path != NULL) {
+        return compare_modes(port) ? 0 : 1;
+    }
+
+    if (!run_load()) {
+        return 1;
+    }
+    double seconds = (end_at - record_from) / 1e6;
+    print_header(0);
+    uint64_t total = print_rows(NULL, hist, seconds);
+    if (!config.csv) {
+        printf("\n");
+    }
+    print_summary(NULL, total, seconds);
+    if (config.hist_file != NULL) {
+        FILE *fp = fopen(config.hist_file, "w");
+        if (fp == NULL) {
+            perror("ERROR writing histogram file");
+            return 1;
+        }
+        write_histograms(fp, NULL, hist);
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,438 @@
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define LOG_SEQ_WRITING (1ull << 63)  // | pid: the record is being filled by that process
+
+typedef struct {
+    uint64_t seq;                 // == position: free, == position + 1: holds that record,
+                                  // LOG_SEQ_WRITING | pid: being filled
+    int64_t at_ns;                // CLOCK_REALTIME
+    int32_t pid;
+    uint8_t level;
+    char tag[LOG_TAG_MAX];
+    uint16_t length;
+    char text[LOG_TEXT_MAX];
+} LogSlot;
+
+typedef struct {
+    uint64_t head __attribute__((aligned(64)));   // Next position to claim
+    int level __attribute__((aligned(64)));
+    int json;
+    int writer_running;           // Records go to the ring, not to stdout
+    uint32_t rate;                // Records per second below error, 0 = unlimited
+    uint64_t window;              // Second the count below belongs to
+    uint64_t window_count;
+    uint64_t suppressed;          // Over the rate
+    uint64_t dropped;             // Ring full or record never published
+    LogSlot slots[LOG_RING_SLOTS];
+} LogShared;
+
+static const char *level_names[] = { "debug", "info", "warn", "error" };
+static const char *level_labels[] = { " DEBUG", "", " WARN", " ERROR" };
+
+static LogShared *shared = NULL;
+static int local_level = LOG_LEVEL_INFO;  // Before logger_init()
+
+// Writer (server process only)
+static int out_fd = -1;
+static pthread_t writer_thread;
+static pid_t writer_pid = 0;
+static volatile int writer_stop = 0;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static int64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int logger_parse_level(const char *name) {
+    for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; i++) {
+        if (name != NULL && strcasecmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *logger_level_name(int level) {
+    return (level >= LOG_LEVEL_DEBUG && level <= LOG_LEVEL_ERROR) ? level_names[level] : "?";
+}
+
+int logger_level() {
+    return shared ? __atomic_load_n(&shared->level, __ATOMIC_RELAXED) : local_level;
+}
+
+void logger_set_level(int level) {
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
+        return;
+    }
+    if (shared != NULL) {
+        __atomic_store_n(&shared->level, level, __ATOMIC_RELAXED);
+    } else {
+        local_level = level;
+    }
+}
+
+int logger_enabled(int level) {
+    return level >= logger_level();
+}
+
+// Take one record from this second's allowance
+static int within_rate(int level, int64_t now_ns) {
+    if (level >= LOG_LEVEL_ERROR || shared->rate == 0) {
+        return 1;
+    }
+    uint64_t second = (uint64_t)(now_ns / 1000000000LL);
+    uint64_t window = __atomic_load_n(&shared->window, __ATOMIC_RELAXED);
+    if (window != second &&
+        __atomic_compare_exchange_n(&shared->window, &window, second, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&shared->window_count, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_fetch_add(&shared->window_count, 1, __ATOMIC_RELAXED) >= shared->rate) {
+        __atomic_fetch_add(&shared->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+// Claim the next free slot
+// Returns: the slot, NULL if the ring is full
+static LogSlot *claim_slot(uint64_t *position) {
+    uint64_t pos = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+    while (1) {
+        LogSlot *slot = &shared->slots[pos % LOG_RING_SLOTS];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&shared->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *position = pos;
+                return slot;
+            }
+            // pos now holds the current head, try that
+        } else if (seq < pos || (seq & LOG_SEQ_WRITING)) {
+            // The record a lap behind is not written out yet
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Mark a claimed slot as being filled by this process. Fails when the
+// writer gave up on the slot while this producer was descheduled
+static int own_slot(LogSlot *slot, uint64_t pos) {
+    uint64_t expected = pos;
+    return __atomic_compare_exchange_n(&slot->seq, &expected, LOG_SEQ_WRITING | (uint64_t)getpid(),
+                                       0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Returns: 1 if the record was published, 0 if the writer took the slot back
+static int publish_slot(LogSlot *slot, uint64_t pos) {
+    uint64_t expected = LOG_SEQ_WRITING | (uint64_t)getpid();
+    return __atomic_compare_exchange_n(&slot->seq, &expected, pos + 1,
+                                       0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// ============================================================================
+// Logging
+// ============================================================================
+
+void logger_write(int level, const char *tag, const char *fmt, ...) {
+    if (!logger_enabled(level)) {
+        return;
+    }
+
+    char text[LOG_TEXT_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if (len >= (int)sizeof(text)) {
+        len = sizeof(text) - 1;
+    }
+
+    if (shared == NULL || !__atomic_load_n(&shared->writer_running, __ATOMIC_ACQUIRE)) {
+        FILE *fp = (level >= LOG_LEVEL_WARN) ? stderr : stdout;
+        fprintf(fp, "[%s%s] %s\n", tag, level_labels[level], text);
+        return;
+    }
+
+    int64_t now = realtime_ns();
+    if (!within_rate(level, now)) {
+        return;
+    }
+    uint64_t pos;
+    LogSlot *slot = claim_slot(&pos);
+    if (slot == NULL || !own_slot(slot, pos)) {
+        __atomic_fetch_add(&shared->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot->at_ns = now;
+    slot->pid = getpid();
+    slot->level = (uint8_t)level;
+    strncpy(slot->tag, tag, LOG_TAG_MAX - 1);
+    slot->tag[LOG_TAG_MAX - 1] = '\0';
+    slot->length = (uint16_t)len;
+    memcpy(slot->text, text, len);
+    if (!publish_slot(slot, pos)) {
+        __atomic_fetch_add(&shared->dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// ============================================================================
+// Writer
+// ============================================================================
+
+static void write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(out_fd, data, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// JSON string body, escaping quotes, backslashes and control bytes
+static size_t json_escape(char *out, size_t size, const char *text, size_t len) {
+    size_t used = 0;
+    for (size_t i = 0; i < len && used + 7 < size; i++) {
+        unsigned char ch = (unsigned char)text[i];
+        if (ch == '"' || ch == '\\') {
+            out[used++] = '\\';
+            out[used++] = ch;
+        } else if (ch < 0x20) {
+            used += snprintf(out + used, size - used, "\\u%04x", ch);
+        } else {
+            out[used++] = ch;
+        }
+    }
+    out[used] = '\0';
+    return used;
+}
+
+// Format one record as a line
+// Returns: its length
+static size_t format_record(const LogSlot *slot, char *line, size_t size) {
+    time_t seconds = (time_t)(slot->at_ns / 1000000000LL);
+    long micros = (long)(slot->at_ns % 1000000000LL) / 1000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    int level = slot->level <= LOG_LEVEL_ERROR ? slot->level : LOG_LEVEL_ERROR;
+
+    int n;
+    if (shared->json) {
+        char escaped[LOG_TEXT_MAX * 6 + 1];
+        json_escape(escaped, sizeof(escaped), slot->text, slot->length);
+        n = snprintf(line, size,
+                     "{\"ts\":\"%s.%06ldZ\",\"level\":\"%s\",\"tag\":\"%s\",\"pid\":%d,\"msg\":\"%s\"}\n",
+                     stamp, micros, level_names[level], slot->tag, slot->pid, escaped);
+    } else {
+        n = snprintf(line, size, "%s.%06ldZ pid=%d [%s%s] %.*s\n", stamp, micros, slot->pid,
+                     slot->tag, level_labels[level], (int)slot->length, slot->text);
+    }
+    if (n < 0) {
+        return 0;
+    }
+    return ((size_t)n < size) ? (size_t)n : size - 1;
+}
+
+// Write every published record, oldest first
+// Returns: number written
+static int drain(uint64_t *tail, int64_t *stalled_since) {
+    char batch[65536];
+    size_t used = 0;
+    int count = 0;
+
+    while (1) {
+        LogSlot *slot = &shared->slots[*tail % LOG_RING_SLOTS];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == *tail + 1) {
+            if (used + LOG_TEXT_MAX * 6 + 128 > sizeof(batch)) {
+                write_all(batch, used);
+                used = 0;
+            }
+            used += format_record(slot, batch + used, sizeof(batch) - used);
+            count++;
+            __atomic_store_n(&slot->seq, *tail + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        } else {
+            // Claimed but not published: wait, unless its producer died
+            uint64_t head = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+            if (head == *tail) {
+                break;
+            }
+            int64_t now = realtime_ns();
+            if (*stalled_since == 0) {
+                *stalled_since = now;
+                break;
+            }
+            if (now - *stalled_since < LOG_STALL_MS * 1000000LL) {
+                break;
+            }
+            // A live process filling the record only lost the CPU
+            if ((seq & LOG_SEQ_WRITING) &&
+                (kill((pid_t)(seq & ~LOG_SEQ_WRITING), 0) == 0 || errno != ESRCH)) {
+                break;
+            }
+            // Take the slot back with a CAS, so a producer that only now
+            // publishes fails instead of moving seq backwards
+            if (!__atomic_compare_exchange_n(&slot->seq, &seq, *tail + LOG_RING_SLOTS, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            __atomic_fetch_add(&shared->dropped, 1, __ATOMIC_RELAXED);
+        }
+        *stalled_since = 0;
+        (*tail)++;
+    }
+
+    if (used > 0) {
+        write_all(batch, used);
+    }
+    return count;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    uint64_t tail = 0;
+    int64_t stalled_since = 0;
+    uint64_t reported_suppressed = 0, reported_dropped = 0;
+    int64_t reported_at = 0;
+
+    while (1) {
+        int stopping = writer_stop;
+        int written = drain(&tail, &stalled_since);
+
+        uint64_t suppressed = __atomic_load_n(&shared->suppressed, __ATOMIC_RELAXED);
+        uint64_t dropped = __atomic_load_n(&shared->dropped, __ATOMIC_RELAXED);
+        int64_t now = realtime_ns();
+        if ((suppressed != reported_suppressed || dropped != reported_dropped) &&
+            (stopping || now - reported_at >= 1000000000LL)) {
+            // Reported like any other record, so JSON output stays JSON
+            LogSlot note = { .at_ns = now, .pid = getpid(), .level = LOG_LEVEL_WARN, .tag = "LOG" };
+            int n = snprintf(note.text, sizeof(note.text),
+                             "%llu messages over SERVER_LOG_RATE, %llu dropped with the ring full",
+                             (unsigned long long)(suppressed - reported_suppressed),
+                             (unsigned long long)(dropped - reported_dropped));
+            note.length = (uint16_t)((n < (int)sizeof(note.text)) ? n : (int)sizeof(note.text) - 1);
+            char line[LOG_TEXT_MAX * 6 + 128];
+            write_all(line, format_record(&note, line, sizeof(line)));
+            reported_suppressed = suppressed;
+            reported_dropped = dropped;
+            reported_at = now;
+        }
+
+        if (stopping) {
+            break;
+        }
+        if (written == 0) {
+            usleep(LOG_IDLE_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+int logger_init() {
+    const char *level_env = getenv("SERVER_LOG_LEVEL");
+    if (level_env != NULL && *level_env != '\0') {
+        if (logger_parse_level(level_env) < 0) {
+            fprintf(stderr, "[LOG] Unknown SERVER_LOG_LEVEL '%s', using info\n", level_env);
+        } else {
+            local_level = logger_parse_level(level_env);
+        }
+    }
+    if (shared != NULL) {
+        return 1;
+    }
+
+    void *map = mmap(NULL, sizeof(LogShared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("[LOG ERROR] Could not map log ring");
+        return 0;
+    }
+    LogShared *ring = map;
+    for (uint64_t i = 0; i < LOG_RING_SLOTS; i++) {
+        ring->slots[i].seq = i;
+    }
+    ring->level = local_level;
+    const char *format = getenv("SERVER_LOG_FORMAT");
+    ring->json = (format != NULL && strcmp(format, "json") == 0);
+    const char *rate = getenv("SERVER_LOG_RATE");
+    ring->rate = (rate != NULL && *rate != '\0') ? (uint32_t)atoi(rate) : LOG_DEFAULT_RATE;
+    shared = ring;
+    return 1;
+}
+
+int logger_start(const char *path) {
+    if (shared == NULL) {
+        return 0;
+    }
+    if (writer_pid != 0) {
+        return 1;
+    }
+
+    if (path != NULL && *path != '\0') {
+        out_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+        if (out_fd < 0) {
+            perror("[LOG ERROR] Could not open log file");
+            return 0;
+        }
+    } else {
+        out_fd = STDOUT_FILENO;
+    }
+
+    // Anything printed so far goes out before the writer's lines
+    fflush(stdout);
+    writer_stop = 0;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        perror("[LOG ERROR] Could not start log writer");
+        if (out_fd != STDOUT_FILENO) {
+            close(out_fd);
+        }
+        out_fd = -1;
+        return 0;
+    }
+    writer_pid = getpid();
+    __atomic_store_n(&shared->writer_running, 1, __ATOMIC_RELEASE);
+    atexit(logger_stop);
+    return 1;
+}
+
+void logger_stop() {
+    // Forked children share the ring but not the writer
+    if (writer_pid == 0 || getpid() != writer_pid) {
+        return;
+    }
+    writer_stop = 1;
+    pthread_join(writer_thread, NULL);
+    __atomic_store_n(&shared->writer_running, 0, __ATOMIC_RELEASE);
+    writer_pid = 0;
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
+    }
+    out_fd = -1;
+}
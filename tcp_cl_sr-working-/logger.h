@@ -0,0 +1,99 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#define LOG_RING_SLOTS 4096              // Records waiting for the writer, 1 MB
+#define LOG_TEXT_MAX 208                 // Longer messages are cut
+#define LOG_TAG_MAX 12                   // "AUTH", "SESSION", ...
+#define LOG_DEFAULT_RATE 2000            // Records per second below ERROR, 0 = unlimited
+#define LOG_IDLE_MS 10                   // Writer sleep when the ring is empty
+#define LOG_STALL_MS 100                 // A claimed record is skipped after this if its process died
+
+/*
+ * Server log. Callers format a message into a fixed binary record (time,
+ * pid, level, tag, text) and append it to a ring in shared memory; a
+ * writer thread in the server process turns records into lines and
+ * writes them in batches. Forked children log into the same ring, so no
+ * process ever blocks on stdout.
+ *
+ * The ring is a bounded multi-producer queue: a writer claims a position
+ * with a compare-and-swap and publishes the record with a per-slot
+ * sequence number, no locks. When the ring is full the record is dropped
+ * and counted rather than waited for. A record whose process died before
+ * publishing it is skipped after LOG_STALL_MS; slots only change hands
+ * by compare-and-swap, so a late producer drops its record instead.
+ *
+ * Lines are "time pid=N [TAG] text" ("[TAG LEVEL]" for anything but
+ * info), or JSON objects with SERVER_LOG_FORMAT=json. SERVER_LOG_LEVEL
+ * (debug, info, warn, error) sets the level, ADMIN:LOGLEVEL changes it
+ * at run time for every process. SERVER_LOG_RATE caps records per second
+ * below error level (default LOG_DEFAULT_RATE, 0 = unlimited); the writer
+ * reports how many were suppressed or dropped.
+ *
+ * Until logger_start() runs (and in the tools), messages are written
+ * directly to stdout, or stderr from warn up, as "[TAG] text".
+ */
+
+/**
+ * Map the ring and read SERVER_LOG_LEVEL / SERVER_LOG_FORMAT /
+ * SERVER_LOG_RATE. Call before fork()
+ * Returns: 1 on success, 0 on failure (messages stay synchronous)
+ */
+int logger_init();
+
+/**
+ * Start the writer thread, appending to path (stdout when NULL or empty)
+ * Returns: 1 on success, 0 on failure
+ */
+int logger_start(const char *path);
+
+/**
+ * Write what is left in the ring and stop the writer (only in the process
+ * that started it)
+ */
+void logger_stop();
+
+/**
+ * Log a message at level under tag, if the level is enabled
+ */
+void logger_write(int level, const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * Returns: 1 if messages at level are written
+ */
+int logger_enabled(int level);
+
+/**
+ * Set the level for every process sharing the ring
+ */
+void logger_set_level(int level);
+
+/**
+ * Returns: the current level
+ */
+int logger_level();
+
+/**
+ * Returns: LOG_LEVEL_* for "debug", "info", "warn" or "error", -1 otherwise
+ */
+int logger_parse_level(const char *name);
+
+/**
+ * Returns: the name of a LOG_LEVEL_*
+ */
+const char *logger_level_name(int level);
+
+#define log_debug(tag, ...) logger_write(LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define log_info(tag, ...) logger_write(LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define log_warn(tag, ...) logger_write(LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define log_error(tag, ...) logger_write(LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+
+#endif // LOGGER_H
@@ -0,0 +1,500 @@
+#define _GNU_SOURCE                  // sched_getcpu()
+#include "metrics.h"
+#include "conntrace.h"
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Auth failure reasons, from the text after "AUTH_FAILED:"
+#define REASON_OTHER 0
+#define REASON_COUNT 9
+
+static const char *reason_names[REASON_COUNT] = {
+    "other", "invalid_credentials", "rate_limited", "bad_format", "user_exists",
+    "too_many_users", "session_expired", "busy", "unknown_command"
+};
+// Checked in order, so "Invalid" catches both kinds of bad format
+static const char *reason_replies[REASON_COUNT] = {
+    NULL, "Invalid credentials", "Too many attempts", "Invalid", "Username already exists",
+    "Too many users", "Session expired", "Server busy", "Unknown command"
+};
+
+static const char *command_names[METRICS_COMMANDS] = {
+    "auth", "register", "resume", "date", "list", "file", "elapsed", "admin", "invalid", "ping"
+};
+
+static const uint64_t bounds_us[METRICS_BUCKETS - 1] = METRICS_BOUNDS_US;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t latency_sum_us;
+    uint64_t latency[METRICS_BUCKETS];  // Not cumulative, +Inf last
+} CommandCounters;
+
+// Only uint64_t fields, so shards can be added up word by word
+typedef struct {
+    CommandCounters commands[METRICS_COMMANDS];
+    uint64_t auth_failures[REASON_COUNT];
+    uint64_t accepted;
+    uint64_t accept_errors;
+    uint64_t closed;
+} __attribute__((aligned(64))) MetricsShard;
+
+typedef struct {
+    long long started_us;
+    MetricsShard shards[METRICS_SHARDS];
+} MetricsShared;
+
+static MetricsShared *shared = NULL;
+static int endpoint_fd = -1;
+static pthread_t endpoint_thread;
+
+#define COUNT(field, amount) __atomic_fetch_add(&(field), (uint64_t)(amount), __ATOMIC_RELAXED)
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+long long metrics_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static MetricsShard *my_shard() {
+    int cpu = sched_getcpu();
+    return &shared->shards[(cpu < 0 ? 0 : cpu) % METRICS_SHARDS];
+}
+
+static int bucket_of(uint64_t us) {
+    int i = 0;
+    while (i < METRICS_BUCKETS - 1 && us > bounds_us[i]) {
+        i++;
+    }
+    return i;
+}
+
+static void count_latency(CommandCounters *cc, long long started_us) {
+    long long now = metrics_now_us();
+    uint64_t us = (now > started_us) ? (uint64_t)(now - started_us) : 0;
+    COUNT(cc->latency[bucket_of(us)], 1);
+    COUNT(cc->latency_sum_us, us);
+}
+
+// Add every shard into total
+static void collect(MetricsShard *total) {
+    memset(total, 0, sizeof(*total));
+    uint64_t *sum = (uint64_t *)total;
+    size_t words = sizeof(MetricsShard) / sizeof(uint64_t);
+    for (int s = 0; s < METRICS_SHARDS; s++) {
+        const uint64_t *part = (const uint64_t *)&shared->shards[s];
+        for (size_t w = 0; w < words; w++) {
+            sum[w] += __atomic_load_n(&part[w], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Upper bound of the bucket holding the given percentile, -1 for +Inf
+static double percentile_ms(const CommandCounters *cc, double percentile) {
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        total += cc->latency[i];
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+        seen += cc->latency[i];
+        if (seen >= rank) {
+            return bounds_us[i] / 1000.0;
+        }
+    }
+    return -1;
+}
+
+// Seconds as plain decimals ("0.00005", not "5e-05") for the le labels
+static void format_seconds(char *out, size_t size, uint64_t us) {
+    snprintf(out, size, "%llu.%06llu", (unsigned long long)(us / 1000000),
+             (unsigned long long)(us % 1000000));
+    char *end = out + strlen(out) - 1;
+    while (*end == '0') {
+        *end-- = '\0';
+    }
+    if (*end == '.') {
+        *end = '\0';
+    }
+}
+
+static size_t appendf(char *out, size_t size, size_t used, const char *fmt, ...) {
+    if (used >= size) {
+        return used;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + used, size - used, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return used;
+    }
+    return (used + n < size) ? used + n : size - 1;
+}
+
+// ============================================================================
+// Counting
+// ============================================================================
+
+int metrics_init() {
+    if (shared != NULL) {
+        return 1;
+    }
+    void *map = mmap(NULL, sizeof(MetricsShared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("[METRICS ERROR] Could not map counters");
+        return 0;
+    }
+    shared = map;
+    shared->started_us = metrics_now_us();
+    return 1;
+}
+
+int metrics_menu_command(int option) {
+    return (option >= 1 && option <= 4) ? METRIC_DATE + option - 1 : METRIC_INVALID;
+}
+
+const char *metrics_command_name(int command) {
+    return (command >= 0 && command < METRICS_COMMANDS) ? command_names[command] : "-";
+}
+
+int metrics_login_command(const char *command) {
+    if (command != NULL && strcmp(command, "REGISTER") == 0) {
+        return METRIC_REGISTER;
+    }
+    if (command != NULL && strcmp(command, "RESUME") == 0) {
+        return METRIC_RESUME;
+    }
+    return METRIC_AUTH;
+}
+
+void metrics_accept(int ok) {
+    if (shared == NULL) {
+        return;
+    }
+    if (ok) {
+        COUNT(my_shard()->accepted, 1);
+    } else {
+        COUNT(my_shard()->accept_errors, 1);
+    }
+}
+
+void metrics_close() {
+    if (shared != NULL) {
+        COUNT(my_shard()->closed, 1);
+    }
+}
+
+void metrics_login(int command, long long started_us, size_t bytes_in, const char *reply) {
+    if (shared == NULL) {
+        return;
+    }
+    MetricsShard *shard = my_shard();
+    CommandCounters *cc = &shard->commands[command];
+    COUNT(cc->requests, 1);
+    COUNT(cc->bytes_in, bytes_in);
+    COUNT(cc->bytes_out, strlen(reply));
+    count_latency(cc, started_us);
+
+    if (strncmp(reply, "AUTH_OK", 7) == 0) {
+        return;
+    }
+    COUNT(cc->errors, 1);
+
+    const char *why = strchr(reply, ':');
+    int reason = REASON_OTHER;
+    for (int i = 1; why != NULL && i < REASON_COUNT; i++) {
+        if (strncmp(why + 1, reason_replies[i], strlen(reason_replies[i])) == 0) {
+            reason = i;
+            break;
+        }
+    }
+    COUNT(shard->auth_failures[reason], 1);
+}
+
+void metrics_request(int command, long long started_us, size_t bytes_in, size_t bytes_out, int failed) {
+    if (shared == NULL) {
+        return;
+    }
+    CommandCounters *cc = &my_shard()->commands[command];
+    COUNT(cc->requests, 1);
+    COUNT(cc->bytes_in, bytes_in);
+    COUNT(cc->bytes_out, bytes_out);
+    if (failed) {
+        COUNT(cc->errors, 1);
+    }
+    count_latency(cc, started_us);
+}
+
+// ============================================================================
+// Reports
+// ============================================================================
+
+void metrics_summary(char *out, size_t size) {
+    if (shared == NULL) {
+        snprintf(out, size, "Metrics unavailable");
+        return;
+    }
+    MetricsShard total;
+    collect(&total);
+    double uptime = (metrics_now_us() - shared->started_us) / 1e6;
+    if (uptime < 1) {
+        uptime = 1;
+    }
+
+    size_t used = appendf(out, size, 0,
+                          "Up %.0f s, %llu connections (%.1f/s), %llu open, %llu accept errors\n",
+                          uptime, (unsigned long long)total.accepted, total.accepted / uptime,
+                          (unsigned long long)(total.accepted - total.closed),
+                          (unsigned long long)total.accept_errors);
+    used = appendf(out, size, used, "command     count  errors     /s  p50 ms  p99 ms  KB out\n");
+    for (int i = 0; i < METRICS_COMMANDS; i++) {
+        const CommandCounters *cc = &total.commands[i];
+        if (cc->requests == 0) {
+            continue;
+        }
+        double p50 = percentile_ms(cc, 50), p99 = percentile_ms(cc, 99);
+        used = appendf(out, size, used, "%-9s %7llu %7llu %6.1f %7.2f %7.2f %7llu\n",
+                       command_names[i], (unsigned long long)cc->requests,
+                       (unsigned long long)cc->errors, cc->requests / uptime,
+                       p50, p99, (unsigned long long)(cc->bytes_out / 1024));
+    }
+
+    used = appendf(out, size, used, "Auth failures:");
+    int any = 0;
+    for (int i = 0; i < REASON_COUNT; i++) {
+        if (total.auth_failures[i] > 0) {
+            used = appendf(out, size, used, " %s %llu", reason_names[i],
+                           (unsigned long long)total.auth_failures[i]);
+            any = 1;
+        }
+    }
+    appendf(out, size, used, any ? "" : " none");
+}
+
+size_t metrics_prometheus(char *out, size_t size) {
+    if (shared == NULL) {
+        return 0;
+    }
+    MetricsShard total;
+    collect(&total);
+
+    static const struct { const char *name; const char *help; size_t offset; } counters[] = {
+        { "tcp_server_requests_total", "Requests answered, handshakes included",
+          offsetof(CommandCounters, requests) },
+        { "tcp_server_request_errors_total", "Failed handshakes and answers that could not be sent",
+          offsetof(CommandCounters, errors) },
+        { "tcp_server_received_bytes_total", "Request bytes read",
+          offsetof(CommandCounters, bytes_in) },
+        { "tcp_server_sent_bytes_total", "Answer bytes written",
+          offsetof(CommandCounters, bytes_out) },
+    };
+
+    size_t used = 0;
+    for (size_t m = 0; m < sizeof(counters) / sizeof(counters[0]); m++) {
+        used = appendf(out, size, used, "# HELP %s %s\n# TYPE %s counter\n",
+                       counters[m].name, counters[m].help, counters[m].name);
+        for (int i = 0; i < METRICS_COMMANDS; i++) {
+            const uint64_t *value = (const uint64_t *)((const char *)&total.commands[i] + counters[m].offset);
+            used = appendf(out, size, used, "%s{command=\"%s\"} %llu\n",
+                           counters[m].name, command_names[i], (unsigned long long)*value);
+        }
+    }
+
+    const char *hist = "tcp_server_request_duration_seconds";
+    used = appendf(out, size, used, "# HELP %s Time from reading a request to writing its answer\n"
+                   "# TYPE %s histogram\n", hist, hist);
+    for (int i = 0; i < METRICS_COMMANDS; i++) {
+        const CommandCounters *cc = &total.commands[i];
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            cumulative += cc->latency[b];
+            if (b < METRICS_BUCKETS - 1) {
+                char le[32];
+                format_seconds(le, sizeof(le), bounds_us[b]);
+                used = appendf(out, size, used, "%s_bucket{command=\"%s\",le=\"%s\"} %llu\n",
+                               hist, command_names[i], le, (unsigned long long)cumulative);
+            } else {
+                used = appendf(out, size, used, "%s_bucket{command=\"%s\",le=\"+Inf\"} %llu\n",
+                               hist, command_names[i], (unsigned long long)cumulative);
+            }
+        }
+        used = appendf(out, size, used, "%s_sum{command=\"%s\"} %.6f\n%s_count{command=\"%s\"} %llu\n",
+                       hist, command_names[i], cc->latency_sum_us / 1e6,
+                       hist, command_names[i], (unsigned long long)cumulative);
+    }
+
+    used = appendf(out, size, used,
+                   "# HELP tcp_server_auth_failures_total Failed handshakes by reason\n"
+                   "# TYPE tcp_server_auth_failures_total counter\n");
+    for (int i = 0; i < REASON_COUNT; i++) {
+        used = appendf(out, size, used, "tcp_server_auth_failures_total{reason=\"%s\"} %llu\n",
+                       reason_names[i], (unsigned long long)total.auth_failures[i]);
+    }
+
+    used = appendf(out, size, used,
+                   "# HELP tcp_server_connections_accepted_total Connections accepted\n"
+                   "# TYPE tcp_server_connections_accepted_total counter\n"
+                   "tcp_server_connections_accepted_total %llu\n"
+                   "# HELP tcp_server_accept_errors_total Failed accept() calls\n"
+                   "# TYPE tcp_server_accept_errors_total counter\n"
+                   "tcp_server_accept_errors_total %llu\n"
+                   "# HELP tcp_server_connections_open Connections accepted and not yet closed\n"
+                   "# TYPE tcp_server_connections_open gauge\n"
+                   "tcp_server_connections_open %llu\n"
+                   "# HELP tcp_server_uptime_seconds Time since the server started\n"
+                   "# TYPE tcp_server_uptime_seconds gauge\n"
+                   "tcp_server_uptime_seconds %.3f\n",
+                   (unsigned long long)total.accepted, (unsigned long long)total.accept_errors,
+                   (unsigned long long)(total.accepted - total.closed),
+                   (metrics_now_us() - shared->started_us) / 1e6);
+    return used;
+}
+
+// ============================================================================
+// Endpoint
+// ============================================================================
+
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return;
+        }
+        data += sent;
+        len -= sent;
+    }
+}
+
+// Answer one HTTP request, then the caller closes the connection
+static void serve_scrape(int fd, char *page) {
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[1024];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        ssize_t got = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (got <= 0) {
+            break;
+        }
+        len += got;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL) {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    char header[160];
+    if (strncmp(request, "GET /trace ", 11) == 0) {
+        // Connection stages, as long as the rings are, so no Content-Length
+        char *text = NULL;
+        size_t text_len = 0;
+        FILE *fp = open_memstream(&text, &text_len);
+        if (fp != NULL) {
+            conntrace_dump(fp, NULL, 0);
+            fclose(fp);
+            const char *ok = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n";
+            send_all(fd, ok, strlen(ok));
+            send_all(fd, text, text_len);
+        }
+        free(text);
+        return;
+    }
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET /metrics?", 13) != 0) {
+        const char *missing = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, missing, strlen(missing));
+        return;
+    }
+
+    size_t body = metrics_prometheus(page, METRICS_REPLY_MAX);
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", body);
+    send_all(fd, header, n);
+    send_all(fd, page, body);
+}
+
+static void *endpoint_main(void *arg) {
+    (void)arg;
+    char *page = malloc(METRICS_REPLY_MAX);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    // One scrape at a time, they are rare and quick
+    while (1) {
+        int fd = accept(endpoint_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                usleep(100000);
+            }
+            continue;
+        }
+        serve_scrape(fd, page);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start_endpoint(int port) {
+    if (shared == NULL || endpoint_fd >= 0) {
+        return shared != NULL;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("[METRICS ERROR] Could not open socket");
+        return 0;
+    }
+
+    // Scrapes leave TIME_WAIT behind on this side, don't let it block a restart
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("[METRICS ERROR] Could not listen");
+        close(fd);
+        return 0;
+    }
+
+    endpoint_fd = fd;
+    if (pthread_create(&endpoint_thread, NULL, endpoint_main, NULL) != 0) {
+        perror("[METRICS ERROR] Could not start endpoint thread");
+        close(fd);
+        endpoint_fd = -1;
+        return 0;
+    }
+    pthread_detach(endpoint_thread);
+    printf("[METRICS] Serving http://127.0.0.1:%d/metrics\n", port);
+    return 1;
+}
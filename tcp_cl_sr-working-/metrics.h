@@ -0,0 +1,114 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define METRICS_SHARDS 16            // Counter copies, picked by CPU
+#define METRICS_BUCKETS 18           // METRICS_BOUNDS_US plus +Inf
+#define METRICS_BOUNDS_US { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, \
+                            50000, 100000, 250000, 500000, 1000000, 2500000,   \
+                            5000000, 10000000 }
+#define METRICS_REPLY_MAX 65536      // Largest Prometheus page
+
+// What a request was, one row of counters each
+#define METRIC_AUTH 0                // Handshakes
+#define METRIC_REGISTER 1
+#define METRIC_RESUME 2
+#define METRIC_DATE 3                // Menu options 1 to 4
+#define METRIC_LIST 4
+#define METRIC_FILE 5
+#define METRIC_ELAPSED 6
+#define METRIC_ADMIN 7               // ADMIN: commands
+#define METRIC_INVALID 8             // Anything else at the menu
+#define METRIC_PING 9                // PING: latency probes
+#define METRICS_COMMANDS 10
+
+/*
+ * Server metrics: per command request, error and byte counts with a
+ * latency histogram, connections accepted and closed, and why handshakes
+ * failed.
+ *
+ * Counters live in shared memory mapped before fork(), so forked children
+ * count into the same place as the parent. Each counter exists once per
+ * shard and is bumped with an atomic add in the shard of the current CPU:
+ * no locks, and processes on different CPUs do not fight over cache lines.
+ * Readers add the shards up.
+ *
+ * Latency runs from reading a request to writing its answer (handing it to
+ * the socket in the event loop), for option 3 from reading the file name.
+ * A handshake counts from reading it to writing AUTH_OK or AUTH_FAILED,
+ * which includes load_users() and hashing.
+ *
+ * The numbers are read with ADMIN:METRICS or, when SERVER_METRICS_PORT is
+ * set, as Prometheus text from http://127.0.0.1:<port>/metrics. The same
+ * endpoint serves the connection stage trace (conntrace.h) at /trace.
+ */
+
+/**
+ * Map the shared counters. Call before fork()
+ * Returns: 1 on success, 0 on failure (counting is then skipped)
+ */
+int metrics_init();
+
+/**
+ * Serve /metrics on 127.0.0.1:port from a background thread
+ * Returns: 1 on success, 0 on failure
+ */
+int metrics_start_endpoint(int port);
+
+/**
+ * Returns: microseconds on the monotonic clock, for request start times
+ */
+long long metrics_now_us();
+
+/**
+ * Returns: METRIC_DATE to METRIC_ELAPSED for menu options 1 to 4,
+ * METRIC_INVALID otherwise
+ */
+int metrics_menu_command(int option);
+
+/**
+ * Returns: the label of a METRIC_* command, such as "date"
+ */
+const char *metrics_command_name(int command);
+
+/**
+ * Returns: METRIC_REGISTER or METRIC_RESUME for those handshakes,
+ * METRIC_AUTH for anything else
+ */
+int metrics_login_command(const char *command);
+
+/**
+ * Count an accepted connection, or a failed accept()
+ */
+void metrics_accept(int ok);
+
+/**
+ * Count a closed connection
+ */
+void metrics_close();
+
+/**
+ * Count a handshake answered with reply, failures by the reason in it
+ */
+void metrics_login(int command, long long started_us, size_t bytes_in, const char *reply);
+
+/**
+ * Count an answered menu request, failed if its answer could not be sent
+ */
+void metrics_request(int command, long long started_us, size_t bytes_in, size_t bytes_out, int failed);
+
+/**
+ * Write a short summary with rates since the server started
+ */
+void metrics_summary(char *out, size_t size);
+
+/**
+ * Write every metric in the Prometheus text format
+ * Returns: bytes written
+ */
+size_t metrics_prometheus(char *out, size_t size);
+
+#endif // METRICS_H
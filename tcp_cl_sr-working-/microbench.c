@@ -0,0 +1,510 @@
+#include "auth.h"
+#include "kdf.h"
+#include "service.h"
+#include "coarseclock.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+// Microbenchmarks for the authentication and service hot paths.
+//
+// Runs in a scratch directory with its own data/ so the real credential
+// store is never touched. Results go to stdout as CSV:
+//     benchmark,param,iterations,ns_per_op,ops_per_sec
+// param is the size the benchmark ran at (users, sessions, files or bytes),
+// so a cost that grows with it shows up as ns_per_op rising along the rows.
+// Everything the modules print themselves is discarded.
+
+#define BENCH_MIN_NS 200000000LL   // Run each benchmark for at least 0.2 s
+#define BENCH_USERS 10000          // Largest user count, override with argv[1]
+#define BENCH_REPLY 256            // Reply buffer, same as MAX_BUFFER in serverdef.h
+
+static const int session_counts[] = {10, 100, 1000, 4000};
+static const int directory_sizes[] = {10, 100, 1000};
+static const int file_sizes[] = {1024, 65536, 1048576};
+
+typedef struct {
+    int users;                     // Sessions belong to bench0..bench<users-1>
+    int count;
+    char (*tokens)[SESSION_TOKEN_MAX];
+} SessionSet;
+
+typedef struct {
+    int fd;                        // Write end of a socketpair
+    char name[64];                 // File under data/
+} FileTarget;
+
+typedef void (*BenchFn)(long iterations, void *arg);
+
+static FILE *results = NULL;
+static char scratch_dir[] = "/tmp/microbench.XXXXXX";
+
+// ============================================================================
+// Harness
+// ============================================================================
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Double the iteration count until a run lasts BENCH_MIN_NS, then report
+static void bench_run(const char *name, long param, BenchFn fn, void *arg) {
+    long iterations = 1;
+    long long elapsed;
+    while (1) {
+        long long start = now_ns();
+        fn(iterations, arg);
+        elapsed = now_ns() - start;
+        if (elapsed >= BENCH_MIN_NS || iterations >= (1L << 30)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    double ns_per_op = (double)elapsed / iterations;
+    fprintf(results, "%s,%ld,%ld,%.1f,%.0f\n", name, param, iterations,
+            ns_per_op, 1e9 / ns_per_op);
+    fflush(results);
+}
+
+// Fresh scratch directory with a data/ folder and a KDF policy
+static int setup_scratch(const char *policy) {
+    if (mkdtemp(scratch_dir) == NULL || chdir(scratch_dir) != 0 || mkdir("data", 0700) != 0) {
+        perror("ERROR creating scratch directory");
+        return 0;
+    }
+
+    FILE *fp = fopen(KDF_POLICY_FILE, "w");
+    if (fp == NULL) {
+        return 0;
+    }
+    fprintf(fp, "%s\n", policy);
+    fclose(fp);
+
+    return 1;
+}
+
+static void remove_scratch() {
+    DIR *d = opendir("data");
+    if (d != NULL) {
+        struct dirent *entry;
+        char path[512];
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                snprintf(path, sizeof(path), "data/%s", entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(d);
+    }
+    rmdir("data");
+    if (chdir("/") == 0) {
+        rmdir(scratch_dir);
+    }
+}
+
+// Add users bench<from>..bench<to-1>
+static int add_users(int from, int to) {
+    CredRecord *batch = malloc(sizeof(CredRecord) * (to - from));
+    if (batch == NULL) {
+        return 0;
+    }
+    for (int i = from; i < to; i++) {
+        char username[MAX_USERNAME];
+        char password[MAX_PASSWORD];
+        snprintf(username, sizeof(username), "bench%d", i);
+        snprintf(password, sizeof(password), "password%d", i);
+        prepare_user(username, password, &batch[i - from]);
+    }
+    int written = credstore_put_batch(batch, to - from, 1, 0);
+    free(batch);
+    return written >= 0;
+}
+
+// Grow the session table to set->count + more live sessions
+static int add_sessions(SessionSet *set, int count) {
+    while (set->count < count) {
+        char username[MAX_USERNAME];
+        snprintf(username, sizeof(username), "bench%d", set->count % set->users);
+        if (!create_session(username, set->tokens[set->count])) {
+            return 0;
+        }
+        set->count++;
+    }
+    return 1;
+}
+
+// Add empty files file<from>.txt..file<to-1>.txt to data/
+static int add_files(int from, int to) {
+    for (int i = from; i < to; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "data/file%05d.txt", i);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            return 0;
+        }
+        fclose(fp);
+    }
+    return 1;
+}
+
+static int write_file(const char *name, int size) {
+    char path[128];
+    snprintf(path, sizeof(path), "data/%s", name);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < size; i++) {
+        fputc('a' + i % 26, fp);
+    }
+    fclose(fp);
+    return 1;
+}
+
+// Reads and discards everything file_content() sends
+static void *drain_main(void *arg) {
+    int fd = *(int *)arg;
+    char data[65536];
+    while (read(fd, data, sizeof(data)) > 0) {
+    }
+    return NULL;
+}
+
+// ============================================================================
+// Baseline
+// ============================================================================
+
+// auth.c before cryptoctx.c: a digest context allocated per hash, RAND_bytes()
+// per salt or token, and sprintf/sscanf hex. Benchmarked as *_baseline rows
+// next to the current code so the before/after numbers can be rerun
+
+static void old_generate_salt(unsigned char *salt, size_t size) {
+    if (RAND_bytes(salt, size) != 1) {
+        fprintf(stderr, "ERROR: RAND_bytes failed\n");
+        exit(1);
+    }
+}
+
+static void old_bytes_to_hex(const unsigned char *bytes, size_t len, char *hex) {
+    for (size_t i = 0; i < len; i++) {
+        sprintf(hex + (i * 2), "%02x", bytes[i]);
+    }
+    hex[len * 2] = '\0';
+}
+
+static void old_hex_to_bytes(const char *hex, unsigned char *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(hex + (i * 2), "%2hhx", &bytes[i]);
+    }
+}
+
+static void old_generate_token(char *token_hex) {
+    unsigned char token[TOKEN_SIZE];
+    old_generate_salt(token, TOKEN_SIZE);
+    old_bytes_to_hex(token, TOKEN_SIZE, token_hex);
+}
+
+static void old_hash_password(const char *password, const unsigned char *salt,
+                              unsigned char *hash) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx == NULL || EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+        fprintf(stderr, "ERROR: Could not start a digest\n");
+        exit(1);
+    }
+    EVP_DigestUpdate(ctx, salt, SALT_SIZE);
+    EVP_DigestUpdate(ctx, password, strlen(password));
+    unsigned int hash_len;
+    EVP_DigestFinal_ex(ctx, hash, &hash_len);
+    EVP_MD_CTX_free(ctx);
+}
+
+static void bench_generate_salt_baseline(long iterations, void *arg) {
+    (void)arg;
+    unsigned char salt[SALT_SIZE];
+    for (long i = 0; i < iterations; i++) {
+        old_generate_salt(salt, SALT_SIZE);
+    }
+}
+
+static void bench_generate_token_baseline(long iterations, void *arg) {
+    (void)arg;
+    char token[SESSION_TOKEN_MAX];
+    for (long i = 0; i < iterations; i++) {
+        old_generate_token(token);
+    }
+}
+
+static void bench_bytes_to_hex_baseline(long iterations, void *arg) {
+    (void)arg;
+    unsigned char bytes[SHA256_DIGEST_LENGTH] = {0x01, 0xab, 0xff};
+    char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+    for (long i = 0; i < iterations; i++) {
+        bytes[0] = (unsigned char)i;
+        old_bytes_to_hex(bytes, sizeof(bytes), hex);
+    }
+}
+
+static void bench_hex_to_bytes_baseline(long iterations, void *arg) {
+    (void)arg;
+    const char *hex = "00112233445566778899aabbccddeeff00112233445566778899AABBCCDDEEFF";
+    unsigned char bytes[SHA256_DIGEST_LENGTH];
+    for (long i = 0; i < iterations; i++) {
+        old_hex_to_bytes(hex, bytes, sizeof(bytes));
+    }
+}
+
+static void bench_hash_password_baseline(long iterations, void *arg) {
+    (void)arg;
+    unsigned char salt[SALT_SIZE] = {0};
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    for (long i = 0; i < iterations; i++) {
+        old_hash_password("password123", salt, hash);
+    }
+}
+
+// ============================================================================
+// Benchmarks
+// ============================================================================
+
+static void bench_generate_salt(long iterations, void *arg) {
+    (void)arg;
+    unsigned char salt[SALT_SIZE];
+    for (long i = 0; i < iterations; i++) {
+        generate_salt(salt, SALT_SIZE);
+    }
+}
+
+static void bench_generate_token(long iterations, void *arg) {
+    (void)arg;
+    char token[SESSION_TOKEN_MAX];
+    for (long i = 0; i < iterations; i++) {
+        generate_token(token, sizeof(token));
+    }
+}
+
+static void bench_bytes_to_hex(long iterations, void *arg) {
+    (void)arg;
+    unsigned char bytes[SHA256_DIGEST_LENGTH] = {0x01, 0xab, 0xff};
+    char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+    for (long i = 0; i < iterations; i++) {
+        bytes[0] = (unsigned char)i;
+        bytes_to_hex(bytes, sizeof(bytes), hex);
+    }
+}
+
+static void bench_hex_to_bytes(long iterations, void *arg) {
+    (void)arg;
+    const char *hex = "00112233445566778899aabbccddeeff00112233445566778899AABBCCDDEEFF";
+    unsigned char bytes[SHA256_DIGEST_LENGTH];
+    for (long i = 0; i < iterations; i++) {
+        hex_to_bytes(hex, bytes, sizeof(bytes));
+    }
+}
+
+static void bench_hash_password(long iterations, void *arg) {
+    (void)arg;
+    unsigned char salt[SALT_SIZE] = {0};
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    for (long i = 0; i < iterations; i++) {
+        hash_password("password123", salt, hash);
+    }
+}
+
+static void bench_date_time(long iterations, void *arg) {
+    (void)arg;
+    char reply[BENCH_REPLY];
+    for (long i = 0; i < iterations; i++) {
+        date_time(reply, sizeof(reply));
+    }
+}
+
+static void bench_directory_files(long iterations, void *arg) {
+    (void)arg;
+    char reply[BENCH_REPLY];
+    for (long i = 0; i < iterations; i++) {
+        directory_files(reply, sizeof(reply));
+    }
+}
+
+static void bench_file_content(long iterations, void *arg) {
+    FileTarget *target = arg;
+    char reply[BENCH_REPLY];
+    for (long i = 0; i < iterations; i++) {
+        file_content(reply, sizeof(reply), target->fd, target->name);
+    }
+}
+
+static void bench_verify_credentials(long iterations, void *arg) {
+    int users = *(int *)arg;
+    char username[MAX_USERNAME];
+    char password[MAX_PASSWORD];
+    for (long i = 0; i < iterations; i++) {
+        int u = (int)(i % users);
+        snprintf(username, sizeof(username), "bench%d", u);
+        snprintf(password, sizeof(password), "password%d", u);
+        verify_credentials(username, password);
+    }
+}
+
+// Paired with invalidate_session() so the table keeps its size
+static void bench_create_session(long iterations, void *arg) {
+    (void)arg;
+    char token[SESSION_TOKEN_MAX];
+    for (long i = 0; i < iterations; i++) {
+        if (create_session("bench0", token)) {
+            invalidate_session("bench0", token);
+        }
+    }
+}
+
+static void bench_verify_session(long iterations, void *arg) {
+    SessionSet *set = arg;
+    char username[MAX_USERNAME];
+    for (long i = 0; i < iterations; i++) {
+        int s = (int)(i % set->count);
+        snprintf(username, sizeof(username), "bench%d", s % set->users);
+        verify_session(username, set->tokens[s]);
+    }
+}
+
+// A full login as handle_client() does it: check, then open a session
+static void bench_login(long iterations, void *arg) {
+    int users = *(int *)arg;
+    char username[MAX_USERNAME];
+    char password[MAX_PASSWORD];
+    char token[SESSION_TOKEN_MAX];
+    for (long i = 0; i < iterations; i++) {
+        int u = (int)(i % users);
+        snprintf(username, sizeof(username), "bench%d", u);
+        snprintf(password, sizeof(password), "password%d", u);
+        if (verify_credentials(username, password) && create_session(username, token)) {
+            invalidate_session(username, token);
+        }
+    }
+}
+
+static int run_service_benchmarks() {
+    // Formatting per call, then from the clock ticker as the server does
+    bench_run("date_time", 0, bench_date_time, NULL);
+    if (coarseclock_start()) {
+        bench_run("date_time_cached", 0, bench_date_time, NULL);
+    }
+
+    int files = 0;
+    for (size_t i = 0; i < sizeof(directory_sizes) / sizeof(directory_sizes[0]); i++) {
+        if (!add_files(files, directory_sizes[i])) {
+            return 0;
+        }
+        files = directory_sizes[i];
+        bench_run("directory_files", files, bench_directory_files, NULL);
+    }
+
+    // file_content() writes to a socket, a thread plays the client
+    int pair[2];
+    pthread_t drain;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0 ||
+        pthread_create(&drain, NULL, drain_main, &pair[1]) != 0) {
+        perror("ERROR setting up socketpair");
+        return 0;
+    }
+    FileTarget target;
+    target.fd = pair[0];
+    for (size_t i = 0; i < sizeof(file_sizes) / sizeof(file_sizes[0]); i++) {
+        snprintf(target.name, sizeof(target.name), "content%d.bin", file_sizes[i]);
+        if (!write_file(target.name, file_sizes[i])) {
+            return 0;
+        }
+        bench_run("file_content", file_sizes[i], bench_file_content, &target);
+    }
+    close(pair[0]);
+    pthread_join(drain, NULL);
+    close(pair[1]);
+    return 1;
+}
+
+static int run_auth_benchmarks(int max_users) {
+    int users = 0;
+    for (int count = 10; users < max_users; count *= 10) {
+        if (count > max_users) {
+            count = max_users;
+        }
+        if (!add_users(users, count)) {
+            return 0;
+        }
+        users = count;
+        bench_run("verify_credentials", users, bench_verify_credentials, &users);
+    }
+
+    SessionSet set;
+    set.users = users;
+    set.count = 0;
+    set.tokens = malloc(sizeof(*set.tokens) * MAX_SESSIONS);
+    if (set.tokens == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(session_counts) / sizeof(session_counts[0]); i++) {
+        if (!add_sessions(&set, session_counts[i])) {
+            free(set.tokens);
+            return 0;
+        }
+        bench_run("create_session", set.count, bench_create_session, NULL);
+        bench_run("verify_session", set.count, bench_verify_session, &set);
+    }
+    for (int i = 0; i < set.count; i++) {
+        char username[MAX_USERNAME];
+        snprintf(username, sizeof(username), "bench%d", i % set.users);
+        invalidate_session(username, set.tokens[i]);
+    }
+    cleanup_expired_sessions();
+    free(set.tokens);
+
+    bench_run("login", users, bench_login, &users);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int users = (argc > 1) ? atoi(argv[1]) : BENCH_USERS;
+    if (users < 1) {
+        users = BENCH_USERS;
+    }
+
+    // Keep results on the real stdout, silence module logging
+    int out_fd = dup(STDOUT_FILENO);
+    results = fdopen(out_fd, "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("ERROR redirecting output");
+        return 1;
+    }
+
+    // Single SHA-256 so the numbers show the code around the KDF
+    if (!setup_scratch("sha256 0 0 0") || !init_auth_system()) {
+        fprintf(stderr, "ERROR: Benchmark setup failed\n");
+        return 1;
+    }
+
+    fprintf(results, "benchmark,param,iterations,ns_per_op,ops_per_sec\n");
+    bench_run("generate_salt", SALT_SIZE, bench_generate_salt, NULL);
+    bench_run("generate_salt_baseline", SALT_SIZE, bench_generate_salt_baseline, NULL);
+    bench_run("generate_token", TOKEN_SIZE, bench_generate_token, NULL);
+    bench_run("generate_token_baseline", TOKEN_SIZE, bench_generate_token_baseline, NULL);
+    bench_run("bytes_to_hex", SHA256_DIGEST_LENGTH, bench_bytes_to_hex, NULL);
+    bench_run("bytes_to_hex_baseline", SHA256_DIGEST_LENGTH, bench_bytes_to_hex_baseline, NULL);
+    bench_run("hex_to_bytes", SHA256_DIGEST_LENGTH, bench_hex_to_bytes, NULL);
+    bench_run("hex_to_bytes_baseline", SHA256_DIGEST_LENGTH, bench_hex_to_bytes_baseline, NULL);
+    bench_run("hash_password", 0, bench_hash_password, NULL);
+    bench_run("hash_password_baseline", 0, bench_hash_password_baseline, NULL);
+
+    int ok = run_auth_benchmarks(users) && run_service_benchmarks();
+    if (!ok) {
+        fprintf(stderr, "ERROR: Benchmark setup failed\n");
+    }
+
+    cleanup_auth_system();
+    remove_scratch();
+    return ok ? 0 : 1;
+}
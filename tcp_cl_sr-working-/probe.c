@@ -0,0 +1,38 @@
+#include "probe.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void probe_stamp(ProbeStamp *out) {
+    out->mono_ns = clock_ns(CLOCK_MONOTONIC);
+    out->real_ns = clock_ns(CLOCK_REALTIME);
+}
+
+int probe_is_request(const char *request) {
+    return strncmp(request, PROBE_PREFIX, strlen(PROBE_PREFIX)) == 0;
+}
+
+size_t probe_reply(const char *request, const ProbeStamp *received, char *out, size_t size) {
+    // Echo only the leading digits, never arbitrary client text
+    const char *client = request + strlen(PROBE_PREFIX);
+    size_t digits = strspn(client, "0123456789");
+    if (digits > PROBE_CLIENT_MAX) {
+        digits = PROBE_CLIENT_MAX;
+    }
+
+    ProbeStamp sent;
+    probe_stamp(&sent);
+    int n = snprintf(out, size, "%s%.*s:%lld:%lld:%lld:%lld", PROBE_REPLY_PREFIX, (int)digits, client,
+                     (long long)received->mono_ns, (long long)received->real_ns,
+                     (long long)sent.mono_ns, (long long)sent.real_ns);
+    if (n < 0) {
+        return 0;
+    }
+    return ((size_t)n < size) ? (size_t)n : size - 1;
+}
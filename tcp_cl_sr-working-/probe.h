@@ -0,0 +1,49 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROBE_REQUEST -3             // listen_question() code for a PING: line
+#define PROBE_PREFIX "PING:"
+#define PROBE_REPLY_PREFIX "PONG:"
+#define PROBE_CLIENT_MAX 24          // Digits of the echoed client timestamp
+#define PROBE_REPLY_MAX 160
+
+/*
+ * Latency probe, sent in place of a menu option once logged in:
+ *
+ *     PING:<client timestamp>
+ *     PONG:<client timestamp>:<recv mono>:<recv real>:<send mono>:<send real>
+ *
+ * The client timestamp (digits, normally CLOCK_REALTIME in ns) comes back
+ * unchanged. The server adds when it read the request and when it wrote
+ * the reply, on CLOCK_MONOTONIC and CLOCK_REALTIME in nanoseconds. A
+ * client takes send - recv (monotonic) as server time, the rest of its
+ * round trip as network time, and estimates its clock offset from the
+ * realtime stamps the way NTP does. See "client host port ping".
+ */
+
+typedef struct {
+    int64_t mono_ns;
+    int64_t real_ns;
+} ProbeStamp;
+
+/**
+ * Read both clocks
+ */
+void probe_stamp(ProbeStamp *out);
+
+/**
+ * Returns: 1 if request is a latency probe (starts with PING:)
+ */
+int probe_is_request(const char *request);
+
+/**
+ * Write the PONG answer to request, read at received, stamping the send
+ * time last
+ * Returns: length of the reply
+ */
+size_t probe_reply(const char *request, const ProbeStamp *received, char *out, size_t size);
+
+#endif // PROBE_H
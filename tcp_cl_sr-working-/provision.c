@@ -0,0 +1,202 @@
+#include "auth.h"
+#include "kdf.h"
+#include <openssl/crypto.h>
+
+// Bulk user import: ./provision users.csv [threads]
+//
+// Each line is "username,password" (the password is everything after the
+// first comma). Blank lines, lines starting with '#' and a leading
+// "username,password" header are skipped. Passwords are hashed on every
+// core, then all new users are written with a single batched append.
+
+#define PROVISION_LINE 512
+
+typedef struct {
+    char username[MAX_USERNAME];
+    char password[MAX_PASSWORD];
+    int line;
+} CsvUser;
+
+static CsvUser *csv_users = NULL;
+static CredRecord *records = NULL;
+static int *prepared = NULL;   // 1 if records[i] is ready to write
+static int user_total = 0;
+static int next_user = 0;      // Next index a worker picks up
+
+// ============================================================================
+// CSV Input
+// ============================================================================
+
+static int read_csv(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("ERROR opening CSV file");
+        return -1;
+    }
+
+    int capacity = 1024;
+    csv_users = malloc(capacity * sizeof(CsvUser));
+    if (csv_users == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    char line[PROVISION_LINE];
+    int line_no = 0;
+    int skipped = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#' ||
+            (line_no == 1 && strcmp(line, "username,password") == 0)) {
+            continue;
+        }
+
+        char *comma = strchr(line, ',');
+        if (comma == NULL) {
+            fprintf(stderr, "[PROVISION] Line %d: expected username,password\n", line_no);
+            skipped++;
+            continue;
+        }
+        *comma = '\0';
+        const char *username = line;
+        const char *password = comma + 1;
+
+        if (!validate_username(username) || !validate_password(password)) {
+            fprintf(stderr, "[PROVISION] Line %d: invalid username or password\n", line_no);
+            skipped++;
+            continue;
+        }
+
+        if (user_total == capacity) {
+            capacity *= 2;
+            CsvUser *grown = realloc(csv_users, capacity * sizeof(CsvUser));
+            if (grown == NULL) {
+                fclose(fp);
+                return -1;
+            }
+            csv_users = grown;
+        }
+
+        CsvUser *user = &csv_users[user_total++];
+        strncpy(user->username, username, MAX_USERNAME - 1);
+        user->username[MAX_USERNAME - 1] = '\0';
+        strncpy(user->password, password, MAX_PASSWORD - 1);
+        user->password[MAX_PASSWORD - 1] = '\0';
+        user->line = line_no;
+    }
+
+    fclose(fp);
+    return skipped;
+}
+
+// ============================================================================
+// Parallel Hashing
+// ============================================================================
+
+static void *hash_worker(void *arg) {
+    (void)arg;
+
+    while (1) {
+        int i = __sync_fetch_and_add(&next_user, 1);
+        if (i >= user_total) {
+            break;
+        }
+
+        // Existing users are left alone, no need to pay for their hash
+        if (!credstore_get(csv_users[i].username, NULL)) {
+            prepared[i] = prepare_user(csv_users[i].username, csv_users[i].password, &records[i]);
+        }
+        OPENSSL_cleanse(csv_users[i].password, sizeof(csv_users[i].password));
+    }
+    return NULL;
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <users.csv> [threads]\n", argv[0]);
+        return 1;
+    }
+
+    long threads = (argc > 2) ? atol(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    load_kdf_policy(KDF_POLICY_FILE);
+    if (!credstore_open()) {
+        fprintf(stderr, "ERROR: Could not open credential store\n");
+        return 1;
+    }
+
+    int skipped = read_csv(argv[1]);
+    if (skipped < 0) {
+        return 1;
+    }
+    printf("[PROVISION] %d users read from %s (%d lines skipped)\n", user_total, argv[1], skipped);
+    if (user_total == 0) {
+        credstore_close();
+        return skipped > 0 ? 1 : 0;
+    }
+
+    records = calloc(user_total, sizeof(CredRecord));
+    prepared = calloc(user_total, sizeof(int));
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    if (records == NULL || prepared == NULL || workers == NULL) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, hash_worker, NULL) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        hash_worker(NULL);
+    }
+    for (long t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+
+    // Pack the new users together for one append
+    int ready = 0;
+    for (int i = 0; i < user_total; i++) {
+        if (prepared[i]) {
+            records[ready++] = records[i];
+        }
+    }
+    double hash_seconds = seconds_since(&start);
+    printf("[PROVISION] Hashed %d passwords on %ld threads in %.2f s\n",
+           ready, started ? started : 1, hash_seconds);
+
+    // Duplicates in the file or users added meanwhile are dropped here
+    int written = credstore_put_batch(records, ready, 1, 1);
+    if (written < 0) {
+        fprintf(stderr, "ERROR: Could not write credential store\n");
+        return 1;
+    }
+    printf("[PROVISION] Added %d users, %d existing or duplicate (%.2f s total)\n",
+           written, user_total - written, seconds_since(&start));
+
+    if (credstore_needs_compaction()) {
+        credstore_compact();
+    }
+
+    credstore_close();
+    free(workers);
+    free(prepared);
+    free(records);
+    free(csv_users);
+    return 0;
+}
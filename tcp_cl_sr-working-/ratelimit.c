@@ -0,0 +1,171 @@
+#include "ratelimit.h"
+#include <time.h>
+#include <sys/mman.h>
+
+#define KIND_IP 0
+#define KIND_USER 1
+
+// One bucket, tokens kept in thousandths so refills stay integral
+typedef struct {
+    uint64_t key;          // 0 = free slot
+    uint64_t refill_ms;    // Last refill, CLOCK_MONOTONIC
+    uint32_t milli_tokens;
+} Bucket;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Bucket slots[RATELIMIT_SLOTS];
+} Shard;
+
+typedef struct {
+    uint32_t rate;         // Attempts per second, 0 = unlimited
+    uint32_t burst;        // Bucket size
+} Limit;
+
+static Shard *shards = NULL;
+static Limit limits[2];
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a over the kind and the key bytes, never 0
+static uint64_t bucket_key(int kind, const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 1469598103934665603ull ^ (uint64_t)kind;
+    h *= 1099511628211ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+static uint32_t env_limit(const char *name, uint32_t fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    long n = atol(value);
+    return (n < 0) ? 0 : (uint32_t)n;
+}
+
+// ============================================================================
+// Buckets
+// ============================================================================
+
+// Find the key's bucket in its shard, claiming a free or the stalest slot
+static Bucket *find_bucket(Shard *shard, uint64_t key, const Limit *limit, uint64_t now) {
+    size_t start = (key >> 8) % RATELIMIT_SLOTS;
+    Bucket *victim = NULL;
+
+    for (size_t i = 0; i < RATELIMIT_PROBE; i++) {
+        Bucket *b = &shard->slots[(start + i) % RATELIMIT_SLOTS];
+        if (b->key == key) {
+            return b;
+        }
+        if (b->key == 0) {
+            if (victim == NULL || victim->key != 0) {
+                victim = b;
+            }
+        } else if (victim == NULL || (victim->key != 0 && b->refill_ms < victim->refill_ms)) {
+            victim = b;
+        }
+    }
+
+    // A new or evicted bucket starts full
+    victim->key = key;
+    victim->refill_ms = now;
+    victim->milli_tokens = limit->burst * 1000;
+    return victim;
+}
+
+static int take(int kind, const void *data, size_t len) {
+    const Limit *limit = &limits[kind];
+    if (shards == NULL || limit->rate == 0) {
+        return 1;
+    }
+
+    uint64_t key = bucket_key(kind, data, len);
+    Shard *shard = &shards[key % RATELIMIT_SHARDS];
+    uint64_t now = now_ms();
+
+    pthread_mutex_lock(&shard->lock);
+    Bucket *b = find_bucket(shard, key, limit, now);
+
+    // rate tokens per second = rate milli-tokens per millisecond
+    uint64_t refill = (now - b->refill_ms) * limit->rate;
+    uint64_t tokens = b->milli_tokens + refill;
+    if (tokens > (uint64_t)limit->burst * 1000) {
+        tokens = (uint64_t)limit->burst * 1000;
+    }
+    b->refill_ms = now;
+
+    int allowed = (tokens >= 1000);
+    if (allowed) {
+        tokens -= 1000;
+    }
+    b->milli_tokens = (uint32_t)tokens;
+    pthread_mutex_unlock(&shard->lock);
+    return allowed;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int ratelimit_init() {
+    limits[KIND_IP].rate = env_limit("AUTH_RATE_IP", RATELIMIT_IP_RATE);
+    limits[KIND_IP].burst = env_limit("AUTH_BURST_IP", RATELIMIT_IP_BURST);
+    limits[KIND_USER].rate = env_limit("AUTH_RATE_USER", RATELIMIT_USER_RATE);
+    limits[KIND_USER].burst = env_limit("AUTH_BURST_USER", RATELIMIT_USER_BURST);
+    for (int k = 0; k < 2; k++) {
+        if (limits[k].burst == 0) {
+            limits[k].burst = 1;
+        }
+    }
+
+    shards = mmap(NULL, sizeof(Shard) * RATELIMIT_SHARDS, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shards == MAP_FAILED) {
+        perror("[RATE ERROR] Could not map rate limit table");
+        shards = NULL;
+        return 0;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < RATELIMIT_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    printf("[RATE] Login limits: %u/s burst %u per address, %u/s burst %u per user\n",
+           limits[KIND_IP].rate, limits[KIND_IP].burst,
+           limits[KIND_USER].rate, limits[KIND_USER].burst);
+    return 1;
+}
+
+int ratelimit_check_login(const struct sockaddr_in *addr, const char *username) {
+    if (addr != NULL && !take(KIND_IP, &addr->sin_addr, sizeof(addr->sin_addr))) {
+        return RATE_LIMITED_IP;
+    }
+    if (username != NULL && !take(KIND_USER, username, strlen(username))) {
+        return RATE_LIMITED_USER;
+    }
+    return RATE_OK;
+}
+
+void ratelimit_cleanup() {
+    if (shards != NULL) {
+        munmap(shards, sizeof(Shard) * RATELIMIT_SHARDS);
+        shards = NULL;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define RATELIMIT_SHARDS 64
+#define RATELIMIT_SLOTS 256            // Buckets per shard, 16384 in total
+#define RATELIMIT_PROBE 8              // Slots searched before evicting
+
+// Defaults, overridden by AUTH_RATE_IP / AUTH_BURST_IP / AUTH_RATE_USER /
+// AUTH_BURST_USER (attempts per second and bucket size, 0 disables)
+#define RATELIMIT_IP_RATE 5
+#define RATELIMIT_IP_BURST 20
+#define RATELIMIT_USER_RATE 1
+#define RATELIMIT_USER_BURST 10
+
+#define RATE_OK 0
+#define RATE_LIMITED_IP 1
+#define RATE_LIMITED_USER 2
+
+/*
+ * Token buckets for login attempts, keyed by client address and by
+ * username. The table is in shared memory so forked children draw from
+ * the same buckets. It is split into shards, each with its own
+ * process-shared lock, and buckets are evicted when a shard fills up
+ * (oldest refill time first), so memory stays fixed.
+ */
+
+/**
+ * Read the limits from the environment and map the shared table.
+ * Call before fork()
+ * Returns: 1 on success, 0 on failure
+ */
+int ratelimit_init();
+
+/**
+ * Take one attempt from the client's and the user's buckets. Call before
+ * any hashing so rejected attempts cost next to nothing
+ * Returns: RATE_OK, or RATE_LIMITED_IP / RATE_LIMITED_USER
+ */
+int ratelimit_check_login(const struct sockaddr_in *addr, const char *username);
+
+/**
+ * Unmap the table
+ */
+void ratelimit_cleanup();
+
+#endif // RATELIMIT_H
@@ -1,4 +1,13 @@
 #include "serverimp.c"
+#include "token.h"
+#include "eventloop.h"
+#include "kdf.h"
+#include "sessionstore.h"
+#include "capture.h"
+#include "metrics.h"
+#include "conntrace.h"
+#include "logger.h"
+#include "coarseclock.h"
 #include <sys/wait.h>
 
 void run_multiprocess_server() {
@@ -10,15 +19,22 @@ void run_multiprocess_server() {
         // 4. Accept actual connection from the client
         accept_connection() ;
 
+        // Refresh the parent's user table (a stat() when nothing changed)
+        // so children inherit it and don't have to re-parse the file
+        load_users();
+
         pid = fork();
         if (pid < 0) {
-            perror("ERROR on fork");
+            log_error("SERVER", "fork failed: %s", strerror(errno));
             exit(1);
         }
 
         if (pid == 0) {  // Child process
             close(sockfd); // Child doesn't need the listener
             handle_client(new_sockfd);
+            capture_close(capture_conn);
+            metrics_close();
+            conntrace_close(trace_conn);
             exit(0);
         } else {  // Parent process
             close(new_sockfd); // Parent doesn't need this
@@ -36,9 +52,12 @@ void run_fifo_server() {
         accept_connection();
         
         // Handle client completely before accepting next one
-        printf("[INFO] Client connected. Handling request...\n");
+        log_info("SERVER", "Client connected. Handling request...");
         handle_client(new_sockfd);
-        printf("[INFO] Client finished. Ready for next client.\n");
+        capture_close(capture_conn);
+        metrics_close();
+        conntrace_close(trace_conn);
+        log_info("SERVER", "Client finished. Ready for next client.");
         
         // Close the client socket
         close(new_sockfd);
@@ -53,15 +72,25 @@ void run_mono_server() {
         accept_connection();
         
         // Handle client completely before accepting next one
-        printf("[INFO] Client connected. Handling request...\n");
+        log_info("SERVER", "Client connected. Handling request...");
         handle_client(new_sockfd);
-        printf("[INFO] Client finished. Ready for next client.\n");
+        capture_close(capture_conn);
+        metrics_close();
+        conntrace_close(trace_conn);
+        log_info("SERVER", "Client finished. Ready for next client.");
         
         // Close the client socket
         close(new_sockfd);
     }
 }
 
+void run_event_loop_server() {
+    printf("\n[INFO] Starting EVENT LOOP server (epoll, auth worker pool)...\n");
+
+    // Logins are hashed on worker threads, everything else runs here
+    run_event_loop(sockfd);
+}
+
 int main(int argc, char *argv[])
 {
     int choice;
@@ -69,15 +98,87 @@ int main(int argc, char *argv[])
     if (argc < 2) {
         fprintf(stderr,"ERROR, no port provided\n");
         fprintf(stderr,"Usage: %s <port>\n", argv[0]);
+        fprintf(stderr,"       %s --rotate-token-keys [key_file]\n", argv[0]);
+        fprintf(stderr,"       %s --calibrate-kdf [target_ms] [scrypt|pbkdf2]\n", argv[0]);
         exit(1);
     }
 
+    // Rotate the stateless token signing keys and exit
+    if (strcmp(argv[1], "--rotate-token-keys") == 0) {
+        const char *key_file = (argc > 2) ? argv[2] : TOKEN_KEY_FILE;
+        return token_keys_rotate(key_file) ? 0 : 1;
+    }
+
+    // Pick KDF parameters that fit the login latency target on this host
+    if (strcmp(argv[1], "--calibrate-kdf") == 0) {
+        int target_ms = (argc > 2) ? atoi(argv[2]) : KDF_DEFAULT_TARGET_MS;
+        uint8_t kdf = (argc > 3 && strcmp(argv[3], "pbkdf2") == 0) ? CRED_KDF_PBKDF2 : CRED_KDF_SCRYPT;
+        KdfParams params;
+        if (target_ms <= 0 || !kdf_calibrate(kdf, target_ms, &params)) {
+            fprintf(stderr, "ERROR: No %s parameters fit in %d ms\n", kdf_name(kdf), target_ms);
+            return 1;
+        }
+        if (!kdf_save_policy(KDF_POLICY_FILE, &params)) {
+            return 1;
+        }
+        printf("[KDF] Saved %s cost %u to %s, existing users are rehashed at their next login\n",
+               kdf_name(params.kdf), params.cost, KDF_POLICY_FILE);
+        return 0;
+    }
+
+    // Runtime messages go through the log ring to a writer thread (see logger.h)
+    if (!logger_init() || !logger_start(getenv("SERVER_LOG_FILE"))) {
+        fprintf(stderr, "[LOG] Asynchronous logging unavailable, writing directly\n");
+    }
+
+    // Option 1 and session expiry read a clock refreshed once a second
+    if (!coarseclock_start()) {
+        fprintf(stderr, "[CLOCK] Cached clock unavailable, reading the system clock\n");
+    }
+
+    // Connection timeouts, SERVER_*_TIMEOUT_SEC=0 turns one off
+    deadlines_load(&deadlines);
+    printf("[SERVER] Timeouts: auth %d s, idle %d s, write %d s (0 = none)\n",
+           deadlines.auth_sec, deadlines.idle_sec, deadlines.write_sec);
+
     // Initialize authentication system
     if (!init_auth_system()) {
         fprintf(stderr, "ERROR: Failed to initialize authentication system\n");
         exit(1);
     }
 
+    // Keep stored sessions across restarts, AUTH_SESSION_SNAPSHOT_SEC=0 turns it off
+    const char *snapshot_env = getenv("AUTH_SESSION_SNAPSHOT_SEC");
+    int snapshot_interval = (snapshot_env != NULL && *snapshot_env != '\0')
+                            ? atoi(snapshot_env) : SESSION_SNAPSHOT_INTERVAL;
+    if (snapshot_interval > 0 && !enable_session_persistence(snapshot_interval)) {
+        fprintf(stderr, "[SESSION] Session persistence unavailable, sessions end with the server\n");
+    }
+
+    // Record client traffic for loadgen -T, off unless SERVER_CAPTURE_FILE is set
+    const char *capture_file = getenv("SERVER_CAPTURE_FILE");
+    if (capture_file != NULL && *capture_file != '\0' && !capture_open(capture_file)) {
+        fprintf(stderr, "[CAPTURE] Traffic capture unavailable\n");
+    }
+
+    // Stage trace rings, every connection unless SERVER_TRACE_SAMPLE says otherwise
+    if (!conntrace_init()) {
+        fprintf(stderr, "[TRACE] Connection tracing unavailable\n");
+    }
+    const char *trace_file = getenv("SERVER_TRACE_FILE");
+    if (trace_file != NULL && *trace_file != '\0') {
+        conntrace_start_file(trace_file);
+    }
+
+    // Counters are shared with forked children, the endpoint is off by default
+    if (!metrics_init()) {
+        fprintf(stderr, "[METRICS] Metrics unavailable\n");
+    }
+    const char *metrics_port = getenv("SERVER_METRICS_PORT");
+    if (metrics_port != NULL && atoi(metrics_port) > 0 && !metrics_start_endpoint(atoi(metrics_port))) {
+        fprintf(stderr, "[METRICS] Metrics endpoint unavailable\n");
+    }
+
     // Display server mode selection menu
     printf("\n========================================\n");
     printf("      TCP SERVER - MODE SELECTION\n");
@@ -85,6 +186,7 @@ int main(int argc, char *argv[])
     printf("1. Multi-process (Concurrent clients)\n");
     printf("2. FIFO/Sequential (One client at a time)\n");
     printf("3. MONO (Single client, no fork)\n");
+    printf("4. Event loop (epoll, logins hashed by a worker pool)\n");
     printf("========================================\n");
     printf("Enter your choice: ");
     
@@ -119,6 +221,9 @@ int main(int argc, char *argv[])
         case 3:
             run_mono_server();
             break;
+        case 4:
+            run_event_loop_server();
+            break;
         default:
             fprintf(stderr, "ERROR: Invalid choice. Using Multi-process mode.\n");
             run_multiprocess_server();
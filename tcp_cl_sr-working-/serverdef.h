@@ -5,6 +5,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <stdint.h>
+#include "timerwheel.h"
 
 #define MAX_BUFFER 256
 
@@ -19,6 +21,10 @@ struct sockaddr_in serv_addr, cli_addr;
 
 int n ;
 
+uint32_t capture_conn; // Trace id of the connection being served, 0 when not capturing
+uint32_t trace_conn;   // Stage trace id of the same connection, 0 when not traced
+Deadlines deadlines;   // Auth, idle and write timeouts, loaded in main()
+
 // 1. Create a socket
 void new_socket() ;
 
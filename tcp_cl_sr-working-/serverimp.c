@@ -1,6 +1,21 @@
 #include "serverdef.h"
 #include "auth.h"
 #include "service.h"
+#include "ratelimit.h"
+#include "admin.h"
+#include "capture.h"
+#include "metrics.h"
+#include "conntrace.h"
+#include "logger.h"
+#include "probe.h"
+#include "coarseclock.h"
+#include <errno.h>
+
+// The request being answered, for the metrics
+static long long request_started;   // us, when it was read
+static size_t request_in;           // Bytes read, with the file name for option 3
+static size_t request_out;          // Bytes of the answer
+static ProbeStamp probe_received;   // When the last PING was read
 
 void new_socket() {
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -35,28 +50,69 @@ void start_listen(char *arg) {
 
 void accept_connection() {
     new_sockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+    metrics_accept(new_sockfd >= 0);
     if (new_sockfd < 0) {
         perror("ERROR on accept");
         exit(1);
     }
+    capture_conn = capture_connect();
+    trace_conn = conntrace_connect();
+}
+
+// Block reads (SO_RCVTIMEO) or writes (SO_SNDTIMEO) for at most us
+// microseconds, 0 = no limit. The kernel enforces it, a read or write
+// that runs out fails with EAGAIN
+static void set_socket_timeout(int sock, int option, long long us) {
+    struct timeval tv;
+    tv.tv_sec = us / 1000000;
+    tv.tv_usec = us % 1000000;
+    setsockopt(sock, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+static int timed_out() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
 }
 
 int listen_question(int sock) {
     bzero(buffer, MAX_BUFFER);
 
     n = read(sock, buffer, MAX_BUFFER-1);
+    if (n < 0 && timed_out()) {
+        log_warn("SERVER", "Client idle for %d s, disconnecting", deadlines.idle_sec);
+        return -1;
+    }
     if (n < 0) {
-        perror("ERROR reading from socket");
+        log_error("SOCKET", "Read failed: %s", strerror(errno));
         return -1 ;
     }
     if (n == 0) {
-        printf("Client closed connection\n");
+        log_debug("SERVER", "Client closed connection");
         return 5; // Return 5 to exit cleanly
     }
+    int probe = probe_is_request(buffer);
+    if (probe) {
+        probe_stamp(&probe_received);
+    }
+    capture_request(capture_conn, buffer, n);
+    request_started = metrics_now_us();
+    request_in = n;
+    request_out = 0;
 
+    if (admin_is_request(buffer)) {
+        return ADMIN_REQUEST;
+    }
+    if (probe) {
+        return PROBE_REQUEST;
+    }
     return atoi(buffer) ;
 }
 
+// Record the size of the answer to the request read last
+static void responded(size_t bytes) {
+    request_out = bytes;
+    capture_response(capture_conn, bytes);
+}
+
 int answer_question(int sock, int answer, time_t start_time){
      switch(answer){
         case 1 :
@@ -65,13 +121,14 @@ int answer_question(int sock, int answer, time_t start_time){
 
             n = write(sock, buffer, strlen(buffer)) ;
             if (n < 0){
-                perror("ERROR writing to socket");
+                log_error("SOCKET", "Write failed: %s", strerror(errno));
                 return 0 ;
             }
             if (n < strlen(buffer)){
-                perror("Partial write occurred");
+                log_warn("SOCKET", "Partial write");
                 return 0 ;
             }
+            responded(n);
             
             return 1 ;
         case 2 :
@@ -79,13 +136,14 @@ int answer_question(int sock, int answer, time_t start_time){
             directory_files(buffer, MAX_BUFFER) ;
             n = write(sock, buffer, strlen(buffer)) ;
             if (n < 0){
-                perror("ERROR writing to socket");
+                log_error("SOCKET", "Write failed: %s", strerror(errno));
                 return 0 ;
             }
             if (n < strlen(buffer)){
-                perror("Partial write occurred");
+                log_warn("SOCKET", "Partial write");
                 return 0 ;
             }
+            responded(n);
         
             return 1 ;
         case 3 :
@@ -97,26 +155,36 @@ int answer_question(int sock, int answer, time_t start_time){
                 write(sock, buffer, strlen(buffer));
                 return 1;
             }
+            capture_request(capture_conn, buffer, n);
+            request_started = metrics_now_us();
+            request_in += n;
             
             // Remove newline if present
             buffer[strcspn(buffer, "\n")] = 0;
             
             // Call file_content with the provided filepath
-            file_content(buffer, MAX_BUFFER, sock, buffer);
-            
+            ssize_t file_sent = file_content(buffer, MAX_BUFFER, sock, buffer);
+            if (file_sent < 0) {
+                // The client stopped reading: drop it instead of blocking
+                // on every chunk left
+                return 0;
+            }
+            responded(file_sent);
+
             // Continue the session after file transfer
             return 1 ;
         case 4 :
             session_time(buffer, MAX_BUFFER, start_time);
             n = write(sock, buffer, strlen(buffer));
             if (n < 0) {
-                perror("ERROR writing to socket");
+                log_error("SOCKET", "Write failed: %s", strerror(errno));
                 return 0;
             }
             if (n < strlen(buffer)){
-                perror("Partial write occurred");
+                log_warn("SOCKET", "Partial write");
                 return 0 ;
             }
+            responded(n);
             return 1;
         case 5 :
             return 0 ;
@@ -130,113 +198,209 @@ int answer_question(int sock, int answer, time_t start_time){
             if (n < strlen(buffer)){
                 return 0 ;
             }
+            responded(n);
             return 1 ;
     }
 }
 
+// Run the admin command left in buffer by listen_question()
+int answer_admin(int sock, const char *username) {
+    char reply[ADMIN_REPLY_MAX];
+    admin_handle(username, buffer, reply, sizeof(reply));
+
+    n = write(sock, reply, strlen(reply));
+    if (n < 0) {
+        log_error("SOCKET", "Write failed: %s", strerror(errno));
+        return 0;
+    }
+    responded(n);
+    return 1;
+}
+
+// Answer the PING left in buffer by listen_question()
+int answer_probe(int sock) {
+    char reply[PROBE_REPLY_MAX];
+    size_t len = probe_reply(buffer, &probe_received, reply, sizeof(reply));
+
+    n = write(sock, reply, len);
+    if (n < 0) {
+        log_error("SOCKET", "Write failed: %s", strerror(errno));
+        return 0;
+    }
+    responded(n);
+    return 1;
+}
+
+// Send a handshake reply and count the attempt
+static void auth_reply(int sock, int kind, const char *msg) {
+    write(sock, msg, strlen(msg));
+    metrics_login(kind, request_started, request_in, msg);
+    conntrace_span(trace_conn, TRACE_AUTH, kind, request_started, strncmp(msg, "AUTH_OK", 7) == 0);
+}
+
 void handle_client(int sock) {
     time_t session_start_time;
-    time(&session_start_time);
-
-    // Reload users in case they were updated by another process
-    load_users();
+    session_start_time = coarseclock_now();
 
     // Authentication phase
-    printf("[AUTH] Client connected. Starting authentication...\n");
+    log_debug("AUTH", "Client connected. Starting authentication...");
     
     // Receive authentication or registration request
-    // Format: "AUTH:username:password" or "REGISTER:username:password"
+    // Format: "AUTH:username:password", "REGISTER:username:password"
+    // or "RESUME:username:token" to reuse a token from create_session
     char auth_buffer[MAX_BUFFER];
-    bzero(auth_buffer, MAX_BUFFER);
-    n = read(sock, auth_buffer, MAX_BUFFER - 1);
-    if (n <= 0) {
-        printf("[AUTH] Failed to receive credentials\n");
-        close(sock);
-        return;
-    }
-    auth_buffer[n] = '\0';
-    
-    // Parse the request - use a copy to preserve original
-    char auth_copy[MAX_BUFFER];
-    strncpy(auth_copy, auth_buffer, MAX_BUFFER - 1);
-    auth_copy[MAX_BUFFER - 1] = '\0';
-    
-    char *command = strtok(auth_copy, ":");
-    char *username = strtok(NULL, ":");
-    char *password = strtok(NULL, ":");
-    
-    if (!command || !username || !password) {
-        printf("[AUTH] Invalid authentication format\n");
-        char fail_msg[] = "AUTH_FAILED:Invalid format";
-        write(sock, fail_msg, strlen(fail_msg));
-        close(sock);
-        return;
-    }
-    
-    // Make copies of username and password to ensure they're not modified
     char stored_username[MAX_USERNAME];
-    char stored_password[MAX_PASSWORD];
-    
-    strncpy(stored_username, username, MAX_USERNAME - 1);
-    stored_username[MAX_USERNAME - 1] = '\0';
-    
-    strncpy(stored_password, password, MAX_PASSWORD - 1);
-    stored_password[MAX_PASSWORD - 1] = '\0';
-    
-    printf("[AUTH] Received - Command: %s, Username: %s, Password length: %zu\n", 
-           command, stored_username, strlen(stored_password));
-    
+    char token[SESSION_TOKEN_MAX];
+    int resume_failed = 0;
     int auth_success = 0;
-    
-    if (strcmp(command, "REGISTER") == 0) {
-        // Handle registration
-        int reg_result = register_user(stored_username, stored_password);
-        if (reg_result == 0) {
-            auth_success = 1;
-            printf("[AUTH] User registered successfully: %s\n", stored_username);
-        } else {
-            char fail_msg[MAX_BUFFER];
-            if (reg_result == -1) {
-                snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Username already exists");
-            } else if (reg_result == -2) {
-                snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Too many users");
-            } else if (reg_result == -3) {
-                snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Invalid username or password format");
-            } else {
-                snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Registration failed");
+
+    // A client that stops reading cannot hold this process in write(), and
+    // one that never finishes logging in is dropped after deadlines.auth_sec
+    set_socket_timeout(sock, SO_SNDTIMEO, deadlines.write_sec * 1000000LL);
+    long long auth_deadline = metrics_now_us() + deadlines.auth_sec * 1000000LL;
+
+    while (!auth_success) {
+        if (deadlines.auth_sec > 0) {
+            long long remaining = auth_deadline - metrics_now_us();
+            set_socket_timeout(sock, SO_RCVTIMEO, remaining > 0 ? remaining : 1);
+        }
+        bzero(auth_buffer, MAX_BUFFER);
+        n = read(sock, auth_buffer, MAX_BUFFER - 1);
+        if (n < 0 && timed_out()) {
+            log_warn("AUTH", "No credentials within %d s, disconnecting", deadlines.auth_sec);
+            close(sock);
+            return;
+        }
+        if (n <= 0) {
+            log_warn("AUTH", "Failed to receive credentials");
+            close(sock);
+            return;
+        }
+        auth_buffer[n] = '\0';
+        request_started = metrics_now_us();
+        request_in = n;
+        
+        // Parse the request - use a copy to preserve original
+        char auth_copy[MAX_BUFFER];
+        strncpy(auth_copy, auth_buffer, MAX_BUFFER - 1);
+        auth_copy[MAX_BUFFER - 1] = '\0';
+        
+        char *command = strtok(auth_copy, ":");
+        char *username = strtok(NULL, ":");
+        char *password = strtok(NULL, ":");
+        int kind = metrics_login_command(command);
+        
+        if (!command || !username || !password) {
+            log_warn("AUTH", "Invalid authentication format");
+            char fail_msg[] = "AUTH_FAILED:Invalid format";
+            auth_reply(sock, kind, fail_msg);
+            close(sock);
+            return;
+        }
+        
+        // Make copies of username and password to ensure they're not modified
+        strncpy(stored_username, username, MAX_USERNAME - 1);
+        stored_username[MAX_USERNAME - 1] = '\0';
+        capture_login(capture_conn, command, stored_username);
+        
+        if (strcmp(command, "RESUME") == 0) {
+            // Token resumption skips both load_users() and hash_password()
+            if (resume_session(stored_username, password, token)) {
+                log_info("AUTH", "Session resumed for user: %s", stored_username);
+                char success_msg[MAX_BUFFER];
+                snprintf(success_msg, MAX_BUFFER, "AUTH_OK:%s", token);
+                auth_reply(sock, kind, success_msg);
+                break;
+            }
+
+            log_warn("AUTH", "Session resume failed for user: %s", stored_username);
+            char fail_msg[] = "AUTH_FAILED:Session expired";
+            auth_reply(sock, kind, fail_msg);
+            if (resume_failed) {
+                close(sock);
+                return;
             }
-            printf("[AUTH] Registration failed for user: %s (code: %d)\n", stored_username, reg_result);
-            write(sock, fail_msg, strlen(fail_msg));
+            // Keep the connection open so the client can fall back to AUTH
+            resume_failed = 1;
+            continue;
+        }
+
+        char stored_password[MAX_PASSWORD];
+        strncpy(stored_password, password, MAX_PASSWORD - 1);
+        stored_password[MAX_PASSWORD - 1] = '\0';
+        
+        log_debug("AUTH", "Received - Command: %s, Username: %s, Password length: %zu",
+                  command, stored_username, strlen(stored_password));
+        
+        // Turn away floods before paying for load_users() and hashing
+        int limited = ratelimit_check_login(&cli_addr, stored_username);
+        if (limited != RATE_OK) {
+            log_warn("AUTH", "Rate limited (%s): %s",
+                     limited == RATE_LIMITED_IP ? "address" : "user", stored_username);
+            char fail_msg[] = "AUTH_FAILED:Too many attempts";
+            auth_reply(sock, kind, fail_msg);
             close(sock);
             return;
         }
-    } else if (strcmp(command, "AUTH") == 0) {
-        // Handle login
-        if (verify_credentials(stored_username, stored_password)) {
-            auth_success = 1;
-            printf("[AUTH] User authenticated: %s\n", stored_username);
+
+        // Reload users in case they were updated by another process
+        long long stage_started = conntrace_now_us();
+        load_users();
+        conntrace_span(trace_conn, TRACE_LOAD_USERS, kind, stage_started, 0);
+        stage_started = conntrace_now_us();
+
+        if (strcmp(command, "REGISTER") == 0) {
+            // Handle registration
+            int reg_result = register_user(stored_username, stored_password);
+            conntrace_span(trace_conn, TRACE_HASH, kind, stage_started, 0);
+            if (reg_result == 0) {
+                auth_success = 1;
+                log_info("AUTH", "User registered successfully: %s", stored_username);
+            } else {
+                char fail_msg[MAX_BUFFER];
+                if (reg_result == -1) {
+                    snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Username already exists");
+                } else if (reg_result == -2) {
+                    snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Too many users");
+                } else if (reg_result == -3) {
+                    snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Invalid username or password format");
+                } else if (reg_result == -4) {
+                    snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Username reserved");
+                } else {
+                    snprintf(fail_msg, MAX_BUFFER, "AUTH_FAILED:Registration failed");
+                }
+                log_warn("AUTH", "Registration failed for user: %s (code: %d)", stored_username, reg_result);
+                auth_reply(sock, kind, fail_msg);
+                close(sock);
+                return;
+            }
+        } else if (strcmp(command, "AUTH") == 0) {
+            // Handle login
+            int verified = verify_credentials(stored_username, stored_password);
+            conntrace_span(trace_conn, TRACE_HASH, kind, stage_started, 0);
+            if (verified) {
+                auth_success = 1;
+                log_info("AUTH", "User authenticated: %s", stored_username);
+            } else {
+                log_warn("AUTH", "Authentication failed for user: %s", stored_username);
+                char fail_msg[] = "AUTH_FAILED:Invalid credentials";
+                auth_reply(sock, kind, fail_msg);
+                close(sock);
+                return;
+            }
         } else {
-            printf("[AUTH] Authentication failed for user: %s\n", stored_username);
-            char fail_msg[] = "AUTH_FAILED:Invalid credentials";
-            write(sock, fail_msg, strlen(fail_msg));
+            log_warn("AUTH", "Unknown command: %s", command);
+            char fail_msg[] = "AUTH_FAILED:Unknown command";
+            auth_reply(sock, kind, fail_msg);
             close(sock);
             return;
         }
-    } else {
-        printf("[AUTH] Unknown command: %s\n", command);
-        char fail_msg[] = "AUTH_FAILED:Unknown command";
-        write(sock, fail_msg, strlen(fail_msg));
-        close(sock);
-        return;
-    }
-    
-    // Create session
-    if (auth_success) {
-        char token[TOKEN_SIZE * 2 + 1];
+        
+        // Create session
         if (!create_session(stored_username, token)) {
-            printf("[AUTH] Failed to create session for user: %s\n", stored_username);
+            log_warn("AUTH", "Failed to create session for user: %s", stored_username);
             char fail_msg[] = "AUTH_FAILED:Session creation failed";
-            write(sock, fail_msg, strlen(fail_msg));
+            auth_reply(sock, kind, fail_msg);
             close(sock);
             return;
         }
@@ -244,15 +408,16 @@ void handle_client(int sock) {
         // Send success message
         char success_msg[MAX_BUFFER];
         snprintf(success_msg, MAX_BUFFER, "AUTH_OK:%s", token);
-        write(sock, success_msg, strlen(success_msg));
-        printf("[AUTH] Session created for user: %s\n", stored_username);
+        auth_reply(sock, kind, success_msg);
+        log_info("AUTH", "Session created for user: %s", stored_username);
     }
 
     // Clear buffer for normal operation
     bzero(buffer, MAX_BUFFER);
+    set_socket_timeout(sock, SO_RCVTIMEO, deadlines.idle_sec * 1000000LL);
     
     int run = 1;
-    printf("[INFO] Starting main communication loop for user: %s\n", stored_username);
+    log_debug("SERVER", "Starting main communication loop for user: %s", stored_username);
 
     while (run)
     {
@@ -261,8 +426,24 @@ void handle_client(int sock) {
         // Pass the client-specific socket to the communication functions
         int answer = listen_question(sock) ;
 
-        run = answer_question(sock, answer, session_start_time) ;
+        if (answer == ADMIN_REQUEST) {
+            run = answer_admin(sock, stored_username);
+            metrics_request(METRIC_ADMIN, request_started, request_in, request_out, !run);
+            conntrace_span(trace_conn, TRACE_REQUEST, METRIC_ADMIN, request_started, request_out);
+        } else if (answer == PROBE_REQUEST) {
+            run = answer_probe(sock);
+            metrics_request(METRIC_PING, request_started, request_in, request_out, !run);
+            conntrace_span(trace_conn, TRACE_REQUEST, METRIC_PING, request_started, request_out);
+        } else {
+            run = answer_question(sock, answer, session_start_time) ;
+            // Quitting and disconnecting are not requests
+            if (answer != 5 && answer != -1) {
+                int command = metrics_menu_command(answer);
+                metrics_request(command, request_started, request_in, request_out, !run);
+                conntrace_span(trace_conn, TRACE_REQUEST, command, request_started, request_out);
+            }
+        }
     }
-    printf("[INFO] Client disconnected: %s (socket %d)\n", stored_username, sock);
+    log_info("SERVER", "Client disconnected: %s (socket %d)", stored_username, sock);
     close(sock);
 }
@@ -1,15 +1,12 @@
 #include "service.h"
+#include "coarseclock.h"
+#include "logger.h"
+#include <errno.h>
+#include <unistd.h>
 
 void date_time(char *buffer, int max_buffer) {
-    bzero(buffer, max_buffer);
-    time_t raw_time ;
-    struct tm *local_time_info ;
-
-    time(&raw_time) ;
-
-    local_time_info = localtime(&raw_time) ;
-
-    strftime(buffer, max_buffer-1, "%Y-%m-%d %H:%M:%S", local_time_info) ;
+    // Formatted once a second by the clock ticker, not per request
+    coarseclock_datetime(buffer, max_buffer);
 }
 
 void directory_files(char *buffer, int max_buffer) {
@@ -32,8 +29,9 @@ void directory_files(char *buffer, int max_buffer) {
     closedir(d) ;
 }
 
-void file_content(char *buffer, int max_buffer, int sockfd, const char *filepath) {
+ssize_t file_content(char *buffer, int max_buffer, int sockfd, const char *filepath) {
     FILE *file_ptr ;
+    ssize_t total_sent = 0;
     char file_buffer[1024];  // Larger buffer for file content
     char full_path[512];     // Full path with data directory
     bzero(file_buffer, sizeof(file_buffer));
@@ -45,29 +43,32 @@ void file_content(char *buffer, int max_buffer, int sockfd, const char *filepath
     file_ptr = fopen(full_path, "r") ;
     if(file_ptr == NULL){
         strcpy(buffer, "ERROR: File does not exist");
-        write(sockfd, buffer, strlen(buffer)) ;
-        return ;
+        ssize_t sent = write(sockfd, buffer, strlen(buffer)) ;
+        return sent == (ssize_t)strlen(buffer) ? sent : -1;
     }else{
-        // Read entire file into buffer
-        size_t bytes_read = fread(file_buffer, 1, sizeof(file_buffer) - 1, file_ptr);
-        while(bytes_read == 1023){
-        file_buffer[bytes_read] = '\0';  // Null terminate
-        
-        // Send the file content
-        ssize_t buffer_sent = write(sockfd, file_buffer, bytes_read);
-        if (buffer_sent < 0) {
-            perror("send failed");
-        } else if (buffer_sent < bytes_read) {
-            perror("Partial write of file content");
+        // Send the file a chunk at a time. A failed or short write means the
+        // client stopped reading (SO_SNDTIMEO ran out) or left: give up at
+        // once rather than wait out the timeout again for every chunk
+        size_t bytes_read;
+        while((bytes_read = fread(file_buffer, 1, sizeof(file_buffer) - 1, file_ptr)) > 0){
+            ssize_t buffer_sent = write(sockfd, file_buffer, bytes_read);
+            if (buffer_sent < 0) {
+                log_warn("SOCKET", "File send failed after %zd bytes: %s", total_sent, strerror(errno));
+                total_sent = -1;
+                break;
+            }
+            if ((size_t)buffer_sent < bytes_read) {
+                log_warn("SOCKET", "Partial write of file content after %zd bytes",
+                         total_sent + buffer_sent);
+                total_sent = -1;
+                break;
+            }
+            total_sent += buffer_sent;
         }
-        bytes_read =fread(file_buffer, 1, sizeof(file_buffer) - 1, file_ptr) ;
-        
-    }   
-        file_buffer[bytes_read] = '\0';
-        write(sockfd, file_buffer, bytes_read);
-        
+
         fclose(file_ptr) ;
     }
+    return total_sent;
 }
 
 void session_time(char *buffer, int max_buffer, time_t start_time) {
@@ -75,7 +76,7 @@ void session_time(char *buffer, int max_buffer, time_t start_time) {
     time_t current_time;
     double elapsed_seconds;
 
-    time(&current_time);
+    current_time = coarseclock_now();
     elapsed_seconds = difftime(current_time, start_time);
 
     snprintf(buffer, max_buffer - 1, "Current session has been active for %.0f seconds.", elapsed_seconds);
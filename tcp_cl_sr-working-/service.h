@@ -5,10 +5,11 @@
 #include <string.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 void date_time(char *buffer, int max_buffer);
 void directory_files(char *buffer, int max_buffer);
-void file_content(char *buffer, int max_buffer, int sockfd, const char *filepath);
+ssize_t file_content(char *buffer, int max_buffer, int sockfd, const char *filepath); // Returns: bytes sent, -1 if a write failed or was cut short
 void session_time(char *buffer, int max_buffer, time_t start_time);
 
 #endif // SERVICE_H
@@ -0,0 +1,365 @@
+#include "sessionstore.h"
+#include "credstore.h"
+#include "logger.h"
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Shared with forked children so a snapshot never trims a half-written append
+typedef struct {
+    pthread_mutex_t lock;
+} JournalShared;
+
+static JournalShared *journal = NULL;
+static int journal_fd = -1;
+
+static pthread_t snapshot_thread;
+static pid_t snapshot_pid = 0;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+static int snapshot_running = 0;
+static int snapshot_interval = SESSION_SNAPSHOT_INTERVAL;
+static SessionCopyFn snapshot_copy = NULL;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint32_t entry_crc(const SessionJournalEntry *entry) {
+    return credstore_crc32(&entry->op, offsetof(SessionJournalEntry, crc) -
+                                       offsetof(SessionJournalEntry, op));
+}
+
+static uint32_t snap_header_crc(const SessionSnapHeader *header) {
+    return credstore_crc32(header, offsetof(SessionSnapHeader, header_crc));
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int find_record(SessionRecord *records, int count, const SessionRecord *record) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(records[i].token, record->token) == 0 &&
+            strcmp(records[i].username, record->username) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Apply one journal entry to the records loaded so far
+static int apply_entry(SessionRecord *records, int count, int max,
+                       const SessionJournalEntry *entry) {
+    int i = find_record(records, count, &entry->record);
+
+    if (entry->op == SESSION_OP_INVALIDATE) {
+        if (i >= 0) {
+            records[i] = records[--count];
+        }
+    } else if (i >= 0) {
+        // Created again or extended: expiries only move forward
+        if (entry->record.expiry > records[i].expiry) {
+            records[i].expiry = entry->record.expiry;
+        }
+    } else if (entry->op == SESSION_OP_CREATE && count < max) {
+        records[count++] = entry->record;
+    }
+    return count;
+}
+
+// Read every valid journal entry, stopping at the first torn or corrupt one
+static int replay_journal(SessionRecord *records, int count, int max) {
+    int fd = open(SESSION_JOURNAL_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return count;
+    }
+
+    SessionJournalEntry entry;
+    int applied = 0;
+    while (read(fd, &entry, sizeof(entry)) == sizeof(entry)) {
+        if (entry.magic != SESSION_ENTRY_MAGIC || entry.crc != entry_crc(&entry)) {
+            log_warn("SESSION", "Journal damaged after %d entries, ignoring the rest", applied);
+            break;
+        }
+        entry.record.username[MAX_USERNAME - 1] = '\0';
+        entry.record.token[SESSION_TOKEN_MAX - 1] = '\0';
+        count = apply_entry(records, count, max, &entry);
+        applied++;
+    }
+    close(fd);
+    return count;
+}
+
+// ============================================================================
+// Snapshot Thread
+// ============================================================================
+
+static void take_snapshot() {
+    SessionRecord *records = malloc(sizeof(SessionRecord) * MAX_SESSIONS);
+    if (records == NULL) {
+        log_error("SESSION", "Out of memory, snapshot skipped");
+        return;
+    }
+
+    off_t mark = 0;
+    int count = snapshot_copy(records, MAX_SESSIONS, &mark);
+    sessionstore_snapshot(records, count, mark);
+    free(records);
+}
+
+static void *snapshot_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&snapshot_mutex);
+    while (snapshot_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += snapshot_interval;
+        while (snapshot_running &&
+               pthread_cond_timedwait(&snapshot_cond, &snapshot_mutex, &deadline) != ETIMEDOUT) {
+        }
+        pthread_mutex_unlock(&snapshot_mutex);
+
+        take_snapshot();
+
+        pthread_mutex_lock(&snapshot_mutex);
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+    return NULL;
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+int sessionstore_open() {
+    if (journal != NULL) {
+        return 1;
+    }
+
+    journal_fd = open(SESSION_JOURNAL_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (journal_fd < 0) {
+        log_error("SESSION", "Could not open session journal: %s", strerror(errno));
+        return 0;
+    }
+
+    // A crash can leave half an entry at the end: without it, the entries
+    // appended from now on stay aligned and are replayed
+    struct stat st;
+    if (fstat(journal_fd, &st) == 0 && st.st_size % sizeof(SessionJournalEntry) != 0) {
+        log_warn("SESSION", "Truncating torn journal entry");
+        if (ftruncate(journal_fd, st.st_size - st.st_size % sizeof(SessionJournalEntry)) != 0) {
+            log_error("SESSION", "Could not truncate session journal: %s", strerror(errno));
+        }
+    }
+
+    journal = mmap(NULL, sizeof(JournalShared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (journal == MAP_FAILED) {
+        log_error("SESSION", "Could not map journal lock: %s", strerror(errno));
+        journal = NULL;
+        close(journal_fd);
+        journal_fd = -1;
+        return 0;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&journal->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return 1;
+}
+
+int sessionstore_load(SessionRecord *out, int max, time_t now) {
+    int count = 0;
+
+    int fd = open(SESSION_SNAPSHOT_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        SessionSnapHeader header;
+        int ok = read(fd, &header, sizeof(header)) == sizeof(header) &&
+                 header.magic == SESSION_SNAP_MAGIC &&
+                 header.version == SESSION_STORE_VERSION &&
+                 header.header_crc == snap_header_crc(&header);
+
+        SessionRecord *records = NULL;
+        size_t size = 0;
+        if (ok) {
+            size = sizeof(SessionRecord) * header.count;
+            records = malloc(size ? size : 1);
+            ok = records != NULL &&
+                 read(fd, records, size) == (ssize_t)size &&
+                 header.records_crc == credstore_crc32(records, size);
+        }
+        close(fd);
+
+        if (!ok) {
+            log_warn("SESSION", "Ignoring damaged snapshot %s", SESSION_SNAPSHOT_FILE);
+        } else {
+            for (uint32_t i = 0; i < header.count && count < max; i++) {
+                records[i].username[MAX_USERNAME - 1] = '\0';
+                records[i].token[SESSION_TOKEN_MAX - 1] = '\0';
+                out[count++] = records[i];
+            }
+        }
+        free(records);
+    }
+
+    count = replay_journal(out, count, max);
+
+    // Expired sessions are not worth restoring
+    int live = 0;
+    for (int i = 0; i < count; i++) {
+        if (out[i].expiry > now) {
+            out[live++] = out[i];
+        }
+    }
+    return live;
+}
+
+int sessionstore_append(int op, const char *username, const char *token, time_t expiry) {
+    if (journal == NULL) {
+        return 0;
+    }
+
+    SessionJournalEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.magic = SESSION_ENTRY_MAGIC;
+    entry.op = (uint8_t)op;
+    strncpy(entry.record.username, username, MAX_USERNAME - 1);
+    strncpy(entry.record.token, token, SESSION_TOKEN_MAX - 1);
+    entry.record.expiry = expiry;
+    entry.crc = entry_crc(&entry);
+
+    pthread_mutex_lock(&journal->lock);
+    int ok = write_all(journal_fd, &entry, sizeof(entry));
+    pthread_mutex_unlock(&journal->lock);
+
+    if (!ok) {
+        log_error("SESSION", "Could not append to session journal: %s", strerror(errno));
+    }
+    return ok;
+}
+
+off_t sessionstore_journal_mark() {
+    if (journal == NULL) {
+        return 0;
+    }
+
+    struct stat st;
+    pthread_mutex_lock(&journal->lock);
+    off_t mark = (fstat(journal_fd, &st) == 0) ? st.st_size : 0;
+    pthread_mutex_unlock(&journal->lock);
+    return mark;
+}
+
+int sessionstore_snapshot(const SessionRecord *records, int count, off_t mark) {
+    SessionSnapHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SESSION_SNAP_MAGIC;
+    header.version = SESSION_STORE_VERSION;
+    header.count = (uint32_t)count;
+    header.records_crc = credstore_crc32(records, sizeof(SessionRecord) * count);
+    header.saved_at = time(NULL);
+    header.header_crc = snap_header_crc(&header);
+
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", SESSION_SNAPSHOT_FILE, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_error("SESSION", "Could not create snapshot: %s", strerror(errno));
+        return 0;
+    }
+
+    int ok = write_all(fd, &header, sizeof(header)) &&
+             write_all(fd, records, sizeof(SessionRecord) * count) &&
+             fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp_path, SESSION_SNAPSHOT_FILE) != 0) {
+        log_error("SESSION", "Could not write snapshot: %s", strerror(errno));
+        unlink(tmp_path);
+        return 0;
+    }
+
+    if (journal == NULL) {
+        return 1;
+    }
+
+    // Keep only what was appended after the copy, usually nothing
+    pthread_mutex_lock(&journal->lock);
+    struct stat st;
+    char *tail = NULL;
+    ssize_t tail_len = 0;
+    if (fstat(journal_fd, &st) == 0 && st.st_size > mark) {
+        tail_len = st.st_size - mark;
+        tail = malloc(tail_len);
+        int rfd = open(SESSION_JOURNAL_FILE, O_RDONLY | O_CLOEXEC);
+        if (tail == NULL || rfd < 0 || pread(rfd, tail, tail_len, mark) != tail_len) {
+            tail_len = -1;
+        }
+        if (rfd >= 0) {
+            close(rfd);
+        }
+    }
+
+    // On any doubt leave the journal as it is, replaying it again is harmless
+    if (tail_len >= 0 && ftruncate(journal_fd, 0) == 0 && tail_len > 0) {
+        write_all(journal_fd, tail, tail_len);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    free(tail);
+    return 1;
+}
+
+int sessionstore_start(int interval, SessionCopyFn copy) {
+    if (snapshot_running) {
+        return 1;
+    }
+
+    snapshot_interval = interval > 0 ? interval : SESSION_SNAPSHOT_INTERVAL;
+    snapshot_copy = copy;
+    snapshot_running = 1;
+    int err = pthread_create(&snapshot_thread, NULL, snapshot_main, NULL);
+    if (err != 0) {
+        log_error("SESSION", "Could not start snapshot thread: %s", strerror(err));
+        snapshot_running = 0;
+        return 0;
+    }
+    snapshot_pid = getpid();
+    return 1;
+}
+
+void sessionstore_stop() {
+    // Only the process running the thread snapshots and tears down
+    if (snapshot_running && getpid() == snapshot_pid) {
+        pthread_mutex_lock(&snapshot_mutex);
+        snapshot_running = 0;
+        pthread_cond_signal(&snapshot_cond);
+        pthread_mutex_unlock(&snapshot_mutex);
+        pthread_join(snapshot_thread, NULL);
+        printf("[SESSION] Sessions saved to %s\n", SESSION_SNAPSHOT_FILE);
+    }
+
+    if (journal_fd >= 0) {
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    if (journal != NULL) {
+        munmap(journal, sizeof(JournalShared));
+        journal = NULL;
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef SESSIONSTORE_H
+#define SESSIONSTORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "auth.h"
+
+#define SESSION_SNAPSHOT_FILE "data/sessions.snap"
+#define SESSION_JOURNAL_FILE  "data/sessions.journal"
+#define SESSION_SNAPSHOT_INTERVAL 60   // Default seconds between snapshots
+
+#define SESSION_SNAP_MAGIC  0x50535353u // "SSSP"
+#define SESSION_ENTRY_MAGIC 0x454a5353u // "SSJE"
+#define SESSION_STORE_VERSION 1
+
+#define SESSION_OP_CREATE 1
+#define SESSION_OP_EXTEND 2
+#define SESSION_OP_INVALIDATE 3
+
+/*
+ * Stored sessions, kept across server restarts.
+ *
+ * sessions.snap     SessionSnapHeader, then SessionRecord[count]: every live
+ *                   session when the snapshot was taken. Replaced by rename.
+ * sessions.journal  SessionJournalEntry... appended (no fsync) on every
+ *                   create, extend and invalidate, each with a CRC.
+ *
+ * Replaying the journal is idempotent (creates are skipped if present,
+ * expiries only move forward), so a crash between writing a snapshot and
+ * trimming the journal loses nothing. Entries whose expiry has passed are
+ * dropped when loading and never written to a snapshot. A torn entry at
+ * the end of the journal is ignored by the load and cut off by the open.
+ *
+ * Appends are not synced: a restart or crash of the server keeps them (they
+ * are in the page cache), a power loss can drop those since the last snapshot.
+ */
+
+typedef struct {
+    char username[MAX_USERNAME];
+    char token[SESSION_TOKEN_MAX];
+    int64_t expiry;
+} SessionRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t records_crc;        // CRC-32 of the records
+    int64_t saved_at;
+    uint32_t header_crc;         // CRC-32 of the fields above
+    uint32_t reserved;
+} SessionSnapHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t op;                  // SESSION_OP_*
+    uint8_t reserved[3];
+    SessionRecord record;
+    uint32_t crc;                // CRC-32 of op, reserved and record
+    uint32_t reserved2;
+} SessionJournalEntry;
+
+/**
+ * Copy every live session into out (at most max) and return how many.
+ * Called by the snapshot thread, must hold the session table lock while
+ * it copies and calls sessionstore_journal_mark()
+ */
+typedef int (*SessionCopyFn)(SessionRecord *out, int max, off_t *journal_mark);
+
+/**
+ * Open the journal for appending. Must be called before fork() so children
+ * append to the same file
+ * Returns: 1 on success, 0 on failure
+ */
+int sessionstore_open();
+
+/**
+ * Read the snapshot and replay the journal, keeping sessions that expire
+ * after now
+ * Returns: number of sessions written to out (at most max), -1 on error
+ */
+int sessionstore_load(SessionRecord *out, int max, time_t now);
+
+/**
+ * Append one change to the journal. Callers serialise appends with the
+ * session table lock so the journal order matches the table
+ * Returns: 1 on success, 0 on failure
+ */
+int sessionstore_append(int op, const char *username, const char *token, time_t expiry);
+
+/**
+ * Current end of the journal: everything before it is reflected in a copy
+ * of the session table taken under the same lock
+ */
+off_t sessionstore_journal_mark();
+
+/**
+ * Write a snapshot of records and drop the journal entries before mark
+ * Returns: 1 on success, 0 on failure
+ */
+int sessionstore_snapshot(const SessionRecord *records, int count, off_t mark);
+
+/**
+ * Take a snapshot through copy every interval seconds on a background thread
+ * Returns: 1 on success, 0 on failure
+ */
+int sessionstore_start(int interval, SessionCopyFn copy);
+
+/**
+ * Stop the snapshot thread after a final snapshot and close the journal
+ */
+void sessionstore_stop();
+
+#endif // SESSIONSTORE_H
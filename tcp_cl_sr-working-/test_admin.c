@@ -0,0 +1,210 @@
+// Unit test for the admin commands: who may run them, LIST paging,
+// DELETE, PASSWD and REVOKE, REVOKE racing PASSWD and DELETE from
+// another process, and signed tokens with revocation checks off
+#include "admin.h"
+#include "credstore.h"
+#include "kdf.h"
+#include "testutil.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+#define ADMIN_NAME "root"
+#define LIST_USERS 30
+#define RACE_ROUNDS 300
+
+static char reply[ADMIN_REPLY_MAX];
+
+static const char *admin(const char *request) {
+    admin_handle(ADMIN_NAME, request, reply, sizeof(reply));
+    return reply;
+}
+
+static int starts_with(const char *text, const char *prefix) {
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
+
+// A process that revokes name's sessions until killed
+static pid_t start_revoker(const char *name) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        while (1) {
+            load_users();
+            revoke_user_sessions(name);
+        }
+    }
+    return pid;
+}
+
+static void stop_revoker(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+// Admin rights come from AUTH_ADMIN_USERS and an existing account
+static void test_rights() {
+    CHECK(starts_with(admin("ADMIN:LIST"), "ADMIN_FAILED:Not an admin"));
+    CHECK(register_user(ADMIN_NAME, "rootpass1") == -4);
+    CHECK(create_user(ADMIN_NAME, "rootpass1") == 1);
+    CHECK(create_user("alice", "alicepass1") == 1);
+    CHECK(starts_with(admin("ADMIN:LIST"), "ADMIN_OK:"));
+
+    admin_handle("alice", "ADMIN:LIST", reply, sizeof(reply));
+    CHECK(starts_with(reply, "ADMIN_FAILED:Not an admin"));
+    CHECK(starts_with(admin("ADMIN:DELETE:" ADMIN_NAME), "ADMIN_FAILED:Cannot delete yourself"));
+    CHECK(starts_with(admin("ADMIN:NOPE:alice"), "ADMIN_FAILED:Unknown command"));
+    CHECK(starts_with(admin("ADMIN:DELETE"), "ADMIN_FAILED:Missing username"));
+}
+
+// Pages of a few names each add up to every user, in order, once
+static void test_list() {
+    for (int i = 0; i < LIST_USERS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "list%02d", i);
+        CHECK(create_user(name, "listpass1") == 1);
+    }
+    load_users();
+
+    char after[MAX_USERNAME] = "", last[MAX_USERNAME] = "";
+    size_t listed = 0;
+    int pages = 0, ordered = 1;
+    while (pages++ < 100) {
+        char request[128];
+        snprintf(request, sizeof(request), "ADMIN:LIST:%s:7", after);
+        CHECK(starts_with(admin(request), "ADMIN_OK:"));
+
+        // A header line, names, then NEXT:<cursor> or END
+        char *save = NULL;
+        char *line = strtok_r(reply, "\n", &save);
+        int more = 0;
+        while ((line = strtok_r(NULL, "\n", &save)) != NULL) {
+            if (starts_with(line, "NEXT:")) {
+                snprintf(after, sizeof(after), "%s", line + strlen("NEXT:"));
+                more = 1;
+            } else if (strcmp(line, "END") != 0) {
+                ordered &= (strcmp(last, line) < 0);
+                snprintf(last, sizeof(last), "%s", line);
+                listed++;
+            }
+        }
+        if (!more) {
+            break;
+        }
+    }
+    CHECK(listed == credstore_count() && ordered);
+    CHECK(pages > (int)(listed / 7));
+    CHECK(starts_with(admin("ADMIN:LIST::0"), "ADMIN_FAILED:Count must be"));
+    CHECK(starts_with(admin("ADMIN:LIST:zzz"), "ADMIN_OK:0 of"));
+}
+
+static void test_delete_passwd() {
+    CHECK(starts_with(admin("ADMIN:DELETE:list05"), "ADMIN_OK:Deleted list05"));
+    CHECK(starts_with(admin("ADMIN:DELETE:list05"), "ADMIN_FAILED:No such user"));
+    CHECK(!verify_credentials("list05", "listpass1"));
+
+    CHECK(starts_with(admin("ADMIN:PASSWD:list06:short"), "ADMIN_FAILED:Password needs"));
+    CHECK(starts_with(admin("ADMIN:PASSWD:list06"), "ADMIN_FAILED:Missing password"));
+    CHECK(starts_with(admin("ADMIN:PASSWD:list06:newpass1"), "ADMIN_OK:Password changed"));
+    CHECK(!verify_credentials("list06", "listpass1"));
+    CHECK(verify_credentials("list06", "newpass1"));
+    CHECK(starts_with(admin("ADMIN:PASSWD:ghost:newpass1"), "ADMIN_FAILED:No such user"));
+    CHECK(!credstore_get("ghost", NULL));
+}
+
+// Signed tokens issued before a REVOKE or PASSWD stop verifying, ones
+// issued afterwards (even in the same second) work
+static void test_revoke() {
+    char before[SESSION_TOKEN_MAX], after[SESSION_TOKEN_MAX];
+    CHECK(create_session("list07", before) && verify_session("list07", before));
+    CHECK(starts_with(admin("ADMIN:REVOKE:list07"), "ADMIN_OK:Revoked"));
+    CHECK(!verify_session("list07", before));
+    CHECK(create_session("list07", after) && verify_session("list07", after));
+    CHECK(verify_credentials("list07", "listpass1"));
+
+    CHECK(create_session("list08", before));
+    CHECK(starts_with(admin("ADMIN:PASSWD:list08:otherpass1"), "ADMIN_OK:"));
+    CHECK(!verify_session("list08", before));
+    CHECK(starts_with(admin("ADMIN:REVOKE:ghost"), "ADMIN_FAILED:No such user"));
+}
+
+// A REVOKE that read the record before a PASSWD must not put the old
+// password back
+static void test_revoke_passwd_race() {
+    CHECK(create_user("racer", "racepass0") == 1);
+    load_users();
+    pid_t revoker = start_revoker("racer");
+
+    int lost = 0;
+    for (int i = 1; i <= RACE_ROUNDS; i++) {
+        char password[32];
+        snprintf(password, sizeof(password), "racepass%d", i);
+        CHECK(change_password("racer", password) == 1);
+        load_users();
+        lost += !verify_credentials("racer", password);
+    }
+    stop_revoker(revoker);
+    CHECK(lost == 0);
+}
+
+// Nor bring a deleted user back
+static void test_revoke_delete_race() {
+    pid_t revoker = start_revoker("phoenix");
+    int back = 0, created = 0;
+    for (int i = 0; i < RACE_ROUNDS; i++) {
+        CredRecord user;
+        created += prepare_user("phoenix", "phoenixpass1", &user) && credstore_put(&user, 1) == 1;
+        usleep(500);
+        CHECK(delete_user("phoenix") == 1);
+        usleep(500);
+        load_users();
+        back += credstore_get("phoenix", NULL);
+    }
+    stop_revoker(revoker);
+    CHECK(created == RACE_ROUNDS);
+    CHECK(back == 0);
+}
+
+// With AUTH_TOKEN_REVOCATION=off only signatures count: as on an instance
+// without the credential store, revoked and deleted users' tokens verify
+static void test_revocation_off() {
+    char revoked[SESSION_TOKEN_MAX], gone[SESSION_TOKEN_MAX];
+    CHECK(create_session("list09", revoked));
+    CHECK(starts_with(admin("ADMIN:REVOKE:list09"), "ADMIN_OK:"));
+    CHECK(create_session("list10", gone));
+    CHECK(starts_with(admin("ADMIN:DELETE:list10"), "ADMIN_OK:"));
+    CHECK(!verify_session("list09", revoked) && !verify_session("list10", gone));
+
+    cleanup_auth_system();
+    setenv("AUTH_TOKEN_REVOCATION", "off", 1);
+    CHECK(init_auth_system());
+    CHECK(verify_session("list09", revoked) && verify_session("list10", gone));
+    CHECK(!verify_session("list11", gone));
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_admin")) {
+        return 1;
+    }
+
+    // Cheap hashes, signed tokens, one admin
+    FILE *fp = fopen(KDF_POLICY_FILE, "w");
+    fprintf(fp, "scrypt %d %d 1\n", KDF_SCRYPT_MIN_LOG_N, (KDF_SCRYPT_R << 8) | KDF_SCRYPT_P);
+    fclose(fp);
+    setenv("AUTH_TOKEN_MODE", "stateless", 1);
+    setenv("AUTH_ADMIN_USERS", ADMIN_NAME, 1);
+    if (!init_auth_system()) {
+        return 1;
+    }
+
+    test_rights();
+    test_list();
+    test_delete_passwd();
+    test_revoke();
+    test_revoke_passwd_race();
+    test_revoke_delete_race();
+    test_revocation_off();
+
+    cleanup_auth_system();
+    test_scratch_clean(dir);
+    return test_done("admin");
+}
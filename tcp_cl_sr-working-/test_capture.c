@@ -0,0 +1,268 @@
+// Unit test for traffic capture and its replay: records read back as
+// written, secrets kept out of the trace, appends from several processes,
+// damaged traces, then a trace the server captured under loadgen that
+// loadgen -T replays request for request
+//
+//     ./test_capture [./server ./loadgen]
+#include "capture.h"
+#include "testutil.h"
+#include <sys/wait.h>
+
+#define TRACE "trace.bin"
+#define CHILDREN 4
+#define CHILD_CONNS 50
+
+static char server_path[PATH_MAX];
+static char loadgen_path[PATH_MAX];
+
+// Read up to max records of the trace at path, each payload in its own slot
+// Returns: records read, -1 if the header is bad, -2 - n if damaged after n
+static int read_trace(const char *path, CaptureRecord *records, char (*payloads)[CAPTURE_PAYLOAD_MAX],
+                      int max) {
+    FILE *fp = fopen(path, "rb");
+    CaptureFileHeader header;
+    if (fp == NULL || !capture_read_header(fp, &header)) {
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return -1;
+    }
+    int count = 0, status = 1;
+    while (count < max && (status = capture_read_record(fp, &records[count], payloads[count])) == 1) {
+        count++;
+    }
+    fclose(fp);
+    return status < 0 ? -2 - count : count;
+}
+
+// Returns: 1 if the bytes of text appear anywhere in the file at path
+static int file_contains(const char *path, const char *text) {
+    FILE *fp = fopen(path, "rb");
+    static char data[1 << 20];
+    size_t len = fp ? fread(data, 1, sizeof(data), fp) : 0;
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    size_t n = strlen(text);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (memcmp(data + i, text, n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void test_records() {
+    CHECK(capture_connect() == 0);
+    CHECK(capture_open(TRACE));
+    uint32_t a = capture_connect(), b = capture_connect();
+    CHECK(a != 0 && b != 0 && a != b);
+    capture_login(a, "AUTH", "alice");
+    capture_login(b, "REGISTER", "bob");
+    capture_request(a, "1", 1);
+    capture_response(a, 29);
+    capture_request(b, "ADMIN:PASSWD:alice:hunter22", 27);
+    capture_login(b, "RESUME", "alice");
+    char big[CAPTURE_PAYLOAD_MAX + 100];
+    memset(big, 'x', sizeof(big));
+    capture_request(b, big, sizeof(big));
+    capture_close(a);
+    capture_request(0, "3", 1);
+    capture_stop();
+
+    CaptureRecord r[16];
+    char payloads[16][CAPTURE_PAYLOAD_MAX];
+    CHECK(read_trace(TRACE, r, payloads, 16) == 10);
+    CHECK(r[0].type == CAPTURE_CONNECT && r[0].conn == a && r[1].conn == b);
+    CHECK(r[2].type == CAPTURE_LOGIN && r[2].detail == CAPTURE_LOGIN_AUTH);
+    CHECK(r[3].detail == CAPTURE_LOGIN_REGISTER && r[7].detail == CAPTURE_LOGIN_RESUME);
+    CHECK(r[2].value == r[7].value && r[2].value != r[3].value);
+    CHECK(r[4].type == CAPTURE_REQUEST && r[4].length == 1 && payloads[4][0] == '1');
+    CHECK(r[5].type == CAPTURE_RESPONSE && r[5].value == 29);
+    CHECK(r[6].length == 12 && memcmp(payloads[6], "ADMIN:PASSWD", 12) == 0);
+    CHECK(r[8].length == CAPTURE_PAYLOAD_MAX);
+    CHECK(r[9].type == CAPTURE_CLOSE && r[9].conn == a);
+    int ordered = 1;
+    for (int i = 1; i < 10; i++) {
+        ordered &= (r[i].at_us >= r[i - 1].at_us);
+    }
+    CHECK(ordered);
+    CHECK(!file_contains(TRACE, "hunter22") && !file_contains(TRACE, "alice"));
+}
+
+// Children share the trace opened before fork(), records never interleave
+static void test_processes() {
+    CHECK(capture_open(TRACE));
+    pid_t pids[CHILDREN];
+    for (int c = 0; c < CHILDREN; c++) {
+        pids[c] = fork();
+        if (pids[c] == 0) {
+            for (int i = 0; i < CHILD_CONNS; i++) {
+                uint32_t conn = (uint32_t)(c * CHILD_CONNS + i + 1);
+                char request[64];
+                int len = snprintf(request, sizeof(request), "%u %u", conn, conn * 7);
+                capture_request(conn, request, len);
+                capture_response(conn, conn * 7);
+            }
+            _exit(0);
+        }
+    }
+    for (int c = 0; c < CHILDREN; c++) {
+        waitpid(pids[c], NULL, 0);
+    }
+    capture_stop();
+
+    static CaptureRecord r[2 * CHILDREN * CHILD_CONNS + 1];
+    static char payloads[2 * CHILDREN * CHILD_CONNS + 1][CAPTURE_PAYLOAD_MAX];
+    int count = read_trace(TRACE, r, payloads, 2 * CHILDREN * CHILD_CONNS + 1);
+    CHECK(count == 2 * CHILDREN * CHILD_CONNS);
+    int intact = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned int conn = 0, value = 0;
+        payloads[i][r[i].length < CAPTURE_PAYLOAD_MAX ? r[i].length : CAPTURE_PAYLOAD_MAX - 1] = '\0';
+        if (r[i].type == CAPTURE_REQUEST) {
+            intact += (sscanf(payloads[i], "%u %u", &conn, &value) == 2 &&
+                       conn == r[i].conn && value == conn * 7);
+        } else {
+            intact += (r[i].type == CAPTURE_RESPONSE && r[i].value == r[i].conn * 7);
+        }
+    }
+    CHECK(intact == count);
+}
+
+static void test_damaged() {
+    CaptureRecord r[2];
+    char payloads[2][CAPTURE_PAYLOAD_MAX];
+    CHECK(truncate(TRACE, sizeof(CaptureFileHeader) + sizeof(CaptureRecord) + 1) == 0);
+    CHECK(read_trace(TRACE, r, payloads, 2) == -2);
+
+    FILE *fp = fopen(TRACE, "r+b");
+    CaptureFileHeader header;
+    CHECK(fread(&header, sizeof(header), 1, fp) == 1);
+    CaptureRecord bad = { 0 };
+    bad.type = CAPTURE_CLOSE + 1;
+    fseek(fp, sizeof(header), SEEK_SET);
+    fwrite(&bad, sizeof(bad), 1, fp);
+    header.version = CAPTURE_VERSION + 1;
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    fclose(fp);
+    CHECK(read_trace(TRACE, r, payloads, 2) == -1);
+    CHECK(read_trace("missing.bin", r, payloads, 2) == -1);
+}
+
+// Run loadgen against a server it starts in mode 4, counting the answered
+// requests per menu option from its CSV rows. The server does not set
+// SO_REUSEADDR, so every run gets a fresh port
+// Returns: 1 if it ran without errors
+static int loadgen(const char *extra, long counts[5]) {
+    static int runs = 0;
+    char command[PATH_MAX * 2 + 256];
+    snprintf(command, sizeof(command), "'%s' 127.0.0.1 %d -S '%s' -M 4 -C %s 2>/dev/null",
+             loadgen_path, 20000 + (getpid() % 10000) * 2 + runs++, server_path, extra);
+    fflush(NULL);
+    FILE *out = popen(command, "r");
+    if (out == NULL) {
+        return 0;
+    }
+    static const char *names[] = { "", "date", "list", "file", "elapsed" };
+    char line[256];
+    long errors = 0;
+    while (fgets(line, sizeof(line), out) != NULL) {
+        char mode[32], name[32];
+        long count, failed;
+        if (sscanf(line, "%31[^,],%31[^,],%ld,%ld", mode, name, &count, &failed) != 4) {
+            continue;
+        }
+        errors += failed;
+        for (int i = 1; i <= 4; i++) {
+            if (strcmp(name, names[i]) == 0) {
+                counts[i] = count;
+            }
+        }
+    }
+    return pclose(out) == 0 && errors == 0;
+}
+
+// What the server captured is what loadgen sent, and a replay sends it again
+static void test_replay() {
+    FILE *fp = fopen("data/kdf_policy.dat", "w");
+    fprintf(fp, "scrypt 10 2049 1\n");
+    fclose(fp);
+    setenv("AUTH_RATE_IP", "0", 1);
+    setenv("AUTH_RATE_USER", "0", 1);
+    setenv("SERVER_CAPTURE_FILE", TRACE, 1);
+    long sent[5] = { 0 }, replayed[5] = { 0 };
+    CHECK(loadgen("-c 4 -d 1 -t 1 -U capuser -p cappass1 -m 1:1,2:1,4:1", sent));
+    unsetenv("SERVER_CAPTURE_FILE");
+
+    // Per connection: connect, logins, requests each answered, close
+    fp = fopen(TRACE, "rb");
+    CaptureFileHeader header;
+    CHECK(fp != NULL && capture_read_header(fp, &header));
+    CaptureRecord record;
+    char payload[CAPTURE_PAYLOAD_MAX + 1];
+    long captured[5] = { 0 };
+    int stages[64] = { 0 }, well_formed = 1, status, count = 0;
+    while (fp != NULL && (status = capture_read_record(fp, &record, payload)) == 1) {
+        uint32_t conn = record.conn < 64 ? record.conn : 0;
+        int stage = stages[conn];
+        int option;
+        count++;
+        switch (record.type) {
+            case CAPTURE_CONNECT:
+                well_formed &= (stage == 0);
+                stages[conn] = 1;
+                break;
+            case CAPTURE_LOGIN:
+                well_formed &= (stage == 1 || stage == 2);
+                stages[conn] = 2;
+                break;
+            case CAPTURE_REQUEST:
+                well_formed &= (stage == 2);
+                stages[conn] = 3;
+                payload[record.length] = '\0';
+                option = atoi(payload);
+                captured[option >= 1 && option <= 4 ? option : 0]++;
+                break;
+            case CAPTURE_RESPONSE:
+                well_formed &= (stage == 3);
+                stages[conn] = 2;
+                break;
+            case CAPTURE_CLOSE:
+                well_formed &= (stage >= 1);
+                stages[conn] = 4;
+                break;
+        }
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    CHECK(status == 0 && count > 0 && well_formed);
+    CHECK(sent[1] > 0 && sent[2] > 0 && sent[4] > 0);
+    CHECK(captured[1] == sent[1] && captured[2] == sent[2] && captured[4] == sent[4]);
+    CHECK(!file_contains(TRACE, "cappass1") && !file_contains(TRACE, "capuser"));
+
+    CHECK(loadgen("-T " TRACE " -x 4", replayed));
+    CHECK(replayed[1] == sent[1] && replayed[2] == sent[2] && replayed[4] == sent[4]);
+}
+
+int main(int argc, char *argv[]) {
+    if (realpath(argc > 2 ? argv[1] : "./server", server_path) == NULL ||
+        realpath(argc > 2 ? argv[2] : "./loadgen", loadgen_path) == NULL) {
+        fprintf(stderr, "[TEST ERROR] No server or loadgen binary, build them first\n");
+        return 1;
+    }
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_capture")) {
+        return 1;
+    }
+
+    test_records();
+    test_processes();
+    test_damaged();
+    test_replay();
+
+    test_scratch_clean(dir);
+    return test_done("capture");
+}
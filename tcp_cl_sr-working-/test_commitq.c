@@ -0,0 +1,177 @@
+// Unit test for the registration write-behind queue: a batch that fills
+// before its window ends, the window itself, duplicates within a batch and
+// against the store, submits from forked children, and async mode
+#include "commitq.h"
+#include "testutil.h"
+#include <sys/wait.h>
+#include <time.h>
+
+#define WINDOW_MS 300
+#define BATCH 16
+#define CHILDREN 4
+#define CHILD_USERS 25
+
+typedef struct {
+    CredRecord record;
+    int result;
+} Submit;
+
+static CredRecord make_record(const char *username, unsigned char tag) {
+    CredRecord record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.username, username, CREDSTORE_USERNAME - 1);
+    memset(record.hash, tag, CREDSTORE_HASH);
+    memset(record.salt, tag, CREDSTORE_SALT);
+    return record;
+}
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void start(int durable) {
+    CommitConfig config = { WINDOW_MS, BATCH, durable };
+    CHECK(commitq_start(&config));
+}
+
+static void *submit_main(void *arg) {
+    Submit *s = arg;
+    s->result = commitq_submit(&s->record);
+    return NULL;
+}
+
+// Submit every record from its own thread at once
+static void submit_all(Submit *subs, int count) {
+    pthread_t threads[BATCH];
+    for (int i = 0; i < count; i++) {
+        pthread_create(&threads[i], NULL, submit_main, &subs[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Returns: the tag stored for username, -1 if it is missing
+static int stored_tag(const char *username) {
+    CredRecord record;
+    credstore_refresh();
+    return credstore_get(username, &record) ? record.hash[0] : -1;
+}
+
+// A full batch is written at once, a lone entry waits out the window
+static void test_batching() {
+    start(1);
+    Submit subs[BATCH];
+    for (int i = 0; i < BATCH; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "batch%02d", i);
+        subs[i].record = make_record(name, (unsigned char)(i + 1));
+    }
+    long long started = now_ms();
+    submit_all(subs, BATCH);
+    CHECK(now_ms() - started < WINDOW_MS);
+    int ok = 0;
+    for (int i = 0; i < BATCH; i++) {
+        ok += (subs[i].result == 1 && stored_tag(subs[i].record.username) == i + 1);
+    }
+    CHECK(ok == BATCH);
+
+    CredRecord lone = make_record("lone", 7);
+    started = now_ms();
+    CHECK(commitq_submit(&lone) == 1);
+    long long took = now_ms() - started;
+    CHECK(took >= WINDOW_MS - 20 && took < 4 * WINDOW_MS);
+    commitq_stop();
+}
+
+// Of two registrations of one name in a batch, the first is kept and the
+// second told it lost. A name already in the store is refused
+static void test_duplicates() {
+    start(1);
+    Submit subs[3];
+    subs[0].record = make_record("twin", 1);
+    subs[1].record = make_record("twin", 2);
+    subs[2].record = make_record("batch03", 9);
+    submit_all(subs, 3);
+
+    int tag = stored_tag("twin");
+    CHECK(tag == 1 || tag == 2);
+    CHECK(subs[0].result == (tag == 1 ? 1 : -1));
+    CHECK(subs[1].result == (tag == 2 ? 1 : -1));
+    CHECK(subs[2].result == -1 && stored_tag("batch03") == 4);
+    commitq_stop();
+}
+
+// Children submit to the queue their parent started
+static void test_children() {
+    start(1);
+    pid_t pids[CHILDREN];
+    for (int c = 0; c < CHILDREN; c++) {
+        pids[c] = fork();
+        if (pids[c] == 0) {
+            int failed = 0;
+            for (int i = 0; i < CHILD_USERS; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "child%d_%02d", c, i);
+                CredRecord record = make_record(name, (unsigned char)(c + 1));
+                failed += (commitq_submit(&record) != 1);
+            }
+            _exit(failed ? 1 : 0);
+        }
+    }
+    int clean = 0;
+    for (int c = 0; c < CHILDREN; c++) {
+        int status;
+        waitpid(pids[c], &status, 0);
+        clean += (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    CHECK(clean == CHILDREN);
+    commitq_stop();
+
+    int found = 0;
+    for (int c = 0; c < CHILDREN; c++) {
+        for (int i = 0; i < CHILD_USERS; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "child%d_%02d", c, i);
+            found += (stored_tag(name) == c + 1);
+        }
+    }
+    CHECK(found == CHILDREN * CHILD_USERS);
+}
+
+// Async submits return before the write, stopping the queue writes them
+static void test_async() {
+    start(0);
+    long long started = now_ms();
+    for (int i = 0; i < 5; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "async%d", i);
+        CredRecord record = make_record(name, 3);
+        CHECK(commitq_submit(&record) == 1);
+    }
+    CHECK(now_ms() - started < WINDOW_MS / 2);
+    CHECK(stored_tag("async0") == -1);
+    commitq_stop();
+    CHECK(stored_tag("async0") == 3 && stored_tag("async4") == 3);
+
+    CredRecord late = make_record("late", 3);
+    CHECK(!commitq_active() && commitq_submit(&late) == 0);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_commitq") || !credstore_open()) {
+        return 1;
+    }
+
+    test_batching();
+    test_duplicates();
+    test_children();
+    test_async();
+
+    credstore_close();
+    test_scratch_clean(dir);
+    return test_done("commitq");
+}
@@ -0,0 +1,223 @@
+// Unit test for connection stage tracing: tracing off, sampling, a dump
+// in time order with the breakdown from the same copy of the rings, spans
+// from forked children, the trace file, and a ring that wrapped
+#define _GNU_SOURCE                  // sched_setaffinity(), open_memstream()
+#include "conntrace.h"
+#include "metrics.h"
+#include "testutil.h"
+#include <sched.h>
+#include <sys/wait.h>
+
+#define SAMPLE 3
+#define SPANS 100
+#define CHILDREN 4
+#define TRACE_FILE "stages.txt"
+
+static char breakdown[4096];
+
+// Dump the rings into a string, the breakdown into breakdown
+// Returns: events written, the text in *text (caller frees)
+static int dump(char **text) {
+    size_t len;
+    FILE *fp = open_memstream(text, &len);
+    int count = conntrace_dump(fp, breakdown, sizeof(breakdown));
+    fclose(fp);
+    return count;
+}
+
+// Returns: the breakdown row of stage and command, NULL if there is none
+static const char *row(const char *stage, const char *command) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%-11s %-8s ", stage, command);
+    for (const char *line = breakdown; line != NULL; line = strchr(line, '\n')) {
+        line += (*line == '\n');
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+// Returns: the span count of a breakdown row, -1 if there is none
+static int row_count(const char *stage, const char *command) {
+    const char *line = row(stage, command);
+    int count;
+    return (line != NULL && sscanf(line, "%*s %*s %d", &count) == 1) ? count : -1;
+}
+
+static void test_off() {
+    setenv("SERVER_TRACE_SAMPLE", "0", 1);
+    CHECK(conntrace_init());
+    CHECK(conntrace_connect() == 0);
+    conntrace_span_at(1, TRACE_REQUEST, METRIC_DATE, 0, 10, 0);
+
+    char *text;
+    CHECK(dump(&text) == 0);
+    CHECK(strcmp(breakdown, "Tracing is off") == 0);
+    CHECK(strncmp(text, "# Tracing is off\n# ms conn stage", 32) == 0);
+    free(text);
+    CHECK(!conntrace_start_file(TRACE_FILE));
+}
+
+// One connection in SAMPLE is traced, id 0 records nothing
+static void test_sampling() {
+    uint32_t ids[3 * SAMPLE];
+    int traced = 0, multiples = 1;
+    for (int i = 0; i < 3 * SAMPLE; i++) {
+        ids[i] = conntrace_connect();
+        traced += (ids[i] != 0);
+        multiples &= (ids[i] % SAMPLE == 0);
+    }
+    CHECK(traced == 3 && multiples);
+    for (int i = 0; i < 3 * SAMPLE; i++) {
+        conntrace_span(ids[i], TRACE_AUTH, METRIC_AUTH, conntrace_now_us(), 1);
+        conntrace_close(ids[i]);
+    }
+
+    char *text;
+    CHECK(dump(&text) == 9);
+    CHECK(row_count("auth", "auth") == 3);
+    CHECK(row("accept", "-") == NULL && row("close", "-") == NULL);
+    free(text);
+}
+
+// Spans recorded newest first come out oldest first, and the breakdown
+// covers the same events as conntrace_breakdown()
+static void test_dump() {
+    uint32_t conn = 0;
+    while (conn == 0) {
+        conn = conntrace_connect();
+    }
+    long long base = conntrace_now_us();
+    for (int i = 0; i < SPANS; i++) {
+        long long at = base - i * 10;
+        conntrace_span_at(conn, TRACE_REQUEST, METRIC_DATE, at, at + (i + 1) * 1000, i);
+    }
+    for (int i = 0; i < 10; i++) {
+        conntrace_span_at(conn, TRACE_HASH, METRIC_AUTH, base, base + 5000, 1);
+    }
+
+    char *text;
+    CHECK(dump(&text) == 9 + 1 + SPANS + 10);
+    int count;
+    double p50, p99, max;
+    const char *line = row("request", "date");
+    CHECK(line != NULL && sscanf(line, "%*s %*s %d %lf %lf %lf", &count, &p50, &p99, &max) == 4);
+    CHECK(count == SPANS && p50 == 51 && p99 == 100 && max == 100);
+    line = row("hash", "auth");
+    CHECK(line != NULL && sscanf(line, "%*s %*s %d %lf %lf %lf", &count, &p50, &p99, &max) == 4);
+    CHECK(count == 10 && p50 == 5 && max == 5);
+
+    char again[sizeof(breakdown)];
+    conntrace_breakdown(again, sizeof(again));
+    CHECK(strcmp(again, breakdown) == 0);
+
+    // Breakdown lines are comments, then events by start time
+    int events = 0, ordered = 1, comments = 1;
+    double last = -1e18;
+    for (char *l = strtok(text, "\n"); l != NULL; l = strtok(NULL, "\n")) {
+        if (l[0] == '#') {
+            comments &= (events == 0);
+            continue;
+        }
+        double ms = atof(l);
+        ordered &= (ms >= last);
+        last = ms;
+        events++;
+    }
+    CHECK(events == 9 + 1 + SPANS + 10 && ordered && comments);
+    free(text);
+}
+
+// Children record into the rings their parent mapped
+static void test_children() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pid_t pids[CHILDREN];
+    for (int c = 0; c < CHILDREN; c++) {
+        pids[c] = fork();
+        if (pids[c] == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(c % (cpus > 0 ? cpus : 1), &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            for (int i = 0; i < SPANS; i++) {
+                conntrace_span(SAMPLE, TRACE_REQUEST, METRIC_LIST, conntrace_now_us(), 0);
+            }
+            _exit(0);
+        }
+    }
+    for (int c = 0; c < CHILDREN; c++) {
+        waitpid(pids[c], NULL, 0);
+    }
+    char *text;
+    dump(&text);
+    CHECK(row_count("request", "list") == CHILDREN * SPANS);
+    free(text);
+}
+
+// The writer thread appends new events every CONNTRACE_FLUSH_MS
+static void test_file() {
+    CHECK(conntrace_start_file(TRACE_FILE));
+    conntrace_span(SAMPLE, TRACE_LOAD_USERS, METRIC_AUTH, conntrace_now_us(), 4242);
+    usleep((CONNTRACE_FLUSH_MS + 300) * 1000);
+
+    FILE *fp = fopen(TRACE_FILE, "r");
+    char line[256];
+    int header = 0, events = 0, ours = 0;
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        header += (strncmp(line, "# ms conn stage", 15) == 0);
+        events += (line[0] != '#');
+        ours += (strstr(line, " load_users auth ") != NULL && strstr(line, " 4242\n") != NULL);
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    CHECK(header == 1 && ours == 1);
+    CHECK(events == 9 + 1 + SPANS + 10 + CHILDREN * SPANS + 1);
+}
+
+// A ring keeps its latest CONNTRACE_RING_EVENTS events
+static void test_wrap() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    CHECK(sched_setaffinity(0, sizeof(set), &set) == 0);
+    for (int i = 0; i < CONNTRACE_RING_EVENTS + 500; i++) {
+        conntrace_span(SAMPLE, TRACE_REQUEST, METRIC_ELAPSED, conntrace_now_us(), (uint32_t)i);
+    }
+
+    char *text;
+    dump(&text);
+    CHECK(row_count("request", "elapsed") == CONNTRACE_RING_EVENTS);
+    int oldest = -1;
+    for (char *l = strtok(text, "\n"); l != NULL; l = strtok(NULL, "\n")) {
+        unsigned int value;
+        if (strstr(l, " request elapsed ") != NULL && sscanf(l, "%*s %*s %*s %*s %*s %u", &value) == 1) {
+            oldest = (oldest < 0 || (int)value < oldest) ? (int)value : oldest;
+        }
+    }
+    CHECK(oldest == 500);
+    free(text);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_conntrace")) {
+        return 1;
+    }
+
+    test_off();
+    char sample[16];
+    snprintf(sample, sizeof(sample), "%d", SAMPLE);
+    setenv("SERVER_TRACE_SAMPLE", sample, 1);
+    CHECK(conntrace_init());
+
+    test_sampling();
+    test_dump();
+    test_children();
+    test_file();
+    test_wrap();
+
+    test_scratch_clean(dir);
+    return test_done("conntrace");
+}
@@ -0,0 +1,220 @@
+// Unit test for the credential store: log, index, compaction, replay of a
+// damaged tail, concurrent writers and batches
+#include "credstore.h"
+#include "testutil.h"
+#include <sys/wait.h>
+
+#define WRITER_USERS 200               // Per child in the two-process test
+
+static CredRecord make_record(const char *username, unsigned char tag) {
+    CredRecord record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.username, username, CREDSTORE_USERNAME - 1);
+    memset(record.hash, tag, CREDSTORE_HASH);
+    memset(record.salt, tag, CREDSTORE_SALT);
+    return record;
+}
+
+static int put(const char *username, unsigned char tag) {
+    CredRecord record = make_record(username, tag);
+    return credstore_put(&record, 0);
+}
+
+// Returns: the hash tag stored for username, -1 if it is missing
+static int stored_tag(const char *username) {
+    CredRecord record;
+    return credstore_get(username, &record) ? record.hash[0] : -1;
+}
+
+static void reopen() {
+    credstore_close();
+    CHECK(credstore_open());
+}
+
+static off_t log_size() {
+    struct stat st;
+    return stat(CREDSTORE_LOG_FILE, &st) == 0 ? st.st_size : -1;
+}
+
+static void append_raw(const void *data, size_t len) {
+    int fd = open(CREDSTORE_LOG_FILE, O_WRONLY | O_APPEND);
+    CHECK(fd >= 0 && write(fd, data, len) == (ssize_t)len);
+    close(fd);
+}
+
+// Every page of the listing, joined as "a,b,c"
+static void list_all(char *out, size_t size, int page) {
+    CredRecord records[16];
+    char after[CREDSTORE_USERNAME] = "";
+    size_t used = 0;
+    out[0] = '\0';
+    int found;
+    while ((found = credstore_list(after, records, page)) > 0) {
+        for (int i = 0; i < found; i++) {
+            used += snprintf(out + used, size - used, "%s%s", used ? "," : "", records[i].username);
+        }
+        strcpy(after, records[found - 1].username);
+    }
+    CHECK(found == 0);
+}
+
+static void test_compaction() {
+    const char *names[] = { "delta", "alpha", "echo", "charlie", "bravo" };
+    for (int i = 0; i < 5; i++) {
+        CHECK(put(names[i], 1) == 1);
+    }
+    CHECK(put("alpha", 2) == 1);
+    CHECK(credstore_delete("echo") == 1);
+    CHECK(credstore_delete("echo") == -1);
+    CredRecord dup = make_record("bravo", 3);
+    CHECK(credstore_put(&dup, 1) == -1);
+
+    char listed[256];
+    list_all(listed, sizeof(listed), 2);
+    CHECK(strcmp(listed, "alpha,bravo,charlie,delta") == 0);
+    CHECK(credstore_count() == 4);
+
+    // Folded into the index, then changed again in the new log
+    CHECK(credstore_compact());
+    CHECK(log_size() == (off_t)sizeof(CredLogHeader));
+    list_all(listed, sizeof(listed), 3);
+    CHECK(strcmp(listed, "alpha,bravo,charlie,delta") == 0);
+    CHECK(stored_tag("alpha") == 2 && stored_tag("echo") == -1);
+
+    CHECK(credstore_delete("bravo") == 1);
+    CHECK(put("beta", 4) == 1);
+    CHECK(put("delta", 5) == 1);
+    reopen();
+    list_all(listed, sizeof(listed), 1);
+    CHECK(strcmp(listed, "alpha,beta,charlie,delta") == 0);
+    CHECK(stored_tag("bravo") == -1 && stored_tag("beta") == 4 && stored_tag("delta") == 5);
+    CHECK(credstore_count() == 4);
+}
+
+// A crash can leave half an entry, or a whole one with a bad CRC, at the
+// end of the log: both are ignored and the next append stays aligned
+static void test_damaged_tail() {
+    size_t before = credstore_count();
+    CredLogEntry entry;
+    credstore_make_entry(&entry, CRED_OP_PUT, &(CredRecord){ .username = "torn" });
+    append_raw(&entry, sizeof(entry) / 2);
+    reopen();
+    CHECK(credstore_count() == before && stored_tag("torn") == -1);
+
+    CHECK(put("after-torn", 6) == 1);
+    CHECK((log_size() - (off_t)sizeof(CredLogHeader)) % (off_t)sizeof(CredLogEntry) == 0);
+    reopen();
+    CHECK(stored_tag("after-torn") == 6 && stored_tag("torn") == -1);
+
+    credstore_make_entry(&entry, CRED_OP_PUT, &(CredRecord){ .username = "bad-crc" });
+    entry.crc ^= 1;
+    append_raw(&entry, sizeof(entry));
+    reopen();
+    CHECK(stored_tag("bad-crc") == -1);
+    CHECK(put("after-crc", 7) == 1);
+    reopen();
+    CHECK(stored_tag("after-crc") == 7 && stored_tag("bad-crc") == -1);
+    CHECK(credstore_count() == before + 2);
+}
+
+// Two processes append at once under the file lock; one of them wins a
+// name both create with must_be_new
+static void test_two_writers() {
+    size_t before = credstore_count();
+    off_t size_before = log_size();
+    pid_t children[2];
+    for (int c = 0; c < 2; c++) {
+        children[c] = fork();
+        if (children[c] == 0) {
+            int created = 0;
+            for (int i = 0; i < WRITER_USERS; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "writer%d-%03d", c, i);
+                if (put(name, (unsigned char)(c + 10)) != 1) {
+                    _exit(2);
+                }
+                if (i == WRITER_USERS / 2) {
+                    CredRecord shared = make_record("both", (unsigned char)(c + 10));
+                    created = (credstore_put(&shared, 1) == 1);
+                }
+            }
+            _exit(created);
+        }
+    }
+
+    int created = 0;
+    for (int c = 0; c < 2; c++) {
+        int status = 0;
+        CHECK(children[c] > 0 && waitpid(children[c], &status, 0) == children[c]);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) <= 1);
+        created += WEXITSTATUS(status);
+    }
+    CHECK(created == 1);
+
+    CHECK(credstore_refresh());
+    CHECK(credstore_count() == before + 2 * WRITER_USERS + 1);
+    CHECK(log_size() - size_before == (off_t)((2 * WRITER_USERS + 1) * sizeof(CredLogEntry)));
+    int missing = 0;
+    for (int c = 0; c < 2; c++) {
+        for (int i = 0; i < WRITER_USERS; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "writer%d-%03d", c, i);
+            missing += (stored_tag(name) != c + 10);
+        }
+    }
+    CHECK(missing == 0);
+}
+
+static void test_batch_duplicates() {
+    CHECK(put("batch-old", 20) == 1);
+    CredRecord batch[] = {
+        make_record("batch-a", 21), make_record("batch-b", 22), make_record("batch-a", 23),
+        make_record("batch-old", 24), make_record("batch-c", 25), make_record("batch-b", 26),
+    };
+    int count = sizeof(batch) / sizeof(batch[0]);
+
+    // New users only: the first record of each name, the stored one kept
+    CHECK(credstore_put_batch(batch, count, 1, 0) == 3);
+    CHECK(stored_tag("batch-a") == 21 && stored_tag("batch-b") == 22);
+    CHECK(stored_tag("batch-c") == 25 && stored_tag("batch-old") == 20);
+
+    // Replacing: every record is written and the last one of a name wins
+    CHECK(credstore_put_batch(batch, count, 0, 0) == count);
+    CHECK(stored_tag("batch-a") == 23 && stored_tag("batch-b") == 26);
+    CHECK(stored_tag("batch-old") == 24);
+    CHECK(credstore_put_batch(batch, 0, 1, 0) == 0);
+}
+
+// A write computed from an old read loses to any change made since
+static void test_replace() {
+    CredRecord read = make_record("cas", 30);
+    CHECK(credstore_put(&read, 0) == 1);
+    CredRecord upgraded = make_record("cas", 31);
+    CHECK(credstore_replace(&read, &upgraded) == 1);
+    CHECK(credstore_replace(&read, &upgraded) == -1);
+
+    CredRecord revoked = upgraded;
+    revoked.sessions_after = 1234;
+    CHECK(credstore_put(&revoked, 0) == 1);
+    CHECK(credstore_replace(&upgraded, &read) == -1);
+    CHECK(credstore_delete("cas") == 1);
+    CHECK(credstore_replace(&revoked, &read) == -1);
+    CHECK(stored_tag("cas") == -1);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_credstore") || !credstore_open()) {
+        return 1;
+    }
+
+    test_compaction();
+    test_damaged_tail();
+    test_two_writers();
+    test_batch_duplicates();
+    test_replace();
+
+    credstore_close();
+    test_scratch_clean(dir);
+    return test_done("credstore");
+}
@@ -0,0 +1,389 @@
+// Integration test for the GUI client's network layer against a real
+// server: connect errors, login and RESUME retries, streamed, slow,
+// cancelled and saved files. Starts its own server in a scratch directory
+//
+//     ./test_guinet ./server [mode...]     (modes default to 1 and 4)
+#include "guinet.h"
+#include "testutil.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SMALL_FILE "small.txt"
+#define BIG_FILE "big.txt"
+#define BIG_LINES 120000                 // About 7 MB, many chunks and stream pauses
+#define JOB_WAIT_MS 20000
+#define SERVER_START_MS 5000
+
+typedef struct {
+    int chunks;
+    size_t bytes;
+    int mismatch;                        // Streamed bytes differ from the file
+} Stream;
+
+static char server_path[PATH_MAX];
+static int port;
+
+// ============================================================================
+// Server
+// ============================================================================
+
+static void write_files() {
+    FILE *fp = fopen("data/" SMALL_FILE, "w");
+    for (int i = 0; fp != NULL && i < 100; i++) {
+        fprintf(fp, "Small file line %d\n", i);
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    fp = fopen("data/" BIG_FILE, "w");
+    for (int i = 0; fp != NULL && i < BIG_LINES; i++) {
+        fprintf(fp, "%08d the quick brown fox jumps over the lazy dog %08x\n", i, i * 2654435761u);
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+static long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Returns: a port nothing listens on right now
+static int free_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int found = 0;
+    if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr *)&addr, &len) == 0) {
+        found = ntohs(addr.sin_port);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return found;
+}
+
+static pid_t start_server(int mode) {
+    int prompt[2];
+    if (pipe(prompt) < 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(prompt[0], STDIN_FILENO);
+        close(prompt[0]);
+        close(prompt[1]);
+        int out = open("server.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (out >= 0) {
+            dup2(out, STDOUT_FILENO);
+            dup2(out, STDERR_FILENO);
+            close(out);
+        }
+        setenv("AUTH_RATE_IP", "0", 1);
+        setenv("AUTH_RATE_USER", "0", 1);
+        char port_arg[16];
+        snprintf(port_arg, sizeof(port_arg), "%d", port);
+        execl(server_path, server_path, port_arg, (char *)NULL);
+        _exit(127);
+    }
+    close(prompt[0]);
+    char answer[16];
+    int len = snprintf(answer, sizeof(answer), "%d\n", mode);
+    if (pid < 0 || write(prompt[1], answer, len) != len) {
+        close(prompt[1]);
+        return -1;
+    }
+    close(prompt[1]);
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    for (int waited = 0; waited < SERVER_START_MS; waited += 50) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int up = fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (up) {
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+        usleep(50000);
+    }
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void stop_server(pid_t pid) {
+    kill(-pid, SIGTERM);
+    for (int waited = 0; waited < 2000; waited += 50) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return;
+        }
+        usleep(50000);
+    }
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+// ============================================================================
+// Jobs
+// ============================================================================
+
+// Wait for the job of type, taking progress jobs on the way. Streamed parts
+// are compared with expected (when not NULL); cancel_at cancels the file at
+// that part, slow collects like a busy GUI
+// Returns: the job, NULL on timeout
+static NetJob *wait_job(int type, Stream *stream, FILE *expected, int cancel_at, int slow) {
+    while (1) {
+        struct pollfd pfd = { guinet_fd(), POLLIN, 0 };
+        if (poll(&pfd, 1, JOB_WAIT_MS) <= 0) {
+            return NULL;
+        }
+        if (slow) {
+            usleep(20000);
+        }
+        NetJob *job = guinet_collect();
+        NetJob *found = NULL;
+        while (job != NULL) {
+            NetJob *next = job->next;
+            if (job->type == NET_JOB_PROGRESS && stream != NULL) {
+                stream->chunks++;
+                stream->bytes += job->reply_len;
+                if (expected != NULL && job->reply_len > 0) {
+                    char buffer[GUINET_CHUNK];
+                    size_t n = fread(buffer, 1, job->reply_len, expected);
+                    stream->mismatch |= (n != job->reply_len ||
+                                         memcmp(buffer, job->reply, n) != 0);
+                }
+                if (cancel_at > 0 && stream->chunks == cancel_at) {
+                    guinet_cancel();
+                }
+            }
+            if (job->type == type && found == NULL) {
+                found = job;
+            } else {
+                guinet_free(job);
+            }
+            job = next;
+        }
+        if (found != NULL) {
+            return found;
+        }
+    }
+}
+
+// Run one job to completion
+// Returns: its status, with reply (or error) copied to out
+static int run(int type, const char *message, const char *host, char *out, size_t size) {
+    NetJob *job = guinet_job(type, NULL);
+    if (job == NULL) {
+        return -100;
+    }
+    if (message != NULL) {
+        snprintf(job->message, sizeof(job->message), "%s", message);
+    }
+    if (host != NULL) {
+        snprintf(job->host, sizeof(job->host), "%s", host);
+        job->port = port;
+    }
+    CHECK(guinet_submit(job));
+    NetJob *done = wait_job(type, NULL, NULL, 0, 0);
+    if (done == NULL) {
+        return -100;
+    }
+    int status = done->status;
+    if (out != NULL) {
+        snprintf(out, size, "%s", status == NET_ERROR ? done->error : done->reply ? done->reply : "");
+    }
+    guinet_free(done);
+    return status;
+}
+
+// Fetch name with option 3, streamed back or written to save
+// Returns: the file job's status
+static int fetch(const char *name, const char *save, int cancel_at, int slow, Stream *stream,
+                 char *error, size_t size) {
+    memset(stream, 0, sizeof(*stream));
+    NetJob *job = guinet_job(NET_JOB_FILE, NULL);
+    if (job == NULL) {
+        return -100;
+    }
+    snprintf(job->message, sizeof(job->message), "%s", name);
+    if (save != NULL) {
+        snprintf(job->save_path, sizeof(job->save_path), "%s", save);
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "data/%s", name);
+    FILE *expected = (save == NULL) ? fopen(path, "r") : NULL;
+
+    CHECK(guinet_submit(job));
+    NetJob *done = wait_job(NET_JOB_FILE, stream, expected, cancel_at, slow);
+    if (expected != NULL) {
+        fclose(expected);
+    }
+    if (done == NULL) {
+        return -100;
+    }
+    int status = done->status;
+    CHECK(status != NET_OK || done->received == (size_t)file_size(path));
+    if (error != NULL) {
+        snprintf(error, size, "%s", done->error);
+    }
+    guinet_free(done);
+    return status;
+}
+
+static int same_files(const char *a, const char *b) {
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    int same = (fa != NULL && fb != NULL);
+    while (same) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        same = (ca == cb);
+        if (ca == EOF || cb == EOF) {
+            break;
+        }
+    }
+    if (fa != NULL) {
+        fclose(fa);
+    }
+    if (fb != NULL) {
+        fclose(fb);
+    }
+    return same;
+}
+
+// ============================================================================
+// Scenarios
+// ============================================================================
+
+// Errors before there is a connection, then register and ask
+static void test_connect(char *token, size_t size) {
+    char out[256];
+    CHECK(run(NET_JOB_CONNECT, NULL, "nosuchhost.invalid", out, sizeof(out)) == NET_ERROR);
+    CHECK(strstr(out, "Unknown host") != NULL);
+    int real_port = port;
+    port = free_port();
+    CHECK(run(NET_JOB_CONNECT, NULL, "localhost", out, sizeof(out)) == NET_ERROR);
+    CHECK(strstr(out, "Failed to connect") != NULL);
+    port = real_port;
+    CHECK(run(NET_JOB_REQUEST, "1", NULL, out, sizeof(out)) == NET_ERROR);
+
+    CHECK(run(NET_JOB_CONNECT, NULL, "localhost", out, sizeof(out)) == NET_OK);
+    CHECK(run(NET_JOB_AUTH, "REGISTER:guinet:guinetpass1", NULL, out, sizeof(out)) == NET_OK);
+    CHECK(strncmp(out, "AUTH_OK:", 8) == 0);
+    snprintf(token, size, "%s", out + 8);
+    token[strcspn(token, "\r\n")] = '\0';
+    CHECK(run(NET_JOB_REQUEST, "1", NULL, out, sizeof(out)) == NET_OK && out[0] != '\0');
+}
+
+// Streamed, slow, cancelled and saved files; the connection stays usable
+static void test_files() {
+    Stream stream;
+    char error[128], out[256];
+    long big = file_size("data/" BIG_FILE);
+
+    CHECK(fetch(SMALL_FILE, NULL, 0, 0, &stream, NULL, 0) == NET_OK);
+    CHECK(stream.bytes == (size_t)file_size("data/" SMALL_FILE) && !stream.mismatch);
+
+    CHECK(fetch(BIG_FILE, NULL, 0, 0, &stream, NULL, 0) == NET_OK);
+    CHECK(stream.bytes == (size_t)big && stream.chunks > 1 && !stream.mismatch);
+
+    // A GUI slow to collect pauses the reading, nothing is lost
+    CHECK(fetch(BIG_FILE, NULL, 0, 1, &stream, NULL, 0) == NET_OK);
+    CHECK(stream.bytes == (size_t)big && !stream.mismatch);
+
+    CHECK(fetch(BIG_FILE, NULL, 5, 0, &stream, NULL, 0) == NET_CANCELLED);
+    CHECK(stream.bytes < (size_t)big);
+    CHECK(run(NET_JOB_REQUEST, "1", NULL, out, sizeof(out)) == NET_OK && out[0] != '\0');
+
+    CHECK(fetch(BIG_FILE, "saved.txt", 0, 0, &stream, NULL, 0) == NET_OK);
+    CHECK(stream.bytes == 0 && stream.chunks > 0);
+    CHECK(same_files("saved.txt", "data/" BIG_FILE));
+    CHECK(fetch(BIG_FILE, "cancelled.txt", 3, 0, &stream, NULL, 0) == NET_CANCELLED);
+    CHECK(access("cancelled.txt", F_OK) != 0);
+
+    CHECK(fetch("nope.txt", NULL, 0, 0, &stream, NULL, 0) == NET_REJECTED);
+    CHECK(fetch("nope.txt", "nope_saved.txt", 0, 0, &stream, NULL, 0) == NET_REJECTED);
+    CHECK(access("nope_saved.txt", F_OK) != 0);
+    CHECK(fetch(SMALL_FILE, "/nonexistent/x", 0, 0, &stream, error, sizeof(error)) == NET_ERROR);
+    CHECK(strstr(error, "Cannot write file") != NULL);
+    CHECK(run(NET_JOB_REQUEST, "2", NULL, out, sizeof(out)) == NET_OK);
+}
+
+// RESUME on a new connection, a failed RESUME then logins on the same
+// one, and a login after a failure that closed it
+static void test_resume(const char *token) {
+    char out[256], message[GUINET_MESSAGE_MAX];
+    CHECK(run(NET_JOB_DISCONNECT, NULL, NULL, out, sizeof(out)) == NET_OK);
+    CHECK(run(NET_JOB_REQUEST, "1", NULL, out, sizeof(out)) == NET_ERROR);
+
+    CHECK(run(NET_JOB_CONNECT, NULL, "localhost", out, sizeof(out)) == NET_OK);
+    snprintf(message, sizeof(message), "RESUME:guinet:%s", token);
+    CHECK(run(NET_JOB_AUTH, message, NULL, out, sizeof(out)) == NET_OK);
+    CHECK(run(NET_JOB_REQUEST, "4", NULL, out, sizeof(out)) == NET_OK);
+
+    CHECK(run(NET_JOB_CONNECT, NULL, "localhost", out, sizeof(out)) == NET_OK);
+    CHECK(run(NET_JOB_AUTH, "RESUME:guinet:bogus", NULL, out, sizeof(out)) == NET_REJECTED);
+    CHECK(run(NET_JOB_AUTH, "AUTH:guinet:wrongpass1", NULL, out, sizeof(out)) == NET_REJECTED);
+    CHECK(strstr(out, "Invalid credentials") != NULL);
+    CHECK(run(NET_JOB_AUTH, "AUTH:guinet:guinetpass1", NULL, out, sizeof(out)) == NET_OK);
+    CHECK(run(NET_JOB_REQUEST, "1", NULL, out, sizeof(out)) == NET_OK);
+}
+
+static void test_mode(int mode) {
+    // Each mode gets its own data/, credentials included
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_guinet")) {
+        test_failures++;
+        return;
+    }
+    write_files();
+    port = free_port();
+    pid_t server = start_server(mode);
+    CHECK(server > 0);
+    if (server <= 0) {
+        test_scratch_clean(dir);
+        return;
+    }
+    printf("[TEST] guinet: server mode %d on port %d\n", mode, port);
+
+    CHECK(guinet_start());
+    char token[CLIENT_TOKEN_MAX];
+    test_connect(token, sizeof(token));
+    test_files();
+    test_resume(token);
+    guinet_stop();
+
+    stop_server(server);
+    test_scratch_clean(dir);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || realpath(argv[1], server_path) == NULL) {
+        fprintf(stderr, "Usage: %s <server> [mode...]\n", argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++) {
+            test_mode(atoi(argv[i]));
+        }
+    } else {
+        test_mode(1);
+        test_mode(4);
+    }
+    return test_done("guinet");
+}
@@ -0,0 +1,101 @@
+// Unit test for the KDF policy file: policies that load, costs and params
+// out of bounds falling back to the defaults, and derivations with both
+#include "kdf.h"
+#include "testutil.h"
+
+#define POLICY "data/kdf_policy.dat"
+
+// Load a policy file holding text into params, which start out as marker
+static int load(const char *text, KdfParams *params) {
+    FILE *fp = fopen(POLICY, "w");
+    fputs(text, fp);
+    fclose(fp);
+    params->kdf = CRED_KDF_SHA256;
+    params->cost = params->param = 7;
+    params->target_ms = 7;
+    return kdf_load_policy(POLICY, params);
+}
+
+static int is_default(const KdfParams *params) {
+    KdfParams defaults;
+    kdf_default_params(&defaults);
+    return params->kdf == defaults.kdf && params->cost == defaults.cost &&
+           params->param == defaults.param && params->target_ms == defaults.target_ms;
+}
+
+static void test_valid() {
+    KdfParams params;
+    CHECK(load("scrypt 10 2049 50\n", &params) == 1);
+    CHECK(params.kdf == CRED_KDF_SCRYPT && params.cost == 10 && params.param == 2049 &&
+          params.target_ms == 50);
+    CHECK(load("scrypt 22 8193 100\n", &params) == 1);
+    CHECK(load("pbkdf2 10000 0 100\n", &params) == 1);
+    CHECK(params.kdf == CRED_KDF_PBKDF2 && params.cost == 10000);
+    CHECK(load("sha256 0 0 0\n", &params) == 1 && params.kdf == CRED_KDF_SHA256);
+
+    // What kdf_save_policy() writes reads back
+    KdfParams saved = { CRED_KDF_PBKDF2, 250000, 0, 80 }, loaded;
+    CHECK(kdf_save_policy(POLICY, &saved));
+    CHECK(kdf_load_policy(POLICY, &loaded) == 1);
+    CHECK(memcmp(&saved, &loaded, sizeof(saved)) == 0);
+}
+
+static void test_out_of_bounds() {
+    const char *bad[] = {
+        "scrypt 9 2049 100\n",          // N below 2^10
+        "scrypt 23 2049 100\n",         // N above 2^22
+        "scrypt 4000000000 2049 100\n",
+        "scrypt 15 0 100\n",            // r = 0, p = 0
+        "scrypt 15 2048 100\n",         // p = 0
+        "scrypt 15 1 100\n",            // r = 0
+        "scrypt 15 8465 100\n",         // r = 33
+        "scrypt 15 2065 100\n",         // p = 17
+        "scrypt 15 4294967295 100\n",
+        "pbkdf2 9999 0 100\n",
+        "pbkdf2 0 0 100\n",
+        "pbkdf2 4000000000 0 100\n",
+        "argon2 3 65536 100\n",
+        "scrypt 15\n",
+        "",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        KdfParams params;
+        int loaded = load(bad[i], &params);
+        CHECK(loaded == 0 && is_default(&params));
+        if (loaded != 0 || !is_default(&params)) {
+            fprintf(stderr, "[TEST ERROR] Policy accepted: %s\n", bad[i]);
+        }
+    }
+
+    // A missing file is not an error, the caller's params stay
+    unlink(POLICY);
+    KdfParams params = { CRED_KDF_PBKDF2, 12345, 0, 1 };
+    CHECK(kdf_load_policy(POLICY, &params) == 0);
+    CHECK(params.kdf == CRED_KDF_PBKDF2 && params.cost == 12345);
+}
+
+// The cheapest accepted policies still derive, and differ from each other
+static void test_derive() {
+    unsigned char salt[CREDSTORE_SALT] = { 1, 2, 3 };
+    unsigned char a[CREDSTORE_HASH], b[CREDSTORE_HASH];
+    KdfParams params;
+    CHECK(load("scrypt 10 257 1\n", &params) == 1);
+    CHECK(kdf_derive("password1", salt, &params, a));
+    CHECK(load("pbkdf2 10000 0 1\n", &params) == 1);
+    CHECK(kdf_derive("password1", salt, &params, b));
+    CHECK(memcmp(a, b, sizeof(a)) != 0);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_kdf")) {
+        return 1;
+    }
+
+    test_valid();
+    test_out_of_bounds();
+    test_derive();
+
+    test_scratch_clean(dir);
+    return test_done("kdf");
+}
@@ -0,0 +1,145 @@
+// Unit test for the log ring: stalled, late and dead producers
+// The ring internals are static, so the module is included whole
+#include "logger.c"
+#include "testutil.h"
+#include <sys/wait.h>
+
+#define TEST_LOG_FILE "test_logger.log"
+
+// Returns: number of lines of the log file that contain text
+static int count_lines(const char *text) {
+    FILE *fp = fopen(TEST_LOG_FILE, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char line[LOG_TEXT_MAX * 6 + 128];
+    int count = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        count += (strstr(line, text) != NULL);
+    }
+    fclose(fp);
+    return count;
+}
+
+// Returns: 1 if every line with first comes before any line with second
+static int ordered(const char *first, const char *second) {
+    FILE *fp = fopen(TEST_LOG_FILE, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    char line[LOG_TEXT_MAX * 6 + 128];
+    int seen_second = 0, ok = 1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, second) != NULL) {
+            seen_second = 1;
+        } else if (strstr(line, first) != NULL && seen_second) {
+            ok = 0;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+static uint64_t dropped() {
+    return __atomic_load_n(&shared->dropped, __ATOMIC_RELAXED);
+}
+
+// Log count lines, pausing so the ring never fills
+static void log_lines(const char *marker, int count) {
+    for (int i = 0; i < count; i++) {
+        log_info("TEST", "%s %d", marker, i);
+        if (i % 512 == 511) {
+            usleep(LOG_IDLE_MS * 3000);
+        }
+    }
+}
+
+// Long enough for the writer to give up on a stalled slot
+static void wait_stall() {
+    usleep((LOG_STALL_MS * 3 + LOG_IDLE_MS * 2) * 1000);
+}
+
+static void fill_slot(LogSlot *slot, const char *text) {
+    slot->at_ns = realtime_ns();
+    slot->pid = getpid();
+    slot->level = LOG_LEVEL_INFO;
+    strcpy(slot->tag, "TEST");
+    slot->length = (uint16_t)strlen(text);
+    memcpy(slot->text, text, slot->length);
+}
+
+// A producer descheduled between claiming and filling its slot is skipped,
+// its late publish fails and the ring keeps working for more than a lap
+static void test_skipped_slot() {
+    uint64_t pos;
+    LogSlot *slot = claim_slot(&pos);
+    CHECK(slot != NULL);
+    log_info("TEST", "after-skip first");
+    wait_stall();
+
+    CHECK(dropped() == 1);
+    CHECK(!own_slot(slot, pos));
+    CHECK(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == pos + LOG_RING_SLOTS);
+
+    log_lines("after-skip", LOG_RING_SLOTS * 2);
+    usleep(LOG_IDLE_MS * 5000);
+    CHECK(count_lines("after-skip") == LOG_RING_SLOTS * 2 + 1);
+    CHECK(dropped() == 1);
+}
+
+// A live producer filling its slot is waited for, however long it takes,
+// and the records behind it keep their order
+static void test_slow_producer() {
+    uint64_t pos;
+    LogSlot *slot = claim_slot(&pos);
+    CHECK(slot != NULL && own_slot(slot, pos));
+    log_info("TEST", "behind-slow");
+    wait_stall();
+
+    CHECK(count_lines("behind-slow") == 0);
+    fill_slot(slot, "slow-record");
+    CHECK(publish_slot(slot, pos));
+    usleep(LOG_IDLE_MS * 5000);
+    CHECK(count_lines("slow-record") == 1);
+    CHECK(count_lines("behind-slow") == 1);
+    CHECK(ordered("slow-record", "behind-slow"));
+    CHECK(dropped() == 1);
+}
+
+// A process that died while filling its slot does not block the ring
+static void test_dead_producer() {
+    pid_t child = fork();
+    if (child == 0) {
+        uint64_t pos;
+        LogSlot *slot = claim_slot(&pos);
+        _exit(slot != NULL && own_slot(slot, pos) ? 0 : 1);
+    }
+    int status = 0;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    log_info("TEST", "after-dead");
+    wait_stall();
+    CHECK(dropped() == 2);
+    CHECK(count_lines("after-dead") == 1);
+}
+
+int main() {
+    setenv("SERVER_LOG_RATE", "0", 1);
+    setenv("SERVER_LOG_LEVEL", "info", 1);
+    setenv("SERVER_LOG_FORMAT", "text", 1);
+
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_logger") ||
+        !logger_init() || !logger_start(TEST_LOG_FILE)) {
+        return 1;
+    }
+
+    test_skipped_slot();
+    test_slow_producer();
+    test_dead_producer();
+
+    logger_stop();
+    test_scratch_clean(dir);
+    return test_done("logger");
+}
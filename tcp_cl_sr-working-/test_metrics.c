@@ -0,0 +1,234 @@
+// Unit test for the server metrics: nothing counted before metrics_init(),
+// handshake failures by reason, latency buckets and byte counts, exact
+// totals from threads and forked children on every CPU, the summary, and
+// the /metrics endpoint
+#define _GNU_SOURCE                  // sched_setaffinity()
+#include "metrics.h"
+#include "testutil.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define THREADS 4
+#define THREAD_REQUESTS 100000
+#define CHILDREN 4
+#define CHILD_REQUESTS 1000
+
+static char page[METRICS_REPLY_MAX];
+
+// Returns: the value of the Prometheus sample named series, -1 if missing
+static long long sample(const char *series) {
+    metrics_prometheus(page, sizeof(page));
+    size_t n = strlen(series);
+    for (const char *line = page; *line; line = strchr(line, '\n') + 1) {
+        if (strncmp(line, series, n) == 0 && line[n] == ' ') {
+            return atoll(line + n + 1);
+        }
+        if (strchr(line, '\n') == NULL) {
+            break;
+        }
+    }
+    return -1;
+}
+
+static void test_uninitialised() {
+    char summary[256];
+    metrics_request(METRIC_DATE, metrics_now_us(), 1, 29, 0);
+    metrics_login(METRIC_AUTH, metrics_now_us(), 20, "AUTH_OK:token");
+    metrics_accept(1);
+    metrics_close();
+    metrics_summary(summary, sizeof(summary));
+    CHECK(strcmp(summary, "Metrics unavailable") == 0);
+    CHECK(metrics_prometheus(page, sizeof(page)) == 0);
+    CHECK(!metrics_start_endpoint(9));
+}
+
+static void test_names() {
+    CHECK(metrics_menu_command(1) == METRIC_DATE && metrics_menu_command(4) == METRIC_ELAPSED);
+    CHECK(metrics_menu_command(0) == METRIC_INVALID && metrics_menu_command(5) == METRIC_INVALID);
+    CHECK(metrics_login_command("REGISTER") == METRIC_REGISTER);
+    CHECK(metrics_login_command("RESUME") == METRIC_RESUME);
+    CHECK(metrics_login_command("AUTH") == METRIC_AUTH && metrics_login_command(NULL) == METRIC_AUTH);
+    CHECK(strcmp(metrics_command_name(METRIC_FILE), "file") == 0);
+    CHECK(strcmp(metrics_command_name(METRICS_COMMANDS), "-") == 0);
+}
+
+static void test_logins() {
+    long long now = metrics_now_us();
+    metrics_login(METRIC_AUTH, now, 20, "AUTH_OK:token");
+    metrics_login(METRIC_AUTH, now, 20, "AUTH_FAILED:Invalid credentials");
+    metrics_login(METRIC_AUTH, now, 20, "AUTH_FAILED:Too many attempts");
+    metrics_login(METRIC_AUTH, now, 20, "AUTH_FAILED:Invalid format");
+    metrics_login(METRIC_REGISTER, now, 20, "AUTH_FAILED:Username already exists");
+    metrics_login(METRIC_RESUME, now, 20, "AUTH_FAILED:Session expired");
+    metrics_login(METRIC_RESUME, now, 20, "AUTH_FAILED:Something new");
+
+    CHECK(sample("tcp_server_requests_total{command=\"auth\"}") == 4);
+    CHECK(sample("tcp_server_request_errors_total{command=\"auth\"}") == 3);
+    CHECK(sample("tcp_server_received_bytes_total{command=\"register\"}") == 20);
+    CHECK(sample("tcp_server_sent_bytes_total{command=\"auth\"}") ==
+          (long long)(strlen("AUTH_OK:token") + strlen("AUTH_FAILED:Invalid credentials") +
+                      strlen("AUTH_FAILED:Too many attempts") + strlen("AUTH_FAILED:Invalid format")));
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"invalid_credentials\"}") == 1);
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"rate_limited\"}") == 1);
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"bad_format\"}") == 1);
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"user_exists\"}") == 1);
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"session_expired\"}") == 1);
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"other\"}") == 1);
+    CHECK(sample("tcp_server_auth_failures_total{reason=\"busy\"}") == 0);
+}
+
+// Buckets are cumulative, a start in the future counts as no time
+static void test_latency() {
+    long long now = metrics_now_us();
+    metrics_request(METRIC_LIST, now - 3000, 1, 100, 0);
+    metrics_request(METRIC_LIST, now + 1000000, 1, 100, 0);
+    metrics_request(METRIC_LIST, now - 20000000, 1, 100, 1);
+
+    const char *hist = "tcp_server_request_duration_seconds_bucket{command=\"list\",le=";
+    char series[160];
+    snprintf(series, sizeof(series), "%s\"0.00005\"}", hist);
+    CHECK(sample(series) == 1);
+    snprintf(series, sizeof(series), "%s\"0.0025\"}", hist);
+    CHECK(sample(series) == 1);
+    snprintf(series, sizeof(series), "%s\"0.005\"}", hist);
+    CHECK(sample(series) == 2);
+    snprintf(series, sizeof(series), "%s\"10\"}", hist);
+    CHECK(sample(series) == 2);
+    snprintf(series, sizeof(series), "%s\"+Inf\"}", hist);
+    CHECK(sample(series) == 3);
+    CHECK(sample("tcp_server_request_duration_seconds_count{command=\"list\"}") == 3);
+    CHECK(sample("tcp_server_request_errors_total{command=\"list\"}") == 1);
+    CHECK(sample("tcp_server_sent_bytes_total{command=\"list\"}") == 300);
+}
+
+static void *count_main(void *arg) {
+    (void)arg;
+    for (int i = 0; i < THREAD_REQUESTS; i++) {
+        metrics_request(METRIC_DATE, metrics_now_us(), 1, 29, 0);
+    }
+    return NULL;
+}
+
+// Concurrent adds are never lost, whatever shard they land in
+static void test_concurrent() {
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, count_main, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(sample("tcp_server_requests_total{command=\"date\"}") == THREADS * THREAD_REQUESTS);
+    CHECK(sample("tcp_server_sent_bytes_total{command=\"date\"}") == 29LL * THREADS * THREAD_REQUESTS);
+
+    // Children pinned to each CPU count into the parent's counters
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pid_t pids[CHILDREN];
+    for (int c = 0; c < CHILDREN; c++) {
+        pids[c] = fork();
+        if (pids[c] == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(c % (cpus > 0 ? cpus : 1), &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            for (int i = 0; i < CHILD_REQUESTS; i++) {
+                metrics_accept(1);
+                metrics_request(METRIC_ELAPSED, metrics_now_us(), 1, 40, 0);
+                metrics_close();
+            }
+            metrics_accept(0);
+            _exit(0);
+        }
+    }
+    for (int c = 0; c < CHILDREN; c++) {
+        waitpid(pids[c], NULL, 0);
+    }
+    CHECK(sample("tcp_server_requests_total{command=\"elapsed\"}") == CHILDREN * CHILD_REQUESTS);
+    CHECK(sample("tcp_server_connections_accepted_total") == CHILDREN * CHILD_REQUESTS);
+    CHECK(sample("tcp_server_accept_errors_total") == CHILDREN);
+    CHECK(sample("tcp_server_connections_open") == 0);
+}
+
+static void test_reports() {
+    metrics_accept(1);
+    char summary[2048];
+    metrics_summary(summary, sizeof(summary));
+    CHECK(strstr(summary, "1 open, 4 accept errors") != NULL);
+    char row[64];
+    snprintf(row, sizeof(row), "\ndate      %7d       0", THREADS * THREAD_REQUESTS);
+    CHECK(strstr(summary, row) != NULL);
+    CHECK(strstr(summary, "\nadmin") == NULL);
+    CHECK(strstr(summary, "Auth failures: other 1 invalid_credentials 1 rate_limited 1") != NULL);
+
+    // A page cut short still ends in a NUL
+    char small[100];
+    size_t len = metrics_prometheus(small, sizeof(small));
+    CHECK(len == sizeof(small) - 1 && strlen(small) == len);
+    CHECK(metrics_prometheus(page, sizeof(page)) < sizeof(page) - 1);
+}
+
+// Send request to the endpoint on port
+// Returns: the whole response in out
+static void scrape(int port, const char *request, char *out, size_t size) {
+    out[0] = '\0';
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    send(fd, request, strlen(request), 0);
+    size_t len = 0;
+    ssize_t got;
+    while (len < size - 1 && (got = recv(fd, out + len, size - 1 - len, 0)) > 0) {
+        len += got;
+    }
+    out[len] = '\0';
+    close(fd);
+}
+
+static void test_endpoint() {
+    int port = 20000 + getpid() % 20000;
+    CHECK(metrics_start_endpoint(port));
+    CHECK(metrics_start_endpoint(port));
+
+    static char response[METRICS_REPLY_MAX + 512];
+    scrape(port, "GET /metrics HTTP/1.0\r\n\r\n", response, sizeof(response));
+    CHECK(strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    const char *body = strstr(response, "\r\n\r\n");
+    const char *length = strstr(response, "Content-Length: ");
+    CHECK(body != NULL && length != NULL && atol(length + 16) == (long)strlen(body + 4));
+    CHECK(strstr(response, "# TYPE tcp_server_request_duration_seconds histogram\n") != NULL);
+
+    scrape(port, "GET /metrics?x=1 HTTP/1.1\r\nHost: x\r\n\r\n", response, sizeof(response));
+    CHECK(strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    scrape(port, "GET /other HTTP/1.0\r\n\r\n", response, sizeof(response));
+    CHECK(strncmp(response, "HTTP/1.0 404 Not Found\r\n", 24) == 0);
+    scrape(port, "GET /trace HTTP/1.0\r\n\r\n", response, sizeof(response));
+    CHECK(strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0 && strstr(response, "\r\n\r\n# ") != NULL);
+}
+
+int main() {
+    test_uninitialised();
+    CHECK(metrics_init() && metrics_init());
+    CHECK(sample("tcp_server_requests_total{command=\"date\"}") == 0);
+
+    test_names();
+    test_logins();
+    test_latency();
+    test_concurrent();
+    test_reports();
+    test_endpoint();
+
+    return test_done("metrics");
+}
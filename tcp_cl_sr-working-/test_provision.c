@@ -0,0 +1,124 @@
+// Unit test for the provision tool, run as a child process: which CSV lines
+// are taken, passwords containing commas, duplicates and existing users
+// left alone, a file with nothing usable, and a few hundred users hashed
+// on several threads
+#include "auth.h"
+#include "kdf.h"
+#include "testutil.h"
+#include <sys/wait.h>
+
+#define BULK_USERS 400
+
+static char provision_path[PATH_MAX];
+
+static void write_csv(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+// Returns: the tool's exit status, -1 if it did not exit
+static int provision(const char *csv, const char *threads) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL) {
+            _exit(127);
+        }
+        execl(provision_path, provision_path, csv, threads, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void test_lines() {
+    write_csv("users.csv",
+              "username,password\n"
+              "alice,alicepass1\n"
+              "\n"
+              "# a comment\n"
+              "bob,pass,with,commas\r\n"
+              "nocomma\n"
+              "carol,short\n"
+              "bad name,goodpass1\n"
+              "alice,otherpass1\n"
+              "root,rootpass1\n");
+    CHECK(provision("users.csv", "2") == 0);
+    CHECK(init_auth_system());
+
+    CHECK(verify_credentials("alice", "alicepass1"));
+    CHECK(!verify_credentials("alice", "otherpass1"));
+    CHECK(verify_credentials("bob", "pass,with,commas"));
+    CHECK(verify_credentials("root", "rootpass1"));
+    CHECK(!credstore_get("carol", NULL) && !credstore_get("nocomma", NULL));
+    CHECK(!credstore_get("bad name", NULL) && !credstore_get("username", NULL));
+    CHECK(credstore_count() == 3);
+}
+
+// A second run keeps existing users and their passwords, adds the rest
+static void test_existing() {
+    write_csv("again.csv", "alice,changedpass1\ndave,davepass1\n");
+    CHECK(provision("again.csv", "1") == 0);
+    load_users();
+    CHECK(verify_credentials("alice", "alicepass1"));
+    CHECK(!verify_credentials("alice", "changedpass1"));
+    CHECK(verify_credentials("dave", "davepass1"));
+}
+
+static void test_unusable() {
+    write_csv("empty.csv", "username,password\n# nobody\n");
+    CHECK(provision("empty.csv", "1") == 0);
+    write_csv("bad.csv", "nocomma\nx,y\n");
+    CHECK(provision("bad.csv", "1") == 1);
+    CHECK(provision("missing.csv", "1") == 1);
+    load_users();
+    CHECK(credstore_count() == 4);
+}
+
+static void test_bulk() {
+    FILE *fp = fopen("bulk.csv", "w");
+    for (int i = 0; i < BULK_USERS; i++) {
+        fprintf(fp, "bulk%03d,bulkpass%d\n", i, i);
+    }
+    fclose(fp);
+    CHECK(provision("bulk.csv", "4") == 0);
+    load_users();
+    CHECK(credstore_count() == 4 + BULK_USERS);
+
+    int valid = 0;
+    for (int i = 0; i < BULK_USERS; i += 37) {
+        char name[32], password[32];
+        snprintf(name, sizeof(name), "bulk%03d", i);
+        snprintf(password, sizeof(password), "bulkpass%d", i);
+        valid += verify_credentials(name, password);
+    }
+    CHECK(valid == (BULK_USERS + 36) / 37);
+}
+
+int main(int argc, char *argv[]) {
+    if (realpath(argc > 1 ? argv[1] : "./provision", provision_path) == NULL) {
+        fprintf(stderr, "[TEST ERROR] No provision binary, build it first\n");
+        return 1;
+    }
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_provision")) {
+        return 1;
+    }
+
+    // Cheap hashes for the tool and for the checks here
+    FILE *fp = fopen(KDF_POLICY_FILE, "w");
+    fprintf(fp, "scrypt %d %d 1\n", KDF_SCRYPT_MIN_LOG_N, (KDF_SCRYPT_R << 8) | KDF_SCRYPT_P);
+    fclose(fp);
+    setenv("AUTH_ADMIN_USERS", "root", 1);
+
+    test_lines();
+    test_existing();
+    test_unusable();
+    test_bulk();
+
+    cleanup_auth_system();
+    test_scratch_clean(dir);
+    return test_done("provision");
+}
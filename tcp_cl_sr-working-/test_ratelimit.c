@@ -0,0 +1,128 @@
+// Unit test for the login rate limiter: bursts, refill, separate buckets,
+// sharing across processes and eviction in a full shard
+// The shard layout is static, so the module is included whole
+#include "ratelimit.c"
+#include "testutil.h"
+#include <arpa/inet.h>
+#include <sys/wait.h>
+
+static void set_limits(const char *ip_rate, const char *ip_burst,
+                       const char *user_rate, const char *user_burst) {
+    ratelimit_cleanup();
+    setenv("AUTH_RATE_IP", ip_rate, 1);
+    setenv("AUTH_BURST_IP", ip_burst, 1);
+    setenv("AUTH_RATE_USER", user_rate, 1);
+    setenv("AUTH_BURST_USER", user_burst, 1);
+    CHECK(ratelimit_init());
+}
+
+static struct sockaddr_in address(const char *ip) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    return addr;
+}
+
+// Returns: attempts allowed out of tries
+static int allowed(const struct sockaddr_in *addr, const char *username, int tries) {
+    int ok = 0;
+    for (int i = 0; i < tries; i++) {
+        ok += (ratelimit_check_login(addr, username) == RATE_OK);
+    }
+    return ok;
+}
+
+static void test_address_bucket() {
+    set_limits("10", "5", "0", "1");
+    struct sockaddr_in one = address("10.0.0.1"), two = address("10.0.0.2");
+
+    CHECK(allowed(&one, "a", 5) == 5);
+    CHECK(ratelimit_check_login(&one, "b") == RATE_LIMITED_IP);
+    CHECK(allowed(&two, "a", 5) == 5);
+
+    // 10 per second: about 3 back after 300 ms, never more than the burst
+    usleep(300 * 1000);
+    int refilled = allowed(&one, "a", 10);
+    CHECK(refilled >= 2 && refilled <= 4);
+    usleep(1000 * 1000);
+    CHECK(allowed(&one, "a", 10) == 5);
+}
+
+static void test_user_bucket() {
+    set_limits("0", "1", "1", "3");
+    struct sockaddr_in addr = address("10.0.0.3");
+
+    CHECK(allowed(&addr, "frank", 3) == 3);
+    CHECK(ratelimit_check_login(&addr, "frank") == RATE_LIMITED_USER);
+    CHECK(ratelimit_check_login(NULL, "frank") == RATE_LIMITED_USER);
+    CHECK(allowed(&addr, "grace", 3) == 3);
+    CHECK(allowed(&addr, NULL, 50) == 50);
+}
+
+// Forked children draw from the parent's buckets
+static void test_shared() {
+    set_limits("0", "1", "1", "4");
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(allowed(NULL, "heidi", 4) == 4 ? 0 : 1);
+    }
+    int status = 0;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(ratelimit_check_login(NULL, "heidi") == RATE_LIMITED_USER);
+}
+
+// A shard whose probe window is full evicts the bucket refilled longest ago,
+// which then starts over full
+static void test_eviction() {
+    set_limits("0", "1", "1", "1");
+
+    // Names that land in the same shard and the same probe window
+    char names[RATELIMIT_PROBE + 1][32];
+    uint64_t first = 0;
+    int found = 0;
+    for (int i = 0; found <= RATELIMIT_PROBE && i < 10000000; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "evict%d", i);
+        uint64_t key = bucket_key(KIND_USER, name, strlen(name));
+        if (found == 0) {
+            first = key;
+        } else if (key % RATELIMIT_SHARDS != first % RATELIMIT_SHARDS ||
+                   (key >> 8) % RATELIMIT_SLOTS != (first >> 8) % RATELIMIT_SLOTS) {
+            continue;
+        }
+        strcpy(names[found++], name);
+    }
+    CHECK(found == RATELIMIT_PROBE + 1);
+
+    // Fill the window, oldest first, each bucket empty afterwards
+    for (int i = 0; i < RATELIMIT_PROBE; i++) {
+        CHECK(allowed(NULL, names[i], 2) == 1);
+        usleep(2000);
+    }
+    CHECK(ratelimit_check_login(NULL, names[0]) == RATE_LIMITED_USER);
+    usleep(2000);
+
+    // The newcomer takes the stalest slot, names[1]'s; the others stay empty
+    CHECK(allowed(NULL, names[RATELIMIT_PROBE], 1) == 1);
+    CHECK(ratelimit_check_login(NULL, names[2]) == RATE_LIMITED_USER);
+    CHECK(ratelimit_check_login(NULL, names[0]) == RATE_LIMITED_USER);
+    CHECK(ratelimit_check_login(NULL, names[1]) == RATE_OK);
+}
+
+static void test_disabled() {
+    set_limits("0", "0", "0", "0");
+    struct sockaddr_in addr = address("10.0.0.4");
+    CHECK(allowed(&addr, "ivan", 1000) == 1000);
+}
+
+int main() {
+    test_address_bucket();
+    test_user_bucket();
+    test_shared();
+    test_eviction();
+    test_disabled();
+    ratelimit_cleanup();
+    return test_done("ratelimit");
+}
@@ -0,0 +1,151 @@
+// Unit test for option 3's file_content(): whole files, a missing file,
+// and clients that stop reading or leave in the middle of a file
+#include "service.h"
+#include "testutil.h"
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define LARGE_SIZE (20 * 1024 * 1024)
+#define SEND_TIMEOUT_MS 200
+
+typedef struct {
+    int fd;
+    size_t expected;
+    size_t received;
+    unsigned long sum;              // Of every byte, against the file's
+    int leave;                      // Close the socket after expected bytes
+} Reader;
+
+static void write_file(const char *name, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "data/%s", name);
+    FILE *fp = fopen(path, "w");
+    for (size_t i = 0; fp != NULL && i < size; i++) {
+        fputc('a' + (int)(i * 7 % 26), fp);
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+static unsigned long file_sum(size_t size) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum += 'a' + (i * 7 % 26);
+    }
+    return sum;
+}
+
+static void *read_all(void *arg) {
+    Reader *r = arg;
+    unsigned char chunk[4096];
+    while (r->received < r->expected) {
+        ssize_t n = read(r->fd, chunk, sizeof(chunk));
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            r->sum += chunk[i];
+        }
+        r->received += n;
+    }
+    if (r->leave) {
+        close(r->fd);
+    }
+    return NULL;
+}
+
+// A connected pair whose server end gives up writing after SEND_TIMEOUT_MS,
+// as handle_client() sets it up with SERVER_WRITE_TIMEOUT_SEC
+static void socket_pair(int fds[2]) {
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    struct timeval tv = { 0, SEND_TIMEOUT_MS * 1000 };
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void test_whole_file() {
+    const size_t sizes[] = { 0, 1, 1023, 1024, 3 * 1024 * 1024 + 17 };
+    for (int i = 0; i < 5; i++) {
+        write_file("whole.txt", sizes[i]);
+        int fds[2];
+        socket_pair(fds);
+        Reader reader = { fds[1], sizes[i], 0, 0, 0 };
+        pthread_t thread;
+        pthread_create(&thread, NULL, read_all, &reader);
+
+        char buffer[256];
+        CHECK(file_content(buffer, sizeof(buffer), fds[0], "whole.txt") == (ssize_t)sizes[i]);
+        close(fds[0]);
+        pthread_join(thread, NULL);
+        CHECK(reader.received == sizes[i] && reader.sum == file_sum(sizes[i]));
+        close(fds[1]);
+    }
+}
+
+static void test_missing() {
+    int fds[2];
+    socket_pair(fds);
+    char buffer[256], reply[256];
+    const char *error = "ERROR: File does not exist";
+    CHECK(file_content(buffer, sizeof(buffer), fds[0], "nope.txt") == (ssize_t)strlen(error));
+    ssize_t n = read(fds[1], reply, sizeof(reply) - 1);
+    CHECK(n == (ssize_t)strlen(error) && strncmp(reply, error, n) == 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// A client that never reads costs one send timeout, not one per chunk
+static void test_stalled_reader() {
+    write_file("large.txt", LARGE_SIZE);
+    int fds[2];
+    socket_pair(fds);
+
+    char buffer[256];
+    long long started = now_ms();
+    CHECK(file_content(buffer, sizeof(buffer), fds[0], "large.txt") == -1);
+    long long took = now_ms() - started;
+    CHECK(took >= SEND_TIMEOUT_MS / 2 && took < 4 * SEND_TIMEOUT_MS);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Nor does one that leaves in the middle of the file
+static void test_gone_reader() {
+    int fds[2];
+    socket_pair(fds);
+    Reader reader = { fds[1], 64 * 1024, 0, 0, 1 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, read_all, &reader);
+
+    char buffer[256];
+    long long started = now_ms();
+    CHECK(file_content(buffer, sizeof(buffer), fds[0], "large.txt") == -1);
+    CHECK(now_ms() - started < 4 * SEND_TIMEOUT_MS);
+    pthread_join(thread, NULL);
+    CHECK(reader.received >= 64 * 1024);
+    close(fds[0]);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_service")) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    test_whole_file();
+    test_missing();
+    test_stalled_reader();
+    test_gone_reader();
+
+    test_scratch_clean(dir);
+    return test_done("service");
+}
@@ -0,0 +1,133 @@
+// Unit test for stored sessions: journal replay, snapshots and trimming,
+// and damaged files
+#include "sessionstore.h"
+#include "testutil.h"
+
+static time_t now;
+
+static void append(int op, const char *username, const char *token, time_t expiry) {
+    CHECK(sessionstore_append(op, username, token, expiry));
+}
+
+static SessionRecord loaded[16];
+
+// Returns: sessions loaded, with loaded[] filled
+static int load() {
+    return sessionstore_load(loaded, 16, now);
+}
+
+// Returns: expiry of the loaded session with token, 0 if it is not there
+static time_t loaded_expiry(int count, const char *token) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(loaded[i].token, token) == 0) {
+            return (time_t)loaded[i].expiry;
+        }
+    }
+    return 0;
+}
+
+static off_t journal_size() {
+    struct stat st;
+    return stat(SESSION_JOURNAL_FILE, &st) == 0 ? st.st_size : -1;
+}
+
+static void reopen() {
+    sessionstore_stop();
+    CHECK(sessionstore_open());
+}
+
+// Creates, extends and invalidates replay in order; expiries only move
+// forward and expired sessions are dropped
+static void test_replay() {
+    append(SESSION_OP_CREATE, "alice", "t-alice", now + 100);
+    append(SESSION_OP_CREATE, "bob", "t-bob", now + 100);
+    append(SESSION_OP_EXTEND, "alice", "t-alice", now + 200);
+    append(SESSION_OP_INVALIDATE, "bob", "t-bob", now + 100);
+    append(SESSION_OP_CREATE, "carol", "t-carol", now - 1);
+    append(SESSION_OP_EXTEND, "alice", "t-alice", now + 150);
+    append(SESSION_OP_CREATE, "alice", "t-alice", now + 120);
+    append(SESSION_OP_EXTEND, "dave", "t-dave", now + 100);
+
+    int count = load();
+    CHECK(count == 1);
+    CHECK(loaded_expiry(count, "t-alice") == now + 200);
+    CHECK(loaded_expiry(count, "t-bob") == 0 && loaded_expiry(count, "t-carol") == 0);
+    CHECK(loaded_expiry(count, "t-dave") == 0);
+}
+
+// A snapshot keeps what was appended after its mark; replaying a journal
+// a crash left untrimmed gives the same sessions
+static void test_snapshot() {
+    int count = load();
+    off_t mark = sessionstore_journal_mark();
+    append(SESSION_OP_CREATE, "erin", "t-erin", now + 300);
+    CHECK(sessionstore_snapshot(loaded, count, mark));
+    CHECK(journal_size() == (off_t)sizeof(SessionJournalEntry));
+
+    count = load();
+    CHECK(count == 2);
+    CHECK(loaded_expiry(count, "t-alice") == now + 200);
+    CHECK(loaded_expiry(count, "t-erin") == now + 300);
+
+    // Crash between the snapshot and the trim: the whole journal again
+    append(SESSION_OP_EXTEND, "erin", "t-erin", now + 400);
+    int untrimmed = load();
+    CHECK(sessionstore_snapshot(loaded, untrimmed, 0));
+    append(SESSION_OP_CREATE, "alice", "t-alice", now + 200);
+    append(SESSION_OP_EXTEND, "erin", "t-erin", now + 400);
+    count = load();
+    CHECK(count == 2);
+    CHECK(loaded_expiry(count, "t-erin") == now + 400);
+}
+
+// A journal cut in the middle of an entry keeps the entries before it, and
+// appends after a reopen are replayed
+static void test_torn_journal() {
+    append(SESSION_OP_CREATE, "frank", "t-frank", now + 100);
+    append(SESSION_OP_CREATE, "grace", "t-grace", now + 100);
+    CHECK(truncate(SESSION_JOURNAL_FILE, journal_size() - sizeof(SessionJournalEntry) / 2) == 0);
+
+    int count = load();
+    CHECK(loaded_expiry(count, "t-frank") == now + 100);
+    CHECK(loaded_expiry(count, "t-grace") == 0);
+
+    reopen();
+    CHECK(journal_size() % sizeof(SessionJournalEntry) == 0);
+    append(SESSION_OP_CREATE, "heidi", "t-heidi", now + 100);
+    count = load();
+    CHECK(loaded_expiry(count, "t-frank") == now + 100);
+    CHECK(loaded_expiry(count, "t-heidi") == now + 100);
+}
+
+// A damaged snapshot is ignored, the journal still replays
+static void test_damaged_snapshot() {
+    int count = load();
+    CHECK(sessionstore_snapshot(loaded, count, sessionstore_journal_mark()));
+    CHECK(journal_size() == 0);
+    append(SESSION_OP_CREATE, "ivan", "t-ivan", now + 100);
+    CHECK(load() == count + 1);
+
+    int fd = open(SESSION_SNAPSHOT_FILE, O_WRONLY);
+    CHECK(fd >= 0 && pwrite(fd, "x", 1, sizeof(SessionSnapHeader) + 3) == 1);
+    close(fd);
+    count = load();
+    CHECK(count == 1);
+    CHECK(loaded_expiry(count, "t-ivan") == now + 100);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_sessionstore") || !sessionstore_open()) {
+        return 1;
+    }
+    now = time(NULL);
+
+    test_replay();
+    test_snapshot();
+    test_torn_journal();
+    test_damaged_snapshot();
+
+    sessionstore_stop();
+    test_scratch_clean(dir);
+    return test_done("sessionstore");
+}
@@ -0,0 +1,195 @@
+// Unit test for the timer wheel: firing ticks across levels, cancel and
+// reschedule from inside a callback, and the next-work hint
+#include "timerwheel.h"
+#include "testutil.h"
+
+#define TIMERS 4096
+#define START 1000003ULL             // Not aligned to any level
+
+typedef struct {
+    TimerWheel *wheel;
+    uint64_t fired_at[TIMERS];       // Tick of the last firing, 0 = never
+    int fire_count[TIMERS];
+    int cancel_pair;                 // Timers 0 and 1 cancel each other when they fire
+    int again_on_fire;               // Ticks timer 2 reschedules itself after, 0 = never
+} Record;
+
+static void record_fire(int timer, void *ctx) {
+    Record *rec = ctx;
+    rec->fired_at[timer] = rec->wheel->now;
+    rec->fire_count[timer]++;
+    if (rec->cancel_pair && (timer == 0 || timer == 1)) {
+        timerwheel_cancel(rec->wheel, 1 - timer);
+    }
+    if (timer == 2 && rec->again_on_fire > 0) {
+        timerwheel_schedule(rec->wheel, 2, rec->wheel->now + rec->again_on_fire);
+        rec->again_on_fire = 0;
+    }
+}
+
+static Record *new_record(int capacity) {
+    Record *rec = calloc(1, sizeof(Record));
+    rec->wheel = calloc(1, timerwheel_size(capacity));
+    timerwheel_init(rec->wheel, capacity, START);
+    return rec;
+}
+
+static void free_record(Record *rec) {
+    free(rec->wheel);
+    free(rec);
+}
+
+// Timers on every level and past the wheel fire on their exact tick,
+// whether the wheel advances a tick at a time or in large jumps
+static void test_levels() {
+    const uint64_t delays[] = {
+        1, 2, 63, 64, 65, 127, 4095, 4096, 4097, 262143, 262144, 262145,
+        (1ULL << 24) - 1, 1ULL << 24, (1ULL << 24) + 5, 3ULL << 24
+    };
+    const int count = sizeof(delays) / sizeof(delays[0]);
+    const uint64_t steps[] = { 1, 7, 1000, 1ULL << 26 };
+
+    for (int s = 0; s < 4; s++) {
+        Record *rec = new_record(count);
+        for (int i = 0; i < count; i++) {
+            timerwheel_schedule(rec->wheel, i, START + delays[i]);
+        }
+        CHECK(rec->wheel->pending == count);
+
+        uint64_t end = START + delays[count - 1];
+        while (rec->wheel->now < end) {
+            uint64_t to = rec->wheel->now + steps[s];
+            timerwheel_advance(rec->wheel, to < end ? to : end, record_fire, rec);
+        }
+        int wrong = 0;
+        for (int i = 0; i < count; i++) {
+            wrong += (rec->fire_count[i] != 1 || rec->fired_at[i] != START + delays[i]);
+        }
+        CHECK(wrong == 0);
+        CHECK(rec->wheel->pending == 0);
+        CHECK(timerwheel_next(rec->wheel) == -1);
+        free_record(rec);
+    }
+}
+
+// Many random timers, rescheduled and cancelled as the wheel turns,
+// against the expected expiry of each
+static void test_random() {
+    Record *rec = new_record(TIMERS);
+    uint64_t expected[TIMERS];
+    srand(47);
+    for (int i = 0; i < TIMERS; i++) {
+        expected[i] = START + 1 + (uint64_t)(rand() % (1 << 20));
+        timerwheel_schedule(rec->wheel, i, expected[i]);
+    }
+
+    int wrong = 0;
+    while (rec->wheel->pending > 0) {
+        uint64_t to = rec->wheel->now + 1 + rand() % 5000;
+        timerwheel_advance(rec->wheel, to, record_fire, rec);
+        for (int i = 0; i < TIMERS; i++) {
+            if (expected[i] != 0 && expected[i] <= rec->wheel->now) {
+                wrong += (rec->fire_count[i] != 1 || rec->fired_at[i] != expected[i]);
+                expected[i] = 0;
+            }
+        }
+        // Move a few pending timers, in either direction, and drop one
+        for (int k = 0; k < 4; k++) {
+            int i = rand() % TIMERS;
+            if (expected[i] != 0) {
+                expected[i] = rec->wheel->now + 1 + (uint64_t)(rand() % (1 << 16));
+                timerwheel_schedule(rec->wheel, i, expected[i]);
+            }
+        }
+        int i = rand() % TIMERS;
+        if (expected[i] != 0) {
+            timerwheel_cancel(rec->wheel, i);
+            expected[i] = 0;
+            rec->fire_count[i] = -1;     // Stays -1 unless it still fires
+        }
+    }
+    CHECK(wrong == 0);
+
+    // Every timer fired once, except the cancelled ones which never did
+    int bad = 0;
+    for (int i = 0; i < TIMERS; i++) {
+        bad += (rec->fire_count[i] != 1 && rec->fire_count[i] != -1);
+    }
+    CHECK(bad == 0);
+    free_record(rec);
+}
+
+// A callback can cancel a timer due on the same tick and reschedule
+// itself, also to the past (which means the next tick)
+static void test_from_callback() {
+    Record *rec = new_record(4);
+    timerwheel_schedule(rec->wheel, 0, START + 100);
+    timerwheel_schedule(rec->wheel, 1, START + 100);
+    timerwheel_schedule(rec->wheel, 2, START + 100);
+    timerwheel_schedule(rec->wheel, 3, START + 5000);
+    rec->cancel_pair = 1;
+    rec->again_on_fire = 70;
+
+    // Whichever of 0 and 1 fires first cancels the other
+    timerwheel_advance(rec->wheel, START + 100, record_fire, rec);
+    CHECK(rec->fire_count[0] + rec->fire_count[1] == 1);
+    CHECK(rec->fire_count[2] == 1 && rec->fired_at[2] == START + 100);
+    CHECK(rec->wheel->pending == 2);
+
+    timerwheel_advance(rec->wheel, START + 200, record_fire, rec);
+    CHECK(rec->fire_count[2] == 2 && rec->fired_at[2] == START + 170);
+    CHECK(rec->fire_count[0] + rec->fire_count[1] == 1);
+
+    // Rescheduled into the past and cancelled twice
+    timerwheel_schedule(rec->wheel, 2, START + 1);
+    timerwheel_cancel(rec->wheel, 3);
+    timerwheel_cancel(rec->wheel, 3);
+    CHECK(rec->wheel->pending == 1);
+    timerwheel_advance(rec->wheel, START + 201, record_fire, rec);
+    CHECK(rec->fire_count[2] == 3 && rec->fired_at[2] == START + 201);
+    timerwheel_advance(rec->wheel, START + 10000, record_fire, rec);
+    CHECK(rec->fire_count[3] == 0);
+    CHECK(rec->wheel->pending == 0);
+
+    // Out of range numbers are ignored
+    timerwheel_schedule(rec->wheel, 4, START + 10001);
+    timerwheel_schedule(rec->wheel, -1, START + 10001);
+    CHECK(rec->wheel->pending == 0);
+    free_record(rec);
+}
+
+// timerwheel_next() never overshoots the next expiry, so sleeping for it
+// and advancing reaches every timer on time
+static void test_next() {
+    Record *rec = new_record(3);
+    CHECK(timerwheel_next(rec->wheel) == -1);
+    timerwheel_schedule(rec->wheel, 0, START + 3);
+    timerwheel_schedule(rec->wheel, 1, START + 5000);
+    timerwheel_schedule(rec->wheel, 2, START + 300000);
+
+    int wakeups = 0, late = 0;
+    while (rec->wheel->pending > 0 && wakeups < 1000) {
+        int64_t wait = timerwheel_next(rec->wheel);
+        CHECK(wait > 0);
+        uint64_t to = rec->wheel->now + (uint64_t)wait;
+        timerwheel_advance(rec->wheel, to, record_fire, rec);
+        for (int i = 0; i < 3; i++) {
+            late += (rec->fire_count[i] > 0 && rec->fired_at[i] != (i == 0 ? START + 3 :
+                                                                   i == 1 ? START + 5000 :
+                                                                            START + 300000));
+        }
+        wakeups++;
+    }
+    CHECK(rec->wheel->pending == 0);
+    CHECK(late == 0);
+    CHECK(wakeups < 1000);
+    free_record(rec);
+}
+
+int main() {
+    test_levels();
+    test_random();
+    test_from_callback();
+    test_next();
+    return test_done("timerwheel");
+}
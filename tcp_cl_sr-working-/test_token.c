@@ -0,0 +1,146 @@
+// Unit test for signed session tokens: tampering, expiry, key rotation
+// with its grace key, and keys shared between processes
+#include "token.h"
+#include "auth.h"
+#include "coarseclock.h"
+#include "testutil.h"
+#include <sys/wait.h>
+
+#define KEYS "data/token_keys.dat"
+
+static int sign(const char *username, time_t expiry, char *token) {
+    return token_sign(username, expiry, token, SESSION_TOKEN_MAX);
+}
+
+static int verify(const char *username, const char *token) {
+    return token_verify(username, token, NULL);
+}
+
+// Returns: the key id a token was signed with
+static unsigned int token_kid(const char *token) {
+    unsigned int kid = 0;
+    const char *mac = strrchr(token, '.');
+    const char *p = mac;
+    while (p > token && p[-1] != '.') {
+        p--;
+    }
+    if (mac != NULL && p > token) {
+        kid = (unsigned int)strtoul(p, NULL, 10);
+    }
+    return kid;
+}
+
+static void test_sign_verify() {
+    time_t later = coarseclock_now() + 60;
+    char token[SESSION_TOKEN_MAX];
+    CHECK(sign("alice", later, token));
+    CHECK(strchr(token, ':') == NULL);
+    time_t expiry = 0;
+    CHECK(token_verify("alice", token, &expiry) && expiry == later);
+    CHECK(!verify("bob", token));
+
+    // Any changed byte breaks the MAC, a changed field as much as the MAC
+    char forged[SESSION_TOKEN_MAX];
+    strcpy(forged, token);
+    char *last = forged + strlen(forged) - 1;
+    *last = (*last == '0') ? '1' : '0';
+    CHECK(!verify("alice", forged));
+
+    char longer[SESSION_TOKEN_MAX];
+    CHECK(sign("alice", later, longer));
+    char *expiry_field = strstr(longer, ".alice.") + strlen(".alice.");
+    expiry_field[0] = (expiry_field[0] == '9') ? '8' : '9';
+    CHECK(!verify("alice", longer));
+
+    // Expired, malformed and foreign-version tokens
+    CHECK(sign("alice", coarseclock_now() - 1, token));
+    CHECK(!verify("alice", token));
+    CHECK(!verify("alice", ""));
+    CHECK(!verify("alice", "s1.alice"));
+    CHECK(!verify("alice", "s1.alice.9999999999.1.abcd"));
+    CHECK(sign("alice", later, token));
+    token[1] = '2';
+    CHECK(!verify("alice", token));
+}
+
+// Tokens of the previous key stay valid for one rotation
+static void test_rotation() {
+    time_t later = coarseclock_now() + 60;
+    char first[SESSION_TOKEN_MAX], second[SESSION_TOKEN_MAX], third[SESSION_TOKEN_MAX];
+    CHECK(sign("carol", later, first));
+    unsigned int kid = token_kid(first);
+
+    CHECK(token_keys_rotate(KEYS));
+    CHECK(sign("carol", later, second));
+    CHECK(token_kid(second) == kid + 1);
+    CHECK(verify("carol", first));
+    CHECK(verify("carol", second));
+
+    CHECK(token_keys_rotate(KEYS));
+    CHECK(sign("carol", later, third));
+    CHECK(token_kid(third) == kid + 2);
+    CHECK(!verify("carol", first));
+    CHECK(verify("carol", second));
+    CHECK(verify("carol", third));
+}
+
+// A rotation by another process is picked up within TOKEN_KEY_RECHECK
+static void test_rotation_elsewhere() {
+    time_t later = coarseclock_now() + 60;
+    char before[SESSION_TOKEN_MAX];
+    CHECK(sign("dave", later, before));
+
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(token_keys_rotate(KEYS) ? 0 : 1);
+    }
+    int status = 0;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    sleep(TOKEN_KEY_RECHECK + 1);
+    char after[SESSION_TOKEN_MAX];
+    CHECK(sign("dave", later, after));
+    CHECK(token_kid(after) == token_kid(before) + 1);
+    CHECK(verify("dave", before));
+    CHECK(verify("dave", after));
+}
+
+// Two processes starting without a key file end up with the same key
+static void test_first_start() {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    const char *path = "data/first_keys.dat";
+
+    pid_t child = fork();
+    if (child == 0) {
+        char token[SESSION_TOKEN_MAX] = "";
+        int ok = token_keys_load(path) && sign("erin", coarseclock_now() + 60, token);
+        ok = ok && write(fds[1], token, sizeof(token)) == (ssize_t)sizeof(token);
+        _exit(ok ? 0 : 1);
+    }
+    CHECK(token_keys_load(path));
+    char theirs[SESSION_TOKEN_MAX] = "";
+    CHECK(read(fds[0], theirs, sizeof(theirs)) == (ssize_t)sizeof(theirs));
+    int status = 0;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(verify("erin", theirs));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main() {
+    char dir[PATH_MAX];
+    if (!test_scratch_dir(dir, sizeof(dir), "test_token") || !token_keys_load(KEYS)) {
+        return 1;
+    }
+
+    test_sign_verify();
+    test_rotation();
+    test_rotation_elsewhere();
+    test_first_start();
+
+    test_scratch_clean(dir);
+    return test_done("token");
+}
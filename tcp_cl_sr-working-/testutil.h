@@ -0,0 +1,62 @@
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Checks shared by the unit tests (test_*.c, run by "make unit"). A failed
+ * CHECK prints the file, line and condition and the test goes on;
+ * test_done() prints the totals and gives the exit status.
+ */
+
+static int test_checks = 0;
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+        test_checks++; \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "[TEST ERROR] %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+/**
+ * Make a scratch directory with a data/ subdirectory and move into it, for
+ * modules that keep their files under data/
+ * Returns: 1 on success, 0 on failure
+ */
+static inline int test_scratch_dir(char *path, size_t size, const char *name) {
+    snprintf(path, size, "/tmp/%s.XXXXXX", name);
+    if (mkdtemp(path) == NULL || chdir(path) != 0 || mkdir("data", 0755) != 0) {
+        perror("[TEST ERROR] Could not make a scratch directory");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Remove the scratch directory made by test_scratch_dir()
+ */
+static inline void test_scratch_clean(const char *path) {
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", path);
+    if (system(command) != 0) {
+        fprintf(stderr, "[TEST] Could not remove %s\n", path);
+    }
+}
+
+/**
+ * Print the totals for name
+ * Returns: exit status, 0 when every check passed
+ */
+static inline int test_done(const char *name) {
+    printf("[TEST] %s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif // TESTUTIL_H
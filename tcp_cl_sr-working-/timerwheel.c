@@ -0,0 +1,187 @@
+#include "timerwheel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LEVEL_SPAN(level) (1ULL << (TIMERWHEEL_BITS * (level)))
+#define SLOT_MASK (TIMERWHEEL_SLOTS - 1)
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+// Slot of a timer expiring at or after now: the finest level whose span reaches it
+static uint32_t slot_for(const TimerWheel *wheel, uint64_t expires) {
+    uint64_t delta = expires - wheel->now;
+    for (int level = 0; level < TIMERWHEEL_LEVELS; level++) {
+        if (delta < LEVEL_SPAN(level + 1)) {
+            return level * TIMERWHEEL_SLOTS + ((expires >> (TIMERWHEEL_BITS * level)) & SLOT_MASK);
+        }
+    }
+    // Beyond the wheel: wait in the farthest slot, filed again when it turns
+    uint64_t farthest = wheel->now + LEVEL_SPAN(TIMERWHEEL_LEVELS) - 1;
+    int top = TIMERWHEEL_LEVELS - 1;
+    return top * TIMERWHEEL_SLOTS + ((farthest >> (TIMERWHEEL_BITS * top)) & SLOT_MASK);
+}
+
+static void link_timer(TimerWheel *wheel, int timer, uint32_t slot) {
+    TimerEntry *entry = &wheel->entries[timer];
+    entry->slot = slot + 1;
+    entry->prev = 0;
+    entry->next = wheel->heads[slot];
+    if (entry->next != 0) {
+        wheel->entries[entry->next - 1].prev = timer + 1;
+    }
+    wheel->heads[slot] = timer + 1;
+    wheel->occupied[slot / TIMERWHEEL_SLOTS] |= 1ULL << (slot % TIMERWHEEL_SLOTS);
+}
+
+static void unlink_timer(TimerWheel *wheel, int timer) {
+    TimerEntry *entry = &wheel->entries[timer];
+    uint32_t slot = entry->slot - 1;
+    if (entry->prev != 0) {
+        wheel->entries[entry->prev - 1].next = entry->next;
+    } else {
+        wheel->heads[slot] = entry->next;
+    }
+    if (entry->next != 0) {
+        wheel->entries[entry->next - 1].prev = entry->prev;
+    }
+    if (wheel->heads[slot] == 0) {
+        wheel->occupied[slot / TIMERWHEEL_SLOTS] &= ~(1ULL << (slot % TIMERWHEEL_SLOTS));
+    }
+    entry->slot = 0;
+}
+
+// Move the timers of one slot to finer levels
+static void cascade(TimerWheel *wheel, int level, uint32_t index) {
+    uint32_t slot = level * TIMERWHEEL_SLOTS + index;
+    uint32_t next = wheel->heads[slot];
+    wheel->heads[slot] = 0;
+    wheel->occupied[level] &= ~(1ULL << index);
+
+    while (next != 0) {
+        int timer = next - 1;
+        next = wheel->entries[timer].next;
+        link_timer(wheel, timer, slot_for(wheel, wheel->entries[timer].expires));
+    }
+}
+
+// ============================================================================
+// Public Interface
+// ============================================================================
+
+size_t timerwheel_size(int capacity) {
+    return sizeof(TimerWheel) + sizeof(TimerEntry) * (size_t)capacity;
+}
+
+void timerwheel_init(TimerWheel *wheel, int capacity, uint64_t now) {
+    memset(wheel, 0, sizeof(TimerWheel));
+    wheel->capacity = capacity;
+    wheel->now = now;
+}
+
+void timerwheel_schedule(TimerWheel *wheel, int timer, uint64_t expires) {
+    if (timer < 0 || timer >= wheel->capacity) {
+        return;
+    }
+    if (wheel->entries[timer].slot != 0) {
+        unlink_timer(wheel, timer);
+        wheel->pending--;
+    }
+    if (expires <= wheel->now) {
+        expires = wheel->now + 1;
+    }
+    wheel->entries[timer].expires = expires;
+    link_timer(wheel, timer, slot_for(wheel, expires));
+    wheel->pending++;
+}
+
+void timerwheel_cancel(TimerWheel *wheel, int timer) {
+    if (timer < 0 || timer >= wheel->capacity || wheel->entries[timer].slot == 0) {
+        return;
+    }
+    unlink_timer(wheel, timer);
+    wheel->pending--;
+}
+
+int timerwheel_advance(TimerWheel *wheel, uint64_t now, TimerFn fire, void *ctx) {
+    int fired = 0;
+    while (wheel->now < now) {
+        if (wheel->pending == 0) {
+            wheel->now = now;
+            break;
+        }
+
+        // With level 0 empty nothing happens before the next cascade
+        uint64_t tick = wheel->now + 1;
+        if (wheel->occupied[0] == 0) {
+            tick = (wheel->now | SLOT_MASK) + 1;
+            if (tick > now) {
+                wheel->now = now;
+                break;
+            }
+        }
+
+        // Coarser slots reaching this tick move down, those due now into
+        // the level 0 slot handled next
+        wheel->now = tick;
+        for (int level = 1; level < TIMERWHEEL_LEVELS; level++) {
+            if (tick & (LEVEL_SPAN(level) - 1)) {
+                break;
+            }
+            cascade(wheel, level, (tick >> (TIMERWHEEL_BITS * level)) & SLOT_MASK);
+        }
+
+        // Everything left in this level 0 slot expires now
+        uint32_t slot = tick & SLOT_MASK;
+        while (wheel->heads[slot] != 0) {
+            int timer = wheel->heads[slot] - 1;
+            unlink_timer(wheel, timer);
+            wheel->pending--;
+            fire(timer, ctx);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+int64_t timerwheel_next(const TimerWheel *wheel) {
+    if (wheel->pending == 0) {
+        return -1;
+    }
+
+    int64_t best = -1;
+    for (int level = 0; level < TIMERWHEEL_LEVELS; level++) {
+        uint64_t bits = wheel->occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+        // Nearest occupied slot after the current one, 1 to TIMERWHEEL_SLOTS away
+        int shift = TIMERWHEEL_BITS * level;
+        unsigned start = (unsigned)(((wheel->now >> shift) + 1) & SLOT_MASK);
+        uint64_t rotated = start ? (bits >> start) | (bits << (TIMERWHEEL_SLOTS - start)) : bits;
+        uint64_t distance = (uint64_t)__builtin_ctzll(rotated) + 1;
+
+        uint64_t at = ((wheel->now >> shift) + distance) << shift;
+        int64_t ticks = (int64_t)(at - wheel->now);
+        if (best < 0 || ticks < best) {
+            best = ticks;
+        }
+    }
+    return best;
+}
+
+static int env_seconds(const char *name, int fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    int seconds = atoi(value);
+    return seconds > 0 ? seconds : 0;
+}
+
+void deadlines_load(Deadlines *out) {
+    out->auth_sec = env_seconds("SERVER_AUTH_TIMEOUT_SEC", DEADLINE_AUTH_SEC);
+    out->idle_sec = env_seconds("SERVER_IDLE_TIMEOUT_SEC", DEADLINE_IDLE_SEC);
+    out->write_sec = env_seconds("SERVER_WRITE_TIMEOUT_SEC", DEADLINE_WRITE_SEC);
+}
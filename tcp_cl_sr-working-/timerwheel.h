@@ -0,0 +1,100 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)  // Per level
+#define TIMERWHEEL_LEVELS 4                      // 2^24 ticks ahead, further is re-filed
+
+// Connection deadlines, in seconds, 0 = none
+#define DEADLINE_AUTH_SEC 10         // Handshake done after accept(), SERVER_AUTH_TIMEOUT_SEC
+#define DEADLINE_IDLE_SEC 300        // Between menu requests, SERVER_IDLE_TIMEOUT_SEC
+#define DEADLINE_WRITE_SEC 30        // Answer accepted by a client that stopped reading, SERVER_WRITE_TIMEOUT_SEC
+
+/*
+ * Hierarchical timer wheel (Varghese and Lauck). Level 0 has one slot per
+ * tick, each further level TIMERWHEEL_SLOTS times coarser. A timer is
+ * filed in the finest level that reaches its expiry and moves down a
+ * level when the wheel turns past its slot, so scheduling, cancelling and
+ * firing are O(1) per timer however many are pending.
+ *
+ * Timers are numbered 0 to capacity - 1 (a session slot, a file
+ * descriptor) and a number has at most one pending expiry. Links are
+ * indices, not pointers, and zeroed memory is an empty wheel, so a wheel
+ * can live in shared memory or in a large calloc() that is only touched
+ * where timers are used. Ticks are whatever unit the caller counts in.
+ *
+ * Not thread safe, callers lock around it.
+ */
+
+typedef struct {
+    uint32_t next;                   // Timer + 1, 0 = end of list
+    uint32_t prev;
+    uint32_t slot;                   // Slot + 1, 0 = not scheduled
+    uint32_t reserved;
+    uint64_t expires;
+} TimerEntry;
+
+typedef struct {
+    uint64_t now;                    // Last tick advanced to
+    int capacity;
+    int pending;                     // Timers scheduled
+    uint64_t occupied[TIMERWHEEL_LEVELS];                  // Non-empty slots
+    uint32_t heads[TIMERWHEEL_LEVELS * TIMERWHEEL_SLOTS];  // Timer + 1, 0 = empty
+    TimerEntry entries[];
+} TimerWheel;
+
+typedef struct {
+    int auth_sec;
+    int idle_sec;
+    int write_sec;
+} Deadlines;
+
+/**
+ * Called for each timer that fires, which is no longer scheduled and may
+ * be scheduled again
+ */
+typedef void (*TimerFn)(int timer, void *ctx);
+
+/**
+ * Returns: bytes needed for a wheel of capacity timers
+ */
+size_t timerwheel_size(int capacity);
+
+/**
+ * Set up a wheel in size bytes of zeroed memory, starting at tick now
+ */
+void timerwheel_init(TimerWheel *wheel, int capacity, uint64_t now);
+
+/**
+ * Fire timer at tick expires (the next tick if that has passed), replacing
+ * any expiry it had
+ */
+void timerwheel_schedule(TimerWheel *wheel, int timer, uint64_t expires);
+
+/**
+ * Unschedule timer, if it was
+ */
+void timerwheel_cancel(TimerWheel *wheel, int timer);
+
+/**
+ * Advance to tick now, calling fire for every timer due by then
+ * Returns: number of timers fired
+ */
+int timerwheel_advance(TimerWheel *wheel, uint64_t now, TimerFn fire, void *ctx);
+
+/**
+ * Returns: ticks from now until the wheel next has work (a lower bound,
+ * the work may be moving timers down a level), -1 if nothing is scheduled
+ */
+int64_t timerwheel_next(const TimerWheel *wheel);
+
+/**
+ * Read the deadlines from SERVER_AUTH_TIMEOUT_SEC, SERVER_IDLE_TIMEOUT_SEC
+ * and SERVER_WRITE_TIMEOUT_SEC, DEADLINE_* when unset
+ */
+void deadlines_load(Deadlines *out);
+
+#endif // TIMERWHEEL_H
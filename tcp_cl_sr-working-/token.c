@@ -0,0 +1,264 @@
+#include "token.h"
+#include "auth.h"
+#include "coarseclock.h"
+#include "logger.h"
+#include <errno.h>
+
+// Active keys, keys[0] signs new tokens
+static TokenKey keys[TOKEN_MAX_KEYS];
+static int key_count = 0;
+static char key_path[256];
+static time_t key_mtime = 0;
+static ino_t key_inode = 0;
+static time_t last_check = 0;
+static pthread_mutex_t key_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// ============================================================================
+// Key File Handling
+// ============================================================================
+
+// Write keys to path atomically (temp file + rename). With exclusive set
+// the file is only created if missing, so concurrent first starts agree
+static int write_keys(const char *path, const TokenKey *list, int count, int exclusive) {
+    char tmp_path[300];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    mode_t old_mask = umask(077);
+    FILE *fp = fopen(tmp_path, "w");
+    umask(old_mask);
+    if (fp == NULL) {
+        perror("[TOKEN ERROR] Could not write key file");
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char hex[TOKEN_KEY_SIZE * 2 + 1];
+        bytes_to_hex(list[i].key, TOKEN_KEY_SIZE, hex);
+        fprintf(fp, "%u %s\n", list[i].kid, hex);
+    }
+
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        perror("[TOKEN ERROR] Could not flush key file");
+        fclose(fp);
+        unlink(tmp_path);
+        return 0;
+    }
+    fclose(fp);
+
+    if (exclusive) {
+        int linked = link(tmp_path, path);
+        unlink(tmp_path);
+        return (linked == 0 || errno == EEXIST) ? 1 : 0;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        perror("[TOKEN ERROR] Could not replace key file");
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Read keys from path into the active table, caller holds key_mutex
+static int read_keys(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    TokenKey loaded[TOKEN_MAX_KEYS];
+    int count = 0;
+    unsigned int kid;
+    char hex[TOKEN_KEY_SIZE * 2 + 1];
+    while (count < TOKEN_MAX_KEYS && fscanf(fp, "%u %64s\n", &kid, hex) == 2) {
+        if (strlen(hex) != TOKEN_KEY_SIZE * 2) {
+            continue;
+        }
+        loaded[count].kid = kid;
+        hex_to_bytes(hex, loaded[count].key, TOKEN_KEY_SIZE);
+        count++;
+    }
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0) {
+        key_mtime = st.st_mtime;
+        key_inode = st.st_ino;
+    }
+    fclose(fp);
+
+    if (count == 0) {
+        fprintf(stderr, "[TOKEN ERROR] No valid keys in %s\n", path);
+        return 0;
+    }
+
+    memcpy(keys, loaded, sizeof(TokenKey) * count);
+    key_count = count;
+    return 1;
+}
+
+// Pick up keys rotated by another process or server instance
+static void refresh_keys() {
+    time_t now = coarseclock_now();
+    if (now - last_check < TOKEN_KEY_RECHECK) {
+        return;
+    }
+    last_check = now;
+
+    struct stat st;
+    if (stat(key_path, &st) == 0 &&
+        (st.st_mtime != key_mtime || st.st_ino != key_inode)) {
+        if (read_keys(key_path)) {
+            log_info("TOKEN", "Reloaded %d signing keys", key_count);
+        }
+    }
+}
+
+int token_keys_load(const char *path) {
+    pthread_mutex_lock(&key_mutex);
+    strncpy(key_path, path, sizeof(key_path) - 1);
+    key_path[sizeof(key_path) - 1] = '\0';
+
+    if (!read_keys(path)) {
+        // No key file yet, create one with a single fresh key
+        TokenKey fresh;
+        fresh.kid = 1;
+        if (RAND_bytes(fresh.key, TOKEN_KEY_SIZE) != 1 ||
+            !write_keys(path, &fresh, 1, 1) || !read_keys(path)) {
+            pthread_mutex_unlock(&key_mutex);
+            return 0;
+        }
+        printf("[TOKEN] Created new signing key in %s\n", path);
+    }
+
+    last_check = coarseclock_now();
+    printf("[TOKEN] Loaded %d signing keys (active kid %u)\n", key_count, keys[0].kid);
+    pthread_mutex_unlock(&key_mutex);
+    return 1;
+}
+
+int token_keys_rotate(const char *path) {
+    pthread_mutex_lock(&key_mutex);
+    strncpy(key_path, path, sizeof(key_path) - 1);
+    key_path[sizeof(key_path) - 1] = '\0';
+
+    TokenKey next[TOKEN_MAX_KEYS];
+    int count = 0;
+    int have_old = read_keys(path);
+
+    next[0].kid = have_old ? keys[0].kid + 1 : 1;
+    if (RAND_bytes(next[0].key, TOKEN_KEY_SIZE) != 1) {
+        pthread_mutex_unlock(&key_mutex);
+        return 0;
+    }
+    count++;
+
+    // Old signing key stays valid until the next rotation
+    if (have_old) {
+        next[count++] = keys[0];
+    }
+
+    int result = write_keys(path, next, count, 0) && read_keys(path);
+    if (result) {
+        printf("[TOKEN] Rotated signing key (active kid %u)\n", keys[0].kid);
+    }
+    pthread_mutex_unlock(&key_mutex);
+    return result;
+}
+
+// ============================================================================
+// Signing and Verification
+// ============================================================================
+
+// HMAC-SHA256 of the token prefix as a hex string
+static void compute_mac(const TokenKey *key, const char *data, size_t len, char *mac_hex) {
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int mac_len = 0;
+    HMAC(EVP_sha256(), key->key, TOKEN_KEY_SIZE,
+         (const unsigned char *)data, len, mac, &mac_len);
+    bytes_to_hex(mac, mac_len, mac_hex);
+}
+
+int token_sign(const char *username, time_t expiry, char *token_out, size_t size) {
+    pthread_mutex_lock(&key_mutex);
+    refresh_keys();
+    if (key_count == 0) {
+        pthread_mutex_unlock(&key_mutex);
+        return 0;
+    }
+    TokenKey key = keys[0];
+    pthread_mutex_unlock(&key_mutex);
+
+    char prefix[SESSION_TOKEN_MAX];
+    int len = snprintf(prefix, sizeof(prefix), "%s.%s.%ld.%u",
+                       TOKEN_VERSION, username, (long)expiry, key.kid);
+    if (len < 0 || (size_t)len >= sizeof(prefix)) {
+        return 0;
+    }
+
+    char mac_hex[EVP_MAX_MD_SIZE * 2 + 1];
+    compute_mac(&key, prefix, len, mac_hex);
+
+    int total = snprintf(token_out, size, "%s.%s", prefix, mac_hex);
+    return (total > 0 && (size_t)total < size) ? 1 : 0;
+}
+
+int token_verify(const char *username, const char *token, time_t *expiry_out) {
+    // The MAC is everything after the last '.'
+    const char *mac = strrchr(token, '.');
+    if (mac == NULL || strlen(mac + 1) != SHA256_DIGEST_LENGTH * 2) {
+        return 0;
+    }
+    size_t prefix_len = mac - token;
+    mac++;
+
+    char prefix[SESSION_TOKEN_MAX];
+    if (prefix_len >= sizeof(prefix)) {
+        return 0;
+    }
+    memcpy(prefix, token, prefix_len);
+    prefix[prefix_len] = '\0';
+
+    // Split s1.<username>.<expiry>.<kid>
+    char *saveptr = NULL;
+    char *version = strtok_r(prefix, ".", &saveptr);
+    char *user = strtok_r(NULL, ".", &saveptr);
+    char *expiry_str = strtok_r(NULL, ".", &saveptr);
+    char *kid_str = strtok_r(NULL, ".", &saveptr);
+    if (!version || !user || !expiry_str || !kid_str ||
+        strcmp(version, TOKEN_VERSION) != 0 || strcmp(user, username) != 0) {
+        return 0;
+    }
+
+    time_t expiry = (time_t)strtoll(expiry_str, NULL, 10);
+    unsigned int kid = (unsigned int)strtoul(kid_str, NULL, 10);
+    if (expiry <= coarseclock_now()) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&key_mutex);
+    refresh_keys();
+    TokenKey key;
+    int found = 0;
+    for (int i = 0; i < key_count; i++) {
+        if (keys[i].kid == kid) {
+            key = keys[i];
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&key_mutex);
+    if (!found) {
+        return 0;
+    }
+
+    char expected[EVP_MAX_MD_SIZE * 2 + 1];
+    compute_mac(&key, token, prefix_len, expected);
+    if (CRYPTO_memcmp(expected, mac, SHA256_DIGEST_LENGTH * 2) != 0) {
+        return 0;
+    }
+
+    if (expiry_out != NULL) {
+        *expiry_out = expiry;
+    }
+    return 1;
+}
@@ -0,0 +1,57 @@
+#ifndef TOKEN_H
+#define TOKEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#define TOKEN_KEY_FILE "data/token_keys.dat"
+#define TOKEN_KEY_SIZE 32
+#define TOKEN_MAX_KEYS 2          // Signing key + previous key still accepted
+#define TOKEN_VERSION "s1"
+#define TOKEN_KEY_RECHECK 1       // Seconds between key file change checks
+
+// Signing key structure
+typedef struct {
+    unsigned int kid;
+    unsigned char key[TOKEN_KEY_SIZE];
+} TokenKey;
+
+/*
+ * Stateless token format (no ':' so it fits in RESUME:user:token):
+ *     s1.<username>.<expiry>.<kid>.<hex HMAC-SHA256 of the prefix>
+ * Any process that shares the key file can verify it without a lookup.
+ */
+
+/**
+ * Load signing keys from file, creating the file with a fresh key if missing
+ * Returns: 1 on success, 0 on failure
+ */
+int token_keys_load(const char *path);
+
+/**
+ * Rotate keys: a new key becomes the signing key and the current signing
+ * key is kept as the second accepted key
+ * Returns: 1 on success, 0 on failure
+ */
+int token_keys_rotate(const char *path);
+
+/**
+ * Sign a token for username valid until expiry
+ * Returns: 1 on success, 0 on failure
+ */
+int token_sign(const char *username, time_t expiry, char *token_out, size_t size);
+
+/**
+ * Verify a signed token for username
+ * Returns: 1 if valid and not expired, 0 otherwise
+ */
+int token_verify(const char *username, const char *token, time_t *expiry_out);
+
+#endif // TOKEN_H